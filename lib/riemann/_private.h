@@ -21,32 +21,346 @@
 #include <riemann/riemann-client.h>
 
 #include "riemann/platform.h"
+#include "riemann/_wire.h"
+#include "riemann/client/tls.h"
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #if HAVE_GNUTLS
 #include <gnutls/gnutls.h>
 #endif
 
-typedef int (*riemann_client_send_message_t) (riemann_client_t *client,
-                                              riemann_message_t *message);
-typedef riemann_message_t *(*riemann_client_recv_message_t) (riemann_client_t *client);
+/* Writing to a connection the server closed must fail with EPIPE,
+   rather than kill the program. Where there is no way to ask for that
+   per call, SIGPIPE is the application's to handle. */
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+typedef int (*riemann_client_send_frame_t) (riemann_client_t *client,
+                                            const uint8_t *buffer, size_t len);
+/* Sends a frame made up of several pieces, without joining them
+   first. The iovec array is used as scratch space, and is modified. */
+typedef int (*riemann_client_sendv_frame_t) (riemann_client_t *client,
+                                             struct iovec *iov, int iovcnt);
+typedef int (*riemann_client_recv_frame_t) (riemann_client_t *client,
+                                            uint8_t **buffer, size_t *len);
+/* Writes as much of the pieces as the transport takes without
+   blocking. Returns the number of bytes written, -EAGAIN if none
+   were, or another negative errno value on failure. */
+typedef ssize_t (*riemann_client_write_t) (riemann_client_t *client,
+                                           const struct iovec *iov, int iovcnt);
+/* Reads whatever is available, without blocking. Returns the number
+   of bytes read, zero at the end of the stream, -EAGAIN if there was
+   nothing to read, or another negative errno value on failure. */
+typedef ssize_t (*riemann_client_read_t) (riemann_client_t *client,
+                                          uint8_t *buffer, size_t len);
+
+typedef struct
+{
+  riemann_client_callback_t callback;
+  void *userdata;
+} riemann_client_request_t;
+
+uint8_t *_riemann_client_recv_buffer (riemann_client_t *client, size_t len);
+void _riemann_iovec_consume (struct iovec **iov, int *iovcnt, size_t len);
+int _riemann_client_get_timeout (riemann_client_t *client);
+int _riemann_client_reconnect (riemann_client_t *client, int timeout,
+                               const int *stop);
+int _riemann_client_send_frame (riemann_client_t *client,
+                                const uint8_t *buffer, size_t len);
 
 struct _riemann_client_t
 {
   int sock;
   struct addrinfo *srv_addr;
 
-  riemann_client_send_message_t send;
-  riemann_client_recv_message_t recv;
+  riemann_client_send_frame_t send;
+  riemann_client_sendv_frame_t sendv;
+  riemann_client_recv_frame_t recv;
+  riemann_client_write_t write;
+  riemann_client_read_t read;
+
+  int nonblocking;
+
+  struct
+  {
+    uint8_t *data;
+    size_t size;
+  } send_buffer;
+
+  struct
+  {
+    uint8_t *data;
+    size_t size;
+  } recv_buffer;
+
+  /* The unsent part of a frame, in non-blocking mode, or the frames
+     sent asynchronously, that are not out yet. */
+  struct
+  {
+    uint8_t *data;
+    size_t size;
+    size_t len;
+    size_t sent;
+  } pending;
+
+  /* Asynchronous requests waiting for a reply, oldest first, in a
+     ring buffer; and the replies read so far. */
+  struct
+  {
+    riemann_client_request_t *requests;
+    size_t size;
+    size_t head;
+    size_t n;
+    size_t max;
+  } in_flight;
+
+  struct
+  {
+    uint8_t *data;
+    size_t size;
+    size_t len;
+  } incoming;
+
+  /* How the client last connected, so that riemann_client_reconnect()
+     can do the same again, without resolving the host name anew. */
+  struct
+  {
+    riemann_client_type_t type;
+    struct addrinfo *addr;
+    struct timeval timeout;
+  } origin;
 
 #if HAVE_GNUTLS
   struct
   {
     gnutls_session_t session;
     gnutls_certificate_credentials_t creds;
+
+    /* Copies of the options connected with, and the session of the
+       last connection, to resume when reconnecting. */
+    riemann_client_tls_options_t options;
+    gnutls_datum_t resume;
   } tls;
 #endif
 };
 
+struct _riemann_arena_chunk_t;
+
+struct _riemann_arena_t
+{
+  ProtobufCAllocator allocator;
+
+  struct _riemann_arena_chunk_t *chunks;
+  struct _riemann_arena_chunk_t *current;
+  size_t chunk_size;
+};
+
+struct _riemann_event_template_t
+{
+  unsigned int variable;
+
+  uint8_t *data;
+  size_t len;
+};
+
+int _riemann_event_template_put (riemann_wire_buffer_t *buffer,
+                                 const riemann_event_template_t *tmpl,
+                                 const riemann_event_template_values_t *values);
+int _riemann_event_template_frame (riemann_wire_buffer_t *buffer,
+                                   const riemann_event_template_t *tmpl,
+                                   const riemann_event_template_values_t *values);
+int _riemann_event_template_frame_iov (riemann_wire_buffer_t *buffer,
+                                       const riemann_event_template_t *tmpl,
+                                       const riemann_event_template_values_t *values,
+                                       struct iovec iov[3]);
+
+/* Room for the frame header, at the start of the buffer. */
+#define RIEMANN_BATCH_WRITER_HEADER_SIZE sizeof (uint32_t)
+
+struct _riemann_batch_writer_t
+{
+  riemann_wire_buffer_t buffer;
+
+  /* Where the length of the event being written goes, if any. */
+  size_t event_start;
+  size_t event_width;
+  int in_event;
+};
+
+struct _riemann_message_builder_t
+{
+  riemann_message_t *message;
+  size_t n_alloced;
+};
+
+struct _riemann_event_pool_t
+{
+  riemann_event_t **events;
+  size_t n_events;
+  size_t n_alloced;
+  size_t max_events;
+};
+
+struct _riemann_batcher_t
+{
+  riemann_client_t *client;
+  riemann_batch_writer_t *writer;
+
+  size_t max_events;
+  size_t max_bytes;
+  unsigned int max_delay;
+
+  size_t n_events;
+  /* When the delay of the oldest event runs out, in milliseconds on
+     the monotonic clock, or -1. */
+  int64_t deadline;
+  int timer_fd;
+
+  riemann_client_callback_t callback;
+  void *userdata;
+};
+
+typedef struct _riemann_async_node_t
+{
+  struct _riemann_async_node_t *next;
+  riemann_event_t *event;
+  size_t size;
+} riemann_async_node_t;
+
+/* A message sent by the I/O thread, and the number of events in it.
+   It is kept until acknowledged, so that it can be sent again on a
+   new connection. */
+typedef struct _riemann_async_batch_t
+{
+  struct _riemann_async_batch_t *next;
+  struct _riemann_async_client_t *async;
+  riemann_message_t *message;
+  size_t n;
+} riemann_async_batch_t;
+
+struct _riemann_async_client_t
+{
+  riemann_client_t *client;
+  riemann_message_builder_t *builder;
+  pthread_t thread;
+  int stop;
+
+  size_t max_events;
+  size_t max_bytes;
+  riemann_async_policy_t policy;
+  unsigned int timeout;
+
+  /* Updated atomically, by producers and the I/O thread alike. The
+     queue sizes include events being enqueued. */
+  size_t queued_events;
+  size_t queued_bytes;
+  uint64_t enqueued;
+  uint64_t delivered;
+  uint64_t failed;
+  uint64_t dropped;
+  uint64_t reconnects;
+
+  /* Reconnection delays; zero if the connection is not reestablished.
+     The messages to send again, those the connection just failed
+     under, and the state of the random number generator for jitter,
+     are only used by the I/O thread. */
+  unsigned int reconnect_min;
+  unsigned int reconnect_max;
+  riemann_async_batch_t *retry_head;
+  riemann_async_batch_t *retry_tail;
+  riemann_async_batch_t *lost_head;
+  riemann_async_batch_t *lost_tail;
+  uint32_t random;
+
+  /* Producers waiting for room in the queue. */
+  pthread_mutex_t lock;
+  pthread_cond_t room;
+  int waiters;
+
+  /* Producers only ever touch the head, the I/O thread only the
+     tail, so they are kept on separate cache lines. */
+  riemann_async_node_t *head __attribute__((aligned (64)));
+  riemann_async_node_t *tail __attribute__((aligned (64)));
+};
+
+/* The spool file starts with this header, in the byte order of the
+   host that wrote it, followed by the ring of frames. */
+#define RIEMANN_SPOOL_MAGIC "RCCSPOOL"
+#define RIEMANN_SPOOL_VERSION 1
+#define RIEMANN_SPOOL_HEADER_SIZE 64
+/* Marks the end of the ring, when the next frame did not fit there. */
+#define RIEMANN_SPOOL_WRAP 0xffffffff
+
+typedef struct
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t capacity;
+  /* Offsets of the oldest frame, and of where the next one goes. */
+  uint64_t head;
+  uint64_t tail;
+  uint64_t count;
+} riemann_spool_header_t;
+
+struct _riemann_spool_t
+{
+  int fd;
+  uint8_t *map;
+  size_t map_size;
+  riemann_spool_header_t *header;
+  uint8_t *data;
+
+  /* Replay rate, in frames per second, and the token bucket that
+     enforces it. */
+  unsigned int rate;
+  double tokens;
+  int64_t refilled;
+};
+
+#define _riemann_arena_allocator(arena) ((arena) ? &(arena)->allocator : NULL)
+
+/* Allocation helpers: a NULL allocator means the system heap. */
+void *_riemann_alloc (ProtobufCAllocator *allocator, size_t size);
+void *_riemann_realloc (ProtobufCAllocator *allocator, void *ptr,
+                        size_t old_size, size_t new_size);
+/* Makes room for `n_more' elements of `size' bytes in an array of
+   `n'. Arrays grow by doubling. In an arena, this must only be used on
+   arrays that were grown by it from the start; on the heap, on any
+   array. */
+void *_riemann_array_grow (ProtobufCAllocator *allocator, void *array,
+                           size_t n, size_t n_more, size_t size);
+void _riemann_free (ProtobufCAllocator *allocator, void *ptr);
+char *_riemann_strdup (ProtobufCAllocator *allocator, const char *str);
+
+/* String interning, see intern.c. Interned strings must be released
+   with _riemann_intern_free(), which frees anything else. */
+int _riemann_intern_in_use (void);
+char *_riemann_intern_strdup (const char *str);
+void _riemann_intern_free (char *str);
+
+/* Allocations shared between clones, see intern.c as well. A shared
+   allocation must only be freed when _riemann_shared_release()
+   returns zero; shared strings are released by _riemann_intern_free()
+   too. */
+void *_riemann_shared_ref (void *ptr);
+int _riemann_shared_release (void *ptr);
+int _riemann_shared_is_shared (const void *ptr);
+char *_riemann_string_ref (char *str);
+
+riemann_attribute_t *_riemann_attribute_create (ProtobufCAllocator *allocator,
+                                                const char *key,
+                                                const char *value);
+void _riemann_attribute_release_shared (riemann_attribute_t *attrib);
+void _riemann_event_release_shared (riemann_event_t *event);
+
+int _riemann_event_view_parse (const uint8_t *pos, const uint8_t *end,
+                               riemann_event_view_t *event);
+
 #if HAVE_VERSIONING
 #define SYMVER(symbol) symbol ## _default
 #else
@@ -0,0 +1,67 @@
+/* riemann/_simd.h -- Riemann C client library
+ * Copyright (C) 2013-2017  Gergely Nagy <algernon@madhouse-project.org>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __MADHOUSE_RIEMANN_SIMD_H__
+#define __MADHOUSE_RIEMANN_SIMD_H__ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Batch kernels for encoding the numeric fields of many events at
+   once, see simd.c. */
+
+/* The kernels may write this many bytes past the end of what they
+   encode, the output buffer must have room for that. */
+#define RIEMANN_SIMD_SLACK 16
+
+/* A block of events, built from an encoded constant prefix, and
+   columns of numeric fields. Columns not present are NULL. The sizes
+   are the encoded sizes of the varints in the matching column. */
+typedef struct
+{
+  size_t n;
+
+  const uint8_t *prefix;
+  size_t prefix_len;
+
+  const uint64_t *time;
+  const uint8_t *time_sizes;
+  const uint64_t *time_micros;
+  const uint8_t *time_micros_sizes;
+  const uint64_t *metric_sint64;
+  const uint8_t *metric_sint64_sizes;
+  const double *metric_d;
+  const float *metric_f;
+} riemann_simd_event_block_t;
+
+typedef struct
+{
+  const char *name;
+
+  void (*zigzag) (const int64_t *in, uint64_t *out, size_t n);
+  void (*varint_sizes) (const uint64_t *in, uint8_t *sizes, size_t n);
+  size_t (*write_events) (uint8_t *out, const riemann_simd_event_block_t *block);
+} riemann_simd_kernels_t;
+
+extern const riemann_simd_kernels_t _riemann_simd_kernels_scalar;
+
+/* The best kernels for the CPU we run on. */
+const riemann_simd_kernels_t *_riemann_simd_kernels (void);
+void _riemann_simd_set_kernels (const riemann_simd_kernels_t *kernels);
+
+size_t _riemann_simd_event_block_size (const riemann_simd_event_block_t *block);
+
+#endif
@@ -0,0 +1,386 @@
+/* riemann/_wire.h -- Riemann C client library
+ * Copyright (C) 2013-2017  Gergely Nagy <algernon@madhouse-project.org>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MADHOUSE_RIEMANN_WIRE_H__
+#define __MADHOUSE_RIEMANN_WIRE_H__ 1
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <riemann/message.h>
+
+/* Low-level helpers for reading and writing the protobuf wire format
+   directly, without going through protobuf-c. */
+
+#define RIEMANN_WIRE_VARINT 0
+#define RIEMANN_WIRE_FIXED64 1
+#define RIEMANN_WIRE_LENGTH_DELIMITED 2
+#define RIEMANN_WIRE_FIXED32 5
+
+#define RIEMANN_WIRE_TAG(field, type) (((field) << 3) | (type))
+
+static inline int
+_riemann_wire_read_varint (const uint8_t **pos, const uint8_t *end,
+                           uint64_t *value)
+{
+  const uint8_t *p = *pos;
+  uint64_t v = 0;
+  unsigned int shift;
+
+  for (shift = 0; shift < 64 && p < end; shift += 7)
+    {
+      uint8_t b = *p++;
+
+      v |= (uint64_t)(b & 0x7f) << shift;
+      if (!(b & 0x80))
+        {
+          *pos = p;
+          *value = v;
+          return 0;
+        }
+    }
+
+  return -EPROTO;
+}
+
+static inline int
+_riemann_wire_read_tag (const uint8_t **pos, const uint8_t *end,
+                        uint32_t *field, uint32_t *type)
+{
+  uint64_t tag;
+
+  if (_riemann_wire_read_varint (pos, end, &tag) != 0 || tag > UINT32_MAX)
+    return -EPROTO;
+
+  *field = (uint32_t)(tag >> 3);
+  *type = (uint32_t)(tag & 7);
+
+  return (*field == 0) ? -EPROTO : 0;
+}
+
+static inline int
+_riemann_wire_read_delimited (const uint8_t **pos, const uint8_t *end,
+                              const uint8_t **data, size_t *len)
+{
+  uint64_t l;
+
+  if (_riemann_wire_read_varint (pos, end, &l) != 0)
+    return -EPROTO;
+  if (l > (uint64_t)(end - *pos))
+    return -EPROTO;
+
+  *data = *pos;
+  *len = (size_t)l;
+  *pos += l;
+
+  return 0;
+}
+
+static inline int
+_riemann_wire_read_fixed32 (const uint8_t **pos, const uint8_t *end,
+                            uint32_t *value)
+{
+  const uint8_t *p = *pos;
+
+  if (end - p < 4)
+    return -EPROTO;
+
+  *value = (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+    ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+  *pos = p + 4;
+
+  return 0;
+}
+
+static inline int
+_riemann_wire_read_fixed64 (const uint8_t **pos, const uint8_t *end,
+                            uint64_t *value)
+{
+  uint32_t lo = 0, hi = 0;
+
+  if (_riemann_wire_read_fixed32 (pos, end, &lo) != 0 ||
+      _riemann_wire_read_fixed32 (pos, end, &hi) != 0)
+    return -EPROTO;
+  *value = (uint64_t)lo | ((uint64_t)hi << 32);
+
+  return 0;
+}
+
+static inline float
+_riemann_wire_float (uint32_t bits)
+{
+  float f;
+
+  memcpy (&f, &bits, sizeof (f));
+  return f;
+}
+
+static inline double
+_riemann_wire_double (uint64_t bits)
+{
+  double d;
+
+  memcpy (&d, &bits, sizeof (d));
+  return d;
+}
+
+static inline int64_t
+_riemann_wire_zigzag_decode (uint64_t v)
+{
+  return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static inline int
+_riemann_wire_skip (const uint8_t **pos, const uint8_t *end, uint32_t type)
+{
+  uint64_t v;
+  const uint8_t *data;
+  size_t len;
+
+  switch (type)
+    {
+    case RIEMANN_WIRE_VARINT:
+      return _riemann_wire_read_varint (pos, end, &v);
+    case RIEMANN_WIRE_FIXED64:
+      if (end - *pos < 8)
+        return -EPROTO;
+      *pos += 8;
+      return 0;
+    case RIEMANN_WIRE_LENGTH_DELIMITED:
+      return _riemann_wire_read_delimited (pos, end, &data, &len);
+    case RIEMANN_WIRE_FIXED32:
+      if (end - *pos < 4)
+        return -EPROTO;
+      *pos += 4;
+      return 0;
+    default:
+      return -EPROTO;
+    }
+}
+
+/* Writing. All field numbers in the Riemann schema are below 16, so
+   every tag fits in a single byte. */
+
+static inline size_t
+_riemann_wire_varint_size (uint64_t value)
+{
+  size_t n = 1;
+
+  while (value >= 0x80)
+    {
+      value >>= 7;
+      n++;
+    }
+
+  return n;
+}
+
+static inline size_t
+_riemann_wire_write_varint (uint8_t *out, uint64_t value)
+{
+  size_t n = 0;
+
+  while (value >= 0x80)
+    {
+      out[n++] = (uint8_t)(value | 0x80);
+      value >>= 7;
+    }
+  out[n++] = (uint8_t)value;
+
+  return n;
+}
+
+static inline size_t
+_riemann_wire_write_fixed32 (uint8_t *out, uint32_t value)
+{
+  out[0] = (uint8_t)value;
+  out[1] = (uint8_t)(value >> 8);
+  out[2] = (uint8_t)(value >> 16);
+  out[3] = (uint8_t)(value >> 24);
+
+  return 4;
+}
+
+static inline size_t
+_riemann_wire_write_fixed64 (uint8_t *out, uint64_t value)
+{
+  _riemann_wire_write_fixed32 (out, (uint32_t)value);
+  _riemann_wire_write_fixed32 (out + 4, (uint32_t)(value >> 32));
+
+  return 8;
+}
+
+static inline uint32_t
+_riemann_wire_float_bits (float f)
+{
+  uint32_t bits;
+
+  memcpy (&bits, &f, sizeof (bits));
+  return bits;
+}
+
+static inline uint64_t
+_riemann_wire_double_bits (double d)
+{
+  uint64_t bits;
+
+  memcpy (&bits, &d, sizeof (bits));
+  return bits;
+}
+
+static inline uint64_t
+_riemann_wire_zigzag_encode (int64_t value)
+{
+  return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline size_t
+_riemann_wire_string_size (const char *str)
+{
+  size_t len = (str) ? strlen (str) : 0;
+
+  return 1 + _riemann_wire_varint_size (len) + len;
+}
+
+/* Specialised encoder, see wire.c. It writes into a buffer that
+   grows as needed. A borrowed buffer is never reallocated: once it
+   fills up, its contents are copied to a newly allocated one. */
+typedef struct
+{
+  uint8_t *data;
+  size_t size;
+  size_t len;
+  int borrowed;
+} riemann_wire_buffer_t;
+
+void _riemann_wire_buffer_grow (riemann_wire_buffer_t *buffer, size_t n);
+
+static inline void
+_riemann_wire_reserve (riemann_wire_buffer_t *buffer, size_t n)
+{
+  if (buffer->size - buffer->len < n)
+    _riemann_wire_buffer_grow (buffer, n);
+}
+
+static inline void
+_riemann_wire_put_varint (riemann_wire_buffer_t *buffer, uint8_t tag,
+                          uint64_t value)
+{
+  _riemann_wire_reserve (buffer, 1 + _riemann_wire_varint_size (value));
+  buffer->data[buffer->len++] = tag;
+  buffer->len += _riemann_wire_write_varint (buffer->data + buffer->len, value);
+}
+
+static inline void
+_riemann_wire_put_bool (riemann_wire_buffer_t *buffer, uint8_t tag, int value)
+{
+  _riemann_wire_reserve (buffer, 2);
+  buffer->data[buffer->len++] = tag;
+  buffer->data[buffer->len++] = (value) ? 1 : 0;
+}
+
+static inline void
+_riemann_wire_put_fixed32 (riemann_wire_buffer_t *buffer, uint8_t tag,
+                           uint32_t value)
+{
+  _riemann_wire_reserve (buffer, 1 + 4);
+  buffer->data[buffer->len++] = tag;
+  buffer->len += _riemann_wire_write_fixed32 (buffer->data + buffer->len, value);
+}
+
+static inline void
+_riemann_wire_put_fixed64 (riemann_wire_buffer_t *buffer, uint8_t tag,
+                           uint64_t value)
+{
+  _riemann_wire_reserve (buffer, 1 + 8);
+  buffer->data[buffer->len++] = tag;
+  buffer->len += _riemann_wire_write_fixed64 (buffer->data + buffer->len, value);
+}
+
+static inline void
+_riemann_wire_put_string (riemann_wire_buffer_t *buffer, uint32_t field,
+                          const char *str)
+{
+  size_t len = (str) ? strlen (str) : 0;
+
+  _riemann_wire_reserve (buffer, 1 + _riemann_wire_varint_size (len) + len);
+  buffer->data[buffer->len++] =
+    RIEMANN_WIRE_TAG (field, RIEMANN_WIRE_LENGTH_DELIMITED);
+  buffer->len += _riemann_wire_write_varint (buffer->data + buffer->len, len);
+  if (len)
+    memcpy (buffer->data + buffer->len, str, len);
+  buffer->len += len;
+}
+
+/* Starts a nested message, reserving `*width' bytes for its length,
+   and returns where the length goes.
+
+   Near the end of a borrowed buffer, a too wide guess could make a
+   message that would fit spill over, so there, only a single byte is
+   reserved, and the body is moved if it turns out to be longer. */
+static inline size_t
+_riemann_wire_begin (riemann_wire_buffer_t *buffer, uint32_t field,
+                     size_t *width)
+{
+  size_t start;
+
+  if (buffer->borrowed && buffer->size - buffer->len < 16384)
+    *width = 1;
+
+  _riemann_wire_reserve (buffer, 1 + *width);
+  buffer->data[buffer->len++] =
+    RIEMANN_WIRE_TAG (field, RIEMANN_WIRE_LENGTH_DELIMITED);
+  start = buffer->len;
+  buffer->len += *width;
+
+  return start;
+}
+
+static inline void
+_riemann_wire_end (riemann_wire_buffer_t *buffer, size_t start, size_t width)
+{
+  size_t len = buffer->len - start - width;
+  size_t needed = _riemann_wire_varint_size (len);
+
+  if (needed != width)
+    {
+      if (needed > width)
+        _riemann_wire_reserve (buffer, needed - width);
+      memmove (buffer->data + start + needed, buffer->data + start + width, len);
+      buffer->len = buffer->len + needed - width;
+    }
+
+  _riemann_wire_write_varint (buffer->data + start, len);
+}
+
+
+size_t _riemann_wire_message_get_packed_size (const riemann_message_t *message);
+size_t _riemann_wire_event_get_packed_size (const riemann_event_t *event);
+size_t _riemann_wire_message_frame (riemann_wire_buffer_t *buffer,
+                                    const riemann_message_t *message);
+void _riemann_wire_event_put (riemann_wire_buffer_t *buffer,
+                              const riemann_event_t *event);
+
+/* Specialised decoder, see decode.c. Returns NULL when the message
+   should be left to protobuf-c. */
+riemann_message_t *_riemann_wire_message_unpack (ProtobufCAllocator *allocator,
+                                                 const uint8_t *buffer,
+                                                 size_t len);
+
+#endif
@@ -0,0 +1,307 @@
+/* riemann/arena.c -- Riemann C client library
+ * Copyright (C) 2013-2017  Gergely Nagy <algernon@madhouse-project.org>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "riemann/_private.h"
+
+#if HAVE_MALLOC_H
+#include <malloc.h>
+#endif
+
+#define RIEMANN_ARENA_DEFAULT_CHUNK_SIZE (64 * 1024)
+#define RIEMANN_ARENA_ALIGNMENT (2 * sizeof (void *))
+#define _riemann_arena_align(size)                                      \
+  (((size) + RIEMANN_ARENA_ALIGNMENT - 1) & ~(RIEMANN_ARENA_ALIGNMENT - 1))
+
+struct _riemann_arena_chunk_t
+{
+  struct _riemann_arena_chunk_t *next;
+  size_t size;
+  size_t used;
+};
+
+#define _riemann_arena_chunk_data(chunk)                                \
+  ((uint8_t *)(chunk) + _riemann_arena_align (sizeof (struct _riemann_arena_chunk_t)))
+
+static void *
+_riemann_arena_allocator_alloc (void *allocator_data, size_t size)
+{
+  return riemann_arena_alloc ((riemann_arena_t *)allocator_data, size);
+}
+
+static void
+_riemann_arena_allocator_free (void __attribute__((unused)) *allocator_data,
+                               void __attribute__((unused)) *pointer)
+{
+  /* Memory is only ever released by resetting or freeing the arena. */
+}
+
+riemann_arena_t *
+riemann_arena_new (size_t chunk_size)
+{
+  riemann_arena_t *arena;
+
+  arena = (riemann_arena_t *) malloc (sizeof (riemann_arena_t));
+
+  memset (&arena->allocator, 0, sizeof (arena->allocator));
+  arena->allocator.alloc = _riemann_arena_allocator_alloc;
+  arena->allocator.free = _riemann_arena_allocator_free;
+  arena->allocator.allocator_data = arena;
+#ifndef PROTOBUF_C_VERSION_NUMBER
+  /* protobuf-c before 1.0 uses a separate allocator for temporaries. */
+  arena->allocator.tmp_alloc = _riemann_arena_allocator_alloc;
+#endif
+
+  arena->chunks = NULL;
+  arena->current = NULL;
+  arena->chunk_size = (chunk_size) ? chunk_size : RIEMANN_ARENA_DEFAULT_CHUNK_SIZE;
+
+  return arena;
+}
+
+void
+riemann_arena_free (riemann_arena_t *arena)
+{
+  struct _riemann_arena_chunk_t *chunk, *next;
+
+  if (!arena)
+    {
+      errno = EINVAL;
+      return;
+    }
+
+  for (chunk = arena->chunks; chunk; chunk = next)
+    {
+      next = chunk->next;
+      free (chunk);
+    }
+
+  free (arena);
+}
+
+void
+riemann_arena_reset (riemann_arena_t *arena)
+{
+  struct _riemann_arena_chunk_t *chunk;
+
+  if (!arena)
+    {
+      errno = EINVAL;
+      return;
+    }
+
+  /* Chunks are kept, so a new batch of the same size will not need to
+     allocate any memory. */
+  for (chunk = arena->chunks; chunk; chunk = chunk->next)
+    chunk->used = 0;
+  arena->current = arena->chunks;
+}
+
+void *
+riemann_arena_alloc (riemann_arena_t *arena, size_t size)
+{
+  struct _riemann_arena_chunk_t *chunk;
+  void *ptr;
+
+  if (!arena)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  size = _riemann_arena_align (size ? size : 1);
+
+  for (chunk = arena->current; chunk; chunk = chunk->next)
+    if (chunk->size - chunk->used >= size)
+      break;
+
+  if (!chunk)
+    {
+      size_t chunk_size = (size > arena->chunk_size) ? size : arena->chunk_size;
+
+      chunk = (struct _riemann_arena_chunk_t *)
+        malloc (_riemann_arena_align (sizeof (struct _riemann_arena_chunk_t)) +
+                chunk_size);
+      chunk->size = chunk_size;
+      chunk->used = 0;
+
+      if (arena->current)
+        {
+          chunk->next = arena->current->next;
+          arena->current->next = chunk;
+        }
+      else
+        {
+          chunk->next = arena->chunks;
+          arena->chunks = chunk;
+        }
+    }
+
+  arena->current = chunk;
+
+  ptr = _riemann_arena_chunk_data (chunk) + chunk->used;
+  chunk->used += size;
+
+  return ptr;
+}
+
+char *
+riemann_arena_strdup (riemann_arena_t *arena, const char *str)
+{
+  size_t len;
+  char *copy;
+
+  if (!arena || !str)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  len = strlen (str) + 1;
+  copy = (char *) riemann_arena_alloc (arena, len);
+  memcpy (copy, str, len);
+
+  return copy;
+}
+
+void *
+_riemann_alloc (ProtobufCAllocator *allocator, size_t size)
+{
+  if (!allocator)
+    return malloc (size);
+  return allocator->alloc (allocator->allocator_data, size);
+}
+
+void *
+_riemann_realloc (ProtobufCAllocator *allocator, void *ptr,
+                  size_t old_size, size_t new_size)
+{
+  void *new_ptr;
+
+  if (!allocator)
+    return realloc (ptr, new_size);
+
+  new_ptr = allocator->alloc (allocator->allocator_data, new_size);
+  if (ptr)
+    {
+      memcpy (new_ptr, ptr, (old_size < new_size) ? old_size : new_size);
+      allocator->free (allocator->allocator_data, ptr);
+    }
+
+  return new_ptr;
+}
+
+/* The number of elements an array of `n' has room for, when grown
+   by _riemann_array_grow() in an arena: nothing records the size of
+   an arena allocation, so it has to follow from the length. */
+static size_t
+_riemann_array_capacity (size_t n)
+{
+  size_t capacity = 4;
+
+  if (n == 0)
+    return 0;
+
+  while (capacity < n)
+    capacity *= 2;
+
+  return capacity;
+}
+
+/* The number of elements of `size' bytes a heap allocated array has
+   room for. Arrays allocated by the library have a power of two
+   elements, and the allocator may round that up a little, so rounding
+   down to a power of two gives their capacity back, and keeps within
+   the allocation for any other array. This works even for arrays that
+   were emptied, like the ones riemann_event_reset() keeps. */
+static size_t
+_riemann_array_heap_capacity (void *array, size_t size)
+{
+#if HAVE_MALLOC_USABLE_SIZE
+  size_t usable, capacity = 1;
+
+  if (!array)
+    return 0;
+
+  usable = malloc_usable_size (array) / size;
+  if (usable == 0)
+    return 0;
+
+  while (capacity * 2 <= usable)
+    capacity *= 2;
+
+  return capacity;
+#else
+  (void) array;
+  (void) size;
+
+  return 0;
+#endif
+}
+
+void *
+_riemann_array_grow (ProtobufCAllocator *allocator, void *array,
+                     size_t n, size_t n_more, size_t size)
+{
+  size_t capacity;
+
+  /* Doubling keeps the memory left behind in the arena by the old
+     copies down to as much as the array itself takes. On the heap, it
+     saves reallocating on most additions. */
+  if (allocator)
+    capacity = _riemann_array_capacity (n);
+  else
+    capacity = _riemann_array_heap_capacity (array, size);
+
+  if (n + n_more <= capacity)
+    return array;
+
+  return _riemann_realloc (allocator, array, n * size,
+                           _riemann_array_capacity (n + n_more) * size);
+}
+
+void
+_riemann_free (ProtobufCAllocator *allocator, void *ptr)
+{
+  if (!ptr)
+    return;
+
+  if (!allocator)
+    free (ptr);
+  else
+    allocator->free (allocator->allocator_data, ptr);
+}
+
+char *
+_riemann_strdup (ProtobufCAllocator *allocator, const char *str)
+{
+  size_t len;
+  char *copy;
+
+  if (!allocator)
+    return strdup (str);
+
+  len = strlen (str) + 1;
+  copy = (char *) allocator->alloc (allocator->allocator_data, len);
+  memcpy (copy, str, len);
+
+  return copy;
+}
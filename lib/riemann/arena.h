@@ -0,0 +1,40 @@
+/* riemann/arena.h -- Riemann C client library
+ * Copyright (C) 2013-2017  Gergely Nagy <algernon@madhouse-project.org>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MADHOUSE_RIEMANN_ARENA_H__
+#define __MADHOUSE_RIEMANN_ARENA_H__ 1
+
+#include <stddef.h>
+
+typedef struct _riemann_arena_t riemann_arena_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+riemann_arena_t *riemann_arena_new (size_t chunk_size);
+void riemann_arena_free (riemann_arena_t *arena);
+void riemann_arena_reset (riemann_arena_t *arena);
+
+void *riemann_arena_alloc (riemann_arena_t *arena, size_t size);
+char *riemann_arena_strdup (riemann_arena_t *arena, const char *str);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
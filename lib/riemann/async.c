@@ -0,0 +1,831 @@
+/* riemann/async.c -- Riemann C client library
+ * Copyright (C) 2013-2017  Gergely Nagy <algernon@madhouse-project.org>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <riemann/async.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "riemann/_private.h"
+#include "riemann/_wire.h"
+
+/* A client driven by an I/O thread of its own. Application threads
+ * hand events over through Dmitry Vyukov's multi-producer,
+ * single-consumer queue: enqueueing is a single atomic exchange,
+ * which never waits for other producers, nor for the consumer, and
+ * never enters the kernel.
+ *
+ * The price is that the I/O thread can not be woken up either, so
+ * when there is nothing to do, it polls the queue: at first often,
+ * then less and less frequently, up to a limit.
+ *
+ * The queue may be bounded, by events, by bytes, or both. Its size is
+ * kept in counters next to it, which producers reserve room in before
+ * enqueueing, and the I/O thread gives room back in as it dequeues.
+ * Only producers that block waiting for room ever take a lock.
+ *
+ * Messages sent are kept until acknowledged. If the connection fails,
+ * and reconnecting is enabled, the I/O thread tries to reconnect, with
+ * growing delays, and sends them again once it did.
+ */
+
+/* The most events sent in one message. */
+#define RIEMANN_ASYNC_BATCH_MAX 256
+/* The most messages awaiting acknowledgement, unless the client has
+   a limit of its own. */
+#define RIEMANN_ASYNC_WINDOW 64
+/* How long the I/O thread sleeps, when idle, in milliseconds. */
+#define RIEMANN_ASYNC_IDLE_MIN 1
+#define RIEMANN_ASYNC_IDLE_MAX 32
+/* How far over its limits the queue may grow under the drop-oldest
+   policy, as a multiple of them, before the I/O thread trims it. */
+#define RIEMANN_ASYNC_DROP_OLDEST_SLACK 2
+
+static riemann_event_t *
+_riemann_async_client_pop (riemann_async_client_t *async, size_t *size)
+{
+  riemann_async_node_t *tail = async->tail, *next;
+  riemann_event_t *event;
+
+  /* A producer that swapped itself in at the head, but did not link
+     the previous node to itself yet, is not visible: until it does,
+     the queue looks empty from here. */
+  next = __atomic_load_n (&tail->next, __ATOMIC_ACQUIRE);
+  if (!next)
+    return NULL;
+
+  /* The next node becomes the stub. */
+  event = next->event;
+  *size = next->size;
+  next->event = NULL;
+  async->tail = next;
+  free (tail);
+
+  return event;
+}
+
+/* Tells whether the queue is over its limits, each multiplied by
+   FACTOR. */
+static int
+_riemann_async_client_over (riemann_async_client_t *async,
+                            size_t events, size_t bytes, size_t factor)
+{
+  return ((async->max_events && events > async->max_events * factor) ||
+          (async->max_bytes && bytes > async->max_bytes * factor));
+}
+
+/* Makes room for an event in the queue, unless that would take it over
+   its limits, multiplied by FACTOR; a FACTOR of zero has none. Room is
+   taken first, and given back if there was none, so that producers
+   racing for the last slot can not both get it. */
+static int
+_riemann_async_client_reserve (riemann_async_client_t *async, size_t size,
+                               size_t factor)
+{
+  size_t events, bytes;
+
+  events = __atomic_add_fetch (&async->queued_events, 1, __ATOMIC_SEQ_CST);
+  bytes = __atomic_add_fetch (&async->queued_bytes, size, __ATOMIC_SEQ_CST);
+
+  if (factor == 0 ||
+      !_riemann_async_client_over (async, events, bytes, factor))
+    return 1;
+
+  __atomic_sub_fetch (&async->queued_events, 1, __ATOMIC_SEQ_CST);
+  __atomic_sub_fetch (&async->queued_bytes, size, __ATOMIC_SEQ_CST);
+  return 0;
+}
+
+/* Gives room back, and wakes up producers waiting for it. Those count
+   themselves as waiting before looking for room, so either they see
+   the room given back here, or they are seen waiting. */
+static void
+_riemann_async_client_release (riemann_async_client_t *async, size_t size)
+{
+  __atomic_sub_fetch (&async->queued_events, 1, __ATOMIC_SEQ_CST);
+  __atomic_sub_fetch (&async->queued_bytes, size, __ATOMIC_SEQ_CST);
+
+  if (__atomic_load_n (&async->waiters, __ATOMIC_SEQ_CST) > 0)
+    {
+      pthread_mutex_lock (&async->lock);
+      pthread_cond_broadcast (&async->room);
+      pthread_mutex_unlock (&async->lock);
+    }
+}
+
+static int64_t
+_riemann_async_client_now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Waits for room in the queue, for as long as the limits allow. */
+static int
+_riemann_async_client_wait (riemann_async_client_t *async, size_t size)
+{
+  struct timespec deadline;
+  int e = 0;
+
+  clock_gettime (CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += async->timeout / 1000;
+  deadline.tv_nsec += (long)(async->timeout % 1000) * 1000000;
+  if (deadline.tv_nsec >= 1000000000)
+    {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+
+  pthread_mutex_lock (&async->lock);
+  __atomic_add_fetch (&async->waiters, 1, __ATOMIC_SEQ_CST);
+
+  while (!_riemann_async_client_reserve (async, size, 1))
+    {
+      if (async->timeout == 0)
+        pthread_cond_wait (&async->room, &async->lock);
+      else if (pthread_cond_timedwait (&async->room, &async->lock,
+                                       &deadline) == ETIMEDOUT)
+        {
+          e = -ETIMEDOUT;
+          break;
+        }
+    }
+
+  __atomic_sub_fetch (&async->waiters, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock (&async->lock);
+
+  return e;
+}
+
+/* xorshift32, seeded on first use. */
+static uint32_t
+_riemann_async_client_random (uint32_t *state)
+{
+  if (*state == 0)
+    *state = ((uint32_t) (uintptr_t) state ^ (uint32_t) time (NULL)) | 1;
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+
+  return *state;
+}
+
+/* Decides whether to shed an event: never while the queue is at most
+   half full, always once it is full, and with a probability growing
+   linearly in between. */
+static int
+_riemann_async_client_shed (riemann_async_client_t *async, size_t size)
+{
+  static __thread uint32_t state;
+  double fill = 0, f;
+
+  if (async->max_events)
+    fill = (double) (__atomic_load_n (&async->queued_events,
+                                      __ATOMIC_RELAXED) + 1) /
+      async->max_events;
+  if (async->max_bytes)
+    {
+      f = (double) (__atomic_load_n (&async->queued_bytes,
+                                     __ATOMIC_RELAXED) + size) /
+        async->max_bytes;
+      if (f > fill)
+        fill = f;
+    }
+
+  if (fill <= 0.5)
+    return 0;
+  if (fill >= 1)
+    return 1;
+
+  return (_riemann_async_client_random (&state) / 4294967296.0) <
+    (fill - 0.5) * 2;
+}
+
+/* Drops the oldest events, while the queue is over its limits. */
+static void
+_riemann_async_client_trim (riemann_async_client_t *async)
+{
+  riemann_event_t *event;
+  size_t size;
+
+  while (_riemann_async_client_over
+         (async, __atomic_load_n (&async->queued_events, __ATOMIC_SEQ_CST),
+          __atomic_load_n (&async->queued_bytes, __ATOMIC_SEQ_CST), 1) &&
+         (event = _riemann_async_client_pop (async, &size)) != NULL)
+    {
+      riemann_event_free (event);
+      _riemann_async_client_release (async, size);
+      __atomic_add_fetch (&async->dropped, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* Collects whatever is queued, up to a limit, into a message. */
+static riemann_async_batch_t *
+_riemann_async_client_collect (riemann_async_client_t *async)
+{
+  riemann_async_batch_t *batch;
+  riemann_event_t *event;
+  size_t size, n = 0;
+
+  while (n < RIEMANN_ASYNC_BATCH_MAX &&
+         (event = _riemann_async_client_pop (async, &size)) != NULL)
+    {
+      riemann_message_builder_append (async->builder, event);
+      _riemann_async_client_release (async, size);
+      n++;
+    }
+
+  if (n == 0)
+    return NULL;
+
+  batch = (riemann_async_batch_t *) malloc (sizeof (riemann_async_batch_t));
+  batch->next = NULL;
+  batch->async = async;
+  batch->message = riemann_message_builder_finish (async->builder);
+  batch->n = n;
+
+  return batch;
+}
+
+static int
+_riemann_async_client_reconnecting (riemann_async_client_t *async)
+{
+  return __atomic_load_n (&async->reconnect_min, __ATOMIC_ACQUIRE) != 0;
+}
+
+static void
+_riemann_async_client_append (riemann_async_batch_t **head,
+                              riemann_async_batch_t **tail,
+                              riemann_async_batch_t *batch)
+{
+  batch->next = NULL;
+  if (*tail)
+    (*tail)->next = batch;
+  else
+    *head = batch;
+  *tail = batch;
+}
+
+/* Keeps a message the connection failed under, to be sent again once
+   reconnected. Until the loss is dealt with, such messages are kept
+   apart from those already waiting to be sent again, which are newer
+   than them. */
+static void
+_riemann_async_client_retry (riemann_async_client_t *async,
+                             riemann_async_batch_t *batch)
+{
+  _riemann_async_client_append (&async->lost_head, &async->lost_tail,
+                                batch);
+}
+
+/* Messages to send again go before new ones. */
+static riemann_async_batch_t *
+_riemann_async_client_next (riemann_async_client_t *async)
+{
+  riemann_async_batch_t *batch = async->retry_head;
+
+  if (!batch)
+    return _riemann_async_client_collect (async);
+
+  async->retry_head = batch->next;
+  if (!async->retry_head)
+    async->retry_tail = NULL;
+
+  return batch;
+}
+
+static void
+_riemann_async_client_done (riemann_async_batch_t *batch, int delivered)
+{
+  __atomic_add_fetch ((delivered) ? &batch->async->delivered :
+                      &batch->async->failed, batch->n, __ATOMIC_RELAXED);
+
+  riemann_message_free (batch->message);
+  free (batch);
+}
+
+static void
+_riemann_async_client_acked (riemann_client_t *client,
+                             riemann_message_t *response, int error,
+                             void *userdata)
+{
+  riemann_async_batch_t *batch = (riemann_async_batch_t *) userdata;
+
+  (void) client;
+
+  /* A message the server refused is not sent again, only one the
+     connection failed under. */
+  if (error == 0)
+    _riemann_async_client_done (batch, response->ok);
+  else if (_riemann_async_client_reconnecting (batch->async))
+    _riemann_async_client_retry (batch->async, batch);
+  else
+    _riemann_async_client_done (batch, 0);
+
+  if (response)
+    riemann_message_free (response);
+}
+
+static int
+_riemann_async_client_send (riemann_async_client_t *async,
+                            riemann_async_batch_t *batch)
+{
+  int e;
+
+  /* Without replies, there is nothing to wait for, and UDP sends
+     do not block in practice. */
+  if (!async->client->read)
+    {
+      if ((e = riemann_client_send_message (async->client,
+                                            batch->message)) == 0)
+        _riemann_async_client_done (batch, 1);
+      return e;
+    }
+
+  return riemann_client_send_async (async->client, batch->message,
+                                    _riemann_async_client_acked, batch);
+}
+
+static int
+_riemann_async_client_busy (riemann_async_client_t *async)
+{
+  int events = riemann_client_get_io_events (async->client);
+
+  return (events > 0);
+}
+
+/* The shortest delay, doubled with every failed attempt, up to the
+   longest one. */
+static uint64_t
+_riemann_async_client_delay (riemann_async_client_t *async,
+                             unsigned int attempts)
+{
+  uint64_t delay = async->reconnect_min;
+
+  while (attempts-- > 0 && delay < async->reconnect_max)
+    delay *= 2;
+  if (delay > async->reconnect_max)
+    delay = async->reconnect_max;
+
+  return delay;
+}
+
+/* How long to wait before the next attempt to reconnect. Only half of
+   the delay is fixed, the rest is random, so that clients cut off at
+   the same time do not all come back at the same time. */
+static int64_t
+_riemann_async_client_backoff (riemann_async_client_t *async,
+                               unsigned int attempts)
+{
+  uint64_t delay = _riemann_async_client_delay (async, attempts);
+
+  return (int64_t) (delay / 2 +
+                    _riemann_async_client_random (&async->random) %
+                    (delay / 2 + 1));
+}
+
+/* Gives up on the connection, keeping whatever was in flight to send
+   again, and returns when to try reconnecting. Messages go back in the
+   order they were first sent: those in flight, then the one held back
+   for the window, if any, and then those still waiting to be sent
+   again since an earlier loss. */
+static int64_t
+_riemann_async_client_lost (riemann_async_client_t *async,
+                            riemann_async_batch_t **batch)
+{
+  riemann_client_disconnect (async->client);
+
+  if (*batch)
+    {
+      _riemann_async_client_retry (async, *batch);
+      *batch = NULL;
+    }
+
+  if (async->lost_head)
+    {
+      async->lost_tail->next = async->retry_head;
+      if (!async->retry_head)
+        async->retry_tail = async->lost_tail;
+      async->retry_head = async->lost_head;
+      async->lost_head = NULL;
+      async->lost_tail = NULL;
+    }
+
+  return _riemann_async_client_now () +
+    _riemann_async_client_backoff (async, 0);
+}
+
+/* How long an attempt to reconnect may take: the client's own timeout,
+   if it has one, or as long as the wait before the next attempt. */
+static int
+_riemann_async_client_reconnect_timeout (riemann_async_client_t *async,
+                                         unsigned int attempts)
+{
+  const struct timeval *tv = &async->client->origin.timeout;
+
+  if (tv->tv_sec || tv->tv_usec)
+    return (int) (tv->tv_sec * 1000 + (tv->tv_usec + 999) / 1000);
+
+  return (int) _riemann_async_client_delay (async, attempts);
+}
+
+static void *
+_riemann_async_client_run (void *data)
+{
+  riemann_async_client_t *async = (riemann_async_client_t *) data;
+  riemann_client_t *client = async->client;
+  riemann_async_batch_t *batch = NULL;
+  struct pollfd pfd;
+  int idle = RIEMANN_ASYNC_IDLE_MIN, timeout, stopping = 0, sent, e;
+  int64_t deadline = -1, retry_at = -1, now;
+  unsigned int attempts = 0;
+
+  for (;;)
+    {
+      if (!stopping &&
+          __atomic_load_n (&async->stop, __ATOMIC_ACQUIRE))
+        {
+          /* Replies still due are waited for as long as a blocking
+             receive would wait for them. */
+          stopping = 1;
+          timeout = _riemann_client_get_timeout (client);
+          if (timeout >= 0)
+            deadline = _riemann_async_client_now () + timeout;
+        }
+
+      /* While a message waits for the window, the queue may fill up,
+         and the oldest events go first. */
+      if (__atomic_load_n (&async->policy, __ATOMIC_ACQUIRE) ==
+          RIEMANN_ASYNC_POLICY_DROP_OLDEST)
+        _riemann_async_client_trim (async);
+
+      /* Without a connection, nothing is sent, and events queue up
+         until the next attempt to reconnect, unless stopping. */
+      if (retry_at >= 0)
+        {
+          if (stopping)
+            break;
+
+          if (_riemann_async_client_now () >= retry_at)
+            {
+              /* Connecting may take a while, but not longer than the
+                 client's timeout, or the next wait, and not past a
+                 request to stop. */
+              timeout = _riemann_async_client_reconnect_timeout
+                (async, attempts);
+              if (_riemann_client_reconnect (client, timeout,
+                                             &async->stop) == 0)
+                {
+                  retry_at = -1;
+                  attempts = 0;
+                  __atomic_add_fetch (&async->reconnects, 1,
+                                      __ATOMIC_RELAXED);
+                }
+              else
+                retry_at = _riemann_async_client_now () +
+                  _riemann_async_client_backoff (async, ++attempts);
+            }
+        }
+
+      sent = 0;
+      if (retry_at < 0)
+        {
+          if (!batch)
+            batch = _riemann_async_client_next (async);
+          if (batch)
+            {
+              e = _riemann_async_client_send (async, batch);
+
+              /* With the window full, the message waits for replies
+                 to make room. Otherwise, it is either on its way, or
+                 the connection failed under it. */
+              if (e != -EAGAIN)
+                {
+                  if (e != 0 && _riemann_async_client_reconnecting (async))
+                    retry_at = _riemann_async_client_lost (async, &batch);
+                  else if (e != 0)
+                    _riemann_async_client_done (batch, 0);
+
+                  batch = NULL;
+                  sent = 1;
+                  idle = RIEMANN_ASYNC_IDLE_MIN;
+                }
+            }
+        }
+
+      if (stopping && !batch && !async->retry_head &&
+          !_riemann_async_client_busy (async))
+        break;
+
+      if (stopping && deadline >= 0 &&
+          _riemann_async_client_now () >= deadline)
+        {
+          riemann_client_disconnect (client);
+          break;
+        }
+
+      /* Having just sent something, there may be more queued, so the
+         socket is only checked, without sleeping. When no replies
+         are due, the socket is left out, so that a broken connection
+         does not keep waking the thread up. */
+      timeout = (sent) ? 0 : idle;
+      pfd.events = (short) riemann_client_get_io_events (client);
+      pfd.fd = (pfd.events && retry_at < 0) ? client->sock : -1;
+      if (retry_at >= 0)
+        {
+          now = _riemann_async_client_now ();
+          if (retry_at - now < timeout)
+            timeout = (retry_at > now) ? (int) (retry_at - now) : 0;
+        }
+
+      if (poll (&pfd, 1, timeout) > 0)
+        {
+          e = riemann_client_process_io (client, pfd.revents);
+          if (e != 0 && _riemann_async_client_reconnecting (async))
+            retry_at = _riemann_async_client_lost (async, &batch);
+          continue;
+        }
+
+      if (!sent && !batch && idle < RIEMANN_ASYNC_IDLE_MAX)
+        idle *= 2;
+    }
+
+  if (batch)
+    _riemann_async_client_done (batch, 0);
+  while ((batch = async->lost_head) != NULL)
+    {
+      async->lost_head = batch->next;
+      _riemann_async_client_done (batch, 0);
+    }
+  async->lost_tail = NULL;
+  while ((batch = async->retry_head) != NULL)
+    {
+      async->retry_head = batch->next;
+      _riemann_async_client_done (batch, 0);
+    }
+  async->retry_tail = NULL;
+
+  return NULL;
+}
+
+riemann_async_client_t *
+riemann_async_client_new (riemann_client_t *client)
+{
+  riemann_async_client_t *async;
+  pthread_condattr_t attr;
+  int e;
+
+  if (!client)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  if (!client->send)
+    {
+      errno = ENOTCONN;
+      return NULL;
+    }
+
+  /* The queue ends are aligned to cache lines. */
+  if ((e = posix_memalign ((void **) &async, 64,
+                           sizeof (riemann_async_client_t))) != 0)
+    {
+      errno = e;
+      return NULL;
+    }
+  async->client = client;
+  async->builder = riemann_message_builder_new (RIEMANN_ASYNC_BATCH_MAX);
+  async->stop = 0;
+
+  async->max_events = 0;
+  async->max_bytes = 0;
+  async->policy = RIEMANN_ASYNC_POLICY_BLOCK;
+  async->timeout = 0;
+  async->queued_events = 0;
+  async->queued_bytes = 0;
+  async->enqueued = 0;
+  async->delivered = 0;
+  async->failed = 0;
+  async->dropped = 0;
+  async->reconnects = 0;
+  async->reconnect_min = 0;
+  async->reconnect_max = 0;
+  async->retry_head = NULL;
+  async->retry_tail = NULL;
+  async->lost_head = NULL;
+  async->lost_tail = NULL;
+  async->random = 0;
+  async->waiters = 0;
+
+  /* Deadlines of blocked producers are not moved by clock changes. */
+  pthread_condattr_init (&attr);
+  pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+  pthread_cond_init (&async->room, &attr);
+  pthread_condattr_destroy (&attr);
+  pthread_mutex_init (&async->lock, NULL);
+
+  /* The queue always holds a stub node, so that producers never
+     find it empty, and never have to touch the tail. */
+  async->head = (riemann_async_node_t *) malloc (sizeof (riemann_async_node_t));
+  async->head->next = NULL;
+  async->head->event = NULL;
+  async->head->size = 0;
+  async->tail = async->head;
+
+  if (client->read && client->in_flight.max == 0)
+    riemann_client_set_max_in_flight (client, RIEMANN_ASYNC_WINDOW);
+
+  e = pthread_create (&async->thread, NULL, _riemann_async_client_run, async);
+  if (e != 0)
+    {
+      free (async->head);
+      pthread_cond_destroy (&async->room);
+      pthread_mutex_destroy (&async->lock);
+      riemann_message_builder_free (async->builder);
+      free (async);
+
+      errno = e;
+      return NULL;
+    }
+
+  return async;
+}
+
+void
+riemann_async_client_free (riemann_async_client_t *async)
+{
+  riemann_event_t *event;
+  size_t size;
+
+  if (!async)
+    {
+      errno = EINVAL;
+      return;
+    }
+
+  __atomic_store_n (&async->stop, 1, __ATOMIC_RELEASE);
+  pthread_join (async->thread, NULL);
+
+  /* Whatever was queued after the thread had stopped. */
+  while ((event = _riemann_async_client_pop (async, &size)) != NULL)
+    riemann_event_free (event);
+  free (async->tail);
+
+  pthread_cond_destroy (&async->room);
+  pthread_mutex_destroy (&async->lock);
+  riemann_message_builder_free (async->builder);
+  riemann_client_free (async->client);
+  free (async);
+}
+
+int
+riemann_async_client_set_limits (riemann_async_client_t *async,
+                                 size_t max_events, size_t max_bytes,
+                                 riemann_async_policy_t policy,
+                                 unsigned int timeout)
+{
+  if (!async)
+    return -EINVAL;
+
+  if (policy != RIEMANN_ASYNC_POLICY_BLOCK &&
+      policy != RIEMANN_ASYNC_POLICY_DROP_NEWEST &&
+      policy != RIEMANN_ASYNC_POLICY_DROP_OLDEST &&
+      policy != RIEMANN_ASYNC_POLICY_SHED)
+    return -EINVAL;
+
+  /* The I/O thread is already running, and only looks at the limits
+     once it sees the policy. */
+  async->max_events = max_events;
+  async->max_bytes = max_bytes;
+  async->timeout = timeout;
+  __atomic_store_n (&async->policy, policy, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+int
+riemann_async_client_get_stats (const riemann_async_client_t *async,
+                                riemann_async_client_stats_t *stats)
+{
+  if (!async || !stats)
+    return -EINVAL;
+
+  stats->queued_events = __atomic_load_n (&async->queued_events,
+                                          __ATOMIC_RELAXED);
+  stats->queued_bytes = __atomic_load_n (&async->queued_bytes,
+                                         __ATOMIC_RELAXED);
+  stats->enqueued = __atomic_load_n (&async->enqueued, __ATOMIC_RELAXED);
+  stats->delivered = __atomic_load_n (&async->delivered, __ATOMIC_RELAXED);
+  stats->failed = __atomic_load_n (&async->failed, __ATOMIC_RELAXED);
+  stats->dropped = __atomic_load_n (&async->dropped, __ATOMIC_RELAXED);
+  stats->reconnects = __atomic_load_n (&async->reconnects, __ATOMIC_RELAXED);
+
+  return 0;
+}
+
+int
+riemann_async_client_set_reconnect (riemann_async_client_t *async,
+                                    unsigned int min_delay,
+                                    unsigned int max_delay)
+{
+  if (!async)
+    return -EINVAL;
+
+  if (min_delay > max_delay)
+    return -EINVAL;
+
+  /* Like the limits, the longest delay is seen by the I/O thread
+     through the shortest. */
+  async->reconnect_max = max_delay;
+  __atomic_store_n (&async->reconnect_min, min_delay, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+/* Finds room for an event, as the policy says, or gives up on it. */
+static int
+_riemann_async_client_admit (riemann_async_client_t *async, size_t size)
+{
+  if (!async->max_events && !async->max_bytes)
+    {
+      _riemann_async_client_reserve (async, size, 0);
+      return 0;
+    }
+
+  /* An event larger than the whole queue would never fit. */
+  if (async->max_bytes && size > async->max_bytes)
+    return -EMSGSIZE;
+
+  switch (async->policy)
+    {
+    case RIEMANN_ASYNC_POLICY_SHED:
+      if (_riemann_async_client_shed (async, size))
+        return -ENOBUFS;
+      /* fall through */
+    case RIEMANN_ASYNC_POLICY_DROP_NEWEST:
+      return _riemann_async_client_reserve (async, size, 1) ? 0 : -ENOBUFS;
+
+    case RIEMANN_ASYNC_POLICY_DROP_OLDEST:
+      /* The I/O thread makes room, by dropping from the other end. While
+         it is busy elsewhere, reconnecting say, the queue may only grow
+         so far: past that, the newest event is dropped instead. */
+      return _riemann_async_client_reserve
+        (async, size, RIEMANN_ASYNC_DROP_OLDEST_SLACK) ? 0 : -ENOBUFS;
+
+    case RIEMANN_ASYNC_POLICY_BLOCK:
+    default:
+      if (_riemann_async_client_reserve (async, size, 1))
+        return 0;
+      return _riemann_async_client_wait (async, size);
+    }
+}
+
+int
+riemann_async_client_send_event (riemann_async_client_t *async,
+                                 riemann_event_t *event)
+{
+  riemann_async_node_t *node, *prev;
+  size_t size;
+  int e;
+
+  if (!async || !event)
+    return -EINVAL;
+
+  size = _riemann_wire_event_get_packed_size (event);
+  if ((e = _riemann_async_client_admit (async, size)) != 0)
+    {
+      riemann_event_free (event);
+      __atomic_add_fetch (&async->dropped, 1, __ATOMIC_RELAXED);
+      return e;
+    }
+
+  node = (riemann_async_node_t *) malloc (sizeof (riemann_async_node_t));
+  node->next = NULL;
+  node->event = event;
+  node->size = size;
+
+  prev = __atomic_exchange_n (&async->head, node, __ATOMIC_ACQ_REL);
+  __atomic_store_n (&prev->next, node, __ATOMIC_RELEASE);
+  __atomic_add_fetch (&async->enqueued, 1, __ATOMIC_RELAXED);
+
+  return 0;
+}
@@ -0,0 +1,71 @@
+/* riemann/async.h -- Riemann C client library
+ * Copyright (C) 2013-2017  Gergely Nagy <algernon@madhouse-project.org>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MADHOUSE_RIEMANN_ASYNC_H__
+#define __MADHOUSE_RIEMANN_ASYNC_H__ 1
+
+#include <riemann/client.h>
+#include <riemann/event.h>
+
+#include <stdint.h>
+
+typedef struct _riemann_async_client_t riemann_async_client_t;
+
+typedef enum
+  {
+    RIEMANN_ASYNC_POLICY_BLOCK,
+    RIEMANN_ASYNC_POLICY_DROP_NEWEST,
+    RIEMANN_ASYNC_POLICY_DROP_OLDEST,
+    RIEMANN_ASYNC_POLICY_SHED
+  } riemann_async_policy_t;
+
+typedef struct
+{
+  size_t queued_events;
+  size_t queued_bytes;
+  uint64_t enqueued;
+  uint64_t delivered;
+  uint64_t failed;
+  uint64_t dropped;
+  uint64_t reconnects;
+} riemann_async_client_stats_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+riemann_async_client_t *riemann_async_client_new (riemann_client_t *client);
+void riemann_async_client_free (riemann_async_client_t *async);
+
+int riemann_async_client_set_limits (riemann_async_client_t *async,
+                                     size_t max_events, size_t max_bytes,
+                                     riemann_async_policy_t policy,
+                                     unsigned int timeout);
+int riemann_async_client_get_stats (const riemann_async_client_t *async,
+                                    riemann_async_client_stats_t *stats);
+int riemann_async_client_set_reconnect (riemann_async_client_t *async,
+                                        unsigned int min_delay,
+                                        unsigned int max_delay);
+
+int riemann_async_client_send_event (riemann_async_client_t *async,
+                                     riemann_event_t *event);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
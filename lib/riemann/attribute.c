@@ -16,6 +16,7 @@
  */
 
 #include <riemann/attribute.h>
+#include "riemann/_private.h"
 
 #include <errno.h>
 #include <stdlib.h>
@@ -41,18 +42,32 @@ riemann_attribute_free (riemann_attribute_t *attrib)
       return;
     }
 
+  _riemann_attribute_release_shared (attrib);
   attribute__free_unpacked (attrib, NULL);
 }
 
+/* Releases the strings that may be interned or shared with clones,
+   and clears them, so that freeing the attribute afterwards does not
+   touch them. */
+void
+_riemann_attribute_release_shared (riemann_attribute_t *attrib)
+{
+  if (!_riemann_intern_in_use ())
+    return;
+
+  _riemann_intern_free (attrib->key);
+  _riemann_intern_free (attrib->value);
+  attrib->key = attrib->value = NULL;
+}
+
 int
 riemann_attribute_set_key (riemann_attribute_t *attrib, const char *key)
 {
   if (!attrib || !key)
     return -EINVAL;
 
-  if (attrib->key)
-    free (attrib->key);
-  attrib->key = strdup (key);
+  _riemann_intern_free (attrib->key);
+  attrib->key = _riemann_intern_strdup (key);
 
   return 0;
 }
@@ -63,8 +78,7 @@ riemann_attribute_set_value (riemann_attribute_t *attrib, const char *value)
   if (!attrib || !value)
     return -EINVAL;
 
-  if (attrib->value)
-    free (attrib->value);
+  _riemann_intern_free (attrib->value);
   attrib->value = strdup (value);
 
   return 0;
@@ -85,7 +99,8 @@ riemann_attribute_set (riemann_attribute_t *attrib,
 }
 
 riemann_attribute_t *
-riemann_attribute_create (const char *key, const char *value)
+_riemann_attribute_create (ProtobufCAllocator *allocator,
+                           const char *key, const char *value)
 {
   riemann_attribute_t *attrib;
 
@@ -94,25 +109,55 @@ riemann_attribute_create (const char *key, const char *value)
      value when they were supplied to this function, so that branch is
      guarded against, too. */
 
-  attrib = riemann_attribute_new ();
+  attrib = (riemann_attribute_t *)
+    _riemann_alloc (allocator, sizeof (riemann_attribute_t));
+  attribute__init (attrib);
 
   if (key)
-    riemann_attribute_set_key (attrib, key);
+    attrib->key = (allocator) ? _riemann_strdup (allocator, key) :
+      _riemann_intern_strdup (key);
 
   if (value)
-    riemann_attribute_set_value (attrib, value);
+    attrib->value = _riemann_strdup (allocator, value);
 
   return attrib;
 }
 
+riemann_attribute_t *
+riemann_attribute_create (const char *key, const char *value)
+{
+  return _riemann_attribute_create (NULL, key, value);
+}
+
+riemann_attribute_t *
+riemann_attribute_create_in (riemann_arena_t *arena,
+                             const char *key, const char *value)
+{
+  if (!arena)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  return _riemann_attribute_create (&arena->allocator, key, value);
+}
+
 riemann_attribute_t *
 riemann_attribute_clone (const riemann_attribute_t *attrib)
 {
+  riemann_attribute_t *clone;
+
   if (!attrib)
     {
       errno = EINVAL;
       return NULL;
     }
 
-  return riemann_attribute_create (attrib->key, attrib->value);
+  /* The strings are shared with the original, setting either of them
+     later replaces the string instead of modifying it. */
+  clone = riemann_attribute_new ();
+  clone->key = _riemann_string_ref (attrib->key);
+  clone->value = _riemann_string_ref (attrib->value);
+
+  return clone;
 }
@@ -19,6 +19,7 @@
 #define __MADHOUSE_RIEMANN_ATTRIBUTE_H__ 1
 
 #include <riemann/proto/riemann.pb-c.h>
+#include <riemann/arena.h>
 
 typedef Attribute riemann_attribute_t;
 
@@ -30,6 +31,9 @@ riemann_attribute_t *riemann_attribute_new (void);
 riemann_attribute_t *riemann_attribute_clone (const riemann_attribute_t *attrib);
 riemann_attribute_t *riemann_attribute_create (const char *key,
                                                const char *value);
+riemann_attribute_t *riemann_attribute_create_in (riemann_arena_t *arena,
+                                                  const char *key,
+                                                  const char *value);
 void riemann_attribute_free (riemann_attribute_t *attrib);
 
 int riemann_attribute_set_key (riemann_attribute_t *attrib, const char *key);
@@ -0,0 +1,351 @@
+/* riemann/batcher.c -- Riemann C client library
+ * Copyright (C) 2013-2017  Gergely Nagy <algernon@madhouse-project.org>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <riemann/batcher.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "riemann/_private.h"
+
+#if HAVE_SYS_TIMERFD_H
+#include <sys/timerfd.h>
+#endif
+
+/* The batcher collects events into a batch writer, and sends them as
+ * a single message once there are enough of them, once the message
+ * grew large enough, or once the oldest of them waited long enough,
+ * whichever comes first.
+ *
+ * Nothing happens on its own: the delay is checked whenever an event
+ * is added, and whenever the batcher is asked to process its timer.
+ * Where timerfd is available, the timer is a file descriptor an event
+ * loop can wait on.
+ */
+
+static int64_t
+_riemann_batcher_now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+_riemann_batcher_set_timer (riemann_batcher_t *batcher, unsigned int delay)
+{
+#if HAVE_SYS_TIMERFD_H
+  struct itimerspec its;
+
+  if (batcher->timer_fd < 0)
+    return;
+
+  /* A zero delay disarms the timer. */
+  memset (&its, 0, sizeof (its));
+  its.it_value.tv_sec = delay / 1000;
+  its.it_value.tv_nsec = (long)(delay % 1000) * 1000000;
+  timerfd_settime (batcher->timer_fd, 0, &its, NULL);
+#else
+  (void) batcher;
+  (void) delay;
+#endif
+}
+
+riemann_batcher_t *
+riemann_batcher_new (riemann_client_t *client, size_t max_events,
+                     size_t max_bytes, unsigned int max_delay)
+{
+  riemann_batcher_t *batcher;
+
+  if (!client)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  batcher = (riemann_batcher_t *) malloc (sizeof (riemann_batcher_t));
+  batcher->client = client;
+  batcher->writer = riemann_batch_writer_new ();
+  batcher->max_events = max_events;
+  batcher->max_bytes = max_bytes;
+  batcher->max_delay = max_delay;
+  batcher->n_events = 0;
+  batcher->deadline = -1;
+  batcher->timer_fd = -1;
+  batcher->callback = NULL;
+  batcher->userdata = NULL;
+
+#if HAVE_SYS_TIMERFD_H
+  if (max_delay)
+    {
+      batcher->timer_fd = timerfd_create (CLOCK_MONOTONIC,
+                                          TFD_NONBLOCK | TFD_CLOEXEC);
+      if (batcher->timer_fd == -1)
+        {
+          int e = errno;
+
+          riemann_batch_writer_free (batcher->writer);
+          free (batcher);
+
+          errno = e;
+          return NULL;
+        }
+    }
+#endif
+
+  return batcher;
+}
+
+void
+riemann_batcher_free (riemann_batcher_t *batcher)
+{
+  if (!batcher)
+    {
+      errno = EINVAL;
+      return;
+    }
+
+  if (batcher->timer_fd >= 0)
+    close (batcher->timer_fd);
+  riemann_batch_writer_free (batcher->writer);
+  free (batcher);
+}
+
+void
+riemann_batcher_set_callback (riemann_batcher_t *batcher,
+                              riemann_client_callback_t callback,
+                              void *userdata)
+{
+  if (!batcher)
+    {
+      errno = EINVAL;
+      return;
+    }
+
+  batcher->callback = callback;
+  batcher->userdata = userdata;
+}
+
+/* Sends what the writer holds, and waits for the acknowledgement,
+   if there is going to be one. The callback, if any, gets the reply,
+   or the reason there is none. */
+static int
+_riemann_batcher_send (riemann_batcher_t *batcher)
+{
+  riemann_client_t *client = batcher->client;
+  riemann_message_t *response;
+  int e;
+
+  if ((e = riemann_client_send_batch (client, batcher->writer)) != 0)
+    return e;
+
+  /* There are no replies over UDP. */
+  if (!client->read)
+    return 0;
+
+  if (!(response = riemann_client_recv_message (client)))
+    {
+      e = -errno;
+      if (batcher->callback)
+        batcher->callback (client, NULL, e, batcher->userdata);
+      return e;
+    }
+
+  e = (response->ok) ? 0 : -EPROTO;
+  if (batcher->callback)
+    batcher->callback (client, response, 0, batcher->userdata);
+  else
+    riemann_message_free (response);
+
+  return e;
+}
+
+static void
+_riemann_batcher_clear (riemann_batcher_t *batcher)
+{
+  riemann_batch_writer_reset (batcher->writer);
+  batcher->n_events = 0;
+  batcher->deadline = -1;
+  _riemann_batcher_set_timer (batcher, 0);
+}
+
+int
+riemann_batcher_flush (riemann_batcher_t *batcher)
+{
+  int e;
+
+  if (!batcher)
+    return -EINVAL;
+
+  if (batcher->n_events == 0)
+    return 0;
+
+  /* The events are gone either way: there is no telling which of
+     them made it, if sending failed. */
+  e = _riemann_batcher_send (batcher);
+  _riemann_batcher_clear (batcher);
+
+  return e;
+}
+
+/* Accounts for an event just written, starting at `start' in the
+   writer's buffer, and flushes if any of the limits was reached. */
+static int
+_riemann_batcher_added (riemann_batcher_t *batcher, size_t start)
+{
+  riemann_wire_buffer_t *buffer = &batcher->writer->buffer;
+  size_t event_len;
+  int e = 0;
+
+  /* If the event made the message too large, everything before it is
+     sent on its own, and the event starts the next batch. */
+  if (batcher->max_bytes && batcher->n_events &&
+      buffer->len - RIEMANN_BATCH_WRITER_HEADER_SIZE > batcher->max_bytes)
+    {
+      event_len = buffer->len - start;
+
+      buffer->len = start;
+      e = _riemann_batcher_send (batcher);
+
+      memmove (buffer->data + RIEMANN_BATCH_WRITER_HEADER_SIZE,
+               buffer->data + start, event_len);
+      buffer->len = RIEMANN_BATCH_WRITER_HEADER_SIZE + event_len;
+      batcher->n_events = 0;
+    }
+
+  if (batcher->n_events++ == 0 && batcher->max_delay)
+    {
+      batcher->deadline = _riemann_batcher_now () + batcher->max_delay;
+      _riemann_batcher_set_timer (batcher, batcher->max_delay);
+    }
+
+  if ((batcher->max_events && batcher->n_events >= batcher->max_events) ||
+      (batcher->max_bytes &&
+       buffer->len - RIEMANN_BATCH_WRITER_HEADER_SIZE >= batcher->max_bytes) ||
+      (batcher->deadline >= 0 && _riemann_batcher_now () >= batcher->deadline))
+    {
+      int f = riemann_batcher_flush (batcher);
+
+      if (e == 0)
+        e = f;
+    }
+
+  return e;
+}
+
+int
+riemann_batcher_add_event (riemann_batcher_t *batcher,
+                           const riemann_event_t *event)
+{
+  size_t start;
+  int e;
+
+  if (!batcher || !event)
+    return -EINVAL;
+
+  start = batcher->writer->buffer.len;
+  if ((e = riemann_batch_writer_add_event (batcher->writer, event)) != 0)
+    return e;
+
+  return _riemann_batcher_added (batcher, start);
+}
+
+int
+riemann_batcher_add_event_template (riemann_batcher_t *batcher,
+                                    const riemann_event_template_t *tmpl,
+                                    const riemann_event_template_values_t *values)
+{
+  size_t start;
+  int e;
+
+  if (!batcher || !tmpl)
+    return -EINVAL;
+
+  start = batcher->writer->buffer.len;
+  if ((e = riemann_batch_writer_add_event_template (batcher->writer, tmpl,
+                                                    values)) != 0)
+    return e;
+
+  return _riemann_batcher_added (batcher, start);
+}
+
+size_t
+riemann_batcher_size (const riemann_batcher_t *batcher)
+{
+  if (!batcher)
+    return 0;
+
+  return batcher->n_events;
+}
+
+int
+riemann_batcher_get_fd (riemann_batcher_t *batcher)
+{
+  if (!batcher)
+    return -EINVAL;
+
+  if (batcher->timer_fd < 0)
+    return -ENOTSUP;
+
+  return batcher->timer_fd;
+}
+
+int
+riemann_batcher_get_timeout (riemann_batcher_t *batcher)
+{
+  int64_t now;
+
+  if (!batcher)
+    return -EINVAL;
+
+  if (batcher->deadline < 0)
+    return -1;
+
+  now = _riemann_batcher_now ();
+  if (now >= batcher->deadline)
+    return 0;
+
+  return (int)(batcher->deadline - now);
+}
+
+int
+riemann_batcher_process (riemann_batcher_t *batcher)
+{
+  uint64_t expirations;
+
+  if (!batcher)
+    return -EINVAL;
+
+  /* The timer is only armed while there are events waiting, so if
+     it fired, they waited long enough. */
+  if (batcher->timer_fd >= 0)
+    {
+      if (read (batcher->timer_fd, &expirations, sizeof (expirations)) > 0)
+        return riemann_batcher_flush (batcher);
+      if (errno != EAGAIN)
+        return -errno;
+    }
+
+  if (batcher->deadline >= 0 && _riemann_batcher_now () >= batcher->deadline)
+    return riemann_batcher_flush (batcher);
+
+  return 0;
+}
@@ -0,0 +1,55 @@
+/* riemann/batcher.h -- Riemann C client library
+ * Copyright (C) 2013-2017  Gergely Nagy <algernon@madhouse-project.org>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MADHOUSE_RIEMANN_BATCHER_H__
+#define __MADHOUSE_RIEMANN_BATCHER_H__ 1
+
+#include <riemann/client.h>
+#include <riemann/event.h>
+#include <riemann/template.h>
+
+typedef struct _riemann_batcher_t riemann_batcher_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+riemann_batcher_t *riemann_batcher_new (riemann_client_t *client,
+                                        size_t max_events, size_t max_bytes,
+                                        unsigned int max_delay);
+void riemann_batcher_free (riemann_batcher_t *batcher);
+void riemann_batcher_set_callback (riemann_batcher_t *batcher,
+                                   riemann_client_callback_t callback,
+                                   void *userdata);
+
+int riemann_batcher_add_event (riemann_batcher_t *batcher,
+                               const riemann_event_t *event);
+int riemann_batcher_add_event_template (riemann_batcher_t *batcher,
+                                        const riemann_event_template_t *tmpl,
+                                        const riemann_event_template_values_t *values);
+size_t riemann_batcher_size (const riemann_batcher_t *batcher);
+int riemann_batcher_flush (riemann_batcher_t *batcher);
+
+int riemann_batcher_get_fd (riemann_batcher_t *batcher);
+int riemann_batcher_get_timeout (riemann_batcher_t *batcher);
+int riemann_batcher_process (riemann_batcher_t *batcher);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
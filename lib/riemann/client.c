@@ -17,13 +17,16 @@
 
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <netdb.h>
+#include <poll.h>
 #include <stdarg.h>
 
 #include "riemann/_private.h"
@@ -33,6 +36,8 @@
 #include "riemann/client/tls.h"
 #include "riemann/client/udp.h"
 
+static void _riemann_client_fail_requests (riemann_client_t *client, int error);
+
 const char *
 riemann_client_version (void)
 {
@@ -55,7 +60,31 @@ SYMVER(riemann_client_new) (void)
   client->sock = -1;
   client->srv_addr = NULL;
   client->send = NULL;
+  client->sendv = NULL;
   client->recv = NULL;
+  client->write = NULL;
+  client->read = NULL;
+  client->nonblocking = 0;
+  client->send_buffer.data = NULL;
+  client->send_buffer.size = 0;
+  client->recv_buffer.data = NULL;
+  client->recv_buffer.size = 0;
+  client->pending.data = NULL;
+  client->pending.size = 0;
+  client->pending.len = 0;
+  client->pending.sent = 0;
+  client->in_flight.requests = NULL;
+  client->in_flight.size = 0;
+  client->in_flight.head = 0;
+  client->in_flight.n = 0;
+  client->in_flight.max = 0;
+  client->incoming.data = NULL;
+  client->incoming.size = 0;
+  client->incoming.len = 0;
+  client->origin.type = RIEMANN_CLIENT_NONE;
+  client->origin.addr = NULL;
+  client->origin.timeout.tv_sec = 0;
+  client->origin.timeout.tv_usec = 0;
   _riemann_client_init_tls (client);
 
   return client;
@@ -76,17 +105,178 @@ riemann_client_disconnect (riemann_client_t *client)
 
   _riemann_client_disconnect_tls (client);
 
+  /* Whatever is left of a frame can not be sent on a new
+     connection, nor will replies to earlier ones arrive there. */
+  client->pending.len = client->pending.sent = 0;
+  client->incoming.len = 0;
+  _riemann_client_fail_requests (client, -ECONNABORTED);
+
   if (close (client->sock) != 0)
     return -errno;
   client->sock = -1;
 
-  if (client->srv_addr)
-    freeaddrinfo (client->srv_addr);
+  /* The address is kept for reconnecting. */
   client->srv_addr = NULL;
 
   return 0;
 }
 
+static int64_t
+_riemann_client_now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int
+_riemann_client_set_sock_timeout (int sock, const struct timeval *timeout)
+{
+  if (setsockopt (sock, SOL_SOCKET, SO_SNDTIMEO, timeout,
+                  sizeof (struct timeval)) == -1)
+    return -errno;
+  if (setsockopt (sock, SOL_SOCKET, SO_RCVTIMEO, timeout,
+                  sizeof (struct timeval)) == -1)
+    return -errno;
+
+  return 0;
+}
+
+/* How often a connection in progress checks whether it should give
+   up, in milliseconds. */
+#define RIEMANN_CLIENT_CONNECT_SLICE 50
+
+/* Connects without blocking, and waits for the connection in slices,
+   for at most `timeout' milliseconds, or without limit if it is
+   negative, giving up early once `*stop' is set. */
+static int
+_riemann_client_connect_sock (int sock, const struct addrinfo *addr,
+                              int timeout, const int *stop)
+{
+  struct pollfd pfd;
+  int64_t deadline = -1, now;
+  int flags, wait, e;
+  socklen_t len = sizeof (e);
+
+  if ((flags = fcntl (sock, F_GETFL)) == -1 ||
+      fcntl (sock, F_SETFL, flags | O_NONBLOCK) == -1)
+    return -errno;
+
+  if (connect (sock, addr->ai_addr, addr->ai_addrlen) != 0)
+    {
+      if (errno != EINPROGRESS)
+        return -errno;
+
+      if (timeout >= 0)
+        deadline = _riemann_client_now () + timeout;
+
+      pfd.fd = sock;
+      pfd.events = POLLOUT;
+      for (;;)
+        {
+          wait = (stop) ? RIEMANN_CLIENT_CONNECT_SLICE : -1;
+          if (deadline >= 0)
+            {
+              now = _riemann_client_now ();
+              if (now >= deadline)
+                return -ETIMEDOUT;
+              if (wait < 0 || deadline - now < wait)
+                wait = (int) (deadline - now);
+            }
+
+          e = poll (&pfd, 1, wait);
+          if (e > 0)
+            break;
+          if (e < 0 && errno != EINTR)
+            return -errno;
+          if (stop && __atomic_load_n (stop, __ATOMIC_ACQUIRE))
+            return -ECANCELED;
+        }
+
+      if (getsockopt (sock, SOL_SOCKET, SO_ERROR, &e, &len) != 0)
+        return -errno;
+      if (e != 0)
+        return -e;
+    }
+
+  if (fcntl (sock, F_SETFL, flags) == -1)
+    return -errno;
+
+  return 0;
+}
+
+int
+_riemann_client_reconnect (riemann_client_t *client, int timeout,
+                           const int *stop)
+{
+  struct addrinfo *addr;
+  struct timeval tv;
+  int sock, e, has_timeout;
+
+  if (!client)
+    return -EINVAL;
+  if (!client->origin.addr)
+    return -ENOTCONN;
+
+  addr = client->origin.addr;
+
+  sock = socket (addr->ai_family, addr->ai_socktype, 0);
+  if (sock == -1)
+    return -errno;
+
+  if ((e = _riemann_client_connect_sock (sock, addr, timeout, stop)) != 0)
+    {
+      close (sock);
+      return e;
+    }
+
+  riemann_client_disconnect (client);
+
+  client->sock = sock;
+  client->srv_addr = addr;
+
+  has_timeout = (client->origin.timeout.tv_sec ||
+                 client->origin.timeout.tv_usec);
+  if (has_timeout)
+    riemann_client_set_timeout (client, &client->origin.timeout);
+
+  if (client->origin.type != RIEMANN_CLIENT_TLS)
+    return 0;
+
+  /* The handshake blocks: without a timeout of the client's own, it is
+     held to the one given, for as long as it lasts. */
+  if (!has_timeout && timeout >= 0)
+    {
+      tv.tv_sec = timeout / 1000;
+      tv.tv_usec = (timeout % 1000) * 1000;
+      _riemann_client_set_sock_timeout (sock, &tv);
+    }
+
+  e = _riemann_client_reconnect_tls (client);
+
+  if (!has_timeout && timeout >= 0 && client->sock == sock)
+    {
+      tv.tv_sec = tv.tv_usec = 0;
+      _riemann_client_set_sock_timeout (sock, &tv);
+    }
+
+  return e;
+}
+
+int
+riemann_client_reconnect (riemann_client_t *client)
+{
+  int timeout = -1;
+
+  if (client && (client->origin.timeout.tv_sec ||
+                 client->origin.timeout.tv_usec))
+    timeout = (int) (client->origin.timeout.tv_sec * 1000 +
+                     (client->origin.timeout.tv_usec + 999) / 1000);
+
+  return _riemann_client_reconnect (client, timeout, NULL);
+}
+
 void
 riemann_client_free (riemann_client_t *client)
 {
@@ -98,6 +288,15 @@ riemann_client_free (riemann_client_t *client)
 
   errno = -riemann_client_disconnect (client);
 
+  if (client->origin.addr)
+    freeaddrinfo (client->origin.addr);
+  _riemann_client_free_tls (client);
+
+  free (client->send_buffer.data);
+  free (client->recv_buffer.data);
+  free (client->pending.data);
+  free (client->in_flight.requests);
+  free (client->incoming.data);
   free (client);
 }
 
@@ -114,18 +313,49 @@ int
 riemann_client_set_timeout (riemann_client_t *client,
                             struct timeval *timeout)
 {
+  int e;
+
   if (!client || !timeout)
     return -EINVAL;
 
   if (client->sock < 0)
     return -EINVAL;
 
-  if (setsockopt (client->sock, SOL_SOCKET, SO_SNDTIMEO, timeout,
-                  sizeof (struct timeval)) == -1)
-    return -errno;
-  if (setsockopt (client->sock, SOL_SOCKET, SO_RCVTIMEO, timeout,
-                  sizeof (struct timeval)) == -1)
-    return -errno;
+  if ((e = _riemann_client_set_sock_timeout (client->sock, timeout)) != 0)
+    return e;
+
+  client->origin.timeout = *timeout;
+
+  return 0;
+}
+
+/* The receive timeout set on the socket, in milliseconds, or -1 if
+   there is none; the way poll() takes it. */
+int
+_riemann_client_get_timeout (riemann_client_t *client)
+{
+  struct timeval tv;
+  socklen_t len = sizeof (tv);
+
+  if (getsockopt (client->sock, SOL_SOCKET, SO_RCVTIMEO, &tv, &len) != 0 ||
+      (tv.tv_sec == 0 && tv.tv_usec == 0))
+    return -1;
+
+  return (int)(tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000);
+}
+
+int
+riemann_client_set_nonblocking (riemann_client_t *client, int nonblocking)
+{
+  if (!client)
+    return -EINVAL;
+
+  /* The rest of a frame can only be sent without blocking. */
+  if (!nonblocking && client->pending.len)
+    return -EBUSY;
+
+  client->nonblocking = (nonblocking != 0);
+  _riemann_client_set_nonblocking_tls (client);
 
   return 0;
 }
@@ -203,6 +433,13 @@ riemann_client_connect_va (riemann_client_t *client,
   client->sock = sock;
   client->srv_addr = res;
 
+  if (client->origin.addr)
+    freeaddrinfo (client->origin.addr);
+  client->origin.type = type;
+  client->origin.addr = res;
+  client->origin.timeout.tv_sec = 0;
+  client->origin.timeout.tv_usec = 0;
+
   if (type == RIEMANN_CLIENT_TLS)
     return _riemann_client_connect_tls_handshake (client, &tls_options);
 
@@ -275,19 +512,215 @@ __asm__(".symver riemann_client_create_1_5,riemann_client_create@RIEMANN_C_1.5")
 __asm__(".symver riemann_client_create_default,riemann_client_create@@RIEMANN_C_1.10");
 #endif
 
+static int
+_riemann_client_pack_message (riemann_client_t *client,
+                              riemann_message_t *message,
+                              uint8_t **buffer, size_t *len)
+{
+  int e;
+
+  /* The send buffer is kept around between sends, and only ever grows,
+     so once it reached the size of the largest message sent, packing
+     does not need to allocate anymore. */
+  e = riemann_message_pack_into (message, client->send_buffer.data,
+                                 client->send_buffer.size, len);
+  if (e == -ENOBUFS)
+    {
+      uint8_t *data;
+
+      data = (uint8_t *) realloc (client->send_buffer.data, *len);
+      if (!data)
+        return -ENOMEM;
+      client->send_buffer.data = data;
+      client->send_buffer.size = *len;
+
+      e = riemann_message_pack_into (message, client->send_buffer.data,
+                                     client->send_buffer.size, len);
+    }
+  if (e != 0)
+    return e;
+
+  *buffer = client->send_buffer.data;
+  return 0;
+}
+
+/* Skips the first `len' bytes of an iovec array. */
+void
+_riemann_iovec_consume (struct iovec **iov, int *iovcnt, size_t len)
+{
+  while (*iovcnt > 0 && len >= (*iov)->iov_len)
+    {
+      len -= (*iov)->iov_len;
+      (*iov)++;
+      (*iovcnt)--;
+    }
+
+  if (*iovcnt > 0)
+    {
+      (*iov)->iov_base = (uint8_t *)(*iov)->iov_base + len;
+      (*iov)->iov_len -= len;
+    }
+}
+
+int
+riemann_client_flush (riemann_client_t *client)
+{
+  struct iovec iov;
+  ssize_t written;
+
+  if (!client)
+    return -ENOTCONN;
+
+  while (client->pending.sent < client->pending.len)
+    {
+      iov.iov_base = client->pending.data + client->pending.sent;
+      iov.iov_len = client->pending.len - client->pending.sent;
+
+      written = client->write (client, &iov, 1);
+      if (written == -EAGAIN)
+        return -EAGAIN;
+      if (written < 0)
+        {
+          client->pending.len = client->pending.sent = 0;
+          return (int)written;
+        }
+
+      client->pending.sent += written;
+    }
+
+  client->pending.len = client->pending.sent = 0;
+  return 0;
+}
+
+/* Adds data to the end of the pending buffer, dropping what was
+   already sent from its front first. Returns -ENOMEM, and leaves the
+   buffer as it was, if it could not grow. */
+static int
+_riemann_client_pending_append (riemann_client_t *client,
+                                const struct iovec *iov, int iovcnt)
+{
+  size_t len = 0;
+  int n;
+
+  if (client->pending.sent)
+    {
+      memmove (client->pending.data,
+               client->pending.data + client->pending.sent,
+               client->pending.len - client->pending.sent);
+      client->pending.len -= client->pending.sent;
+      client->pending.sent = 0;
+    }
+
+  for (n = 0; n < iovcnt; n++)
+    len += iov[n].iov_len;
+
+  if (client->pending.len + len > client->pending.size)
+    {
+      size_t size = client->pending.len + len;
+      uint8_t *data;
+
+      if (size < client->pending.len * 2)
+        size = client->pending.len * 2;
+      data = (uint8_t *) realloc (client->pending.data, size);
+      if (!data)
+        return -ENOMEM;
+      client->pending.data = data;
+      client->pending.size = size;
+    }
+
+  for (n = 0; n < iovcnt; n++)
+    {
+      memcpy (client->pending.data + client->pending.len, iov[n].iov_base,
+              iov[n].iov_len);
+      client->pending.len += iov[n].iov_len;
+    }
+
+  return 0;
+}
+
+/* Sends a frame, or in non-blocking mode, as much of it as the
+   transport takes, and keeps the rest to be sent by
+   riemann_client_flush(). */
+static int
+_riemann_client_sendv (riemann_client_t *client, struct iovec *iov,
+                       int iovcnt)
+{
+  ssize_t written;
+
+  if (!client->nonblocking || !client->write)
+    return client->sendv (client, iov, iovcnt);
+
+  written = client->write (client, iov, iovcnt);
+  if (written < 0 && written != -EAGAIN)
+    return (int)written;
+  if (written > 0)
+    _riemann_iovec_consume (&iov, &iovcnt, (size_t)written);
+
+  if (iovcnt == 0)
+    return 0;
+
+  if (_riemann_client_pending_append (client, iov, iovcnt) != 0)
+    return -ENOMEM;
+
+  return -EINPROGRESS;
+}
+
+static int
+_riemann_client_send (riemann_client_t *client, const uint8_t *buffer,
+                      size_t len)
+{
+  struct iovec iov;
+
+  if (!client->nonblocking || !client->write)
+    return client->send (client, buffer, len);
+
+  iov.iov_base = (void *)buffer;
+  iov.iov_len = len;
+
+  return _riemann_client_sendv (client, &iov, 1);
+}
+
+uint8_t *
+_riemann_client_recv_buffer (riemann_client_t *client, size_t len)
+{
+  /* Like the send buffer, the receive buffer only ever grows. */
+  if (len > client->recv_buffer.size)
+    {
+      uint8_t *data;
+
+      data = (uint8_t *) realloc (client->recv_buffer.data, len);
+      if (!data)
+        return NULL;
+      client->recv_buffer.data = data;
+      client->recv_buffer.size = len;
+    }
+
+  return client->recv_buffer.data;
+}
+
 int
 riemann_client_send_message (riemann_client_t *client,
                              riemann_message_t *message)
 {
+  uint8_t *buffer;
+  size_t len;
+  int e;
+
   if (!client)
     return -ENOTCONN;
   if (!message)
     return -EINVAL;
 
-  if (!client->send)
+  if (!client->send || client->sock == -1)
     return -ENOTCONN;
 
-  return client->send (client, message);
+  if ((e = riemann_client_flush (client)) != 0)
+    return e;
+
+  if ((e = _riemann_client_pack_message (client, message, &buffer, &len)) != 0)
+    return e;
+
+  return _riemann_client_send (client, buffer, len);
 }
 
 int
@@ -302,14 +735,466 @@ riemann_client_send_message_oneshot (riemann_client_t *client,
   return ret;
 }
 
+int
+riemann_client_send_event_template (riemann_client_t *client,
+                                    const riemann_event_template_t *tmpl,
+                                    const riemann_event_template_values_t *values)
+{
+  riemann_wire_buffer_t buffer;
+  struct iovec iov[3];
+  int e;
+
+  if (!client)
+    return -ENOTCONN;
+  if (!tmpl)
+    return -EINVAL;
+
+  if (!client->send || client->sock == -1)
+    return -ENOTCONN;
+
+  if ((e = riemann_client_flush (client)) != 0)
+    return e;
+
+  buffer.data = client->send_buffer.data;
+  buffer.size = client->send_buffer.size;
+  buffer.len = 0;
+  buffer.borrowed = 0;
+
+  /* The constant part of the event is sent straight from the
+     template, only the header and the variable fields are written to
+     the send buffer. */
+  e = _riemann_event_template_frame_iov (&buffer, tmpl, values, iov);
+
+  client->send_buffer.data = buffer.data;
+  client->send_buffer.size = buffer.size;
+
+  if (e != 0)
+    return e;
+
+  return _riemann_client_sendv (client, iov, 3);
+}
+
+/* Sends a frame serialised elsewhere, as it is. */
+int
+_riemann_client_send_frame (riemann_client_t *client, const uint8_t *buffer,
+                            size_t len)
+{
+  int e;
+
+  if (!client->send || client->sock == -1)
+    return -ENOTCONN;
+
+  if ((e = riemann_client_flush (client)) != 0)
+    return e;
+
+  return _riemann_client_send (client, buffer, len);
+}
+
+int
+riemann_client_send_batch (riemann_client_t *client,
+                           riemann_batch_writer_t *writer)
+{
+  const uint8_t *buffer;
+  size_t len;
+  int e;
+
+  if (!client)
+    return -ENOTCONN;
+  if (!writer)
+    return -EINVAL;
+
+  if (!client->send || client->sock == -1)
+    return -ENOTCONN;
+
+  if ((e = riemann_client_flush (client)) != 0)
+    return e;
+
+  if (!(buffer = riemann_batch_writer_get_buffer (writer, &len)))
+    return -errno;
+
+  return _riemann_client_send (client, buffer, len);
+}
+
+/* Asynchronous operation */
+
+static void
+_riemann_client_push_request (riemann_client_t *client,
+                              riemann_client_callback_t callback,
+                              void *userdata)
+{
+  riemann_client_request_t *requests;
+  size_t n, size;
+
+  if (client->in_flight.n == client->in_flight.size)
+    {
+      size = (client->in_flight.size) ? client->in_flight.size * 2 : 16;
+      requests = (riemann_client_request_t *)
+        malloc (sizeof (riemann_client_request_t) * size);
+      for (n = 0; n < client->in_flight.n; n++)
+        requests[n] = client->in_flight.requests
+          [(client->in_flight.head + n) % client->in_flight.size];
+
+      free (client->in_flight.requests);
+      client->in_flight.requests = requests;
+      client->in_flight.size = size;
+      client->in_flight.head = 0;
+    }
+
+  n = (client->in_flight.head + client->in_flight.n) % client->in_flight.size;
+  client->in_flight.requests[n].callback = callback;
+  client->in_flight.requests[n].userdata = userdata;
+  client->in_flight.n++;
+}
+
+static riemann_client_request_t
+_riemann_client_pop_request (riemann_client_t *client)
+{
+  riemann_client_request_t request;
+
+  request = client->in_flight.requests[client->in_flight.head];
+  client->in_flight.head = (client->in_flight.head + 1) %
+    client->in_flight.size;
+  client->in_flight.n--;
+
+  return request;
+}
+
+static void
+_riemann_client_complete_request (riemann_client_t *client,
+                                  riemann_message_t *response, int error)
+{
+  riemann_client_request_t request;
+
+  request = _riemann_client_pop_request (client);
+  if (request.callback)
+    request.callback (client, response, error, request.userdata);
+  else if (response)
+    riemann_message_free (response);
+}
+
+/* Tells every request in flight that no reply is coming. Callbacks
+   may send new requests, those are left alone. */
+static void
+_riemann_client_fail_requests (riemann_client_t *client, int error)
+{
+  size_t n = client->in_flight.n;
+
+  while (n-- > 0)
+    _riemann_client_complete_request (client, NULL, error);
+}
+
+/* Gives up on the connection: part of a frame may have been sent, or
+   a reply misread, so nothing more can be sent or received on it. The
+   requests in flight learn why, before the disconnect fails whatever
+   their callbacks sent since. */
+static void
+_riemann_client_fail (riemann_client_t *client, int error)
+{
+  _riemann_client_fail_requests (client, error);
+  riemann_client_disconnect (client);
+}
+
+int
+riemann_client_send_async (riemann_client_t *client,
+                           riemann_message_t *message,
+                           riemann_client_callback_t callback,
+                           void *userdata)
+{
+  struct iovec iov;
+  uint8_t *buffer;
+  size_t len;
+  int e;
+
+  if (!client)
+    return -ENOTCONN;
+  if (!message)
+    return -EINVAL;
+
+  if (!client->send || client->sock == -1)
+    return -ENOTCONN;
+
+  /* There are no replies over UDP. */
+  if (!client->read)
+    return -ENOTSUP;
+
+  if (client->in_flight.max && client->in_flight.n >= client->in_flight.max)
+    return -EAGAIN;
+
+  if (!client->nonblocking)
+    riemann_client_set_nonblocking (client, 1);
+
+  if ((e = _riemann_client_pack_message (client, message, &buffer, &len)) != 0)
+    return e;
+
+  iov.iov_base = buffer;
+  iov.iov_len = len;
+  if ((e = _riemann_client_pending_append (client, &iov, 1)) != 0)
+    return e;
+
+  e = riemann_client_flush (client);
+  if (e != 0 && e != -EAGAIN)
+    {
+      _riemann_client_fail (client, e);
+      return e;
+    }
+
+  _riemann_client_push_request (client, callback, userdata);
+
+  return 0;
+}
+
+/* Hands every complete reply read so far to the request it belongs
+   to, and keeps the rest. */
+static int
+_riemann_client_dispatch_replies (riemann_client_t *client)
+{
+  riemann_message_t *response;
+  size_t pos = 0, len;
+  uint32_t header;
+
+  while (client->incoming.len - pos >= sizeof (header))
+    {
+      memcpy (&header, client->incoming.data + pos, sizeof (header));
+      len = ntohl (header);
+      if (client->incoming.len - pos - sizeof (header) < len)
+        break;
+
+      if (client->in_flight.n == 0)
+        return -EPROTO;
+
+      response = riemann_message_from_buffer
+        (client->incoming.data + pos + sizeof (header), len);
+      pos += sizeof (header) + len;
+
+      _riemann_client_complete_request (client, response,
+                                        (response) ? 0 : -errno);
+    }
+
+  memmove (client->incoming.data, client->incoming.data + pos,
+           client->incoming.len - pos);
+  client->incoming.len -= pos;
+
+  return 0;
+}
+
+static int
+_riemann_client_read_replies (riemann_client_t *client)
+{
+  ssize_t received;
+  int e;
+
+  for (;;)
+    {
+      if (client->incoming.len == client->incoming.size)
+        {
+          size_t size = (client->incoming.size) ?
+            client->incoming.size * 2 : 4096;
+          uint8_t *data;
+
+          data = (uint8_t *) realloc (client->incoming.data, size);
+          if (!data)
+            return -ENOMEM;
+          client->incoming.data = data;
+          client->incoming.size = size;
+        }
+
+      received = client->read (client,
+                               client->incoming.data + client->incoming.len,
+                               client->incoming.size - client->incoming.len);
+      if (received == -EAGAIN)
+        return 0;
+      if (received == 0)
+        return -ECONNRESET;
+      if (received < 0)
+        return (int)received;
+
+      client->incoming.len += received;
+
+      if ((e = _riemann_client_dispatch_replies (client)) != 0)
+        return e;
+    }
+}
+
+int
+riemann_client_set_max_in_flight (riemann_client_t *client, size_t max)
+{
+  if (!client)
+    return -EINVAL;
+
+  client->in_flight.max = max;
+
+  return 0;
+}
+
+int
+riemann_client_process_io (riemann_client_t *client, int revents)
+{
+  int e = 0;
+
+  if (!client || !client->read || client->sock == -1)
+    return -ENOTCONN;
+
+  if (revents & POLLOUT)
+    {
+      e = riemann_client_flush (client);
+      if (e == -EAGAIN)
+        e = 0;
+    }
+
+  if (e == 0 && (revents & (POLLIN | POLLERR | POLLHUP)))
+    e = _riemann_client_read_replies (client);
+
+  if (e != 0)
+    _riemann_client_fail (client, e);
+
+  return e;
+}
+
+int
+riemann_client_get_io_events (riemann_client_t *client)
+{
+  int events = 0;
+
+  if (!client)
+    return -EINVAL;
+
+  if (client->in_flight.n)
+    events |= POLLIN;
+  if (client->pending.sent < client->pending.len)
+    events |= POLLOUT;
+
+  return events;
+}
+
 riemann_message_t *
 riemann_client_recv_message (riemann_client_t *client)
 {
+  uint8_t *buffer;
+  size_t len;
+  int e;
+
+  if (!client || !client->recv)
+    {
+      errno = ENOTCONN;
+      return NULL;
+    }
+
+  /* Replies to asynchronous requests belong to their callbacks. */
+  if (client->in_flight.n)
+    {
+      errno = EBUSY;
+      return NULL;
+    }
+
+  if ((e = client->recv (client, &buffer, &len)) != 0)
+    {
+      errno = -e;
+      return NULL;
+    }
+
+  return riemann_message_from_buffer (buffer, len);
+}
+
+riemann_message_t *
+riemann_client_recv_message_in (riemann_client_t *client,
+                                riemann_arena_t *arena)
+{
+  uint8_t *buffer;
+  size_t len;
+  int e;
+
+  if (!client || !client->recv)
+    {
+      errno = ENOTCONN;
+      return NULL;
+    }
+
+  if (!arena)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  if (client->in_flight.n)
+    {
+      errno = EBUSY;
+      return NULL;
+    }
+
+  if ((e = client->recv (client, &buffer, &len)) != 0)
+    {
+      errno = -e;
+      return NULL;
+    }
+
+  return riemann_message_from_buffer_in (arena, buffer, len);
+}
+
+riemann_message_t *
+riemann_client_recv_message_projected (riemann_client_t *client,
+                                       unsigned int fields)
+{
+  uint8_t *buffer;
+  size_t len;
+  int e;
+
+  if (!client || !client->recv)
+    {
+      errno = ENOTCONN;
+      return NULL;
+    }
+
+  /* Replies to asynchronous requests belong to their callbacks. */
+  if (client->in_flight.n)
+    {
+      errno = EBUSY;
+      return NULL;
+    }
+
+  if ((e = client->recv (client, &buffer, &len)) != 0)
+    {
+      errno = -e;
+      return NULL;
+    }
+
+  return riemann_message_from_buffer_projected (buffer, len, fields);
+}
+
+riemann_message_view_t *
+riemann_client_recv_message_view (riemann_client_t *client)
+{
+  riemann_message_view_t *view;
+  uint8_t *buffer;
+  size_t len;
+  int e;
+
   if (!client || !client->recv)
     {
       errno = ENOTCONN;
       return NULL;
     }
 
-  return client->recv (client);
+  /* Replies to asynchronous requests belong to their callbacks. */
+  if (client->in_flight.n)
+    {
+      errno = EBUSY;
+      return NULL;
+    }
+
+  if ((e = client->recv (client, &buffer, &len)) != 0)
+    {
+      errno = -e;
+      return NULL;
+    }
+
+  view = riemann_message_view_new (buffer, len);
+  if (!view)
+    return NULL;
+
+  /* The view took over the receive buffer, the next reply will need a
+     new one. */
+  client->recv_buffer.data = NULL;
+  client->recv_buffer.size = 0;
+
+  return view;
 }
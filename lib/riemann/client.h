@@ -19,6 +19,9 @@
 #define __MADHOUSE_RIEMANN_CLIENT_H__
 
 #include <riemann/message.h>
+#include <riemann/view.h>
+#include <riemann/template.h>
+#include <riemann/writer.h>
 #include <sys/time.h>
 
 typedef enum
@@ -41,6 +44,10 @@ typedef enum
 
 typedef struct _riemann_client_t riemann_client_t;
 
+typedef void (*riemann_client_callback_t) (riemann_client_t *client,
+                                           riemann_message_t *response,
+                                           int error, void *userdata);
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -57,16 +64,37 @@ void riemann_client_free (riemann_client_t *client);
 int riemann_client_get_fd (riemann_client_t *client);
 int riemann_client_set_timeout (riemann_client_t *client,
                                 struct timeval *timeout);
+int riemann_client_set_nonblocking (riemann_client_t *client, int nonblocking);
 
 int riemann_client_connect (riemann_client_t *client, riemann_client_type_t type,
                             const char *hostname, int port, ...);
 int riemann_client_disconnect (riemann_client_t *client);
+int riemann_client_reconnect (riemann_client_t *client);
 
 int riemann_client_send_message (riemann_client_t *client,
                                  riemann_message_t *message);
 int riemann_client_send_message_oneshot (riemann_client_t *client,
                                          riemann_message_t *message);
+int riemann_client_send_event_template (riemann_client_t *client,
+                                        const riemann_event_template_t *tmpl,
+                                        const riemann_event_template_values_t *values);
+int riemann_client_send_batch (riemann_client_t *client,
+                               riemann_batch_writer_t *writer);
+int riemann_client_flush (riemann_client_t *client);
+
+int riemann_client_send_async (riemann_client_t *client,
+                               riemann_message_t *message,
+                               riemann_client_callback_t callback,
+                               void *userdata);
+int riemann_client_set_max_in_flight (riemann_client_t *client, size_t max);
+int riemann_client_process_io (riemann_client_t *client, int revents);
+int riemann_client_get_io_events (riemann_client_t *client);
 riemann_message_t *riemann_client_recv_message (riemann_client_t *client);
+riemann_message_t *riemann_client_recv_message_in (riemann_client_t *client,
+                                                   riemann_arena_t *arena);
+riemann_message_t *riemann_client_recv_message_projected (riemann_client_t *client,
+                                                          unsigned int fields);
+riemann_message_view_t *riemann_client_recv_message_view (riemann_client_t *client);
 
 #ifdef __cplusplus
 }
@@ -17,83 +17,155 @@
 
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "riemann/client/tcp.h"
 #include "riemann/_private.h"
 
+/* The limit on Linux, where IOV_MAX is only declared in some modes. */
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
 void
 _riemann_client_connect_setup_tcp (riemann_client_t *client,
                                    struct addrinfo *hints)
 {
-  client->send = _riemann_client_send_message_tcp;
-  client->recv = _riemann_client_recv_message_tcp;
+  client->send = _riemann_client_send_frame_tcp;
+  client->sendv = _riemann_client_sendv_frame_tcp;
+  client->write = _riemann_client_write_tcp;
+  client->read = _riemann_client_read_tcp;
+  client->recv = _riemann_client_recv_frame_tcp;
 
   hints->ai_socktype = SOCK_STREAM;
 }
 
 int
-_riemann_client_send_message_tcp (riemann_client_t *client,
-                                  riemann_message_t *message)
+_riemann_client_send_frame_tcp (riemann_client_t *client,
+                                const uint8_t *buffer, size_t len)
 {
-  uint8_t *buffer;
-  size_t len;
   ssize_t sent;
 
-  buffer = riemann_message_to_buffer (message, &len);
-  if (!buffer)
-    return -errno;
-
-  sent = send (client->sock, buffer, len, 0);
-  if (sent == -1 || (size_t)sent != len)
+  /* A stream socket may take only part of the frame, with a send
+     timeout set, in which case the rest is sent in another round, and
+     the timeout reported by that. */
+  while (len > 0)
     {
-      int e = errno;
-
-      free (buffer);
-      return -e;
+      sent = send (client->sock, buffer, len, MSG_NOSIGNAL);
+      if (sent == -1)
+        return -errno;
+      if (sent == 0)
+        return -EIO;
+
+      buffer += sent;
+      len -= (size_t)sent;
     }
-  free (buffer);
+
   return 0;
 }
 
-riemann_message_t *
-_riemann_client_recv_message_tcp (riemann_client_t *client)
+int
+_riemann_client_sendv_frame_tcp (riemann_client_t *client,
+                                 struct iovec *iov, int iovcnt)
 {
-  uint32_t header, len;
-  uint8_t *buffer;
-  ssize_t received;
-  riemann_message_t *message;
+  struct msghdr msg;
+  ssize_t sent;
 
-  received = recv (client->sock, &header, sizeof (header), MSG_WAITALL);
-  if (received != sizeof (header))
-    return NULL;
-  len = ntohl (header);
+  memset (&msg, 0, sizeof (msg));
 
-  buffer = (uint8_t *) malloc (len);
+  /* A stream socket may take only part of the data, in which case the
+     rest is sent in another round. */
+  while (iovcnt > 0)
+    {
+      msg.msg_iov = iov;
+      msg.msg_iovlen = (iovcnt > IOV_MAX) ? IOV_MAX : iovcnt;
 
-  received = recv (client->sock, buffer, len, MSG_WAITALL);
-  if (received != len)
+      sent = sendmsg (client->sock, &msg, MSG_NOSIGNAL);
+      if (sent == -1)
+        return -errno;
+
+      _riemann_iovec_consume (&iov, &iovcnt, (size_t)sent);
+    }
+
+  return 0;
+}
+
+ssize_t
+_riemann_client_write_tcp (riemann_client_t *client,
+                           const struct iovec *iov, int iovcnt)
+{
+  struct msghdr msg;
+  ssize_t sent;
+
+  if (iovcnt == 1)
+    sent = send (client->sock, iov->iov_base, iov->iov_len,
+                 MSG_DONTWAIT | MSG_NOSIGNAL);
+  else
     {
-      int e = errno;
+      memset (&msg, 0, sizeof (msg));
+      msg.msg_iov = (struct iovec *)iov;
+      msg.msg_iovlen = (iovcnt > IOV_MAX) ? IOV_MAX : iovcnt;
 
-      free (buffer);
-      errno = e;
-      return NULL;
+      sent = sendmsg (client->sock, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
     }
 
-  message = riemann_message_from_buffer (buffer, len);
-  if (message == NULL)
+  if (sent == -1)
     {
-      int e = errno;
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        return -EAGAIN;
+      return -errno;
+    }
 
-      free (buffer);
-      errno = e;
-      return NULL;
+  return sent;
+}
+
+ssize_t
+_riemann_client_read_tcp (riemann_client_t *client, uint8_t *buffer,
+                          size_t len)
+{
+  ssize_t received;
+
+  received = recv (client->sock, buffer, len, MSG_DONTWAIT);
+  if (received == -1)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        return -EAGAIN;
+      return -errno;
     }
-  free (buffer);
 
-  return message;
+  return received;
+}
+
+int
+_riemann_client_recv_frame_tcp (riemann_client_t *client,
+                                uint8_t **buffer, size_t *len)
+{
+  uint32_t header;
+  ssize_t received;
+
+  received = recv (client->sock, &header, sizeof (header), MSG_WAITALL);
+  if (received == -1)
+    return -errno;
+  if (received != sizeof (header))
+    return -EPROTO;
+  *len = ntohl (header);
+
+  *buffer = _riemann_client_recv_buffer (client, *len);
+  if (!*buffer && *len > 0)
+    return -ENOMEM;
+
+  received = recv (client->sock, *buffer, *len, MSG_WAITALL);
+  if (received == -1)
+    return -errno;
+  if ((size_t)received != *len)
+    return -EPROTO;
+
+  return 0;
 }
@@ -42,15 +42,41 @@ _riemann_client_init_tls (riemann_client_t *client)
 {
   client->tls.session = NULL;
   client->tls.creds = NULL;
+  memset (&client->tls.options, 0, sizeof (client->tls.options));
+  client->tls.resume.data = NULL;
+  client->tls.resume.size = 0;
+}
+
+static void
+_riemann_client_forget_tls (riemann_client_t *client)
+{
+  gnutls_free (client->tls.resume.data);
+  client->tls.resume.data = NULL;
+  client->tls.resume.size = 0;
+}
+
+void
+_riemann_client_free_tls (riemann_client_t *client)
+{
+  free (client->tls.options.cafn);
+  free (client->tls.options.certfn);
+  free (client->tls.options.keyfn);
+  free (client->tls.options.priorities);
+  _riemann_client_forget_tls (client);
 }
 
 void
 _riemann_client_disconnect_tls (riemann_client_t *client)
 {
-  if (client->send == _riemann_client_send_message_tls)
+  if (client->send == _riemann_client_send_frame_tls)
     {
       if (client->tls.session)
         {
+          /* Kept, so that reconnecting can skip most of the
+             handshake, if the server still remembers the session. */
+          _riemann_client_forget_tls (client);
+          gnutls_session_get_data2 (client->tls.session, &client->tls.resume);
+
           gnutls_deinit (client->tls.session);
           client->tls.session = NULL;
         }
@@ -75,8 +101,11 @@ _riemann_client_connect_setup_tls (riemann_client_t *client,
   memset (tls_options, 0, sizeof (riemann_client_tls_options_t));
   tls_options->handshake_timeout = GNUTLS_DEFAULT_HANDSHAKE_TIMEOUT;
 
-  client->send = _riemann_client_send_message_tls;
-  client->recv = _riemann_client_recv_message_tls;
+  client->send = _riemann_client_send_frame_tls;
+  client->sendv = _riemann_client_sendv_frame_tls;
+  client->write = _riemann_client_write_tls;
+  client->read = _riemann_client_read_tls;
+  client->recv = _riemann_client_recv_frame_tls;
 
   hints->ai_socktype = SOCK_STREAM;
 
@@ -129,9 +158,16 @@ _riemann_client_connect_setup_tls (riemann_client_t *client,
   return 0;
 }
 
-int
-_riemann_client_connect_tls_handshake (riemann_client_t *client,
-                                       riemann_client_tls_options_t *tls_options)
+static char *
+_riemann_client_tls_strdup (const char *str)
+{
+  return (str) ? strdup (str) : NULL;
+}
+
+static int
+_riemann_client_tls_handshake (riemann_client_t *client,
+                               riemann_client_tls_options_t *tls_options,
+                               int resume)
 {
   int e;
 
@@ -160,6 +196,10 @@ _riemann_client_connect_tls_handshake (riemann_client_t *client,
   else
     gnutls_set_default_priority (client->tls.session);
 
+  if (resume && client->tls.resume.data)
+    gnutls_session_set_data (client->tls.session, client->tls.resume.data,
+                             client->tls.resume.size);
+
   gnutls_credentials_set (client->tls.session, GNUTLS_CRD_CERTIFICATE,
                           client->tls.creds);
 
@@ -175,6 +215,9 @@ _riemann_client_connect_tls_handshake (riemann_client_t *client,
       e = -1;
 #endif
 
+  if (e == 0)
+    _riemann_client_set_nonblocking_tls (client);
+
  end:
   if (e != 0)
     {
@@ -191,63 +234,186 @@ _riemann_client_connect_tls_handshake (riemann_client_t *client,
 }
 
 int
-_riemann_client_send_message_tls (riemann_client_t *client,
-                                  riemann_message_t *message)
+_riemann_client_connect_tls_handshake (riemann_client_t *client,
+                                       riemann_client_tls_options_t *tls_options)
 {
-  uint8_t *buffer;
-  size_t len;
-  ssize_t sent;
+  riemann_client_tls_options_t *options = &client->tls.options;
+
+  /* The caller's options may not outlive the call, but reconnecting
+     needs them. A session with another server is of no use. */
+  _riemann_client_free_tls (client);
+  options->cafn = _riemann_client_tls_strdup (tls_options->cafn);
+  options->certfn = _riemann_client_tls_strdup (tls_options->certfn);
+  options->keyfn = _riemann_client_tls_strdup (tls_options->keyfn);
+  options->priorities = _riemann_client_tls_strdup (tls_options->priorities);
+  options->handshake_timeout = tls_options->handshake_timeout;
+
+  return _riemann_client_tls_handshake (client, options, 0);
+}
 
-  buffer = riemann_message_to_buffer (message, &len);
-  if (!buffer)
-    return -errno;
+int
+_riemann_client_reconnect_tls (riemann_client_t *client)
+{
+  return _riemann_client_tls_handshake (client, &client->tls.options, 1);
+}
+
+int
+_riemann_client_send_frame_tls (riemann_client_t *client,
+                                const uint8_t *buffer, size_t len)
+{
+  ssize_t sent;
 
   sent = gnutls_record_send (client->tls.session, buffer, len);
   if (sent < 0 || (size_t)sent != len)
-    {
-      free (buffer);
-      return -EPROTO;
-    }
-  free (buffer);
+    return -EPROTO;
+
   return 0;
 }
 
-riemann_message_t *
-_riemann_client_recv_message_tls (riemann_client_t *client)
+/* GnuTLS writes to the socket itself. In non-blocking mode, it is
+   made to do so without waiting; the socket stays blocking, so that
+   receiving is not affected. */
+static ssize_t
+_riemann_client_tls_push (gnutls_transport_ptr_t ptr,
+                          const void *data, size_t len)
 {
-  uint32_t header, len;
-  uint8_t *buffer;
-  ssize_t received;
-  riemann_message_t *message;
+  return send ((int)(intptr_t)ptr, data, len, MSG_NOSIGNAL);
+}
 
-  received = gnutls_record_recv (client->tls.session, &header, sizeof (header));
-  if (received != sizeof (header))
+static ssize_t
+_riemann_client_tls_push_nonblocking (gnutls_transport_ptr_t ptr,
+                                      const void *data, size_t len)
+{
+  return send ((int)(intptr_t)ptr, data, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+void
+_riemann_client_set_nonblocking_tls (riemann_client_t *client)
+{
+  if (!client->tls.session)
+    return;
+
+  gnutls_transport_set_push_function (client->tls.session,
+                                      (client->nonblocking) ?
+                                      _riemann_client_tls_push_nonblocking :
+                                      _riemann_client_tls_push);
+}
+
+/* When GnuTLS could not send a record in full, it keeps the rest, and
+   must be called again with the same data, which then counts as
+   written once the record is out. */
+ssize_t
+_riemann_client_write_tls (riemann_client_t *client,
+                           const struct iovec *iov, int iovcnt)
+{
+  ssize_t sent, written = 0;
+  size_t done;
+  int n;
+
+  for (n = 0; n < iovcnt; n++)
     {
-      errno = EPROTO;
-      return NULL;
+      done = 0;
+      while (done < iov[n].iov_len)
+        {
+          sent = gnutls_record_send (client->tls.session,
+                                     (const uint8_t *)iov[n].iov_base + done,
+                                     iov[n].iov_len - done);
+          if (sent == GNUTLS_E_AGAIN || sent == GNUTLS_E_INTERRUPTED)
+            return (written + done) ? (ssize_t)(written + done) : -EAGAIN;
+          if (sent < 0)
+            return -EPROTO;
+          done += sent;
+        }
+      written += done;
     }
-  len = ntohl (header);
 
-  buffer = (uint8_t *) malloc (len);
+  return written;
+}
+
+static ssize_t
+_riemann_client_tls_pull (gnutls_transport_ptr_t ptr, void *data, size_t len)
+{
+  return recv ((int)(intptr_t)ptr, data, len, 0);
+}
+
+static ssize_t
+_riemann_client_tls_pull_nonblocking (gnutls_transport_ptr_t ptr,
+                                      void *data, size_t len)
+{
+  return recv ((int)(intptr_t)ptr, data, len, MSG_DONTWAIT);
+}
+
+/* Receiving blocks everywhere else, so reading without blocking
+   swaps the pull function only for the duration of the call. */
+ssize_t
+_riemann_client_read_tls (riemann_client_t *client, uint8_t *buffer,
+                          size_t len)
+{
+  ssize_t received;
 
+  gnutls_transport_set_pull_function (client->tls.session,
+                                      _riemann_client_tls_pull_nonblocking);
   received = gnutls_record_recv (client->tls.session, buffer, len);
-  if (received != len)
+  gnutls_transport_set_pull_function (client->tls.session,
+                                      _riemann_client_tls_pull);
+
+  if (received == GNUTLS_E_AGAIN || received == GNUTLS_E_INTERRUPTED)
+    return -EAGAIN;
+  if (received < 0)
+    return -EPROTO;
+
+  return received;
+}
+
+/* Corking collects the pieces into as few records as possible, and
+   sends them at once, when uncorked. Without it, every piece becomes
+   a record of its own, which is still correct, just more wasteful. */
+int
+_riemann_client_sendv_frame_tls (riemann_client_t *client,
+                                 struct iovec *iov, int iovcnt)
+{
+  ssize_t sent;
+  int n, e = 0;
+
+#if GNUTLS_VERSION_NUMBER >= 0x030109
+  gnutls_record_cork (client->tls.session);
+#endif
+
+  for (n = 0; n < iovcnt && e == 0; n++)
     {
-      free (buffer);
-      errno = EPROTO;
-      return NULL;
+      sent = gnutls_record_send (client->tls.session, iov[n].iov_base,
+                                 iov[n].iov_len);
+      if (sent < 0 || (size_t)sent != iov[n].iov_len)
+        e = -EPROTO;
     }
 
-  message = riemann_message_from_buffer (buffer, len);
-  if (message == NULL)
-    {
-      int e = errno;
+#if GNUTLS_VERSION_NUMBER >= 0x030109
+  if (gnutls_record_uncork (client->tls.session, GNUTLS_RECORD_WAIT) < 0)
+    e = -EPROTO;
+#endif
 
-      free (buffer);
-      errno = e;
-      return NULL;
-    }
-  free (buffer);
+  return e;
+}
 
-  return message;
+int
+_riemann_client_recv_frame_tls (riemann_client_t *client,
+                                uint8_t **buffer, size_t *len)
+{
+  uint32_t header;
+  ssize_t received;
+
+  received = gnutls_record_recv (client->tls.session, &header, sizeof (header));
+  if (received != sizeof (header))
+    return -EPROTO;
+  *len = ntohl (header);
+
+  *buffer = _riemann_client_recv_buffer (client, *len);
+  if (!*buffer && *len > 0)
+    return -ENOMEM;
+
+  received = gnutls_record_recv (client->tls.session, *buffer, *len);
+  if (received < 0 || (size_t)received != *len)
+    return -EPROTO;
+
+  return 0;
 }
@@ -36,6 +36,11 @@ _riemann_client_init_tls (riemann_client_t __attribute__((unused)) *client)
 {
 }
 
+void
+_riemann_client_free_tls (riemann_client_t __attribute__((unused)) *client)
+{
+}
+
 void
 _riemann_client_disconnect_tls (riemann_client_t __attribute__((unused)) *client)
 {
@@ -57,4 +62,15 @@ _riemann_client_connect_tls_handshake (riemann_client_t __attribute__((unused))
   return -ENOSYS;
 }
 
+int
+_riemann_client_reconnect_tls (riemann_client_t __attribute__((unused)) *client)
+{
+  return -ENOSYS;
+}
+
+void
+_riemann_client_set_nonblocking_tls (riemann_client_t __attribute__((unused)) *client)
+{
+}
+
 #endif
@@ -21,6 +21,7 @@
 #include <riemann/client.h>
 #include <riemann/message.h>
 #include <netdb.h>
+#include <sys/uio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -36,6 +37,7 @@ typedef struct
 } riemann_client_tls_options_t;
 
 void _riemann_client_init_tls (riemann_client_t *client);
+void _riemann_client_free_tls (riemann_client_t *client);
 void _riemann_client_disconnect_tls (riemann_client_t *client);
 
 int _riemann_client_connect_setup_tls (riemann_client_t *client,
@@ -44,10 +46,19 @@ int _riemann_client_connect_setup_tls (riemann_client_t *client,
                                        riemann_client_tls_options_t *tls_options);
 int _riemann_client_connect_tls_handshake (riemann_client_t *client,
                                            riemann_client_tls_options_t *tls_options);
+int _riemann_client_reconnect_tls (riemann_client_t *client);
 
-int _riemann_client_send_message_tls (riemann_client_t *client,
-                                      riemann_message_t *message);
-riemann_message_t *_riemann_client_recv_message_tls (riemann_client_t *client);
+int _riemann_client_send_frame_tls (riemann_client_t *client,
+                                    const uint8_t *buffer, size_t len);
+int _riemann_client_sendv_frame_tls (riemann_client_t *client,
+                                     struct iovec *iov, int iovcnt);
+ssize_t _riemann_client_write_tls (riemann_client_t *client,
+                                   const struct iovec *iov, int iovcnt);
+ssize_t _riemann_client_read_tls (riemann_client_t *client,
+                                  uint8_t *buffer, size_t len);
+void _riemann_client_set_nonblocking_tls (riemann_client_t *client);
+int _riemann_client_recv_frame_tls (riemann_client_t *client,
+                                    uint8_t **buffer, size_t *len);
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -16,9 +16,11 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "riemann/client/udp.h"
 #include "riemann/_private.h"
@@ -27,8 +29,13 @@ void
 _riemann_client_connect_setup_udp (riemann_client_t *client,
                                    struct addrinfo *hints)
 {
-  client->send = _riemann_client_send_message_udp;
-  client->recv = _riemann_client_recv_message_udp;
+  client->send = _riemann_client_send_frame_udp;
+  client->sendv = _riemann_client_sendv_frame_udp;
+  client->recv = _riemann_client_recv_frame_udp;
+  /* No replies come over UDP, so there is nothing to write to or read
+     from a stream. */
+  client->write = NULL;
+  client->read = NULL;
 
   hints->ai_socktype = SOCK_DGRAM;
 }
@@ -40,34 +47,53 @@ struct _riemann_buff_w_hdr
 };
 
 int
-_riemann_client_send_message_udp (riemann_client_t *client,
-                                  riemann_message_t *message)
+_riemann_client_send_frame_udp (riemann_client_t *client,
+                                const uint8_t *frame, size_t len)
 {
-  struct _riemann_buff_w_hdr *buffer;
-  size_t len;
+  const struct _riemann_buff_w_hdr *buffer =
+    (const struct _riemann_buff_w_hdr *) frame;
   ssize_t sent;
 
-  buffer = (struct _riemann_buff_w_hdr *)
-    riemann_message_to_buffer (message, &len);
-  if (!buffer)
-    return -errno;
-
   sent = sendto (client->sock, buffer->data, len - sizeof (buffer->header), 0,
                  client->srv_addr->ai_addr, client->srv_addr->ai_addrlen);
   if (sent == -1 || (size_t)sent != len - sizeof (buffer->header))
-    {
-      int e = errno;
+    return -errno;
+
+  return 0;
+}
+
+int
+_riemann_client_sendv_frame_udp (riemann_client_t *client,
+                                 struct iovec *iov, int iovcnt)
+{
+  struct msghdr msg;
+  size_t len = 0;
+  ssize_t sent;
+  int n;
+
+  /* Datagrams carry no length header, skip it. */
+  _riemann_iovec_consume (&iov, &iovcnt, sizeof (uint32_t));
+
+  for (n = 0; n < iovcnt; n++)
+    len += iov[n].iov_len;
+
+  memset (&msg, 0, sizeof (msg));
+  msg.msg_name = client->srv_addr->ai_addr;
+  msg.msg_namelen = client->srv_addr->ai_addrlen;
+  msg.msg_iov = iov;
+  msg.msg_iovlen = iovcnt;
+
+  sent = sendmsg (client->sock, &msg, 0);
+  if (sent == -1 || (size_t)sent != len)
+    return -errno;
 
-      free (buffer);
-      return -e;
-    }
-  free (buffer);
   return 0;
 }
 
-riemann_message_t *
-_riemann_client_recv_message_udp (riemann_client_t __attribute__((unused)) *client)
+int
+_riemann_client_recv_frame_udp (riemann_client_t __attribute__((unused)) *client,
+                                uint8_t __attribute__((unused)) **buffer,
+                                size_t __attribute__((unused)) *len)
 {
-  errno = ENOTSUP;
-  return NULL;
+  return -ENOTSUP;
 }
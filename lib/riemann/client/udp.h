@@ -21,6 +21,7 @@
 #include <riemann/client.h>
 #include <riemann/message.h>
 #include <netdb.h>
+#include <sys/uio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -29,9 +30,12 @@ extern "C" {
 void _riemann_client_connect_setup_udp (riemann_client_t *client,
                                         struct addrinfo *hints);
 
-int _riemann_client_send_message_udp (riemann_client_t *client,
-                                      riemann_message_t *message);
-riemann_message_t *_riemann_client_recv_message_udp (riemann_client_t *client);
+int _riemann_client_send_frame_udp (riemann_client_t *client,
+                                    const uint8_t *buffer, size_t len);
+int _riemann_client_sendv_frame_udp (riemann_client_t *client,
+                                     struct iovec *iov, int iovcnt);
+int _riemann_client_recv_frame_udp (riemann_client_t *client,
+                                    uint8_t **buffer, size_t *len);
 
 #ifdef __cplusplus
 } /* extern "C" */
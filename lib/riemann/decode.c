@@ -0,0 +1,354 @@
+/* riemann/decode.c -- Riemann C client library
+ * Copyright (C) 2013-2017  Gergely Nagy <algernon@madhouse-project.org>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* A hand-written decoder for the replies a query produces: a Msg
+ * with an ok flag, maybe an error, and lots of events. Every tag the
+ * schema uses for these fits in a single byte, so the decoder
+ * dispatches on that byte directly, tag and wire type at once.
+ *
+ * Anything it does not expect - states, a query, unknown fields, a
+ * known field with the wrong wire type, a multi-byte tag - makes it
+ * give up, and leave the message to protobuf-c. So does anything
+ * malformed, in which case protobuf-c reports the error.
+ *
+ * The result is laid out exactly like msg__unpack() would lay it out,
+ * with every string and array allocated on its own, so it is freed
+ * the same way.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined (__SSE2__) && defined (__BYTE_ORDER__) &&     \
+  __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#include <emmintrin.h>
+#define RIEMANN_DECODE_SSE2 1
+#endif
+
+#include "riemann/_private.h"
+
+/* Most varints in a reply are lengths and flags, which fit in a
+   single byte. The rest (timestamps, mostly) are decoded without a
+   loop: SSE2 finds the terminating byte of the next sixteen, and the
+   payload bits of up to eight bytes are squeezed together in three
+   steps, each one halving the number of gaps. Near the end of the
+   buffer, and for longer varints, the plain reader takes over. */
+static inline int
+_riemann_decode_varint (const uint8_t **pos, const uint8_t *end,
+                        uint64_t *value)
+{
+#if RIEMANN_DECODE_SSE2
+  unsigned int mask, n;
+  uint64_t v;
+#endif
+
+  if (*pos < end && **pos < 0x80)
+    {
+      *value = *(*pos)++;
+      return 0;
+    }
+
+#if RIEMANN_DECODE_SSE2
+  if (end - *pos >= 16)
+    {
+      mask = (unsigned int)
+        _mm_movemask_epi8 (_mm_loadu_si128 ((const __m128i *) *pos));
+      n = (unsigned int) __builtin_ctz (~mask) + 1;
+
+      if (n <= 8)
+        {
+          memcpy (&v, *pos, sizeof (v));
+          if (n < 8)
+            v &= (UINT64_C (1) << (n * 8)) - 1;
+
+          v = (v & UINT64_C (0x007f007f007f007f)) |
+            ((v & UINT64_C (0x7f007f007f007f00)) >> 1);
+          v = (v & UINT64_C (0x00003fff00003fff)) |
+            ((v & UINT64_C (0x3fff00003fff0000)) >> 2);
+          v = (v & UINT64_C (0x000000000fffffff)) |
+            ((v & UINT64_C (0x0fffffff00000000)) >> 4);
+
+          *pos += n;
+          *value = v;
+          return 0;
+        }
+    }
+#endif
+
+  return _riemann_wire_read_varint (pos, end, value);
+}
+
+static inline int
+_riemann_decode_delimited (const uint8_t **pos, const uint8_t *end,
+                           const uint8_t **data, size_t *len)
+{
+  uint64_t l;
+
+  if (_riemann_decode_varint (pos, end, &l) != 0 ||
+      l > (uint64_t)(end - *pos))
+    return -EPROTO;
+
+  *data = *pos;
+  *len = (size_t)l;
+  *pos += l;
+
+  return 0;
+}
+
+static int
+_riemann_decode_string (ProtobufCAllocator *allocator,
+                        const uint8_t **pos, const uint8_t *end, char **str)
+{
+  const uint8_t *data;
+  size_t len;
+
+  if (_riemann_decode_delimited (pos, end, &data, &len) != 0)
+    return -EPROTO;
+
+  /* Like protobuf-c, the last occurrence wins. */
+  _riemann_free (allocator, *str);
+  *str = (char *) _riemann_alloc (allocator, len + 1);
+  memcpy (*str, data, len);
+  (*str)[len] = '\0';
+
+  return 0;
+}
+
+/* Makes room for one more element in a repeated field, doubling the
+   array when it is full. */
+static void *
+_riemann_decode_grow (ProtobufCAllocator *allocator, void *array,
+                      size_t n, size_t *alloced)
+{
+  size_t new_alloced;
+
+  if (n < *alloced)
+    return array;
+
+  new_alloced = (*alloced) ? *alloced * 2 : 4;
+  array = _riemann_realloc (allocator, array, *alloced * sizeof (void *),
+                            new_alloced * sizeof (void *));
+  *alloced = new_alloced;
+
+  return array;
+}
+
+static riemann_attribute_t *
+_riemann_decode_attribute (ProtobufCAllocator *allocator,
+                           const uint8_t *pos, const uint8_t *end)
+{
+  riemann_attribute_t *attrib;
+
+  attrib = (riemann_attribute_t *)
+    _riemann_alloc (allocator, sizeof (riemann_attribute_t));
+  attribute__init (attrib);
+
+  while (pos < end)
+    {
+      switch (*pos++)
+        {
+        case RIEMANN_WIRE_TAG (1, RIEMANN_WIRE_LENGTH_DELIMITED):
+          if (_riemann_decode_string (allocator, &pos, end, &attrib->key) != 0)
+            goto fallback;
+          break;
+        case RIEMANN_WIRE_TAG (2, RIEMANN_WIRE_LENGTH_DELIMITED):
+          if (_riemann_decode_string (allocator, &pos, end,
+                                      &attrib->value) != 0)
+            goto fallback;
+          break;
+        default:
+          goto fallback;
+        }
+    }
+
+  /* The key is required; let protobuf-c reject the message. */
+  if (!attrib->key)
+    goto fallback;
+
+  return attrib;
+
+ fallback:
+  attribute__free_unpacked (attrib, allocator);
+  return NULL;
+}
+
+static riemann_event_t *
+_riemann_decode_event (ProtobufCAllocator *allocator,
+                       const uint8_t *pos, const uint8_t *end)
+{
+  riemann_event_t *event;
+  size_t n_tags_alloced = 0, n_attributes_alloced = 0;
+  const uint8_t *data;
+  size_t len;
+  uint64_t v;
+  uint32_t v32;
+
+  event = (riemann_event_t *) _riemann_alloc (allocator,
+                                              sizeof (riemann_event_t));
+  event__init (event);
+
+  while (pos < end)
+    {
+      switch (*pos++)
+        {
+        case RIEMANN_WIRE_TAG (1, RIEMANN_WIRE_VARINT):
+          if (_riemann_decode_varint (&pos, end, &v) != 0)
+            goto fallback;
+          event->has_time = 1;
+          event->time = (int64_t)v;
+          break;
+        case RIEMANN_WIRE_TAG (2, RIEMANN_WIRE_LENGTH_DELIMITED):
+          if (_riemann_decode_string (allocator, &pos, end,
+                                      &event->state) != 0)
+            goto fallback;
+          break;
+        case RIEMANN_WIRE_TAG (3, RIEMANN_WIRE_LENGTH_DELIMITED):
+          if (_riemann_decode_string (allocator, &pos, end,
+                                      &event->service) != 0)
+            goto fallback;
+          break;
+        case RIEMANN_WIRE_TAG (4, RIEMANN_WIRE_LENGTH_DELIMITED):
+          if (_riemann_decode_string (allocator, &pos, end,
+                                      &event->host) != 0)
+            goto fallback;
+          break;
+        case RIEMANN_WIRE_TAG (5, RIEMANN_WIRE_LENGTH_DELIMITED):
+          if (_riemann_decode_string (allocator, &pos, end,
+                                      &event->description) != 0)
+            goto fallback;
+          break;
+        case RIEMANN_WIRE_TAG (7, RIEMANN_WIRE_LENGTH_DELIMITED):
+          event->tags = (char **)
+            _riemann_decode_grow (allocator, event->tags, event->n_tags,
+                                  &n_tags_alloced);
+          event->tags[event->n_tags] = NULL;
+          if (_riemann_decode_string (allocator, &pos, end,
+                                      &event->tags[event->n_tags]) != 0)
+            goto fallback;
+          event->n_tags++;
+          break;
+        case RIEMANN_WIRE_TAG (8, RIEMANN_WIRE_FIXED32):
+          if (_riemann_wire_read_fixed32 (&pos, end, &v32) != 0)
+            goto fallback;
+          event->has_ttl = 1;
+          event->ttl = _riemann_wire_float (v32);
+          break;
+        case RIEMANN_WIRE_TAG (9, RIEMANN_WIRE_LENGTH_DELIMITED):
+          {
+            riemann_attribute_t *attrib;
+
+            if (_riemann_decode_delimited (&pos, end, &data, &len) != 0)
+              goto fallback;
+            attrib = _riemann_decode_attribute (allocator, data, data + len);
+            if (!attrib)
+              goto fallback;
+
+            event->attributes = (riemann_attribute_t **)
+              _riemann_decode_grow (allocator, event->attributes,
+                                    event->n_attributes,
+                                    &n_attributes_alloced);
+            event->attributes[event->n_attributes++] = attrib;
+            break;
+          }
+        case RIEMANN_WIRE_TAG (10, RIEMANN_WIRE_VARINT):
+          if (_riemann_decode_varint (&pos, end, &v) != 0)
+            goto fallback;
+          event->has_time_micros = 1;
+          event->time_micros = (int64_t)v;
+          break;
+        case RIEMANN_WIRE_TAG (13, RIEMANN_WIRE_VARINT):
+          if (_riemann_decode_varint (&pos, end, &v) != 0)
+            goto fallback;
+          event->has_metric_sint64 = 1;
+          event->metric_sint64 = _riemann_wire_zigzag_decode (v);
+          break;
+        case RIEMANN_WIRE_TAG (14, RIEMANN_WIRE_FIXED64):
+          if (_riemann_wire_read_fixed64 (&pos, end, &v) != 0)
+            goto fallback;
+          event->has_metric_d = 1;
+          event->metric_d = _riemann_wire_double (v);
+          break;
+        case RIEMANN_WIRE_TAG (15, RIEMANN_WIRE_FIXED32):
+          if (_riemann_wire_read_fixed32 (&pos, end, &v32) != 0)
+            goto fallback;
+          event->has_metric_f = 1;
+          event->metric_f = _riemann_wire_float (v32);
+          break;
+        default:
+          goto fallback;
+        }
+    }
+
+  return event;
+
+ fallback:
+  event__free_unpacked (event, allocator);
+  return NULL;
+}
+
+riemann_message_t *
+_riemann_wire_message_unpack (ProtobufCAllocator *allocator,
+                              const uint8_t *buffer, size_t len)
+{
+  riemann_message_t *message;
+  riemann_event_t *event;
+  const uint8_t *pos = buffer, *end = buffer + len, *data;
+  size_t n_events_alloced = 0, event_len;
+  uint64_t v;
+
+  message = (riemann_message_t *) _riemann_alloc (allocator,
+                                                  sizeof (riemann_message_t));
+  msg__init (message);
+
+  while (pos < end)
+    {
+      switch (*pos++)
+        {
+        case RIEMANN_WIRE_TAG (2, RIEMANN_WIRE_VARINT):
+          if (_riemann_decode_varint (&pos, end, &v) != 0)
+            goto fallback;
+          message->has_ok = 1;
+          message->ok = (v != 0);
+          break;
+        case RIEMANN_WIRE_TAG (3, RIEMANN_WIRE_LENGTH_DELIMITED):
+          if (_riemann_decode_string (allocator, &pos, end,
+                                      &message->error) != 0)
+            goto fallback;
+          break;
+        case RIEMANN_WIRE_TAG (6, RIEMANN_WIRE_LENGTH_DELIMITED):
+          if (_riemann_decode_delimited (&pos, end, &data, &event_len) != 0)
+            goto fallback;
+          event = _riemann_decode_event (allocator, data, data + event_len);
+          if (!event)
+            goto fallback;
+
+          message->events = (riemann_event_t **)
+            _riemann_decode_grow (allocator, message->events,
+                                  message->n_events, &n_events_alloced);
+          message->events[message->n_events++] = event;
+          break;
+        default:
+          goto fallback;
+        }
+    }
+
+  return message;
+
+ fallback:
+  msg__free_unpacked (message, allocator);
+  return NULL;
+}
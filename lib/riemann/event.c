@@ -16,6 +16,7 @@
  */
 
 #include <riemann/event.h>
+#include "riemann/_private.h"
 
 #include <errno.h>
 #include <stdlib.h>
@@ -33,6 +34,22 @@ riemann_event_new (void)
   return event;
 }
 
+riemann_event_t *
+riemann_event_new_in (riemann_arena_t *arena)
+{
+  riemann_event_t *event;
+
+  if (!arena)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  event = (riemann_event_t *)riemann_arena_alloc (arena, sizeof (riemann_event_t));
+  event__init (event);
+  return event;
+}
+
 void
 riemann_event_free (riemann_event_t *event)
 {
@@ -42,23 +59,214 @@ riemann_event_free (riemann_event_t *event)
       return;
     }
 
+  _riemann_event_release_shared (event);
   event__free_unpacked (event, NULL);
 }
 
+/* Releases the tags of a heap allocated event. If the array is shared
+   with a clone, only the reference to it is dropped; otherwise the
+   strings are released, and unless `keep_array' is set, so is the
+   array. */
 static void
-_riemann_event_set_string (char **str, char *value)
+_riemann_event_release_tags (riemann_event_t *event, int keep_array)
 {
-  if (*str)
-    free (*str);
+  size_t n;
+
+  if (_riemann_shared_release (event->tags))
+    event->tags = NULL;
+  else
+    {
+      for (n = 0; n < event->n_tags; n++)
+        _riemann_intern_free (event->tags[n]);
+      if (!keep_array)
+        {
+          free (event->tags);
+          event->tags = NULL;
+        }
+    }
+  event->n_tags = 0;
+}
+
+/* Releases the attributes of a heap allocated event, and unless
+   `keep_array' is set, the array too. Attributes are never shared,
+   only their keys and values may be. */
+static void
+_riemann_event_release_attributes (riemann_event_t *event, int keep_array)
+{
+  size_t n;
+
+  for (n = 0; n < event->n_attributes; n++)
+    riemann_attribute_free (event->attributes[n]);
+  if (!keep_array)
+    {
+      free (event->attributes);
+      event->attributes = NULL;
+    }
+  event->n_attributes = 0;
+}
+
+int
+riemann_event_reset (riemann_event_t *event)
+{
+  char **tags;
+  riemann_attribute_t **attributes;
+  size_t n;
+
+  if (!event)
+    return -EINVAL;
+
+  _riemann_event_release_tags (event, 1);
+  _riemann_event_release_attributes (event, 1);
+
+  _riemann_intern_free (event->state);
+  _riemann_intern_free (event->service);
+  _riemann_intern_free (event->host);
+  _riemann_intern_free (event->description);
+
+  for (n = 0; n < event->base.n_unknown_fields; n++)
+    free (event->base.unknown_fields[n].data);
+  free (event->base.unknown_fields);
+
+  /* The tag and attribute arrays are kept, unless they were shared,
+     the next additions will reuse them. */
+  tags = event->tags;
+  attributes = event->attributes;
+  event__init (event);
+  event->tags = tags;
+  event->attributes = attributes;
+
+  return 0;
+}
+
+/* Releases the strings and arrays that may have been interned or
+   shared with clones, and clears them, so that freeing the event
+   afterwards does not touch them. */
+void
+_riemann_event_release_shared (riemann_event_t *event)
+{
+  if (!_riemann_intern_in_use ())
+    return;
+
+  _riemann_intern_free (event->state);
+  _riemann_intern_free (event->service);
+  _riemann_intern_free (event->host);
+  _riemann_intern_free (event->description);
+  event->state = event->service = event->host = event->description = NULL;
+
+  _riemann_event_release_tags (event, 0);
+  _riemann_event_release_attributes (event, 0);
+}
+
+/* Gives a heap allocated event a tag array of its own, if it shares
+   one with a clone. The tags themselves remain shared. */
+static void
+_riemann_event_unshare_tags (riemann_event_t *event)
+{
+  char **tags;
+  size_t n, n_tags = event->n_tags;
+
+  if (!_riemann_shared_is_shared (event->tags))
+    return;
+
+  tags = (char **) malloc (sizeof (char *) * n_tags);
+  for (n = 0; n < n_tags; n++)
+    tags[n] = _riemann_string_ref (event->tags[n]);
+
+  _riemann_event_release_tags (event, 0);
+  event->tags = tags;
+  event->n_tags = n_tags;
+}
+
+/* Heap allocated hosts, services, states and tags are interned when
+   interning is enabled; arena allocated ones never are. */
+static char *
+_riemann_event_strdup_interned (ProtobufCAllocator *allocator,
+                                const char *str)
+{
+  if (allocator)
+    return _riemann_strdup (allocator, str);
+  return _riemann_intern_strdup (str);
+}
+
+static void
+_riemann_event_free_interned (ProtobufCAllocator *allocator, char *str)
+{
+  if (allocator)
+    _riemann_free (allocator, str);
+  else
+    _riemann_intern_free (str);
+}
+
+static void
+_riemann_event_set_string (ProtobufCAllocator *allocator,
+                           char **str, char *value)
+{
+  _riemann_event_free_interned (allocator, *str);
   if (value)
-    *str = strdup (value);
+    *str = _riemann_strdup (allocator, value);
   else
     *str = NULL;
 }
 
-int
-riemann_event_set_va (riemann_event_t *event,
-                      riemann_event_field_t first_field, va_list aq)
+static void
+_riemann_event_set_interned (ProtobufCAllocator *allocator,
+                             char **str, const char *value)
+{
+  _riemann_event_free_interned (allocator, *str);
+  if (value)
+    *str = _riemann_event_strdup_interned (allocator, value);
+  else
+    *str = NULL;
+}
+
+static void
+_riemann_event_clear_attributes (ProtobufCAllocator *allocator,
+                                 riemann_event_t *event)
+{
+  size_t n;
+
+  if (!allocator)
+    {
+      _riemann_event_release_attributes (event, 0);
+      return;
+    }
+
+  for (n = 0; n < event->n_attributes; n++)
+    attribute__free_unpacked (event->attributes[n], allocator);
+  _riemann_free (allocator, event->attributes);
+  event->attributes = NULL;
+  event->n_attributes = 0;
+}
+
+static void
+_riemann_event_append_attribute (ProtobufCAllocator *allocator,
+                                 riemann_event_t *event,
+                                 riemann_attribute_t *attrib)
+{
+  event->attributes = (riemann_attribute_t **)
+    _riemann_array_grow (allocator, event->attributes, event->n_attributes,
+                         1, sizeof (riemann_attribute_t *));
+  event->attributes[event->n_attributes] = attrib;
+  event->n_attributes++;
+}
+
+static void
+_riemann_event_append_tag (ProtobufCAllocator *allocator,
+                           riemann_event_t *event, const char *tag)
+{
+  if (!allocator)
+    _riemann_event_unshare_tags (event);
+
+  event->tags = (char **)
+    _riemann_array_grow (allocator, event->tags, event->n_tags, 1,
+                         sizeof (char *));
+  event->tags[event->n_tags] = _riemann_event_strdup_interned (allocator, tag);
+  event->n_tags++;
+}
+
+static int
+_riemann_event_set_va (ProtobufCAllocator *allocator, riemann_event_t *event,
+                       riemann_event_field_t first_field, va_list aq)
 {
   va_list ap;
   riemann_event_field_t field;
@@ -86,19 +294,19 @@ riemann_event_set_va (riemann_event_t *event,
         break;
 
         case RIEMANN_EVENT_FIELD_STATE:
-          _riemann_event_set_string (&event->state, va_arg (ap, char *));
+          _riemann_event_set_interned (allocator, &event->state, va_arg (ap, char *));
           break;
 
         case RIEMANN_EVENT_FIELD_SERVICE:
-          _riemann_event_set_string (&event->service, va_arg (ap, char *));
+          _riemann_event_set_interned (allocator, &event->service, va_arg (ap, char *));
           break;
 
         case RIEMANN_EVENT_FIELD_HOST:
-          _riemann_event_set_string (&event->host, va_arg (ap, char *));
+          _riemann_event_set_interned (allocator, &event->host, va_arg (ap, char *));
           break;
 
         case RIEMANN_EVENT_FIELD_DESCRIPTION:
-          _riemann_event_set_string (&event->description, va_arg (ap, char *));
+          _riemann_event_set_string (allocator, &event->description, va_arg (ap, char *));
           break;
 
         case RIEMANN_EVENT_FIELD_TAGS:
@@ -106,20 +314,19 @@ riemann_event_set_va (riemann_event_t *event,
             char *tag;
             size_t n;
 
-            for (n = 0; n < event->n_tags; n++)
-              free (event->tags[n]);
-            if (event->tags)
-              free (event->tags);
-            event->tags = NULL;
-            event->n_tags = 0;
-
-            while ((tag = va_arg (ap, char *)) != NULL)
+            if (allocator)
               {
-                event->tags = (char **)
-                  realloc (event->tags, sizeof (char *) * (event->n_tags + 1));
-                event->tags[event->n_tags] = strdup (tag);
-                event->n_tags++;
+                for (n = 0; n < event->n_tags; n++)
+                  _riemann_free (allocator, event->tags[n]);
+                _riemann_free (allocator, event->tags);
+                event->tags = NULL;
+                event->n_tags = 0;
               }
+            else
+              _riemann_event_release_tags (event, 0);
+
+            while ((tag = va_arg (ap, char *)) != NULL)
+              _riemann_event_append_tag (allocator, event, tag);
 
             break;
           }
@@ -132,23 +339,11 @@ riemann_event_set_va (riemann_event_t *event,
         case RIEMANN_EVENT_FIELD_ATTRIBUTES:
           {
             riemann_attribute_t *attrib;
-            size_t n;
 
-            for (n = 0; n < event->n_attributes; n++)
-              riemann_attribute_free (event->attributes[n]);
-            if (event->attributes)
-              free (event->attributes);
-            event->attributes = NULL;
-            event->n_attributes = 0;
+            _riemann_event_clear_attributes (allocator, event);
 
             while ((attrib = va_arg (ap, riemann_attribute_t *)) != NULL)
-              {
-                event->attributes = (riemann_attribute_t **)
-                  realloc (event->attributes,
-                           sizeof (riemann_attribute_t *) * (event->n_attributes + 1));
-                event->attributes[event->n_attributes] = attrib;
-                event->n_attributes++;
-              }
+              _riemann_event_append_attribute (allocator, event, attrib);
 
             break;
           }
@@ -156,25 +351,16 @@ riemann_event_set_va (riemann_event_t *event,
         case RIEMANN_EVENT_FIELD_STRING_ATTRIBUTES:
           {
             const char *key, *value;
-            size_t n;
 
-            for (n = 0; n < event->n_attributes; n++)
-              riemann_attribute_free (event->attributes[n]);
-            if (event->attributes)
-              free (event->attributes);
-            event->attributes = NULL;
-            event->n_attributes = 0;
+            _riemann_event_clear_attributes (allocator, event);
 
             while ((key = va_arg (ap, const char *)) != NULL)
               {
                 value = va_arg (ap, const char *);
 
-                event->attributes = (riemann_attribute_t **)
-                  realloc (event->attributes,
-                           sizeof (riemann_attribute_t *) * (event->n_attributes + 1));
-                event->attributes[event->n_attributes] =
-                  riemann_attribute_create (key, value);
-                event->n_attributes++;
+                _riemann_event_append_attribute
+                  (allocator, event,
+                   _riemann_attribute_create (allocator, key, value));
               }
 
             break;
@@ -209,6 +395,23 @@ riemann_event_set_va (riemann_event_t *event,
   return 0;
 }
 
+int
+riemann_event_set_va (riemann_event_t *event,
+                      riemann_event_field_t first_field, va_list aq)
+{
+  return _riemann_event_set_va (NULL, event, first_field, aq);
+}
+
+int
+riemann_event_set_va_in (riemann_arena_t *arena, riemann_event_t *event,
+                         riemann_event_field_t first_field, va_list aq)
+{
+  if (!arena)
+    return -EINVAL;
+
+  return _riemann_event_set_va (&arena->allocator, event, first_field, aq);
+}
+
 int
 riemann_event_set (riemann_event_t *event, ...)
 {
@@ -223,16 +426,127 @@ riemann_event_set (riemann_event_t *event, ...)
   return r;
 }
 
+int
+riemann_event_set_in (riemann_arena_t *arena, riemann_event_t *event, ...)
+{
+  va_list ap;
+  int r;
+  riemann_event_field_t first_field;
+
+  va_start (ap, event);
+  first_field = (riemann_event_field_t) va_arg (ap, int);
+  r = riemann_event_set_va_in (arena, event, first_field, ap);
+  va_end (ap);
+  return r;
+}
+
+/* Typed setters */
+
+#define _riemann_event_set_scalar(event, field, value)  \
+  do                                                    \
+    {                                                   \
+      if (!(event))                                     \
+        return -EINVAL;                                 \
+      (event)->field = (value);                         \
+      (event)->has_##field = 1;                         \
+      return 0;                                         \
+    }                                                   \
+  while (0)
+
+#define _riemann_event_set_str(event, field, value)                     \
+  do                                                                    \
+    {                                                                   \
+      if (!(event))                                                     \
+        return -EINVAL;                                                 \
+      _riemann_event_set_interned (NULL, &(event)->field, (value));     \
+      return 0;                                                         \
+    }                                                                   \
+  while (0)
+
+int
+riemann_event_set_time (riemann_event_t *event, int64_t time)
+{
+  _riemann_event_set_scalar (event, time, time);
+}
+
+int
+riemann_event_set_time_micros (riemann_event_t *event, int64_t time_micros)
+{
+  _riemann_event_set_scalar (event, time_micros, time_micros);
+}
+
+int
+riemann_event_set_state (riemann_event_t *event, const char *state)
+{
+  _riemann_event_set_str (event, state, state);
+}
+
+int
+riemann_event_set_service (riemann_event_t *event, const char *service)
+{
+  _riemann_event_set_str (event, service, service);
+}
+
+int
+riemann_event_set_host (riemann_event_t *event, const char *host)
+{
+  _riemann_event_set_str (event, host, host);
+}
+
+int
+riemann_event_set_description (riemann_event_t *event,
+                               const char *description)
+{
+  if (!event)
+    return -EINVAL;
+
+  _riemann_event_set_string (NULL, &event->description, (char *)description);
+  return 0;
+}
+
+int
+riemann_event_set_ttl (riemann_event_t *event, float ttl)
+{
+  _riemann_event_set_scalar (event, ttl, ttl);
+}
+
+int
+riemann_event_set_metric_sint64 (riemann_event_t *event, int64_t metric)
+{
+  _riemann_event_set_scalar (event, metric_sint64, metric);
+}
+
+int
+riemann_event_set_metric_d (riemann_event_t *event, double metric)
+{
+  _riemann_event_set_scalar (event, metric_d, metric);
+}
+
+int
+riemann_event_set_metric_f (riemann_event_t *event, float metric)
+{
+  _riemann_event_set_scalar (event, metric_f, metric);
+}
+
 int
 riemann_event_tag_add (riemann_event_t *event, const char *tag)
 {
   if (!event || !tag)
     return -EINVAL;
 
-  event->tags = (char **)
-    realloc (event->tags, sizeof (char *) * (event->n_tags + 1));
-  event->tags[event->n_tags] = strdup (tag);
-  event->n_tags++;
+  _riemann_event_append_tag (NULL, event, tag);
+
+  return 0;
+}
+
+int
+riemann_event_tag_add_in (riemann_arena_t *arena, riemann_event_t *event,
+                          const char *tag)
+{
+  if (!arena || !event || !tag)
+    return -EINVAL;
+
+  _riemann_event_append_tag (&arena->allocator, event, tag);
 
   return 0;
 }
@@ -244,11 +558,20 @@ riemann_event_attribute_add (riemann_event_t *event,
   if (!event || !attrib)
     return -EINVAL;
 
-  event->attributes = (riemann_attribute_t **)
-    realloc (event->attributes,
-             sizeof (riemann_attribute_t *) * (event->n_attributes + 1));
-  event->attributes[event->n_attributes] = attrib;
-  event->n_attributes++;
+  _riemann_event_append_attribute (NULL, event, attrib);
+
+  return 0;
+}
+
+int
+riemann_event_attribute_add_in (riemann_arena_t *arena,
+                                riemann_event_t *event,
+                                riemann_attribute_t *attrib)
+{
+  if (!arena || !event || !attrib)
+    return -EINVAL;
+
+  _riemann_event_append_attribute (&arena->allocator, event, attrib);
 
   return 0;
 }
@@ -300,6 +623,126 @@ riemann_event_create (riemann_event_field_t field, ...)
   return event;
 }
 
+riemann_event_t *
+riemann_event_create_in (riemann_arena_t *arena,
+                         riemann_event_field_t field, ...)
+{
+  riemann_event_t *event;
+  va_list ap;
+  int e;
+
+  if (!arena)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  event = riemann_event_new_in (arena);
+
+  va_start (ap, field);
+  e = _riemann_event_set_va (&arena->allocator, event, field, ap);
+  va_end (ap);
+
+  if (e != 0)
+    {
+      errno = -e;
+      return NULL;
+    }
+
+  return event;
+}
+
+#define _riemann_events_fill_scalar(events, n_events, column, field)     \
+  do                                                                    \
+    {                                                                   \
+      size_t i;                                                         \
+                                                                        \
+      if (!(column))                                                    \
+        break;                                                          \
+      for (i = 0; i < (n_events); i++)                                  \
+        {                                                               \
+          (events)[i]->field = (column)[i];                             \
+          (events)[i]->has_##field = 1;                                 \
+        }                                                               \
+    }                                                                   \
+  while (0)
+
+#define _riemann_events_fill_string(allocator, events, n_events, column, \
+                                    field, strdup_fn)                   \
+  do                                                                    \
+    {                                                                   \
+      size_t i;                                                         \
+                                                                        \
+      if (!(column))                                                    \
+        break;                                                          \
+      for (i = 0; i < (n_events); i++)                                  \
+        if ((column)[i])                                                \
+          (events)[i]->field = strdup_fn (allocator, (column)[i]);      \
+    }                                                                   \
+  while (0)
+
+riemann_event_t **
+riemann_events_create_n (riemann_arena_t *arena, size_t n_events,
+                         const riemann_event_fields_t *fields)
+{
+  ProtobufCAllocator *allocator = _riemann_arena_allocator (arena);
+  riemann_event_t **events, *event;
+  size_t i;
+
+  if (!fields)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+  if (n_events < 1)
+    {
+      errno = ERANGE;
+      return NULL;
+    }
+
+  events = (riemann_event_t **)
+    _riemann_alloc (allocator, sizeof (riemann_event_t *) * n_events);
+
+  /* From an arena, the events are allocated together. On the heap,
+     they need to be freed one by one, so they are allocated that way,
+     too. */
+  if (arena)
+    {
+      event = (riemann_event_t *)
+        riemann_arena_alloc (arena, sizeof (riemann_event_t) * n_events);
+      for (i = 0; i < n_events; i++)
+        events[i] = &event[i];
+    }
+  else
+    for (i = 0; i < n_events; i++)
+      events[i] = (riemann_event_t *) malloc (sizeof (riemann_event_t));
+
+  for (i = 0; i < n_events; i++)
+    event__init (events[i]);
+
+  /* Column by column, so that every loop does one thing only. */
+  _riemann_events_fill_string (allocator, events, n_events, fields->host,
+                               host, _riemann_event_strdup_interned);
+  _riemann_events_fill_string (allocator, events, n_events, fields->service,
+                               service, _riemann_event_strdup_interned);
+  _riemann_events_fill_string (allocator, events, n_events, fields->state,
+                               state, _riemann_event_strdup_interned);
+  _riemann_events_fill_string (allocator, events, n_events,
+                               fields->description, description,
+                               _riemann_strdup);
+
+  _riemann_events_fill_scalar (events, n_events, fields->time, time);
+  _riemann_events_fill_scalar (events, n_events, fields->time_micros,
+                               time_micros);
+  _riemann_events_fill_scalar (events, n_events, fields->ttl, ttl);
+  _riemann_events_fill_scalar (events, n_events, fields->metric_sint64,
+                               metric_sint64);
+  _riemann_events_fill_scalar (events, n_events, fields->metric_d, metric_d);
+  _riemann_events_fill_scalar (events, n_events, fields->metric_f, metric_f);
+
+  return events;
+}
+
 riemann_event_t *
 riemann_event_clone (const riemann_event_t *event)
 {
@@ -312,38 +755,30 @@ riemann_event_clone (const riemann_event_t *event)
       return NULL;
     }
 
-  clone = riemann_event_new ();
-
-  /* Copy non-pointer properties */
-  clone->time = event->time;
-  clone->time_micros = event->time_micros;
-  clone->ttl = event->ttl;
-  clone->metric_sint64 = event->metric_sint64;
-  clone->metric_d = event->metric_d;
-  clone->metric_f = event->metric_f;
-
-  /* Copy strings */
-  if (event->state)
-    clone->state = strdup (event->state);
-  if (event->host)
-    clone->host = strdup (event->host);
-  if (event->service)
-    clone->service = strdup (event->service);
-  if (event->description)
-    clone->description = strdup (event->description);
-
-  /* Copy deeper structures */
-  clone->n_tags = event->n_tags;
-  clone->tags = (char **) malloc (sizeof (char *) * clone->n_tags);
-  for (n = 0; n < clone->n_tags; n++)
-    clone->tags[n] = strdup (event->tags[n]);
-
-  clone->n_attributes = event->n_attributes;
-  clone->attributes = (riemann_attribute_t **)
-    malloc (sizeof (riemann_attribute_t *) *
-            clone->n_attributes);
-  for (n = 0; n < clone->n_attributes; n++)
-    clone->attributes[n] = riemann_attribute_clone (event->attributes[n]);
+  clone = (riemann_event_t *) malloc (sizeof (riemann_event_t));
+  *clone = *event;
+  clone->base.n_unknown_fields = 0;
+  clone->base.unknown_fields = NULL;
+
+  /* Strings and tags are shared with the original. Either side
+     changing them later replaces them, or copies the tag array first.
+     Attributes can be changed in place, so every event has attribute
+     objects of its own, but their keys and values are shared too. */
+  _riemann_string_ref (clone->state);
+  _riemann_string_ref (clone->service);
+  _riemann_string_ref (clone->host);
+  _riemann_string_ref (clone->description);
+  _riemann_shared_ref (clone->tags);
+
+  if (event->n_attributes)
+    {
+      clone->attributes = (riemann_attribute_t **)
+        malloc (sizeof (riemann_attribute_t *) * event->n_attributes);
+      for (n = 0; n < event->n_attributes; n++)
+        clone->attributes[n] = riemann_attribute_clone (event->attributes[n]);
+    }
+  else
+    clone->attributes = NULL;
 
   return clone;
 }
@@ -21,6 +21,7 @@
 #include <riemann/proto/riemann.pb-c.h>
 #include <riemann/attribute.h>
 #include <stdarg.h>
+#include <stdint.h>
 
 typedef Event riemann_event_t;
 
@@ -44,6 +45,29 @@ typedef enum
     RIEMANN_EVENT_FIELD_TIME_MICROS
   } riemann_event_field_t;
 
+/* The field identifiers are sequential, so they can not be combined
+   directly: use RIEMANN_EVENT_FIELD_MASK (SERVICE) | ... instead. */
+#define RIEMANN_EVENT_FIELD_MASK(field) (1U << RIEMANN_EVENT_FIELD_##field)
+#define RIEMANN_EVENT_FIELD_MASK_ALL (~0U)
+
+/* Parallel arrays of event fields, for riemann_events_create_n(): the
+   i-th event gets the i-th element of every array that is not NULL.
+   A NULL string within an array leaves that field unset. */
+typedef struct
+{
+  const char *const *host;
+  const char *const *service;
+  const char *const *state;
+  const char *const *description;
+
+  const int64_t *time;
+  const int64_t *time_micros;
+  const float *ttl;
+  const int64_t *metric_sint64;
+  const double *metric_d;
+  const float *metric_f;
+} riemann_event_fields_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -54,6 +78,15 @@ riemann_event_t *riemann_event_create_va (riemann_event_field_t field,
                                           va_list aq);
 riemann_event_t *riemann_event_clone (const riemann_event_t *event);
 void riemann_event_free (riemann_event_t *event);
+int riemann_event_reset (riemann_event_t *event);
+
+riemann_event_t **riemann_events_create_n (riemann_arena_t *arena,
+                                           size_t n_events,
+                                           const riemann_event_fields_t *fields);
+
+riemann_event_t *riemann_event_new_in (riemann_arena_t *arena);
+riemann_event_t *riemann_event_create_in (riemann_arena_t *arena,
+                                          riemann_event_field_t field, ...);
 
 int riemann_event_set (riemann_event_t *event, ...);
 int riemann_event_set_va (riemann_event_t *event,
@@ -62,6 +95,24 @@ int riemann_event_set_va (riemann_event_t *event,
   riemann_event_set (event, RIEMANN_EVENT_FIELD_##field, __VA_ARGS__,   \
                      RIEMANN_EVENT_FIELD_NONE)
 
+int riemann_event_set_in (riemann_arena_t *arena,
+                          riemann_event_t *event, ...);
+int riemann_event_set_va_in (riemann_arena_t *arena, riemann_event_t *event,
+                             riemann_event_field_t first_field, va_list aq);
+
+int riemann_event_set_time (riemann_event_t *event, int64_t time);
+int riemann_event_set_time_micros (riemann_event_t *event,
+                                   int64_t time_micros);
+int riemann_event_set_state (riemann_event_t *event, const char *state);
+int riemann_event_set_service (riemann_event_t *event, const char *service);
+int riemann_event_set_host (riemann_event_t *event, const char *host);
+int riemann_event_set_description (riemann_event_t *event,
+                                   const char *description);
+int riemann_event_set_ttl (riemann_event_t *event, float ttl);
+int riemann_event_set_metric_sint64 (riemann_event_t *event, int64_t metric);
+int riemann_event_set_metric_d (riemann_event_t *event, double metric);
+int riemann_event_set_metric_f (riemann_event_t *event, float metric);
+
 int riemann_event_tag_add (riemann_event_t *event, const char *tag);
 int riemann_event_attribute_add (riemann_event_t *event,
                                  riemann_attribute_t *attrib);
@@ -69,6 +120,12 @@ int riemann_event_string_attribute_add (riemann_event_t *event,
                                         const char *key,
                                         const char *value);
 
+int riemann_event_tag_add_in (riemann_arena_t *arena, riemann_event_t *event,
+                              const char *tag);
+int riemann_event_attribute_add_in (riemann_arena_t *arena,
+                                    riemann_event_t *event,
+                                    riemann_attribute_t *attrib);
+
 #ifdef __cplusplus
 }
 #endif
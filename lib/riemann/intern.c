@@ -0,0 +1,485 @@
+/* riemann/intern.c -- Riemann C client library
+ * Copyright (C) 2013-2017  Gergely Nagy <algernon@madhouse-project.org>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* An optional, process-wide registry of the strings that tend to
+ * repeat across events: hosts, services, states, tags and attribute
+ * keys. While it is enabled, setting any of these stores a pointer to
+ * a shared, reference counted copy instead of a fresh one, so a batch
+ * of events coming from the same host only holds that name once.
+ *
+ * Interned strings are handed out as plain char pointers, so nothing
+ * outside the library needs to know about them. The library itself
+ * releases them through _riemann_intern_free(), which recognises
+ * interned pointers by looking them up, and free()s anything else.
+ *
+ * A separate registry keeps track of allocations shared by clones:
+ * strings that are not interned, and tag arrays. These are recorded
+ * by address, with the number of objects owning them, but only while
+ * there is more than one: the last owner is dropped from the table,
+ * and frees the allocation as it normally would. The table is split
+ * into stripes by address, each with a lock of its own, so threads
+ * working on unrelated events rarely meet, and releasing an address
+ * whose stripe is empty takes no lock at all.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "riemann/_private.h"
+
+#define RIEMANN_INTERN_MIN_BUCKETS 256
+#define RIEMANN_SHARED_STRIPES 64
+#define RIEMANN_SHARED_MIN_SLOTS 16
+
+typedef struct _riemann_intern_entry_t
+{
+  struct _riemann_intern_entry_t *next;
+  uint32_t hash;
+  size_t refcount;
+  char str[];
+} riemann_intern_entry_t;
+
+typedef struct
+{
+  const void *ptr;
+  size_t owners;
+} riemann_shared_slot_t;
+
+/* An open addressed table, with linear probing. */
+typedef struct
+{
+  pthread_mutex_t lock;
+  size_t n_used;
+  size_t n_slots;
+  riemann_shared_slot_t *slots;
+} __attribute__((aligned (64))) riemann_shared_stripe_t;
+
+static struct
+{
+  pthread_mutex_t lock;
+  int enabled;
+  size_t n_entries;
+  size_t n_buckets;
+  riemann_intern_entry_t **buckets;
+} _riemann_intern = { PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, NULL };
+
+static riemann_shared_stripe_t _riemann_shared[RIEMANN_SHARED_STRIPES] =
+  { [0 ... RIEMANN_SHARED_STRIPES - 1] = { PTHREAD_MUTEX_INITIALIZER, 0, 0, NULL } };
+/* The number of shared allocations, in all stripes. */
+static size_t _riemann_shared_total;
+
+static uint32_t
+_riemann_intern_hash (const char *str)
+{
+  uint32_t hash = 2166136261U;
+
+  while (*str)
+    {
+      hash ^= (uint8_t)*str++;
+      hash *= 16777619U;
+    }
+
+  return hash;
+}
+
+static void
+_riemann_intern_rehash (size_t n_buckets)
+{
+  riemann_intern_entry_t **buckets, *entry, *next;
+  size_t i;
+
+  buckets = (riemann_intern_entry_t **)
+    calloc (n_buckets, sizeof (riemann_intern_entry_t *));
+
+  for (i = 0; i < _riemann_intern.n_buckets; i++)
+    for (entry = _riemann_intern.buckets[i]; entry; entry = next)
+      {
+        next = entry->next;
+        entry->next = buckets[entry->hash & (n_buckets - 1)];
+        buckets[entry->hash & (n_buckets - 1)] = entry;
+      }
+
+  free (_riemann_intern.buckets);
+  _riemann_intern.buckets = buckets;
+  _riemann_intern.n_buckets = n_buckets;
+}
+
+/* Finds the entry `str' points into, if it points into one. Must be
+   called with the lock held. */
+static riemann_intern_entry_t **
+_riemann_intern_find_pointer (const char *str, uint32_t hash)
+{
+  riemann_intern_entry_t **entry;
+
+  if (!_riemann_intern.buckets)
+    return NULL;
+
+  for (entry = &_riemann_intern.buckets[hash & (_riemann_intern.n_buckets - 1)];
+       *entry; entry = &(*entry)->next)
+    if ((*entry)->str == str)
+      return entry;
+
+  return NULL;
+}
+
+int
+riemann_intern_enable (void)
+{
+  pthread_mutex_lock (&_riemann_intern.lock);
+  _riemann_intern.enabled = 1;
+  pthread_mutex_unlock (&_riemann_intern.lock);
+
+  return 0;
+}
+
+int
+riemann_intern_disable (void)
+{
+  pthread_mutex_lock (&_riemann_intern.lock);
+  _riemann_intern.enabled = 0;
+  pthread_mutex_unlock (&_riemann_intern.lock);
+
+  return 0;
+}
+
+size_t
+riemann_intern_count (void)
+{
+  return __atomic_load_n (&_riemann_intern.n_entries, __ATOMIC_ACQUIRE);
+}
+
+int
+_riemann_intern_in_use (void)
+{
+  return riemann_intern_count () != 0 ||
+    __atomic_load_n (&_riemann_shared_total, __ATOMIC_ACQUIRE) != 0;
+}
+
+/* Shared allocations */
+
+static uint64_t
+_riemann_shared_hash (const void *ptr)
+{
+  return (uint64_t)(((uintptr_t)ptr) >> 4) * UINT64_C (0x9e3779b97f4a7c15);
+}
+
+static riemann_shared_stripe_t *
+_riemann_shared_stripe (const void *ptr)
+{
+  return &_riemann_shared[_riemann_shared_hash (ptr) >> 58];
+}
+
+static size_t
+_riemann_shared_home (const void *ptr, size_t n_slots)
+{
+  return (size_t)(_riemann_shared_hash (ptr) >> 32) & (n_slots - 1);
+}
+
+/* Must be called with the lock of the stripe held. */
+static riemann_shared_slot_t *
+_riemann_shared_find (riemann_shared_stripe_t *stripe, const void *ptr)
+{
+  size_t i;
+
+  if (stripe->n_used == 0)
+    return NULL;
+
+  for (i = _riemann_shared_home (ptr, stripe->n_slots);
+       stripe->slots[i].ptr; i = (i + 1) & (stripe->n_slots - 1))
+    if (stripe->slots[i].ptr == ptr)
+      return &stripe->slots[i];
+
+  return NULL;
+}
+
+/* Must be called with the lock of the stripe held. */
+static void
+_riemann_shared_insert (riemann_shared_stripe_t *stripe, const void *ptr,
+                        size_t owners)
+{
+  size_t i;
+
+  for (i = _riemann_shared_home (ptr, stripe->n_slots);
+       stripe->slots[i].ptr; i = (i + 1) & (stripe->n_slots - 1))
+    ;
+
+  stripe->slots[i].ptr = ptr;
+  stripe->slots[i].owners = owners;
+}
+
+/* Must be called with the lock of the stripe held. */
+static void
+_riemann_shared_rehash (riemann_shared_stripe_t *stripe, size_t n_slots)
+{
+  riemann_shared_slot_t *slots = stripe->slots;
+  size_t i, old_n_slots = stripe->n_slots;
+
+  stripe->slots = (riemann_shared_slot_t *)
+    calloc (n_slots, sizeof (riemann_shared_slot_t));
+  stripe->n_slots = n_slots;
+
+  for (i = 0; i < old_n_slots; i++)
+    if (slots[i].ptr)
+      _riemann_shared_insert (stripe, slots[i].ptr, slots[i].owners);
+
+  free (slots);
+}
+
+/* Must be called with the lock of the stripe held. Closes the gap the
+   removed slot leaves, by moving back the entries that would not be
+   found past it otherwise. */
+static void
+_riemann_shared_remove (riemann_shared_stripe_t *stripe,
+                        riemann_shared_slot_t *slot)
+{
+  size_t mask = stripe->n_slots - 1, i, j, home;
+
+  i = (size_t)(slot - stripe->slots);
+  for (j = (i + 1) & mask; stripe->slots[j].ptr; j = (j + 1) & mask)
+    {
+      home = _riemann_shared_home (stripe->slots[j].ptr, stripe->n_slots);
+      if (((j - home) & mask) >= ((j - i) & mask))
+        {
+          stripe->slots[i] = stripe->slots[j];
+          i = j;
+        }
+    }
+  stripe->slots[i].ptr = NULL;
+
+  __atomic_store_n (&stripe->n_used, stripe->n_used - 1, __ATOMIC_RELEASE);
+  __atomic_sub_fetch (&_riemann_shared_total, 1, __ATOMIC_RELEASE);
+}
+
+void *
+_riemann_shared_ref (void *ptr)
+{
+  riemann_shared_stripe_t *stripe;
+  riemann_shared_slot_t *slot;
+
+  if (!ptr)
+    return NULL;
+
+  stripe = _riemann_shared_stripe (ptr);
+  pthread_mutex_lock (&stripe->lock);
+
+  slot = _riemann_shared_find (stripe, ptr);
+  if (slot)
+    slot->owners++;
+  else
+    {
+      /* Kept at most half full, so that probes stay short. */
+      if ((stripe->n_used + 1) * 2 > stripe->n_slots)
+        _riemann_shared_rehash (stripe, (stripe->n_slots) ?
+                                stripe->n_slots * 2 :
+                                RIEMANN_SHARED_MIN_SLOTS);
+
+      _riemann_shared_insert (stripe, ptr, 2);
+      __atomic_store_n (&stripe->n_used, stripe->n_used + 1,
+                        __ATOMIC_RELEASE);
+      __atomic_add_fetch (&_riemann_shared_total, 1, __ATOMIC_RELEASE);
+    }
+
+  pthread_mutex_unlock (&stripe->lock);
+
+  return ptr;
+}
+
+int
+_riemann_shared_release (void *ptr)
+{
+  riemann_shared_stripe_t *stripe;
+  riemann_shared_slot_t *slot;
+
+  if (!ptr)
+    return 0;
+
+  /* An allocation can only become shared through an owner, and the
+     caller is one, so if it is not in the table now, it will not be
+     while it is released either. */
+  stripe = _riemann_shared_stripe (ptr);
+  if (__atomic_load_n (&stripe->n_used, __ATOMIC_ACQUIRE) == 0)
+    return 0;
+
+  pthread_mutex_lock (&stripe->lock);
+
+  slot = _riemann_shared_find (stripe, ptr);
+  if (slot && --slot->owners == 1)
+    _riemann_shared_remove (stripe, slot);
+
+  pthread_mutex_unlock (&stripe->lock);
+
+  return slot != NULL;
+}
+
+int
+_riemann_shared_is_shared (const void *ptr)
+{
+  riemann_shared_stripe_t *stripe;
+  int shared;
+
+  if (!ptr)
+    return 0;
+
+  stripe = _riemann_shared_stripe (ptr);
+  if (__atomic_load_n (&stripe->n_used, __ATOMIC_ACQUIRE) == 0)
+    return 0;
+
+  pthread_mutex_lock (&stripe->lock);
+  shared = (_riemann_shared_find (stripe, ptr) != NULL);
+  pthread_mutex_unlock (&stripe->lock);
+
+  return shared;
+}
+
+char *
+_riemann_string_ref (char *str)
+{
+  riemann_intern_entry_t **found;
+
+  if (!str)
+    return NULL;
+
+  if (riemann_intern_count () != 0)
+    {
+      pthread_mutex_lock (&_riemann_intern.lock);
+
+      found = _riemann_intern_find_pointer (str, _riemann_intern_hash (str));
+      if (found)
+        {
+          (*found)->refcount++;
+          pthread_mutex_unlock (&_riemann_intern.lock);
+          return str;
+        }
+
+      pthread_mutex_unlock (&_riemann_intern.lock);
+    }
+
+  return (char *) _riemann_shared_ref (str);
+}
+
+char *
+_riemann_intern_strdup (const char *str)
+{
+  riemann_intern_entry_t *entry, **found;
+  uint32_t hash;
+  size_t len;
+
+  if (!__atomic_load_n (&_riemann_intern.enabled, __ATOMIC_RELAXED) &&
+      riemann_intern_count () == 0)
+    return strdup (str);
+
+  hash = _riemann_intern_hash (str);
+
+  pthread_mutex_lock (&_riemann_intern.lock);
+
+  /* Sharing an already interned string is always fine, even when
+     interning has been disabled since. */
+  found = _riemann_intern_find_pointer (str, hash);
+  if (found)
+    {
+      (*found)->refcount++;
+      pthread_mutex_unlock (&_riemann_intern.lock);
+      return (char *)str;
+    }
+
+  if (!_riemann_intern.enabled)
+    {
+      pthread_mutex_unlock (&_riemann_intern.lock);
+      return strdup (str);
+    }
+
+  if (_riemann_intern.buckets)
+    for (entry = _riemann_intern.buckets[hash & (_riemann_intern.n_buckets - 1)];
+         entry; entry = entry->next)
+      if (entry->hash == hash && strcmp (entry->str, str) == 0)
+        {
+          entry->refcount++;
+          pthread_mutex_unlock (&_riemann_intern.lock);
+          return entry->str;
+        }
+
+  if (_riemann_intern.n_entries >= _riemann_intern.n_buckets)
+    _riemann_intern_rehash ((_riemann_intern.n_buckets) ?
+                            _riemann_intern.n_buckets * 2 :
+                            RIEMANN_INTERN_MIN_BUCKETS);
+
+  len = strlen (str);
+  entry = (riemann_intern_entry_t *) malloc (sizeof (riemann_intern_entry_t) +
+                                             len + 1);
+  entry->hash = hash;
+  entry->refcount = 1;
+  memcpy (entry->str, str, len + 1);
+  entry->next = _riemann_intern.buckets[hash & (_riemann_intern.n_buckets - 1)];
+  _riemann_intern.buckets[hash & (_riemann_intern.n_buckets - 1)] = entry;
+  __atomic_store_n (&_riemann_intern.n_entries, _riemann_intern.n_entries + 1,
+                    __ATOMIC_RELEASE);
+
+  pthread_mutex_unlock (&_riemann_intern.lock);
+
+  return entry->str;
+}
+
+void
+_riemann_intern_free (char *str)
+{
+  riemann_intern_entry_t **found, *entry;
+
+  if (!str)
+    return;
+
+  if (_riemann_shared_release (str))
+    return;
+
+  /* Holding an interned string keeps the registry non-empty, so when
+     it is empty, `str' can not be one. */
+  if (riemann_intern_count () == 0)
+    {
+      free (str);
+      return;
+    }
+
+  pthread_mutex_lock (&_riemann_intern.lock);
+
+  found = _riemann_intern_find_pointer (str, _riemann_intern_hash (str));
+  if (!found)
+    {
+      pthread_mutex_unlock (&_riemann_intern.lock);
+      free (str);
+      return;
+    }
+
+  entry = *found;
+  if (--entry->refcount == 0)
+    {
+      *found = entry->next;
+      free (entry);
+      __atomic_store_n (&_riemann_intern.n_entries,
+                        _riemann_intern.n_entries - 1, __ATOMIC_RELEASE);
+
+      if (_riemann_intern.n_entries == 0 && !_riemann_intern.enabled)
+        {
+          free (_riemann_intern.buckets);
+          _riemann_intern.buckets = NULL;
+          _riemann_intern.n_buckets = 0;
+        }
+    }
+
+  pthread_mutex_unlock (&_riemann_intern.lock);
+}
@@ -16,6 +16,8 @@
  */
 
 #include <riemann/message.h>
+#include "riemann/_private.h"
+#include "riemann/_wire.h"
 
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -36,6 +38,23 @@ riemann_message_new (void)
   return message;
 }
 
+riemann_message_t *
+riemann_message_new_in (riemann_arena_t *arena)
+{
+  riemann_message_t *message;
+
+  if (!arena)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  message = (riemann_message_t *)riemann_arena_alloc (arena, sizeof (riemann_message_t));
+  msg__init (message);
+
+  return message;
+}
+
 void
 riemann_message_free (riemann_message_t *message)
 {
@@ -45,6 +64,14 @@ riemann_message_free (riemann_message_t *message)
       return;
     }
 
+  if (_riemann_intern_in_use ())
+    {
+      size_t i;
+
+      for (i = 0; i < message->n_events; i++)
+        _riemann_event_release_shared (message->events[i]);
+    }
+
   msg__free_unpacked ((Msg *)message, NULL);
 }
 
@@ -187,6 +214,34 @@ riemann_message_append_events_n (riemann_message_t *message,
   return 0;
 }
 
+int
+riemann_message_append_events_n_in (riemann_arena_t *arena,
+                                    riemann_message_t *message,
+                                    size_t n_events,
+                                    riemann_event_t **events)
+{
+  if (!arena || !message)
+    return -EINVAL;
+
+  if (n_events < 1)
+    return -ERANGE;
+
+  if (!events)
+    return -EINVAL;
+
+  /* Unlike riemann_message_append_events_n(), the events array is
+     only copied, never taken over. */
+  message->events = (riemann_event_t **)
+    _riemann_array_grow (&arena->allocator, message->events,
+                         message->n_events, n_events,
+                         sizeof (riemann_event_t *));
+  memcpy (message->events + message->n_events, events,
+          sizeof (riemann_event_t *) * n_events);
+  message->n_events += n_events;
+
+  return 0;
+}
+
 int
 riemann_message_append_events_va (riemann_message_t *message, va_list aq)
 {
@@ -285,6 +340,162 @@ riemann_message_set_query (riemann_message_t *message,
   return 0;
 }
 
+/* Message builders */
+
+/* A builder owns a message that is still being put together, and
+   remembers how large its events array really is, so that appending
+   to it only reallocates when it is full, doubling it each time. */
+
+#define RIEMANN_MESSAGE_BUILDER_MIN_CAPACITY 16
+
+static void
+_riemann_message_builder_resize (riemann_message_builder_t *builder,
+                                 size_t capacity)
+{
+  builder->message->events = (riemann_event_t **)
+    realloc (builder->message->events, sizeof (riemann_event_t *) * capacity);
+  builder->n_alloced = capacity;
+}
+
+/* Makes room for `n_events' more events, growing geometrically. */
+static void
+_riemann_message_builder_grow (riemann_message_builder_t *builder,
+                               size_t n_events)
+{
+  size_t needed = builder->message->n_events + n_events, capacity;
+
+  if (needed <= builder->n_alloced)
+    return;
+
+  capacity = (builder->n_alloced) ? builder->n_alloced * 2 :
+    RIEMANN_MESSAGE_BUILDER_MIN_CAPACITY;
+  if (capacity < needed)
+    capacity = needed;
+
+  _riemann_message_builder_resize (builder, capacity);
+}
+
+riemann_message_builder_t *
+riemann_message_builder_new (size_t capacity)
+{
+  riemann_message_builder_t *builder;
+
+  builder = (riemann_message_builder_t *)
+    malloc (sizeof (riemann_message_builder_t));
+  builder->message = riemann_message_new ();
+  builder->n_alloced = 0;
+
+  if (capacity)
+    _riemann_message_builder_resize (builder, capacity);
+
+  return builder;
+}
+
+void
+riemann_message_builder_free (riemann_message_builder_t *builder)
+{
+  if (!builder)
+    {
+      errno = EINVAL;
+      return;
+    }
+
+  riemann_message_free (builder->message);
+  free (builder);
+}
+
+int
+riemann_message_builder_reserve (riemann_message_builder_t *builder,
+                                 size_t capacity)
+{
+  if (!builder)
+    return -EINVAL;
+
+  if (capacity > builder->n_alloced)
+    _riemann_message_builder_resize (builder, capacity);
+
+  return 0;
+}
+
+size_t
+riemann_message_builder_capacity (const riemann_message_builder_t *builder)
+{
+  if (!builder)
+    {
+      errno = EINVAL;
+      return 0;
+    }
+
+  return builder->n_alloced;
+}
+
+size_t
+riemann_message_builder_size (const riemann_message_builder_t *builder)
+{
+  if (!builder)
+    {
+      errno = EINVAL;
+      return 0;
+    }
+
+  return builder->message->n_events;
+}
+
+int
+riemann_message_builder_append (riemann_message_builder_t *builder,
+                                riemann_event_t *event)
+{
+  if (!builder || !event)
+    return -EINVAL;
+
+  _riemann_message_builder_grow (builder, 1);
+  builder->message->events[builder->message->n_events++] = event;
+
+  return 0;
+}
+
+int
+riemann_message_builder_append_n (riemann_message_builder_t *builder,
+                                  size_t n_events,
+                                  riemann_event_t **events)
+{
+  if (!builder)
+    return -EINVAL;
+
+  if (n_events < 1)
+    return -ERANGE;
+
+  if (!events)
+    return -EINVAL;
+
+  _riemann_message_builder_grow (builder, n_events);
+  memcpy (builder->message->events + builder->message->n_events, events,
+          sizeof (riemann_event_t *) * n_events);
+  builder->message->n_events += n_events;
+
+  return 0;
+}
+
+riemann_message_t *
+riemann_message_builder_finish (riemann_message_builder_t *builder)
+{
+  riemann_message_t *message;
+
+  if (!builder)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  /* The events array may be larger than needed; it is freed along
+     with the message all the same. */
+  message = builder->message;
+  builder->message = riemann_message_new ();
+  builder->n_alloced = 0;
+
+  return message;
+}
+
 riemann_message_t *
 riemann_message_create_with_query (riemann_query_t *query)
 {
@@ -308,12 +519,7 @@ riemann_message_create_with_query (riemann_query_t *query)
 uint8_t *
 riemann_message_to_buffer (riemann_message_t *message, size_t *len)
 {
-  size_t l;
-  struct buff
-  {
-    uint32_t header;
-    uint8_t data[0];
-  } *buff;
+  riemann_wire_buffer_t buffer = { NULL, 0, 0, 0 };
 
   if (!message)
     {
@@ -321,31 +527,268 @@ riemann_message_to_buffer (riemann_message_t *message, size_t *len)
       return NULL;
     }
 
-  l = msg__get_packed_size (message) + sizeof (buff->header);
-  buff = (struct buff *) malloc (l);
-  msg__pack (message, buff->data);
+  /* A rough guess, so that typical messages do not need to grow the
+     buffer more than once. */
+  _riemann_wire_buffer_grow (&buffer, 64 + 128 * message->n_events);
+  _riemann_wire_message_frame (&buffer, message);
+
+  if (len)
+    *len = buffer.len;
+
+  return buffer.data;
+}
+
+int
+riemann_message_pack_into (riemann_message_t *message,
+                           uint8_t *buffer, size_t size, size_t *len)
+{
+  riemann_wire_buffer_t out = { buffer, size, 0, 1 };
+
+  if (!message)
+    return -EINVAL;
 
-  buff->header = htonl (l - sizeof (buff->header));
+  if (!buffer)
+    {
+      if (len)
+        *len = _riemann_wire_message_get_packed_size (message) +
+          sizeof (uint32_t);
+      return -ENOBUFS;
+    }
 
+  _riemann_wire_message_frame (&out, message);
   if (len)
-    *len = l;
+    *len = out.len;
 
-  return (uint8_t *)buff;
+  /* The message did not fit, and was packed into a buffer of our own
+     instead. */
+  if (!out.borrowed)
+    {
+      free (out.data);
+      return -ENOBUFS;
+    }
+
+  return 0;
 }
 
 riemann_message_t *
 riemann_message_from_buffer (uint8_t *buffer, size_t len)
 {
+  riemann_message_t *message;
+
   if (!buffer || len == 0)
     {
       errno = EINVAL;
       return NULL;
     }
 
+  message = _riemann_wire_message_unpack (NULL, buffer, len);
+  if (message)
+    return message;
+
   errno = EPROTO;
   return msg__unpack (NULL, len, buffer);
 }
 
+riemann_message_t *
+riemann_message_from_buffer_in (riemann_arena_t *arena,
+                                uint8_t *buffer, size_t len)
+{
+  riemann_message_t *message;
+
+  if (!arena || !buffer || len == 0)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  message = _riemann_wire_message_unpack (&arena->allocator, buffer, len);
+  if (message)
+    return message;
+
+  errno = EPROTO;
+  return msg__unpack (&arena->allocator, len, buffer);
+}
+
+static char *
+_riemann_slice_strdup (riemann_slice_t slice)
+{
+  char *str;
+
+  str = (char *) malloc (slice.len + 1);
+  memcpy (str, slice.data, slice.len);
+  str[slice.len] = '\0';
+
+  return str;
+}
+
+#define _riemann_field_wanted(fields, field)    \
+  ((fields) & RIEMANN_EVENT_FIELD_MASK (field))
+
+static riemann_event_t *
+_riemann_event_from_view (const riemann_event_view_t *view,
+                          unsigned int fields)
+{
+  riemann_event_t *event;
+  riemann_view_iter_t iter;
+  size_t n;
+
+  event = riemann_event_new ();
+
+  if (_riemann_field_wanted (fields, TIME) && view->has_time)
+    {
+      event->time = view->time;
+      event->has_time = 1;
+    }
+  if (_riemann_field_wanted (fields, TIME_MICROS) && view->has_time_micros)
+    {
+      event->time_micros = view->time_micros;
+      event->has_time_micros = 1;
+    }
+  if (_riemann_field_wanted (fields, TTL) && view->has_ttl)
+    {
+      event->ttl = view->ttl;
+      event->has_ttl = 1;
+    }
+  if (_riemann_field_wanted (fields, METRIC_S64) && view->has_metric_sint64)
+    {
+      event->metric_sint64 = view->metric_sint64;
+      event->has_metric_sint64 = 1;
+    }
+  if (_riemann_field_wanted (fields, METRIC_D) && view->has_metric_d)
+    {
+      event->metric_d = view->metric_d;
+      event->has_metric_d = 1;
+    }
+  if (_riemann_field_wanted (fields, METRIC_F) && view->has_metric_f)
+    {
+      event->metric_f = view->metric_f;
+      event->has_metric_f = 1;
+    }
+
+  if (_riemann_field_wanted (fields, STATE) && view->state.data)
+    event->state = _riemann_slice_strdup (view->state);
+  if (_riemann_field_wanted (fields, SERVICE) && view->service.data)
+    event->service = _riemann_slice_strdup (view->service);
+  if (_riemann_field_wanted (fields, HOST) && view->host.data)
+    event->host = _riemann_slice_strdup (view->host);
+  if (_riemann_field_wanted (fields, DESCRIPTION) && view->description.data)
+    event->description = _riemann_slice_strdup (view->description);
+
+  if (_riemann_field_wanted (fields, TAGS) && view->n_tags)
+    {
+      riemann_slice_t tag;
+
+      event->tags = (char **) malloc (sizeof (char *) * view->n_tags);
+
+      iter = riemann_event_view_iter (view);
+      for (n = 0; riemann_event_view_next_tag (&iter, &tag) > 0; n++)
+        event->tags[n] = _riemann_slice_strdup (tag);
+      event->n_tags = n;
+    }
+
+  if ((_riemann_field_wanted (fields, ATTRIBUTES) ||
+       _riemann_field_wanted (fields, STRING_ATTRIBUTES)) &&
+      view->n_attributes)
+    {
+      riemann_slice_t key, value;
+
+      event->attributes = (riemann_attribute_t **)
+        malloc (sizeof (riemann_attribute_t *) * view->n_attributes);
+
+      iter = riemann_event_view_iter (view);
+      for (n = 0; riemann_event_view_next_attribute (&iter, &key, &value) > 0; n++)
+        {
+          event->attributes[n] = riemann_attribute_new ();
+          event->attributes[n]->key = _riemann_slice_strdup (key);
+          if (value.data)
+            event->attributes[n]->value = _riemann_slice_strdup (value);
+        }
+      event->n_attributes = n;
+    }
+
+  return event;
+}
+
+riemann_message_t *
+riemann_message_from_buffer_projected (uint8_t *buffer, size_t len,
+                                       unsigned int fields)
+{
+  riemann_message_t *message;
+  const uint8_t *pos, *end;
+  size_t alloced = 0;
+
+  if (!buffer || len == 0)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  message = riemann_message_new ();
+
+  /* Events are parsed into a view first, which validates them, and
+     records where each field is, without allocating anything. Only
+     the requested fields are copied out of the buffer afterwards. */
+  pos = buffer;
+  end = buffer + len;
+  while (pos < end)
+    {
+      uint32_t field, type;
+      const uint8_t *data;
+      size_t data_len;
+      uint64_t v;
+
+      if (_riemann_wire_read_tag (&pos, end, &field, &type) != 0)
+        goto error;
+
+      if (field == 2 && type == RIEMANN_WIRE_VARINT)
+        {
+          if (_riemann_wire_read_varint (&pos, end, &v) != 0)
+            goto error;
+          message->ok = (v != 0);
+          message->has_ok = 1;
+        }
+      else if (field == 3 && type == RIEMANN_WIRE_LENGTH_DELIMITED)
+        {
+          riemann_slice_t error;
+
+          if (_riemann_wire_read_delimited (&pos, end, &data, &data_len) != 0)
+            goto error;
+          error.data = (const char *)data;
+          error.len = data_len;
+
+          free (message->error);
+          message->error = _riemann_slice_strdup (error);
+        }
+      else if (field == 6 && type == RIEMANN_WIRE_LENGTH_DELIMITED)
+        {
+          riemann_event_view_t view;
+
+          if (_riemann_wire_read_delimited (&pos, end, &data, &data_len) != 0 ||
+              _riemann_event_view_parse (data, data + data_len, &view) != 0)
+            goto error;
+
+          if (message->n_events >= alloced)
+            {
+              alloced = (alloced) ? alloced * 2 : 16;
+              message->events = (riemann_event_t **)
+                realloc (message->events, sizeof (riemann_event_t *) * alloced);
+            }
+          message->events[message->n_events++] =
+            _riemann_event_from_view (&view, fields);
+        }
+      else if ((field == 2 || field == 3 || field == 6) ||
+               _riemann_wire_skip (&pos, end, type) != 0)
+        goto error;
+    }
+
+  return message;
+
+ error:
+  riemann_message_free (message);
+  errno = EPROTO;
+  return NULL;
+}
+
 riemann_message_t *
 riemann_message_clone (const riemann_message_t *message)
 {
@@ -386,5 +829,5 @@ riemann_message_get_packed_size (riemann_message_t *message)
       return 0;
     }
 
-  return msg__get_packed_size (message);
+  return _riemann_wire_message_get_packed_size (message);
 }
@@ -23,6 +23,7 @@
 #include <riemann/query.h>
 
 typedef Msg riemann_message_t;
+typedef struct _riemann_message_builder_t riemann_message_builder_t;
 
 #ifdef __cplusplus
 extern "C" {
@@ -35,6 +36,8 @@ riemann_message_t *riemann_message_create_with_query (riemann_query_t *query);
 riemann_message_t *riemann_message_clone (const riemann_message_t *message);
 void riemann_message_free (riemann_message_t *message);
 
+riemann_message_t *riemann_message_new_in (riemann_arena_t *arena);
+
 int riemann_message_set_events (riemann_message_t *message, ...);
 int riemann_message_set_events_va (riemann_message_t *message, va_list aq);
 int riemann_message_set_events_n (riemann_message_t *message,
@@ -47,11 +50,36 @@ int riemann_message_append_events_n (riemann_message_t *message,
                                      size_t n_events,
                                      riemann_event_t **events);
 
+int riemann_message_append_events_n_in (riemann_arena_t *arena,
+                                        riemann_message_t *message,
+                                        size_t n_events,
+                                        riemann_event_t **events);
+
 int riemann_message_set_query (riemann_message_t *message,
                                riemann_query_t *query);
 
+riemann_message_builder_t *riemann_message_builder_new (size_t capacity);
+void riemann_message_builder_free (riemann_message_builder_t *builder);
+int riemann_message_builder_reserve (riemann_message_builder_t *builder,
+                                     size_t capacity);
+size_t riemann_message_builder_capacity (const riemann_message_builder_t *builder);
+size_t riemann_message_builder_size (const riemann_message_builder_t *builder);
+int riemann_message_builder_append (riemann_message_builder_t *builder,
+                                    riemann_event_t *event);
+int riemann_message_builder_append_n (riemann_message_builder_t *builder,
+                                      size_t n_events,
+                                      riemann_event_t **events);
+riemann_message_t *riemann_message_builder_finish (riemann_message_builder_t *builder);
+
 uint8_t *riemann_message_to_buffer (riemann_message_t *message, size_t *len);
+int riemann_message_pack_into (riemann_message_t *message,
+                               uint8_t *buffer, size_t size, size_t *len);
 riemann_message_t *riemann_message_from_buffer (uint8_t *buffer, size_t len);
+riemann_message_t *riemann_message_from_buffer_in (riemann_arena_t *arena,
+                                                   uint8_t *buffer, size_t len);
+riemann_message_t *riemann_message_from_buffer_projected (uint8_t *buffer,
+                                                          size_t len,
+                                                          unsigned int fields);
 size_t riemann_message_get_packed_size (riemann_message_t *message);
 
 #ifdef __cplusplus
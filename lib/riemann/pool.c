@@ -0,0 +1,123 @@
+/* riemann/pool.c -- Riemann C client library
+ * Copyright (C) 2013-2017  Gergely Nagy <algernon@madhouse-project.org>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <riemann/pool.h>
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "riemann/_private.h"
+
+/* A pool of idle events. Events taken from it are ordinary, heap
+ * allocated events, which can be used, sent and freed like any
+ * other. Putting them back resets them, keeping their tag and
+ * attribute arrays, so that a producer that keeps recycling events
+ * stops allocating them once the pool has warmed up.
+ */
+
+#define RIEMANN_EVENT_POOL_DEFAULT_SIZE 1024
+
+riemann_event_pool_t *
+riemann_event_pool_new (size_t max_events)
+{
+  riemann_event_pool_t *pool;
+
+  pool = (riemann_event_pool_t *) malloc (sizeof (riemann_event_pool_t));
+  pool->events = NULL;
+  pool->n_events = 0;
+  pool->n_alloced = 0;
+  pool->max_events = (max_events) ? max_events : RIEMANN_EVENT_POOL_DEFAULT_SIZE;
+
+  return pool;
+}
+
+void
+riemann_event_pool_free (riemann_event_pool_t *pool)
+{
+  size_t n;
+
+  if (!pool)
+    {
+      errno = EINVAL;
+      return;
+    }
+
+  for (n = 0; n < pool->n_events; n++)
+    riemann_event_free (pool->events[n]);
+  free (pool->events);
+  free (pool);
+}
+
+riemann_event_t *
+riemann_event_pool_get (riemann_event_pool_t *pool)
+{
+  if (!pool)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  if (pool->n_events == 0)
+    return riemann_event_new ();
+
+  return pool->events[--pool->n_events];
+}
+
+int
+riemann_event_pool_put (riemann_event_pool_t *pool, riemann_event_t *event)
+{
+  if (!pool || !event)
+    return -EINVAL;
+
+  if (pool->n_events >= pool->max_events)
+    {
+      riemann_event_free (event);
+      return 0;
+    }
+
+  riemann_event_reset (event);
+
+  if (pool->n_events == pool->n_alloced)
+    {
+      pool->n_alloced = (pool->n_alloced) ? pool->n_alloced * 2 : 16;
+      if (pool->n_alloced > pool->max_events)
+        pool->n_alloced = pool->max_events;
+      pool->events = (riemann_event_t **)
+        realloc (pool->events, sizeof (riemann_event_t *) * pool->n_alloced);
+    }
+  pool->events[pool->n_events++] = event;
+
+  return 0;
+}
+
+int
+riemann_event_pool_put_message (riemann_event_pool_t *pool,
+                                riemann_message_t *message)
+{
+  size_t n;
+
+  if (!pool || !message)
+    return -EINVAL;
+
+  for (n = 0; n < message->n_events; n++)
+    riemann_event_pool_put (pool, message->events[n]);
+  message->n_events = 0;
+
+  riemann_message_free (message);
+
+  return 0;
+}
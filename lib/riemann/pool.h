@@ -0,0 +1,43 @@
+/* riemann/pool.h -- Riemann C client library
+ * Copyright (C) 2013-2017  Gergely Nagy <algernon@madhouse-project.org>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MADHOUSE_RIEMANN_POOL_H__
+#define __MADHOUSE_RIEMANN_POOL_H__ 1
+
+#include <riemann/event.h>
+#include <riemann/message.h>
+
+typedef struct _riemann_event_pool_t riemann_event_pool_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+riemann_event_pool_t *riemann_event_pool_new (size_t max_events);
+void riemann_event_pool_free (riemann_event_pool_t *pool);
+
+riemann_event_t *riemann_event_pool_get (riemann_event_pool_t *pool);
+int riemann_event_pool_put (riemann_event_pool_t *pool,
+                            riemann_event_t *event);
+int riemann_event_pool_put_message (riemann_event_pool_t *pool,
+                                    riemann_message_t *message);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,313 @@
+/* riemann/simd.c -- Riemann C client library
+ * Copyright (C) 2013-2017  Gergely Nagy <algernon@madhouse-project.org>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Batch kernels for the numeric fields of events built from columns.
+ *
+ * Zigzag encoding and computing varint sizes are done four values at
+ * a time with AVX2, and varints are written with a single BMI2 PDEP
+ * (which spreads the 7-bit groups of a value over bytes) and an 8
+ * byte store, instead of a loop over every byte. Both are only used
+ * when the CPU supports them, which is checked once, at run time;
+ * otherwise, or on other architectures, the scalar versions are used.
+ */
+
+#include <string.h>
+
+#include "riemann/platform.h"
+#include "riemann/_simd.h"
+#include "riemann/_wire.h"
+
+#if HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+static inline size_t
+_riemann_simd_event_len (const riemann_simd_event_block_t *block, size_t i)
+{
+  size_t len = block->prefix_len;
+
+  if (block->time)
+    len += 1 + block->time_sizes[i];
+  if (block->time_micros)
+    len += 1 + block->time_micros_sizes[i];
+  if (block->metric_sint64)
+    len += 1 + block->metric_sint64_sizes[i];
+  if (block->metric_d)
+    len += 1 + 8;
+  if (block->metric_f)
+    len += 1 + 4;
+
+  return len;
+}
+
+size_t
+_riemann_simd_event_block_size (const riemann_simd_event_block_t *block)
+{
+  size_t i, size = 0;
+
+  for (i = 0; i < block->n; i++)
+    {
+      size_t len = _riemann_simd_event_len (block, i);
+
+      size += 1 + _riemann_wire_varint_size (len) + len;
+    }
+
+  return size;
+}
+
+/* -- Scalar kernels -- */
+
+static void
+_riemann_simd_zigzag_scalar (const int64_t *in, uint64_t *out, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    out[i] = _riemann_wire_zigzag_encode (in[i]);
+}
+
+static void
+_riemann_simd_varint_sizes_scalar (const uint64_t *in, uint8_t *sizes,
+                                   size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    sizes[i] = (uint8_t) _riemann_wire_varint_size (in[i]);
+}
+
+static inline size_t
+_riemann_simd_write_varint_scalar (uint8_t *out, uint64_t value,
+                                   size_t __attribute__((unused)) size)
+{
+  return _riemann_wire_write_varint (out, value);
+}
+
+/* The event writer loop, shared by the scalar and the BMI2 kernels,
+   which only differ in how they write varints. */
+#define RIEMANN_SIMD_DEFINE_WRITE_EVENTS(name, attributes, write_varint) \
+  static attributes size_t                                              \
+  name (uint8_t *out, const riemann_simd_event_block_t *block)          \
+  {                                                                     \
+    uint8_t *pos = out;                                                 \
+    size_t i;                                                           \
+                                                                        \
+    for (i = 0; i < block->n; i++)                                      \
+      {                                                                 \
+        size_t len = _riemann_simd_event_len (block, i);                \
+                                                                        \
+        *pos++ = RIEMANN_WIRE_TAG (6, RIEMANN_WIRE_LENGTH_DELIMITED);   \
+        pos += _riemann_wire_write_varint (pos, len);                   \
+        memcpy (pos, block->prefix, block->prefix_len);                 \
+        pos += block->prefix_len;                                       \
+                                                                        \
+        if (block->time)                                                \
+          {                                                             \
+            *pos++ = RIEMANN_WIRE_TAG (1, RIEMANN_WIRE_VARINT);         \
+            pos += write_varint (pos, block->time[i],                   \
+                                 block->time_sizes[i]);                 \
+          }                                                             \
+        if (block->time_micros)                                         \
+          {                                                             \
+            *pos++ = RIEMANN_WIRE_TAG (10, RIEMANN_WIRE_VARINT);        \
+            pos += write_varint (pos, block->time_micros[i],            \
+                                 block->time_micros_sizes[i]);          \
+          }                                                             \
+        if (block->metric_sint64)                                       \
+          {                                                             \
+            *pos++ = RIEMANN_WIRE_TAG (13, RIEMANN_WIRE_VARINT);        \
+            pos += write_varint (pos, block->metric_sint64[i],          \
+                                 block->metric_sint64_sizes[i]);        \
+          }                                                             \
+        if (block->metric_d)                                            \
+          {                                                             \
+            *pos++ = RIEMANN_WIRE_TAG (14, RIEMANN_WIRE_FIXED64);       \
+            pos += _riemann_wire_write_fixed64                          \
+              (pos, _riemann_wire_double_bits (block->metric_d[i]));    \
+          }                                                             \
+        if (block->metric_f)                                            \
+          {                                                             \
+            *pos++ = RIEMANN_WIRE_TAG (15, RIEMANN_WIRE_FIXED32);       \
+            pos += _riemann_wire_write_fixed32                          \
+              (pos, _riemann_wire_float_bits (block->metric_f[i]));     \
+          }                                                             \
+      }                                                                 \
+                                                                        \
+    return pos - out;                                                   \
+  }
+
+RIEMANN_SIMD_DEFINE_WRITE_EVENTS (_riemann_simd_write_events_scalar, ,
+                                  _riemann_simd_write_varint_scalar)
+
+const riemann_simd_kernels_t _riemann_simd_kernels_scalar =
+  {
+    "scalar",
+    _riemann_simd_zigzag_scalar,
+    _riemann_simd_varint_sizes_scalar,
+    _riemann_simd_write_events_scalar
+  };
+
+#if HAVE_X86_SIMD
+
+/* -- AVX2 kernels -- */
+
+__attribute__((target ("avx2"))) static void
+_riemann_simd_zigzag_avx2 (const int64_t *in, uint64_t *out, size_t n)
+{
+  const __m256i zero = _mm256_setzero_si256 ();
+  size_t i;
+
+  for (i = 0; i + 4 <= n; i += 4)
+    {
+      __m256i value = _mm256_loadu_si256 ((const __m256i *)(in + i));
+      __m256i sign = _mm256_cmpgt_epi64 (zero, value);
+
+      _mm256_storeu_si256 ((__m256i *)(out + i),
+                           _mm256_xor_si256 (_mm256_slli_epi64 (value, 1),
+                                             sign));
+    }
+
+  _riemann_simd_zigzag_scalar (in + i, out + i, n - i);
+}
+
+__attribute__((target ("avx2"))) static void
+_riemann_simd_varint_sizes_avx2 (const uint64_t *in, uint8_t *sizes, size_t n)
+{
+  /* AVX2 only has signed 64-bit comparisons: flipping the sign bit of
+     both sides turns them into unsigned ones. */
+  const __m256i bias = _mm256_set1_epi64x ((long long) (1ULL << 63));
+  __m256i thresholds[9];
+  size_t i, k;
+
+  for (k = 0; k < 9; k++)
+    thresholds[k] = _mm256_set1_epi64x
+      ((long long) (((1ULL << (7 * (k + 1))) - 1) ^ (1ULL << 63)));
+
+  for (i = 0; i + 4 <= n; i += 4)
+    {
+      __m256i value = _mm256_xor_si256
+        (_mm256_loadu_si256 ((const __m256i *)(in + i)), bias);
+      __m256i size = _mm256_set1_epi64x (1);
+      uint64_t lanes[4];
+
+      /* One more byte for every 7 bits the value does not fit in */
+      for (k = 0; k < 9; k++)
+        size = _mm256_sub_epi64 (size, _mm256_cmpgt_epi64 (value,
+                                                           thresholds[k]));
+
+      _mm256_storeu_si256 ((__m256i *)lanes, size);
+      sizes[i] = (uint8_t) lanes[0];
+      sizes[i + 1] = (uint8_t) lanes[1];
+      sizes[i + 2] = (uint8_t) lanes[2];
+      sizes[i + 3] = (uint8_t) lanes[3];
+    }
+
+  _riemann_simd_varint_sizes_scalar (in + i, sizes + i, n - i);
+}
+
+/* -- BMI2 kernels -- */
+
+__attribute__((target ("bmi2"))) static inline size_t
+_riemann_simd_write_varint_bmi2 (uint8_t *out, uint64_t value, size_t size)
+{
+  uint64_t bytes;
+
+  /* Values of more than 56 bits do not fit in 8 bytes */
+  if (size > 8)
+    return _riemann_wire_write_varint (out, value);
+
+  bytes = _pdep_u64 (value, 0x7f7f7f7f7f7f7f7fULL) |
+    (0x8080808080808080ULL & ((1ULL << (8 * (size - 1))) - 1));
+  memcpy (out, &bytes, sizeof (bytes));
+
+  return size;
+}
+
+RIEMANN_SIMD_DEFINE_WRITE_EVENTS (_riemann_simd_write_events_bmi2,
+                                  __attribute__((target ("bmi2"))),
+                                  _riemann_simd_write_varint_bmi2)
+
+static const riemann_simd_kernels_t _riemann_simd_kernels_avx2_bmi2 =
+  {
+    "avx2+bmi2",
+    _riemann_simd_zigzag_avx2,
+    _riemann_simd_varint_sizes_avx2,
+    _riemann_simd_write_events_bmi2
+  };
+
+static const riemann_simd_kernels_t _riemann_simd_kernels_avx2 =
+  {
+    "avx2",
+    _riemann_simd_zigzag_avx2,
+    _riemann_simd_varint_sizes_avx2,
+    _riemann_simd_write_events_scalar
+  };
+
+static const riemann_simd_kernels_t _riemann_simd_kernels_bmi2 =
+  {
+    "bmi2",
+    _riemann_simd_zigzag_scalar,
+    _riemann_simd_varint_sizes_scalar,
+    _riemann_simd_write_events_bmi2
+  };
+
+#endif /* HAVE_X86_SIMD */
+
+/* -- Dispatch -- */
+
+static const riemann_simd_kernels_t *_riemann_simd_active;
+
+static const riemann_simd_kernels_t *
+_riemann_simd_detect (void)
+{
+#if HAVE_X86_SIMD
+  int avx2, bmi2;
+
+  __builtin_cpu_init ();
+  avx2 = __builtin_cpu_supports ("avx2");
+  bmi2 = __builtin_cpu_supports ("bmi2");
+
+  if (avx2 && bmi2)
+    return &_riemann_simd_kernels_avx2_bmi2;
+  if (avx2)
+    return &_riemann_simd_kernels_avx2;
+  if (bmi2)
+    return &_riemann_simd_kernels_bmi2;
+#endif
+
+  return &_riemann_simd_kernels_scalar;
+}
+
+const riemann_simd_kernels_t *
+_riemann_simd_kernels (void)
+{
+  const riemann_simd_kernels_t *kernels;
+
+  kernels = __atomic_load_n (&_riemann_simd_active, __ATOMIC_ACQUIRE);
+  if (!kernels)
+    {
+      kernels = _riemann_simd_detect ();
+      __atomic_store_n (&_riemann_simd_active, kernels, __ATOMIC_RELEASE);
+    }
+
+  return kernels;
+}
+
+void
+_riemann_simd_set_kernels (const riemann_simd_kernels_t *kernels)
+{
+  __atomic_store_n (&_riemann_simd_active, kernels, __ATOMIC_RELEASE);
+}
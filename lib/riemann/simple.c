@@ -16,6 +16,7 @@
  */
 
 #include <netdb.h>
+#include <poll.h>
 #include <stdarg.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -132,7 +133,7 @@ riemann_message_t *
 riemann_communicate_query (riemann_client_t *client,
                            const char *query_string)
 {
-  if (client && client->srv_addr->ai_socktype == SOCK_DGRAM)
+  if (client && client->sock != -1 && !client->read)
     {
       errno = ENOTSUP;
       return NULL;
@@ -162,3 +163,118 @@ riemann_communicate_event (riemann_client_t *client,
     (client,
      riemann_message_create_with_events (event, NULL));
 }
+
+typedef struct
+{
+  int *results;
+  size_t acked;
+  int error;
+  int abort;
+} _riemann_pipeline_t;
+
+/* Replies arrive in order, so the n-th reply belongs to the n-th
+   message. */
+static void
+_riemann_pipeline_ack (riemann_client_t __attribute__((unused)) *client,
+                       riemann_message_t *response, int error,
+                       void *userdata)
+{
+  _riemann_pipeline_t *pipeline = (_riemann_pipeline_t *) userdata;
+
+  if (pipeline->abort)
+    error = pipeline->abort;
+  else if (response && !response->ok)
+    error = -EPROTO;
+
+  if (pipeline->results)
+    pipeline->results[pipeline->acked] = error;
+  if (error && !pipeline->error)
+    pipeline->error = error;
+  pipeline->acked++;
+
+  if (response)
+    riemann_message_free (response);
+}
+
+int
+riemann_communicate_pipelined (riemann_client_t *client,
+                               riemann_message_t **messages, size_t n,
+                               int *results)
+{
+  _riemann_pipeline_t pipeline = {results, 0, 0, 0};
+  struct pollfd pfd;
+  size_t sent = 0, i;
+  int nonblocking, timeout, e = 0;
+
+  if (!client || !client->send || client->sock == -1)
+    return -ENOTCONN;
+  if (!messages && n)
+    return -EINVAL;
+  for (i = 0; i < n; i++)
+    if (!messages[i])
+      return -EINVAL;
+
+  /* UDP has no acknowledgements to wait for. */
+  if (!client->read)
+    {
+      for (i = 0; i < n; i++)
+        {
+          e = riemann_client_send_message (client, messages[i]);
+          if (results)
+            results[i] = e;
+          if (e && !pipeline.error)
+            pipeline.error = e;
+        }
+      return pipeline.error;
+    }
+
+  nonblocking = client->nonblocking;
+  timeout = _riemann_client_get_timeout (client);
+  pfd.fd = client->sock;
+
+  while (pipeline.acked < n)
+    {
+      e = 0;
+      while (sent < n && e == 0)
+        {
+          e = riemann_client_send_async (client, messages[sent],
+                                         _riemann_pipeline_ack, &pipeline);
+          if (e == 0)
+            sent++;
+        }
+      if (e != 0 && e != -EAGAIN)
+        break;
+
+      pfd.events = (short) riemann_client_get_io_events (client);
+      e = poll (&pfd, 1, timeout);
+      if (e < 0 && errno == EINTR)
+        continue;
+      if (e <= 0)
+        {
+          /* Late replies would be matched to the wrong requests, so
+             the connection can not be used anymore. */
+          e = (e == 0) ? -ETIMEDOUT : -errno;
+          pipeline.abort = e;
+          riemann_client_disconnect (client);
+          break;
+        }
+
+      if ((e = riemann_client_process_io (client, pfd.revents)) != 0)
+        break;
+    }
+
+  if (pipeline.acked == n)
+    e = pipeline.error;
+  else if (results)
+    {
+      /* Everything in flight was failed already; what was not sent
+         yet, fails with the same error. */
+      for (i = sent; i < n; i++)
+        results[i] = e;
+    }
+
+  if (!nonblocking)
+    riemann_client_set_nonblocking (client, 0);
+
+  return e;
+}
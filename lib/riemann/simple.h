@@ -38,6 +38,9 @@ riemann_message_t *riemann_communicate_query (riemann_client_t *client,
                                               const char *query_string);
 riemann_message_t *riemann_communicate_event (riemann_client_t *client,
                                               riemann_event_field_t field, ...);
+int riemann_communicate_pipelined (riemann_client_t *client,
+                                   riemann_message_t **messages, size_t n,
+                                   int *results);
 
 #ifdef __cplusplus
 }
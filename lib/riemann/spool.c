@@ -0,0 +1,418 @@
+/* riemann/spool.c -- Riemann C client library
+ * Copyright (C) 2013-2017  Gergely Nagy <algernon@madhouse-project.org>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <riemann/spool.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "riemann/_private.h"
+
+/* The spool keeps messages that could not be sent in a file, so that
+ * they survive an outage, and a restart of the program too. The file
+ * is mapped into memory, and used as a ring: frames are appended at
+ * the tail, exactly as riemann_message_to_buffer() would serialise
+ * them, and replayed, and removed, from the head.
+ *
+ * A frame never wraps around the end of the ring. When the next one
+ * does not fit there, the rest is marked as unused, and it goes to the
+ * start instead. The file is never resized: once the ring is full,
+ * appending fails, and what is already there is kept.
+ */
+
+static int64_t
+_riemann_spool_now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int
+_riemann_spool_valid (const riemann_spool_header_t *header, size_t size)
+{
+  return (memcmp (header->magic, RIEMANN_SPOOL_MAGIC,
+                  sizeof (header->magic)) == 0 &&
+          header->version == RIEMANN_SPOOL_VERSION &&
+          header->capacity == size - RIEMANN_SPOOL_HEADER_SIZE &&
+          header->head <= header->capacity &&
+          header->tail <= header->capacity);
+}
+
+riemann_spool_t *
+riemann_spool_open (const char *path, size_t max_size)
+{
+  riemann_spool_t *spool;
+  riemann_spool_header_t *header;
+  struct stat st;
+  size_t size;
+  void *map;
+  int fd, e, created = 0;
+
+  if (!path)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  if ((fd = open (path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) == -1)
+    return NULL;
+
+  /* Two writers would overwrite each other's frames. */
+  if (flock (fd, LOCK_EX | LOCK_NB) != 0 || fstat (fd, &st) != 0)
+    goto error;
+
+  size = (size_t) st.st_size;
+  if (size == 0)
+    {
+      if (max_size < RIEMANN_SPOOL_HEADER_SIZE + sizeof (uint32_t))
+        {
+          errno = EINVAL;
+          goto error;
+        }
+      if (ftruncate (fd, (off_t) max_size) != 0)
+        goto error;
+      size = max_size;
+      created = 1;
+    }
+  else if (size <= RIEMANN_SPOOL_HEADER_SIZE)
+    {
+      errno = EINVAL;
+      goto error;
+    }
+
+  map = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+    goto error;
+
+  header = (riemann_spool_header_t *) map;
+  if (created)
+    {
+      memset (header, 0, RIEMANN_SPOOL_HEADER_SIZE);
+      memcpy (header->magic, RIEMANN_SPOOL_MAGIC, sizeof (header->magic));
+      header->version = RIEMANN_SPOOL_VERSION;
+      header->capacity = size - RIEMANN_SPOOL_HEADER_SIZE;
+    }
+  else if (!_riemann_spool_valid (header, size))
+    {
+      munmap (map, size);
+      errno = EINVAL;
+      goto error;
+    }
+
+  spool = (riemann_spool_t *) malloc (sizeof (riemann_spool_t));
+  spool->fd = fd;
+  spool->map = (uint8_t *) map;
+  spool->map_size = size;
+  spool->header = header;
+  spool->data = spool->map + RIEMANN_SPOOL_HEADER_SIZE;
+  spool->rate = 0;
+  spool->tokens = 0;
+  spool->refilled = 0;
+
+  return spool;
+
+ error:
+  e = errno;
+  close (fd);
+  errno = e;
+  return NULL;
+}
+
+void
+riemann_spool_free (riemann_spool_t *spool)
+{
+  if (!spool)
+    {
+      errno = EINVAL;
+      return;
+    }
+
+  msync (spool->map, spool->map_size, MS_SYNC);
+  munmap (spool->map, spool->map_size);
+  close (spool->fd);
+  free (spool);
+}
+
+/* Finds room for a frame of `len' bytes, and returns its offset, or -1
+   if the ring is too full. */
+static int64_t
+_riemann_spool_reserve (riemann_spool_t *spool, size_t len)
+{
+  riemann_spool_header_t *header = spool->header;
+  uint32_t wrap = htonl (RIEMANN_SPOOL_WRAP);
+
+  if (header->count == 0)
+    header->head = header->tail = 0;
+  else if (header->tail == header->head)
+    return -1;
+
+  if (header->tail < header->head)
+    return (header->head - header->tail >= len) ? (int64_t) header->tail : -1;
+
+  if (header->capacity - header->tail >= len)
+    return (int64_t) header->tail;
+  if (header->head < len)
+    return -1;
+
+  /* Too little left at the end, but there is room at the start. */
+  if (header->capacity - header->tail >= sizeof (wrap))
+    memcpy (spool->data + header->tail, &wrap, sizeof (wrap));
+  return 0;
+}
+
+int
+riemann_spool_append (riemann_spool_t *spool, riemann_message_t *message)
+{
+  size_t len;
+  int64_t offset;
+  int e;
+
+  if (!spool || !message)
+    return -EINVAL;
+
+  riemann_message_pack_into (message, NULL, 0, &len);
+  if (len > spool->header->capacity)
+    return -EMSGSIZE;
+
+  if ((offset = _riemann_spool_reserve (spool, len)) < 0)
+    return -ENOSPC;
+
+  if ((e = riemann_message_pack_into (message, spool->data + offset,
+                                      len, NULL)) != 0)
+    return e;
+
+  /* The frame is in place before the header says so. */
+  spool->header->tail = (uint64_t) offset + len;
+  spool->header->count++;
+
+  return 0;
+}
+
+size_t
+riemann_spool_count (const riemann_spool_t *spool)
+{
+  if (!spool)
+    return 0;
+
+  return spool->header->count;
+}
+
+/* Finds the oldest frame, and its length. A length that would take the
+   frame past the end of the ring, or past the tail, means the file was
+   torn or tampered with: nothing in it can be trusted then, so the
+   ring is emptied, and -EBADMSG returned. */
+static int
+_riemann_spool_peek (riemann_spool_t *spool, const uint8_t **frame,
+                     size_t *len)
+{
+  riemann_spool_header_t *header = spool->header;
+  uint32_t header_len;
+  uint64_t end;
+
+  if (header->capacity - header->head < sizeof (header_len))
+    header->head = 0;
+  else
+    {
+      memcpy (&header_len, spool->data + header->head, sizeof (header_len));
+      if (ntohl (header_len) == RIEMANN_SPOOL_WRAP)
+        header->head = 0;
+    }
+
+  end = (header->head < header->tail) ? header->tail : header->capacity;
+  if (end - header->head < sizeof (header_len))
+    goto corrupt;
+
+  memcpy (&header_len, spool->data + header->head, sizeof (header_len));
+  if ((uint64_t) ntohl (header_len) > end - header->head - sizeof (header_len))
+    goto corrupt;
+
+  *frame = spool->data + header->head;
+  *len = sizeof (header_len) + ntohl (header_len);
+  return 0;
+
+ corrupt:
+  header->head = header->tail = 0;
+  header->count = 0;
+  return -EBADMSG;
+}
+
+static void
+_riemann_spool_consume (riemann_spool_t *spool, size_t len)
+{
+  riemann_spool_header_t *header = spool->header;
+
+  header->head += len;
+  if (--header->count == 0)
+    header->head = header->tail = 0;
+}
+
+int
+riemann_spool_set_replay_rate (riemann_spool_t *spool, unsigned int rate)
+{
+  if (!spool)
+    return -EINVAL;
+
+  spool->rate = rate;
+  spool->tokens = rate;
+  spool->refilled = _riemann_spool_now ();
+
+  return 0;
+}
+
+/* Tops the token bucket up, for the time passed since the last time.
+   The bucket holds up to a second's worth of frames. */
+static void
+_riemann_spool_refill (riemann_spool_t *spool)
+{
+  int64_t now = _riemann_spool_now ();
+
+  spool->tokens += (double) (now - spool->refilled) * spool->rate / 1000;
+  if (spool->tokens > spool->rate)
+    spool->tokens = spool->rate;
+  spool->refilled = now;
+}
+
+/* Waits for the server to acknowledge what was just sent, if it is
+   going to. Returns zero if it accepted it, 1 if it refused it, or a
+   negative errno value if the reply never arrived: transport errors,
+   -EPROTO from TLS among them, are not a refusal. */
+static int
+_riemann_spool_ack (riemann_client_t *client)
+{
+  riemann_message_t *response;
+  int e;
+
+  /* There are no replies over UDP. */
+  if (!client->read)
+    return 0;
+
+  if (!(response = riemann_client_recv_message (client)))
+    return -errno;
+
+  e = (response->ok) ? 0 : 1;
+  riemann_message_free (response);
+
+  return e;
+}
+
+/* Replays what the rate allows, and notes whether the server refused
+   any of the frames. */
+static int
+_riemann_spool_replay (riemann_spool_t *spool, riemann_client_t *client,
+                       int *rejected)
+{
+  const uint8_t *frame;
+  size_t len;
+  int e;
+
+  if (spool->rate)
+    _riemann_spool_refill (spool);
+
+  while (spool->header->count > 0)
+    {
+      if (spool->rate && spool->tokens < 1)
+        return -EAGAIN;
+
+      if ((e = _riemann_spool_peek (spool, &frame, &len)) != 0)
+        return e;
+
+      e = _riemann_client_send_frame (client, frame, len);
+      if (e == 0)
+        e = _riemann_spool_ack (client);
+
+      /* A frame the server refused would be refused again, so it is
+         dropped. Anything else is tried again next time. */
+      if (e == 1)
+        *rejected = 1;
+      else if (e != 0)
+        return e;
+
+      _riemann_spool_consume (spool, len);
+      if (spool->rate)
+        spool->tokens -= 1;
+    }
+
+  return 0;
+}
+
+int
+riemann_spool_replay (riemann_spool_t *spool, riemann_client_t *client)
+{
+  int e, rejected = 0;
+
+  /* A non-blocking client may leave a frame half sent, and the
+     acknowledgement unread. */
+  if (!spool || !client || client->nonblocking)
+    return -EINVAL;
+
+  if ((e = _riemann_spool_replay (spool, client, &rejected)) != 0)
+    return e;
+
+  return (rejected) ? -EPROTO : 0;
+}
+
+int
+riemann_spool_send_message (riemann_spool_t *spool, riemann_client_t *client,
+                            riemann_message_t *message)
+{
+  int e, s;
+
+  if (!spool || !client || !message || client->nonblocking)
+    return -EINVAL;
+
+  /* Spooled frames go first, to keep the order. */
+  if (spool->header->count > 0)
+    {
+      int rejected = 0;
+
+      e = _riemann_spool_replay (spool, client, &rejected);
+      if (spool->header->count > 0)
+        {
+          if ((s = riemann_spool_append (spool, message)) != 0)
+            return s;
+          return (e == -EAGAIN) ? 0 : e;
+        }
+    }
+
+  e = riemann_client_send_message (client, message);
+  if (e == 0)
+    e = _riemann_spool_ack (client);
+
+  /* A refused message would be refused again, so it is not spooled. */
+  if (e == 1)
+    return -EPROTO;
+  if (e == 0)
+    return 0;
+
+  /* The message may or may not have arrived; when in doubt, it is
+     sent again later. The error is passed on either way, so that the
+     caller knows to reconnect. */
+  if ((s = riemann_spool_append (spool, message)) != 0)
+    return s;
+
+  return e;
+}
@@ -0,0 +1,47 @@
+/* riemann/spool.h -- Riemann C client library
+ * Copyright (C) 2013-2017  Gergely Nagy <algernon@madhouse-project.org>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MADHOUSE_RIEMANN_SPOOL_H__
+#define __MADHOUSE_RIEMANN_SPOOL_H__ 1
+
+#include <riemann/client.h>
+#include <riemann/message.h>
+
+typedef struct _riemann_spool_t riemann_spool_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+riemann_spool_t *riemann_spool_open (const char *path, size_t max_size);
+void riemann_spool_free (riemann_spool_t *spool);
+
+int riemann_spool_append (riemann_spool_t *spool, riemann_message_t *message);
+size_t riemann_spool_count (const riemann_spool_t *spool);
+
+int riemann_spool_set_replay_rate (riemann_spool_t *spool, unsigned int rate);
+int riemann_spool_replay (riemann_spool_t *spool, riemann_client_t *client);
+
+int riemann_spool_send_message (riemann_spool_t *spool,
+                                riemann_client_t *client,
+                                riemann_message_t *message);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
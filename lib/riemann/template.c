@@ -0,0 +1,288 @@
+/* riemann/template.c -- Riemann C client library
+ * Copyright (C) 2013-2017  Gergely Nagy <algernon@madhouse-project.org>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <riemann/template.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "riemann/_private.h"
+#include "riemann/_wire.h"
+
+/* An event template holds the encoded form of every field of an event
+ * that does not change between sends. Sending one only needs to copy
+ * those bytes, and append the few fields that do change. Protobuf
+ * does not care about the order of fields, so the variable ones can
+ * go last.
+ */
+
+#define RIEMANN_EVENT_TEMPLATE_VARIABLE_FIELDS          \
+  (RIEMANN_EVENT_FIELD_MASK (TIME) |                    \
+   RIEMANN_EVENT_FIELD_MASK (STATE) |                   \
+   RIEMANN_EVENT_FIELD_MASK (TTL) |                     \
+   RIEMANN_EVENT_FIELD_MASK (METRIC_S64) |              \
+   RIEMANN_EVENT_FIELD_MASK (METRIC_D) |                \
+   RIEMANN_EVENT_FIELD_MASK (METRIC_F) |                \
+   RIEMANN_EVENT_FIELD_MASK (TIME_MICROS))
+
+#define _has(values, field)                                     \
+  ((values)->fields & RIEMANN_EVENT_FIELD_MASK (field))
+
+riemann_event_template_t *
+riemann_event_template_new (const riemann_event_t *event,
+                            unsigned int variable_fields)
+{
+  riemann_event_template_t *tmpl;
+  riemann_event_t constant;
+  riemann_wire_buffer_t buffer = { NULL, 0, 0, 0 };
+
+  if (!event || (variable_fields & ~RIEMANN_EVENT_TEMPLATE_VARIABLE_FIELDS))
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  /* A shallow copy, with the variable fields cleared, is all the
+     encoder needs. */
+  constant = *event;
+  if (variable_fields & RIEMANN_EVENT_FIELD_MASK (TIME))
+    constant.has_time = 0;
+  if (variable_fields & RIEMANN_EVENT_FIELD_MASK (STATE))
+    constant.state = NULL;
+  if (variable_fields & RIEMANN_EVENT_FIELD_MASK (TTL))
+    constant.has_ttl = 0;
+  if (variable_fields & RIEMANN_EVENT_FIELD_MASK (METRIC_S64))
+    constant.has_metric_sint64 = 0;
+  if (variable_fields & RIEMANN_EVENT_FIELD_MASK (METRIC_D))
+    constant.has_metric_d = 0;
+  if (variable_fields & RIEMANN_EVENT_FIELD_MASK (METRIC_F))
+    constant.has_metric_f = 0;
+  if (variable_fields & RIEMANN_EVENT_FIELD_MASK (TIME_MICROS))
+    constant.has_time_micros = 0;
+
+  _riemann_wire_event_put (&buffer, &constant);
+
+  tmpl = (riemann_event_template_t *) malloc (sizeof (riemann_event_template_t));
+  tmpl->variable = variable_fields;
+  tmpl->data = buffer.data;
+  tmpl->len = buffer.len;
+
+  return tmpl;
+}
+
+void
+riemann_event_template_free (riemann_event_template_t *tmpl)
+{
+  if (!tmpl)
+    {
+      errno = EINVAL;
+      return;
+    }
+
+  free (tmpl->data);
+  free (tmpl);
+}
+
+static size_t
+_riemann_event_template_values_size (const riemann_event_template_values_t *values)
+{
+  size_t size = 0;
+
+  if (_has (values, TIME))
+    size += 1 + _riemann_wire_varint_size ((uint64_t)values->time);
+  /* A NULL state leaves the field out, as it would from an event. */
+  if (_has (values, STATE) && values->state)
+    size += _riemann_wire_string_size (values->state);
+  if (_has (values, TTL))
+    size += 1 + 4;
+  if (_has (values, TIME_MICROS))
+    size += 1 + _riemann_wire_varint_size ((uint64_t)values->time_micros);
+  if (_has (values, METRIC_S64))
+    size += 1 + _riemann_wire_varint_size
+      (_riemann_wire_zigzag_encode (values->metric_sint64));
+  if (_has (values, METRIC_D))
+    size += 1 + 8;
+  if (_has (values, METRIC_F))
+    size += 1 + 4;
+
+  return size;
+}
+
+static void
+_riemann_event_template_values_put (riemann_wire_buffer_t *buffer,
+                                    const riemann_event_template_values_t *values)
+{
+  if (_has (values, TIME))
+    _riemann_wire_put_varint (buffer, RIEMANN_WIRE_TAG (1, RIEMANN_WIRE_VARINT),
+                              (uint64_t)values->time);
+  if (_has (values, STATE) && values->state)
+    _riemann_wire_put_string (buffer, 2, values->state);
+  if (_has (values, TTL))
+    _riemann_wire_put_fixed32 (buffer, RIEMANN_WIRE_TAG (8, RIEMANN_WIRE_FIXED32),
+                               _riemann_wire_float_bits (values->ttl));
+  if (_has (values, TIME_MICROS))
+    _riemann_wire_put_varint (buffer, RIEMANN_WIRE_TAG (10, RIEMANN_WIRE_VARINT),
+                              (uint64_t)values->time_micros);
+  if (_has (values, METRIC_S64))
+    _riemann_wire_put_varint (buffer, RIEMANN_WIRE_TAG (13, RIEMANN_WIRE_VARINT),
+                              _riemann_wire_zigzag_encode (values->metric_sint64));
+  if (_has (values, METRIC_D))
+    _riemann_wire_put_fixed64 (buffer, RIEMANN_WIRE_TAG (14, RIEMANN_WIRE_FIXED64),
+                               _riemann_wire_double_bits (values->metric_d));
+  if (_has (values, METRIC_F))
+    _riemann_wire_put_fixed32 (buffer, RIEMANN_WIRE_TAG (15, RIEMANN_WIRE_FIXED32),
+                               _riemann_wire_float_bits (values->metric_f));
+}
+
+static size_t
+_riemann_event_template_event_size (const riemann_event_template_t *tmpl,
+                                    const riemann_event_template_values_t *values)
+{
+  return tmpl->len + _riemann_event_template_values_size (values);
+}
+
+static const riemann_event_template_values_t _riemann_event_template_no_values;
+
+int
+_riemann_event_template_put (riemann_wire_buffer_t *buffer,
+                             const riemann_event_template_t *tmpl,
+                             const riemann_event_template_values_t *values)
+{
+  size_t event_len;
+
+  if (!values)
+    values = &_riemann_event_template_no_values;
+  if (values->fields & ~tmpl->variable)
+    return -EINVAL;
+
+  /* Every size is known up front, so there is nothing to backpatch. */
+  event_len = _riemann_event_template_event_size (tmpl, values);
+
+  _riemann_wire_reserve (buffer, 1 + _riemann_wire_varint_size (event_len) +
+                         event_len);
+
+  buffer->data[buffer->len++] =
+    RIEMANN_WIRE_TAG (6, RIEMANN_WIRE_LENGTH_DELIMITED);
+  buffer->len += _riemann_wire_write_varint (buffer->data + buffer->len,
+                                             event_len);
+  memcpy (buffer->data + buffer->len, tmpl->data, tmpl->len);
+  buffer->len += tmpl->len;
+
+  _riemann_event_template_values_put (buffer, values);
+
+  return 0;
+}
+
+int
+_riemann_event_template_frame (riemann_wire_buffer_t *buffer,
+                               const riemann_event_template_t *tmpl,
+                               const riemann_event_template_values_t *values)
+{
+  size_t start;
+  uint32_t header;
+  int e;
+
+  start = buffer->len;
+  _riemann_wire_reserve (buffer, sizeof (header));
+  buffer->len += sizeof (header);
+
+  if ((e = _riemann_event_template_put (buffer, tmpl, values)) != 0)
+    {
+      buffer->len = start;
+      return e;
+    }
+
+  header = htonl (buffer->len - start - sizeof (header));
+  memcpy (buffer->data + start, &header, sizeof (header));
+
+  return 0;
+}
+
+/* Like _riemann_event_template_frame(), but leaves the constant part of
+   the event where it is: only the frame header and the variable fields
+   are written to `buffer', which must be empty, and `iov' is set up to
+   send the three pieces in order. */
+int
+_riemann_event_template_frame_iov (riemann_wire_buffer_t *buffer,
+                                   const riemann_event_template_t *tmpl,
+                                   const riemann_event_template_values_t *values,
+                                   struct iovec iov[3])
+{
+  size_t event_len, prefix_len;
+  uint32_t header;
+
+  if (!values)
+    values = &_riemann_event_template_no_values;
+  if (values->fields & ~tmpl->variable)
+    return -EINVAL;
+
+  event_len = _riemann_event_template_event_size (tmpl, values);
+
+  _riemann_wire_reserve (buffer, sizeof (header) + 1 +
+                         _riemann_wire_varint_size (event_len) +
+                         event_len - tmpl->len);
+
+  buffer->len = sizeof (header);
+  buffer->data[buffer->len++] =
+    RIEMANN_WIRE_TAG (6, RIEMANN_WIRE_LENGTH_DELIMITED);
+  buffer->len += _riemann_wire_write_varint (buffer->data + buffer->len,
+                                             event_len);
+  prefix_len = buffer->len;
+
+  header = htonl (prefix_len - sizeof (header) + event_len);
+  memcpy (buffer->data, &header, sizeof (header));
+
+  _riemann_event_template_values_put (buffer, values);
+
+  iov[0].iov_base = buffer->data;
+  iov[0].iov_len = prefix_len;
+  iov[1].iov_base = tmpl->data;
+  iov[1].iov_len = tmpl->len;
+  iov[2].iov_base = buffer->data + prefix_len;
+  iov[2].iov_len = buffer->len - prefix_len;
+
+  return 0;
+}
+
+int
+riemann_event_template_pack_into (const riemann_event_template_t *tmpl,
+                                  const riemann_event_template_values_t *values,
+                                  uint8_t *buffer, size_t size, size_t *len)
+{
+  riemann_wire_buffer_t out = { buffer, size, 0, 1 };
+  size_t event_len, l;
+
+  if (!tmpl)
+    return -EINVAL;
+
+  if (!values)
+    values = &_riemann_event_template_no_values;
+  if (values->fields & ~tmpl->variable)
+    return -EINVAL;
+
+  event_len = _riemann_event_template_event_size (tmpl, values);
+  l = sizeof (uint32_t) + 1 + _riemann_wire_varint_size (event_len) + event_len;
+  if (len)
+    *len = l;
+
+  if (!buffer || size < l)
+    return -ENOBUFS;
+
+  return _riemann_event_template_frame (&out, tmpl, values);
+}
@@ -0,0 +1,56 @@
+/* riemann/template.h -- Riemann C client library
+ * Copyright (C) 2013-2017  Gergely Nagy <algernon@madhouse-project.org>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __MADHOUSE_RIEMANN_TEMPLATE_H__
+#define __MADHOUSE_RIEMANN_TEMPLATE_H__ 1
+
+#include <riemann/event.h>
+#include <stdint.h>
+
+typedef struct _riemann_event_template_t riemann_event_template_t;
+
+/* The per-send values of an event template. Only the fields in
+   `fields' (a combination of RIEMANN_EVENT_FIELD_MASK()s) are sent. */
+typedef struct
+{
+  unsigned int fields;
+
+  int64_t time;
+  int64_t time_micros;
+  const char *state;
+  float ttl;
+  int64_t metric_sint64;
+  double metric_d;
+  float metric_f;
+} riemann_event_template_values_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+riemann_event_template_t *riemann_event_template_new (const riemann_event_t *event,
+                                                      unsigned int variable_fields);
+void riemann_event_template_free (riemann_event_template_t *tmpl);
+
+int riemann_event_template_pack_into (const riemann_event_template_t *tmpl,
+                                      const riemann_event_template_values_t *values,
+                                      uint8_t *buffer, size_t size, size_t *len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,397 @@
+/* riemann/view.c -- Riemann C client library
+ * Copyright (C) 2013-2017  Gergely Nagy <algernon@madhouse-project.org>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <riemann/view.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "riemann/_private.h"
+#include "riemann/_wire.h"
+
+static int
+_riemann_view_read_slice (const uint8_t **pos, const uint8_t *end,
+                          riemann_slice_t *slice)
+{
+  const uint8_t *data;
+  size_t len;
+
+  if (_riemann_wire_read_delimited (pos, end, &data, &len) != 0)
+    return -EPROTO;
+
+  slice->data = (const char *)data;
+  slice->len = len;
+
+  return 0;
+}
+
+static int
+_riemann_view_parse_attribute (const uint8_t *pos, const uint8_t *end,
+                               riemann_slice_t *key, riemann_slice_t *value)
+{
+  uint32_t field, type;
+
+  key->data = value->data = NULL;
+  key->len = value->len = 0;
+
+  while (pos < end)
+    {
+      if (_riemann_wire_read_tag (&pos, end, &field, &type) != 0)
+        return -EPROTO;
+
+      if ((field == 1 || field == 2) && type != RIEMANN_WIRE_LENGTH_DELIMITED)
+        return -EPROTO;
+
+      if (field == 1)
+        {
+          if (_riemann_view_read_slice (&pos, end, key) != 0)
+            return -EPROTO;
+        }
+      else if (field == 2)
+        {
+          if (_riemann_view_read_slice (&pos, end, value) != 0)
+            return -EPROTO;
+        }
+      else if (_riemann_wire_skip (&pos, end, type) != 0)
+        return -EPROTO;
+    }
+
+  /* The key is a required field. */
+  return (key->data) ? 0 : -EPROTO;
+}
+
+int
+_riemann_event_view_parse (const uint8_t *pos, const uint8_t *end,
+                           riemann_event_view_t *event)
+{
+  uint32_t field, type;
+  uint64_t v;
+  uint32_t v32;
+
+  memset (event, 0, sizeof (*event));
+  event->raw = pos;
+  event->raw_len = end - pos;
+
+  while (pos < end)
+    {
+      if (_riemann_wire_read_tag (&pos, end, &field, &type) != 0)
+        return -EPROTO;
+
+      switch (field)
+        {
+        case 1:
+        case 10:
+        case 13:
+          if (type != RIEMANN_WIRE_VARINT ||
+              _riemann_wire_read_varint (&pos, end, &v) != 0)
+            return -EPROTO;
+
+          if (field == 1)
+            {
+              event->time = (int64_t)v;
+              event->has_time = 1;
+            }
+          else if (field == 10)
+            {
+              event->time_micros = (int64_t)v;
+              event->has_time_micros = 1;
+            }
+          else
+            {
+              event->metric_sint64 = _riemann_wire_zigzag_decode (v);
+              event->has_metric_sint64 = 1;
+            }
+          break;
+
+        case 2:
+        case 3:
+        case 4:
+        case 5:
+          {
+            riemann_slice_t *slice;
+
+            if (type != RIEMANN_WIRE_LENGTH_DELIMITED)
+              return -EPROTO;
+
+            if (field == 2)
+              slice = &event->state;
+            else if (field == 3)
+              slice = &event->service;
+            else if (field == 4)
+              slice = &event->host;
+            else
+              slice = &event->description;
+
+            if (_riemann_view_read_slice (&pos, end, slice) != 0)
+              return -EPROTO;
+            break;
+          }
+
+        case 7:
+          {
+            riemann_slice_t tag;
+
+            if (type != RIEMANN_WIRE_LENGTH_DELIMITED ||
+                _riemann_view_read_slice (&pos, end, &tag) != 0)
+              return -EPROTO;
+            event->n_tags++;
+            break;
+          }
+
+        case 9:
+          {
+            riemann_slice_t attrib, key, value;
+
+            if (type != RIEMANN_WIRE_LENGTH_DELIMITED ||
+                _riemann_view_read_slice (&pos, end, &attrib) != 0)
+              return -EPROTO;
+            if (_riemann_view_parse_attribute
+                ((const uint8_t *)attrib.data,
+                 (const uint8_t *)attrib.data + attrib.len,
+                 &key, &value) != 0)
+              return -EPROTO;
+            event->n_attributes++;
+            break;
+          }
+
+        case 8:
+        case 15:
+          if (type != RIEMANN_WIRE_FIXED32 ||
+              _riemann_wire_read_fixed32 (&pos, end, &v32) != 0)
+            return -EPROTO;
+
+          if (field == 8)
+            {
+              event->ttl = _riemann_wire_float (v32);
+              event->has_ttl = 1;
+            }
+          else
+            {
+              event->metric_f = _riemann_wire_float (v32);
+              event->has_metric_f = 1;
+            }
+          break;
+
+        case 14:
+          if (type != RIEMANN_WIRE_FIXED64 ||
+              _riemann_wire_read_fixed64 (&pos, end, &v) != 0)
+            return -EPROTO;
+          event->metric_d = _riemann_wire_double (v);
+          event->has_metric_d = 1;
+          break;
+
+        default:
+          if (_riemann_wire_skip (&pos, end, type) != 0)
+            return -EPROTO;
+          break;
+        }
+    }
+
+  return 0;
+}
+
+static int
+_riemann_view_count_events (const uint8_t *pos, const uint8_t *end,
+                            size_t *n_events)
+{
+  uint32_t field, type;
+
+  *n_events = 0;
+
+  while (pos < end)
+    {
+      if (_riemann_wire_read_tag (&pos, end, &field, &type) != 0)
+        return -EPROTO;
+      if (_riemann_wire_skip (&pos, end, type) != 0)
+        return -EPROTO;
+
+      if (field == 6)
+        (*n_events)++;
+    }
+
+  return 0;
+}
+
+riemann_message_view_t *
+riemann_message_view_new (uint8_t *buffer, size_t len)
+{
+  riemann_message_view_t *view;
+  const uint8_t *pos, *end;
+  uint32_t field, type;
+  size_t n_events, n = 0;
+  uint64_t v;
+
+  if (!buffer || len == 0)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  pos = buffer;
+  end = buffer + len;
+
+  /* The message is walked twice: first to count the events, so that
+     the view and all event views fit in a single allocation, then to
+     parse them. The first pass only looks at top-level tags. */
+  if (_riemann_view_count_events (pos, end, &n_events) != 0)
+    {
+      errno = EPROTO;
+      return NULL;
+    }
+
+  view = (riemann_message_view_t *)
+    malloc (sizeof (riemann_message_view_t) +
+            sizeof (riemann_event_view_t) * n_events);
+  memset (view, 0, sizeof (riemann_message_view_t));
+  view->events = (riemann_event_view_t *)(view + 1);
+  view->n_events = n_events;
+
+  while (pos < end)
+    {
+      if (_riemann_wire_read_tag (&pos, end, &field, &type) != 0)
+        goto error;
+
+      switch (field)
+        {
+        case 2:
+          if (type != RIEMANN_WIRE_VARINT ||
+              _riemann_wire_read_varint (&pos, end, &v) != 0)
+            goto error;
+          view->has_ok = 1;
+          view->ok = (v != 0);
+          break;
+
+        case 3:
+          if (type != RIEMANN_WIRE_LENGTH_DELIMITED ||
+              _riemann_view_read_slice (&pos, end, &view->error) != 0)
+            goto error;
+          break;
+
+        case 6:
+          {
+            riemann_slice_t event;
+
+            if (type != RIEMANN_WIRE_LENGTH_DELIMITED ||
+                _riemann_view_read_slice (&pos, end, &event) != 0)
+              goto error;
+            if (_riemann_event_view_parse
+                ((const uint8_t *)event.data,
+                 (const uint8_t *)event.data + event.len,
+                 &view->events[n++]) != 0)
+              goto error;
+            break;
+          }
+
+        default:
+          if (_riemann_wire_skip (&pos, end, type) != 0)
+            goto error;
+          break;
+        }
+    }
+
+  view->buffer = buffer;
+  view->len = len;
+
+  return view;
+
+ error:
+  free (view);
+  errno = EPROTO;
+  return NULL;
+}
+
+void
+riemann_message_view_free (riemann_message_view_t *view)
+{
+  if (!view)
+    {
+      errno = EINVAL;
+      return;
+    }
+
+  free (view->buffer);
+  free (view);
+}
+
+riemann_view_iter_t
+riemann_event_view_iter (const riemann_event_view_t *event)
+{
+  riemann_view_iter_t iter = {NULL, NULL};
+
+  if (!event)
+    {
+      errno = EINVAL;
+      return iter;
+    }
+
+  iter.pos = event->raw;
+  iter.end = event->raw + event->raw_len;
+
+  return iter;
+}
+
+/* The event was fully validated when the view was made, so the
+   iterators below treat any error as the end of the event. */
+static int
+_riemann_event_view_next_field (riemann_view_iter_t *iter, uint32_t wanted,
+                                riemann_slice_t *slice)
+{
+  uint32_t field, type;
+
+  while (iter->pos < iter->end)
+    {
+      if (_riemann_wire_read_tag (&iter->pos, iter->end, &field, &type) != 0)
+        break;
+
+      if (field == wanted)
+        return _riemann_view_read_slice (&iter->pos, iter->end, slice) == 0;
+
+      if (_riemann_wire_skip (&iter->pos, iter->end, type) != 0)
+        break;
+    }
+
+  return 0;
+}
+
+int
+riemann_event_view_next_tag (riemann_view_iter_t *iter, riemann_slice_t *tag)
+{
+  if (!iter || !tag)
+    return -EINVAL;
+
+  return _riemann_event_view_next_field (iter, 7, tag);
+}
+
+int
+riemann_event_view_next_attribute (riemann_view_iter_t *iter,
+                                   riemann_slice_t *key,
+                                   riemann_slice_t *value)
+{
+  riemann_slice_t attrib;
+
+  if (!iter || !key || !value)
+    return -EINVAL;
+
+  if (!_riemann_event_view_next_field (iter, 9, &attrib))
+    return 0;
+
+  _riemann_view_parse_attribute ((const uint8_t *)attrib.data,
+                                 (const uint8_t *)attrib.data + attrib.len,
+                                 key, value);
+  return 1;
+}
@@ -0,0 +1,99 @@
+/* riemann/view.h -- Riemann C client library
+ * Copyright (C) 2013-2017  Gergely Nagy <algernon@madhouse-project.org>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MADHOUSE_RIEMANN_VIEW_H__
+#define __MADHOUSE_RIEMANN_VIEW_H__ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Strings within a view point into the received buffer, and are NOT
+   NUL-terminated. An absent field has a NULL data pointer. */
+typedef struct
+{
+  const char *data;
+  size_t len;
+} riemann_slice_t;
+
+typedef struct
+{
+  const uint8_t *pos;
+  const uint8_t *end;
+} riemann_view_iter_t;
+
+typedef struct
+{
+  int has_time;
+  int64_t time;
+  int has_time_micros;
+  int64_t time_micros;
+
+  riemann_slice_t state;
+  riemann_slice_t service;
+  riemann_slice_t host;
+  riemann_slice_t description;
+
+  int has_ttl;
+  float ttl;
+
+  int has_metric_sint64;
+  int64_t metric_sint64;
+  int has_metric_d;
+  double metric_d;
+  int has_metric_f;
+  float metric_f;
+
+  size_t n_tags;
+  size_t n_attributes;
+
+  /* The encoded event, used by the tag and attribute iterators. */
+  const uint8_t *raw;
+  size_t raw_len;
+} riemann_event_view_t;
+
+typedef struct
+{
+  int has_ok;
+  int ok;
+  riemann_slice_t error;
+
+  size_t n_events;
+  riemann_event_view_t *events;
+
+  uint8_t *buffer;
+  size_t len;
+} riemann_message_view_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+riemann_message_view_t *riemann_message_view_new (uint8_t *buffer, size_t len);
+void riemann_message_view_free (riemann_message_view_t *view);
+
+riemann_view_iter_t riemann_event_view_iter (const riemann_event_view_t *event);
+int riemann_event_view_next_tag (riemann_view_iter_t *iter,
+                                 riemann_slice_t *tag);
+int riemann_event_view_next_attribute (riemann_view_iter_t *iter,
+                                       riemann_slice_t *key,
+                                       riemann_slice_t *value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,377 @@
+/* riemann/wire.c -- Riemann C client library
+ * Copyright (C) 2013-2017  Gergely Nagy <algernon@madhouse-project.org>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* A hand-written encoder for the Riemann protocol, which produces the
+ * very same bytes msg__pack() does, without walking the protobuf-c
+ * descriptors for every field, and without walking the message twice
+ * (once for the size, once for packing). Fields are written in field
+ * number order, exactly like protobuf-c does.
+ *
+ * Messages carrying unknown fields (which can only come from
+ * decoding a newer server's reply) are handed to protobuf-c, which
+ * knows where to put them.
+ */
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdlib.h>
+
+#include "riemann/_wire.h"
+
+#define _riemann_wire_delimited_size(size)                      \
+  (1 + _riemann_wire_varint_size (size) + (size))
+
+static size_t
+_riemann_wire_attribute_size (const riemann_attribute_t *attrib)
+{
+  /* The key is required: protobuf-c writes an empty string for a
+     missing one. */
+  size_t size = _riemann_wire_string_size (attrib->key);
+
+  if (attrib->value)
+    size += _riemann_wire_string_size (attrib->value);
+
+  return size;
+}
+
+static size_t
+_riemann_wire_event_size (const riemann_event_t *event)
+{
+  size_t size = 0, n;
+
+  if (event->has_time)
+    size += 1 + _riemann_wire_varint_size ((uint64_t)event->time);
+  if (event->state)
+    size += _riemann_wire_string_size (event->state);
+  if (event->service)
+    size += _riemann_wire_string_size (event->service);
+  if (event->host)
+    size += _riemann_wire_string_size (event->host);
+  if (event->description)
+    size += _riemann_wire_string_size (event->description);
+  for (n = 0; n < event->n_tags; n++)
+    size += _riemann_wire_string_size (event->tags[n]);
+  if (event->has_ttl)
+    size += 1 + 4;
+  for (n = 0; n < event->n_attributes; n++)
+    size += _riemann_wire_delimited_size
+      (_riemann_wire_attribute_size (event->attributes[n]));
+  if (event->has_time_micros)
+    size += 1 + _riemann_wire_varint_size ((uint64_t)event->time_micros);
+  if (event->has_metric_sint64)
+    size += 1 + _riemann_wire_varint_size
+      (_riemann_wire_zigzag_encode (event->metric_sint64));
+  if (event->has_metric_d)
+    size += 1 + 8;
+  if (event->has_metric_f)
+    size += 1 + 4;
+
+  return size;
+}
+
+static size_t
+_riemann_wire_state_size (const State *state)
+{
+  size_t size = 0, n;
+
+  if (state->has_time)
+    size += 1 + _riemann_wire_varint_size ((uint64_t)state->time);
+  if (state->state)
+    size += _riemann_wire_string_size (state->state);
+  if (state->service)
+    size += _riemann_wire_string_size (state->service);
+  if (state->host)
+    size += _riemann_wire_string_size (state->host);
+  if (state->description)
+    size += _riemann_wire_string_size (state->description);
+  if (state->has_once)
+    size += 1 + 1;
+  for (n = 0; n < state->n_tags; n++)
+    size += _riemann_wire_string_size (state->tags[n]);
+  if (state->has_ttl)
+    size += 1 + 4;
+
+  return size;
+}
+
+static size_t
+_riemann_wire_query_size (const riemann_query_t *query)
+{
+  return (query->string) ? _riemann_wire_string_size (query->string) : 0;
+}
+
+static size_t
+_riemann_wire_msg_size (const riemann_message_t *message)
+{
+  size_t size = 0, n;
+
+  if (message->has_ok)
+    size += 1 + 1;
+  if (message->error)
+    size += _riemann_wire_string_size (message->error);
+  for (n = 0; n < message->n_states; n++)
+    size += _riemann_wire_delimited_size
+      (_riemann_wire_state_size (message->states[n]));
+  if (message->query)
+    size += _riemann_wire_delimited_size
+      (_riemann_wire_query_size (message->query));
+  for (n = 0; n < message->n_events; n++)
+    size += _riemann_wire_delimited_size
+      (_riemann_wire_event_size (message->events[n]));
+
+  return size;
+}
+
+/* -- Single-pass encoding --
+ *
+ * Nested messages are written without knowing their size in advance:
+ * a guess of the length prefix's width is reserved, and once the
+ * nested message is written, the length is filled in. If the guess
+ * was wrong, the body is moved to make the prefix fit.
+ */
+
+void
+_riemann_wire_buffer_grow (riemann_wire_buffer_t *buffer, size_t n)
+{
+  size_t size = buffer->size * 2;
+
+  if (size < buffer->len + n)
+    size = buffer->len + n;
+  if (size < 256)
+    size = 256;
+
+  if (buffer->borrowed)
+    {
+      uint8_t *data = (uint8_t *) malloc (size);
+
+      memcpy (data, buffer->data, buffer->len);
+      buffer->data = data;
+      buffer->borrowed = 0;
+    }
+  else
+    buffer->data = (uint8_t *) realloc (buffer->data, size);
+
+  buffer->size = size;
+}
+
+/* Most attributes are shorter than 128 bytes, most events are
+   shorter than 16k: these are the widths reserved for their length
+   prefixes. */
+#define RIEMANN_WIRE_ATTRIBUTE_LEN_WIDTH 1
+#define RIEMANN_WIRE_EVENT_LEN_WIDTH 2
+
+static void
+_riemann_wire_put_event (riemann_wire_buffer_t *buffer,
+                         const riemann_event_t *event)
+{
+  size_t i;
+
+  if (event->has_time)
+    _riemann_wire_put_varint (buffer, RIEMANN_WIRE_TAG (1, RIEMANN_WIRE_VARINT),
+                              (uint64_t)event->time);
+  if (event->state)
+    _riemann_wire_put_string (buffer, 2, event->state);
+  if (event->service)
+    _riemann_wire_put_string (buffer, 3, event->service);
+  if (event->host)
+    _riemann_wire_put_string (buffer, 4, event->host);
+  if (event->description)
+    _riemann_wire_put_string (buffer, 5, event->description);
+  for (i = 0; i < event->n_tags; i++)
+    _riemann_wire_put_string (buffer, 7, event->tags[i]);
+  if (event->has_ttl)
+    _riemann_wire_put_fixed32 (buffer, RIEMANN_WIRE_TAG (8, RIEMANN_WIRE_FIXED32),
+                               _riemann_wire_float_bits (event->ttl));
+  for (i = 0; i < event->n_attributes; i++)
+    {
+      const riemann_attribute_t *attrib = event->attributes[i];
+      size_t width = RIEMANN_WIRE_ATTRIBUTE_LEN_WIDTH, start;
+
+      start = _riemann_wire_begin (buffer, 9, &width);
+      _riemann_wire_put_string (buffer, 1, attrib->key);
+      if (attrib->value)
+        _riemann_wire_put_string (buffer, 2, attrib->value);
+      _riemann_wire_end (buffer, start, width);
+    }
+  if (event->has_time_micros)
+    _riemann_wire_put_varint (buffer, RIEMANN_WIRE_TAG (10, RIEMANN_WIRE_VARINT),
+                              (uint64_t)event->time_micros);
+  if (event->has_metric_sint64)
+    _riemann_wire_put_varint (buffer, RIEMANN_WIRE_TAG (13, RIEMANN_WIRE_VARINT),
+                              _riemann_wire_zigzag_encode (event->metric_sint64));
+  if (event->has_metric_d)
+    _riemann_wire_put_fixed64 (buffer, RIEMANN_WIRE_TAG (14, RIEMANN_WIRE_FIXED64),
+                               _riemann_wire_double_bits (event->metric_d));
+  if (event->has_metric_f)
+    _riemann_wire_put_fixed32 (buffer, RIEMANN_WIRE_TAG (15, RIEMANN_WIRE_FIXED32),
+                               _riemann_wire_float_bits (event->metric_f));
+}
+
+static void
+_riemann_wire_put_state (riemann_wire_buffer_t *buffer, const State *state)
+{
+  size_t i;
+
+  if (state->has_time)
+    _riemann_wire_put_varint (buffer, RIEMANN_WIRE_TAG (1, RIEMANN_WIRE_VARINT),
+                              (uint64_t)state->time);
+  if (state->state)
+    _riemann_wire_put_string (buffer, 2, state->state);
+  if (state->service)
+    _riemann_wire_put_string (buffer, 3, state->service);
+  if (state->host)
+    _riemann_wire_put_string (buffer, 4, state->host);
+  if (state->description)
+    _riemann_wire_put_string (buffer, 5, state->description);
+  if (state->has_once)
+    _riemann_wire_put_bool (buffer, RIEMANN_WIRE_TAG (6, RIEMANN_WIRE_VARINT),
+                            state->once);
+  for (i = 0; i < state->n_tags; i++)
+    _riemann_wire_put_string (buffer, 7, state->tags[i]);
+  if (state->has_ttl)
+    _riemann_wire_put_fixed32 (buffer, RIEMANN_WIRE_TAG (8, RIEMANN_WIRE_FIXED32),
+                               _riemann_wire_float_bits (state->ttl));
+}
+
+static void
+_riemann_wire_put_msg (riemann_wire_buffer_t *buffer,
+                       const riemann_message_t *message)
+{
+  size_t i, start, width;
+
+  if (message->has_ok)
+    _riemann_wire_put_bool (buffer, RIEMANN_WIRE_TAG (2, RIEMANN_WIRE_VARINT),
+                            message->ok);
+  if (message->error)
+    _riemann_wire_put_string (buffer, 3, message->error);
+  for (i = 0; i < message->n_states; i++)
+    {
+      width = RIEMANN_WIRE_EVENT_LEN_WIDTH;
+      start = _riemann_wire_begin (buffer, 4, &width);
+      _riemann_wire_put_state (buffer, message->states[i]);
+      _riemann_wire_end (buffer, start, width);
+    }
+  if (message->query)
+    {
+      width = RIEMANN_WIRE_EVENT_LEN_WIDTH;
+      start = _riemann_wire_begin (buffer, 5, &width);
+      if (message->query->string)
+        _riemann_wire_put_string (buffer, 1, message->query->string);
+      _riemann_wire_end (buffer, start, width);
+    }
+  for (i = 0; i < message->n_events; i++)
+    {
+      width = RIEMANN_WIRE_EVENT_LEN_WIDTH;
+      start = _riemann_wire_begin (buffer, 6, &width);
+      _riemann_wire_put_event (buffer, message->events[i]);
+      _riemann_wire_end (buffer, start, width);
+    }
+}
+
+static int
+_riemann_wire_event_has_unknown_fields (const riemann_event_t *event)
+{
+  size_t i;
+
+  if (event->base.n_unknown_fields)
+    return 1;
+  for (i = 0; i < event->n_attributes; i++)
+    if (event->attributes[i]->base.n_unknown_fields)
+      return 1;
+
+  return 0;
+}
+
+static int
+_riemann_wire_has_unknown_fields (const riemann_message_t *message)
+{
+  size_t i;
+
+  if (message->base.n_unknown_fields)
+    return 1;
+  if (message->query && message->query->base.n_unknown_fields)
+    return 1;
+  for (i = 0; i < message->n_states; i++)
+    if (message->states[i]->base.n_unknown_fields)
+      return 1;
+  for (i = 0; i < message->n_events; i++)
+    if (_riemann_wire_event_has_unknown_fields (message->events[i]))
+      return 1;
+
+  return 0;
+}
+
+size_t
+_riemann_wire_message_get_packed_size (const riemann_message_t *message)
+{
+  if (_riemann_wire_has_unknown_fields (message))
+    return msg__get_packed_size (message);
+
+  return _riemann_wire_msg_size (message);
+}
+
+size_t
+_riemann_wire_event_get_packed_size (const riemann_event_t *event)
+{
+  if (_riemann_wire_event_has_unknown_fields (event))
+    return event__get_packed_size (event);
+
+  return _riemann_wire_event_size (event);
+}
+
+size_t
+_riemann_wire_message_frame (riemann_wire_buffer_t *buffer,
+                             const riemann_message_t *message)
+{
+  size_t start;
+  uint32_t header;
+
+  start = buffer->len;
+  _riemann_wire_reserve (buffer, sizeof (header));
+  buffer->len += sizeof (header);
+
+  if (_riemann_wire_has_unknown_fields (message))
+    {
+      size_t len = msg__get_packed_size (message);
+
+      _riemann_wire_reserve (buffer, len);
+      buffer->len += msg__pack (message, buffer->data + buffer->len);
+    }
+  else
+    _riemann_wire_put_msg (buffer, message);
+
+  /* The frame header is only known once everything else is written. */
+  header = htonl (buffer->len - start - sizeof (header));
+  memcpy (buffer->data + start, &header, sizeof (header));
+
+  return buffer->len - start;
+}
+
+void
+_riemann_wire_event_put (riemann_wire_buffer_t *buffer,
+                         const riemann_event_t *event)
+{
+  if (_riemann_wire_event_has_unknown_fields (event))
+    {
+      size_t len = event__get_packed_size (event);
+
+      _riemann_wire_reserve (buffer, len);
+      buffer->len += event__pack (event, buffer->data + buffer->len);
+    }
+  else
+    _riemann_wire_put_event (buffer, event);
+}
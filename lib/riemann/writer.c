@@ -0,0 +1,401 @@
+/* riemann/writer.c -- Riemann C client library
+ * Copyright (C) 2013-2017  Gergely Nagy <algernon@madhouse-project.org>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <riemann/writer.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "riemann/_private.h"
+#include "riemann/_simd.h"
+#include "riemann/_wire.h"
+
+/* The batch writer serialises events straight into a framed buffer,
+ * the same bytes a message holding the same events would be packed
+ * to, without building the message first. The buffer starts with
+ * room for the frame header, which is filled in when the buffer is
+ * asked for.
+ */
+
+riemann_batch_writer_t *
+riemann_batch_writer_new (void)
+{
+  riemann_batch_writer_t *writer;
+
+  writer = (riemann_batch_writer_t *) malloc (sizeof (riemann_batch_writer_t));
+  memset (writer, 0, sizeof (riemann_batch_writer_t));
+
+  riemann_batch_writer_reset (writer);
+
+  return writer;
+}
+
+void
+riemann_batch_writer_free (riemann_batch_writer_t *writer)
+{
+  if (!writer)
+    {
+      errno = EINVAL;
+      return;
+    }
+
+  free (writer->buffer.data);
+  free (writer);
+}
+
+void
+riemann_batch_writer_reset (riemann_batch_writer_t *writer)
+{
+  if (!writer)
+    {
+      errno = EINVAL;
+      return;
+    }
+
+  /* The buffer is kept, so a writer reused for every batch stops
+     allocating once it grew large enough. */
+  writer->buffer.len = 0;
+  _riemann_wire_reserve (&writer->buffer, RIEMANN_BATCH_WRITER_HEADER_SIZE);
+  writer->buffer.len = RIEMANN_BATCH_WRITER_HEADER_SIZE;
+
+  writer->in_event = 0;
+}
+
+int
+riemann_batch_writer_begin_event (riemann_batch_writer_t *writer)
+{
+  if (!writer || writer->in_event)
+    return -EINVAL;
+
+  writer->event_width = 2;
+  writer->event_start = _riemann_wire_begin (&writer->buffer, 6,
+                                             &writer->event_width);
+  writer->in_event = 1;
+
+  return 0;
+}
+
+int
+riemann_batch_writer_end_event (riemann_batch_writer_t *writer)
+{
+  if (!writer || !writer->in_event)
+    return -EINVAL;
+
+  _riemann_wire_end (&writer->buffer, writer->event_start,
+                     writer->event_width);
+  writer->in_event = 0;
+
+  return 0;
+}
+
+static inline int
+_riemann_batch_writer_in_event (const riemann_batch_writer_t *writer)
+{
+  return writer && writer->in_event;
+}
+
+int
+riemann_batch_writer_set_time (riemann_batch_writer_t *writer, int64_t time)
+{
+  if (!_riemann_batch_writer_in_event (writer))
+    return -EINVAL;
+
+  _riemann_wire_put_varint (&writer->buffer,
+                            RIEMANN_WIRE_TAG (1, RIEMANN_WIRE_VARINT),
+                            (uint64_t)time);
+  return 0;
+}
+
+int
+riemann_batch_writer_set_time_micros (riemann_batch_writer_t *writer,
+                                      int64_t time_micros)
+{
+  if (!_riemann_batch_writer_in_event (writer))
+    return -EINVAL;
+
+  _riemann_wire_put_varint (&writer->buffer,
+                            RIEMANN_WIRE_TAG (10, RIEMANN_WIRE_VARINT),
+                            (uint64_t)time_micros);
+  return 0;
+}
+
+static int
+_riemann_batch_writer_put_string (riemann_batch_writer_t *writer,
+                                  uint32_t field, const char *str)
+{
+  if (!_riemann_batch_writer_in_event (writer))
+    return -EINVAL;
+
+  if (!str)
+    return -EINVAL;
+
+  _riemann_wire_put_string (&writer->buffer, field, str);
+  return 0;
+}
+
+int
+riemann_batch_writer_set_state (riemann_batch_writer_t *writer,
+                                const char *state)
+{
+  return _riemann_batch_writer_put_string (writer, 2, state);
+}
+
+int
+riemann_batch_writer_set_service (riemann_batch_writer_t *writer,
+                                  const char *service)
+{
+  return _riemann_batch_writer_put_string (writer, 3, service);
+}
+
+int
+riemann_batch_writer_set_host (riemann_batch_writer_t *writer,
+                               const char *host)
+{
+  return _riemann_batch_writer_put_string (writer, 4, host);
+}
+
+int
+riemann_batch_writer_set_description (riemann_batch_writer_t *writer,
+                                      const char *description)
+{
+  return _riemann_batch_writer_put_string (writer, 5, description);
+}
+
+int
+riemann_batch_writer_add_tag (riemann_batch_writer_t *writer,
+                              const char *tag)
+{
+  return _riemann_batch_writer_put_string (writer, 7, tag);
+}
+
+int
+riemann_batch_writer_set_ttl (riemann_batch_writer_t *writer, float ttl)
+{
+  if (!_riemann_batch_writer_in_event (writer))
+    return -EINVAL;
+
+  _riemann_wire_put_fixed32 (&writer->buffer,
+                             RIEMANN_WIRE_TAG (8, RIEMANN_WIRE_FIXED32),
+                             _riemann_wire_float_bits (ttl));
+  return 0;
+}
+
+int
+riemann_batch_writer_add_attribute (riemann_batch_writer_t *writer,
+                                    const char *key, const char *value)
+{
+  size_t start, width = 1;
+
+  if (!_riemann_batch_writer_in_event (writer))
+    return -EINVAL;
+
+  if (!key)
+    return -EINVAL;
+
+  start = _riemann_wire_begin (&writer->buffer, 9, &width);
+  _riemann_wire_put_string (&writer->buffer, 1, key);
+  if (value)
+    _riemann_wire_put_string (&writer->buffer, 2, value);
+  _riemann_wire_end (&writer->buffer, start, width);
+
+  return 0;
+}
+
+int
+riemann_batch_writer_set_metric_sint64 (riemann_batch_writer_t *writer,
+                                        int64_t metric)
+{
+  if (!_riemann_batch_writer_in_event (writer))
+    return -EINVAL;
+
+  _riemann_wire_put_varint (&writer->buffer,
+                            RIEMANN_WIRE_TAG (13, RIEMANN_WIRE_VARINT),
+                            _riemann_wire_zigzag_encode (metric));
+  return 0;
+}
+
+int
+riemann_batch_writer_set_metric_d (riemann_batch_writer_t *writer,
+                                   double metric)
+{
+  if (!_riemann_batch_writer_in_event (writer))
+    return -EINVAL;
+
+  _riemann_wire_put_fixed64 (&writer->buffer,
+                             RIEMANN_WIRE_TAG (14, RIEMANN_WIRE_FIXED64),
+                             _riemann_wire_double_bits (metric));
+  return 0;
+}
+
+int
+riemann_batch_writer_set_metric_f (riemann_batch_writer_t *writer,
+                                   float metric)
+{
+  if (!_riemann_batch_writer_in_event (writer))
+    return -EINVAL;
+
+  _riemann_wire_put_fixed32 (&writer->buffer,
+                             RIEMANN_WIRE_TAG (15, RIEMANN_WIRE_FIXED32),
+                             _riemann_wire_float_bits (metric));
+  return 0;
+}
+
+int
+riemann_batch_writer_add_event (riemann_batch_writer_t *writer,
+                                const riemann_event_t *event)
+{
+  size_t start, width = 2;
+
+  if (!writer || writer->in_event || !event)
+    return -EINVAL;
+
+  start = _riemann_wire_begin (&writer->buffer, 6, &width);
+  _riemann_wire_event_put (&writer->buffer, event);
+  _riemann_wire_end (&writer->buffer, start, width);
+
+  return 0;
+}
+
+int
+riemann_batch_writer_add_event_template (riemann_batch_writer_t *writer,
+                                         const riemann_event_template_t *tmpl,
+                                         const riemann_event_template_values_t *values)
+{
+  if (!writer || writer->in_event || !tmpl)
+    return -EINVAL;
+
+  return _riemann_event_template_put (&writer->buffer, tmpl, values);
+}
+
+/* Columns are encoded in blocks this large, so the scratch space
+   needed fits on the stack. */
+#define RIEMANN_BATCH_WRITER_COLUMN_BLOCK 256
+
+static int
+_riemann_batch_writer_columns_valid (const riemann_event_columns_t *columns)
+{
+  unsigned int fields = 0;
+
+  if (columns->time)
+    fields |= RIEMANN_EVENT_FIELD_MASK (TIME);
+  if (columns->time_micros)
+    fields |= RIEMANN_EVENT_FIELD_MASK (TIME_MICROS);
+  if (columns->metric_sint64)
+    fields |= RIEMANN_EVENT_FIELD_MASK (METRIC_S64);
+  if (columns->metric_d)
+    fields |= RIEMANN_EVENT_FIELD_MASK (METRIC_D);
+  if (columns->metric_f)
+    fields |= RIEMANN_EVENT_FIELD_MASK (METRIC_F);
+
+  return !columns->tmpl || !(fields & ~columns->tmpl->variable);
+}
+
+int
+riemann_batch_writer_add_columns (riemann_batch_writer_t *writer,
+                                  const riemann_event_columns_t *columns)
+{
+  const riemann_simd_kernels_t *kernels;
+  uint64_t metric_sint64[RIEMANN_BATCH_WRITER_COLUMN_BLOCK];
+  uint8_t time_sizes[RIEMANN_BATCH_WRITER_COLUMN_BLOCK],
+    time_micros_sizes[RIEMANN_BATCH_WRITER_COLUMN_BLOCK],
+    metric_sint64_sizes[RIEMANN_BATCH_WRITER_COLUMN_BLOCK];
+  size_t offset;
+
+  if (!writer || writer->in_event || !columns)
+    return -EINVAL;
+  if (!_riemann_batch_writer_columns_valid (columns))
+    return -EINVAL;
+
+  kernels = _riemann_simd_kernels ();
+
+  for (offset = 0; offset < columns->n_events;
+       offset += RIEMANN_BATCH_WRITER_COLUMN_BLOCK)
+    {
+      riemann_simd_event_block_t block;
+      size_t size;
+
+      memset (&block, 0, sizeof (block));
+      block.n = columns->n_events - offset;
+      if (block.n > RIEMANN_BATCH_WRITER_COLUMN_BLOCK)
+        block.n = RIEMANN_BATCH_WRITER_COLUMN_BLOCK;
+
+      if (columns->tmpl)
+        {
+          block.prefix = columns->tmpl->data;
+          block.prefix_len = columns->tmpl->len;
+        }
+
+      /* Timestamps are plain int64 varints, encoded as their two's
+         complement. */
+      if (columns->time)
+        {
+          block.time = (const uint64_t *) columns->time + offset;
+          block.time_sizes = time_sizes;
+          kernels->varint_sizes (block.time, time_sizes, block.n);
+        }
+      if (columns->time_micros)
+        {
+          block.time_micros = (const uint64_t *) columns->time_micros + offset;
+          block.time_micros_sizes = time_micros_sizes;
+          kernels->varint_sizes (block.time_micros, time_micros_sizes, block.n);
+        }
+      if (columns->metric_sint64)
+        {
+          kernels->zigzag (columns->metric_sint64 + offset, metric_sint64,
+                           block.n);
+          block.metric_sint64 = metric_sint64;
+          block.metric_sint64_sizes = metric_sint64_sizes;
+          kernels->varint_sizes (metric_sint64, metric_sint64_sizes, block.n);
+        }
+      if (columns->metric_d)
+        block.metric_d = columns->metric_d + offset;
+      if (columns->metric_f)
+        block.metric_f = columns->metric_f + offset;
+
+      /* With every size known, the whole block is reserved at once,
+         and written without any backpatching. */
+      size = _riemann_simd_event_block_size (&block);
+      _riemann_wire_reserve (&writer->buffer, size + RIEMANN_SIMD_SLACK);
+      writer->buffer.len +=
+        kernels->write_events (writer->buffer.data + writer->buffer.len,
+                               &block);
+    }
+
+  return 0;
+}
+
+const uint8_t *
+riemann_batch_writer_get_buffer (riemann_batch_writer_t *writer, size_t *len)
+{
+  uint32_t header;
+
+  if (!writer || writer->in_event)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  header = htonl (writer->buffer.len - RIEMANN_BATCH_WRITER_HEADER_SIZE);
+  memcpy (writer->buffer.data, &header, sizeof (header));
+
+  if (len)
+    *len = writer->buffer.len;
+
+  return writer->buffer.data;
+}
@@ -0,0 +1,92 @@
+/* riemann/writer.h -- Riemann C client library
+ * Copyright (C) 2013-2017  Gergely Nagy <algernon@madhouse-project.org>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __MADHOUSE_RIEMANN_WRITER_H__
+#define __MADHOUSE_RIEMANN_WRITER_H__ 1
+
+#include <riemann/event.h>
+#include <riemann/template.h>
+#include <stdint.h>
+
+typedef struct _riemann_batch_writer_t riemann_batch_writer_t;
+
+/* Events built from columns of numeric fields: the i-th event has the
+   constant fields of the template (if any), and the i-th element of
+   every column that is not NULL. */
+typedef struct
+{
+  size_t n_events;
+
+  const riemann_event_template_t *tmpl;
+
+  const int64_t *time;
+  const int64_t *time_micros;
+  const int64_t *metric_sint64;
+  const double *metric_d;
+  const float *metric_f;
+} riemann_event_columns_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+riemann_batch_writer_t *riemann_batch_writer_new (void);
+void riemann_batch_writer_free (riemann_batch_writer_t *writer);
+void riemann_batch_writer_reset (riemann_batch_writer_t *writer);
+
+int riemann_batch_writer_begin_event (riemann_batch_writer_t *writer);
+int riemann_batch_writer_end_event (riemann_batch_writer_t *writer);
+
+int riemann_batch_writer_set_time (riemann_batch_writer_t *writer,
+                                   int64_t time);
+int riemann_batch_writer_set_time_micros (riemann_batch_writer_t *writer,
+                                          int64_t time_micros);
+int riemann_batch_writer_set_state (riemann_batch_writer_t *writer,
+                                    const char *state);
+int riemann_batch_writer_set_service (riemann_batch_writer_t *writer,
+                                      const char *service);
+int riemann_batch_writer_set_host (riemann_batch_writer_t *writer,
+                                   const char *host);
+int riemann_batch_writer_set_description (riemann_batch_writer_t *writer,
+                                          const char *description);
+int riemann_batch_writer_set_ttl (riemann_batch_writer_t *writer, float ttl);
+int riemann_batch_writer_set_metric_sint64 (riemann_batch_writer_t *writer,
+                                            int64_t metric);
+int riemann_batch_writer_set_metric_d (riemann_batch_writer_t *writer,
+                                       double metric);
+int riemann_batch_writer_set_metric_f (riemann_batch_writer_t *writer,
+                                       float metric);
+int riemann_batch_writer_add_tag (riemann_batch_writer_t *writer,
+                                  const char *tag);
+int riemann_batch_writer_add_attribute (riemann_batch_writer_t *writer,
+                                        const char *key, const char *value);
+
+int riemann_batch_writer_add_event (riemann_batch_writer_t *writer,
+                                    const riemann_event_t *event);
+int riemann_batch_writer_add_event_template (riemann_batch_writer_t *writer,
+                                             const riemann_event_template_t *tmpl,
+                                             const riemann_event_template_values_t *values);
+int riemann_batch_writer_add_columns (riemann_batch_writer_t *writer,
+                                      const riemann_event_columns_t *columns);
+
+const uint8_t *riemann_batch_writer_get_buffer (riemann_batch_writer_t *writer,
+                                                size_t *len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -15,10 +15,19 @@
  * License along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+/* Strings in a message view are not NUL-terminated, and may be
+   absent, in which case they are printed the way printf() would print
+   a NULL string. */
+#define QUERY_SLICE_FMT "%.*s"
+#define QUERY_SLICE_ARGS(s)                             \
+  (int)((s).data ? (s).len : strlen ("(null)")),        \
+    ((s).data ? (s).data : "(null)")
+
 static void
-query_dump_event (size_t n, const riemann_event_t *event)
+query_dump_event (size_t n, const riemann_event_view_t *event)
 {
-  size_t i;
+  riemann_view_iter_t iter;
+  riemann_slice_t tag, key, value;
   time_t t;
 
   if (event->has_time_micros)
@@ -28,15 +37,16 @@ query_dump_event (size_t n, const riemann_event_t *event)
 
   printf ("Event #%zu:\n"
           "  time  = %" PRId64 " - %s"
-          "  state = %s\n"
-          "  service = %s\n"
-          "  host = %s\n"
-          "  description = %s\n"
+          "  state = " QUERY_SLICE_FMT "\n"
+          "  service = " QUERY_SLICE_FMT "\n"
+          "  host = " QUERY_SLICE_FMT "\n"
+          "  description = " QUERY_SLICE_FMT "\n"
           "  ttl = %f\n",
           n,
           t, ctime (&t),
-          event->state, event->service, event->host,
-          event->description, event->ttl);
+          QUERY_SLICE_ARGS (event->state), QUERY_SLICE_ARGS (event->service),
+          QUERY_SLICE_ARGS (event->host),
+          QUERY_SLICE_ARGS (event->description), event->ttl);
 
   if (event->has_metric_sint64)
     printf ("  metric_sint64 = %" PRId64 "\n", event->metric_sint64);
@@ -45,23 +55,25 @@ query_dump_event (size_t n, const riemann_event_t *event)
   if (event->has_metric_f)
     printf ("  metric_f = %f\n", event->metric_f);
 
-  if (event->tags)
+  if (event->n_tags)
     {
       printf ("  tags = [ ");
 
-      for (i = 0; i < event->n_tags; i++)
-        printf ("%s ", event->tags[i]);
+      iter = riemann_event_view_iter (event);
+      while (riemann_event_view_next_tag (&iter, &tag) > 0)
+        printf (QUERY_SLICE_FMT " ", QUERY_SLICE_ARGS (tag));
 
       printf ("]\n");
     }
 
-  if (event->attributes)
+  if (event->n_attributes)
     {
       printf ("  attributes = {\n");
 
-      for (i = 0; i < event->n_attributes; i++)
-        printf ("    %s = %s\n", event->attributes[i]->key,
-                event->attributes[i]->value);
+      iter = riemann_event_view_iter (event);
+      while (riemann_event_view_next_attribute (&iter, &key, &value) > 0)
+        printf ("    " QUERY_SLICE_FMT " = " QUERY_SLICE_FMT "\n",
+                QUERY_SLICE_ARGS (key), QUERY_SLICE_ARGS (value));
 
       printf ("  }\n");
     }
@@ -70,20 +82,28 @@ query_dump_event (size_t n, const riemann_event_t *event)
 }
 
 static void
-query_dump_events (size_t n, const riemann_event_t **events)
+query_dump_events (size_t n, const riemann_event_view_t *events)
 {
   size_t i;
 
   for (i = 0; i < n; i++)
-    query_dump_event (i, events[i]);
+    query_dump_event (i, &events[i]);
 }
 
 #if HAVE_JSON_C
 static json_object *
-query_dump_event_json (size_t __attribute__((unused)) n, const riemann_event_t *event)
+query_json_string (riemann_slice_t slice)
+{
+  return json_object_new_string_len (slice.data, (int) slice.len);
+}
+
+static json_object *
+query_dump_event_json (size_t __attribute__((unused)) n,
+                       const riemann_event_view_t *event)
 {
+  riemann_view_iter_t iter;
+  riemann_slice_t tag, key, value;
   json_object *o;
-  size_t i;
 
   o = json_object_new_object ();
 
@@ -91,16 +111,15 @@ query_dump_event_json (size_t __attribute__((unused)) n, const riemann_event_t *
     json_object_object_add (o, "time", json_object_new_int64 (event->time));
   if (event->has_time_micros)
     json_object_object_add (o, "time_micros", json_object_new_int64 (event->time_micros));
-  if (event->state)
-    json_object_object_add (o, "state", json_object_new_string (event->state));
-  if (event->service)
-    json_object_object_add (o, "service",
-                            json_object_new_string (event->service));
-  if (event->host)
-    json_object_object_add (o, "host", json_object_new_string (event->host));
-  if (event->description)
+  if (event->state.data)
+    json_object_object_add (o, "state", query_json_string (event->state));
+  if (event->service.data)
+    json_object_object_add (o, "service", query_json_string (event->service));
+  if (event->host.data)
+    json_object_object_add (o, "host", query_json_string (event->host));
+  if (event->description.data)
     json_object_object_add (o, "description",
-                            json_object_new_string (event->description));
+                            query_json_string (event->description));
   if (event->has_ttl)
     json_object_object_add (o, "ttl", json_object_new_double (event->ttl));
   if (event->has_metric_sint64)
@@ -113,27 +132,35 @@ query_dump_event_json (size_t __attribute__((unused)) n, const riemann_event_t *
     json_object_object_add (o, "metric_f",
                             json_object_new_double (event->metric_f));
 
-  if (event->tags)
+  if (event->n_tags)
     {
       json_object *tags;
 
       tags = json_object_new_array ();
 
-      for (i = 0; i < event->n_tags; i++)
-        json_object_array_add (tags, json_object_new_string (event->tags[i]));
+      iter = riemann_event_view_iter (event);
+      while (riemann_event_view_next_tag (&iter, &tag) > 0)
+        json_object_array_add (tags, query_json_string (tag));
 
       json_object_object_add (o, "tags", tags);
     }
 
-  if (event->attributes)
+  if (event->n_attributes)
     {
       json_object *attrs;
 
       attrs = json_object_new_object ();
 
-      for (i = 0; i < event->n_attributes; i++)
-        json_object_object_add (attrs, event->attributes[i]->key,
-                                json_object_new_string (event->attributes[i]->value));
+      iter = riemann_event_view_iter (event);
+      while (riemann_event_view_next_attribute (&iter, &key, &value) > 0)
+        {
+          /* Object keys must be NUL-terminated. */
+          char *k = strndup (key.data, key.len);
+
+          json_object_object_add (attrs, k, (value.data) ?
+                                  query_json_string (value) : NULL);
+          free (k);
+        }
 
       json_object_object_add (o, "attributes", attrs);
     }
@@ -142,7 +169,7 @@ query_dump_event_json (size_t __attribute__((unused)) n, const riemann_event_t *
 }
 
 static void
-query_dump_events_json (size_t n, const riemann_event_t **events)
+query_dump_events_json (size_t n, const riemann_event_view_t *events)
 {
   size_t i;
   json_object *o;
@@ -150,7 +177,7 @@ query_dump_events_json (size_t n, const riemann_event_t **events)
   o = json_object_new_array ();
 
   for (i = 0; i < n; i++)
-    json_object_array_add (o, query_dump_event_json (i, events[i]));
+    json_object_array_add (o, query_dump_event_json (i, &events[i]));
 
   printf ("%s\n", json_object_to_json_string_ext (o, JSON_C_TO_STRING_PLAIN));
 
@@ -159,7 +186,7 @@ query_dump_events_json (size_t n, const riemann_event_t **events)
 #else
 static void
 query_dump_events_json (size_t __attribute__((unused)) n,
-                        const riemann_event_t __attribute__((unused)) **events)
+                        const riemann_event_view_t __attribute__((unused)) *events)
 {
   fprintf (stderr, "JSON support not available in this build!\n");
   exit (EXIT_FAILURE);
@@ -184,12 +211,12 @@ help_query (void)
           "  -?, --help                        This help screen.\n");
 }
 
-typedef void (*query_func_t) (size_t, const riemann_event_t **);
+typedef void (*query_func_t) (size_t, const riemann_event_view_t *);
 
 static int
 client_query (int argc, char *argv[])
 {
-  riemann_message_t *response;
+  riemann_message_view_t *response;
   riemann_client_t *client;
   riemann_client_type_t client_type = RIEMANN_CLIENT_TCP;
   const char *host = "localhost", *query_string = NULL;
@@ -319,7 +346,7 @@ client_query (int argc, char *argv[])
       goto end;
     }
 
-  response = riemann_client_recv_message (client);
+  response = riemann_client_recv_message_view (client);
   if (!response)
     {
       fprintf (stderr, "Error when asking for a message receipt: %s\n",
@@ -330,14 +357,16 @@ client_query (int argc, char *argv[])
 
   if (response->ok != 1)
     {
-      fprintf (stderr, "Message receipt failed: %s\n", response->error);
+      fprintf (stderr, "Message receipt failed: " QUERY_SLICE_FMT "\n",
+               QUERY_SLICE_ARGS (response->error));
+      riemann_message_view_free (response);
       exit_status = EXIT_FAILURE;
       goto end;
     }
 
-  dump (response->n_events, (const riemann_event_t **)response->events);
+  dump (response->n_events, response->events);
 
-  riemann_message_free (response);
+  riemann_message_view_free (response);
 
  end:
   riemann_client_free (client);
@@ -39,89 +39,268 @@ help_send (void)
           "  -o, --option option=value         Set a client option to a given value.\n"
           "\n"
           "  -0, --stdin                       Read metric/state from STDIN continuously.\n"
+          "  -b, --batch-events=EVENTS         Send up to EVENTS events read from STDIN at once.\n"
+          "  -w, --batch-delay=MSEC            Wait at most MSEC milliseconds to fill a batch.\n"
           "\n"
           "  -?, --help                        This help screen.\n");
 }
 
+/* Standard input is read into a buffer of our own, rather than through
+   stdio: poll() only knows about the file descriptor, and would keep
+   waiting while lines sat in stdio's buffer. */
+typedef struct
+{
+  char data[4096];
+  size_t start;
+  size_t len;
+  int eof;
+} send_input_t;
+
+/* Returns the next complete line in the buffer, without its newline,
+   or NULL if more has to be read first. Once the input ended, or
+   filled the buffer without a newline, what is left counts as a
+   line too. */
+static char *
+_send_input_line (send_input_t *input)
+{
+  char *line = input->data + input->start, *nl;
+  size_t n;
+
+  if (input->len == 0)
+    return NULL;
+
+  nl = (char *) memchr (line, '\n', input->len);
+  if (nl)
+    n = nl - line + 1;
+  else if (input->eof || input->len == sizeof (input->data) - 1)
+    n = input->len;
+  else
+    return NULL;
+
+  line[(nl) ? n - 1 : n] = '\0';
+  input->start += n;
+  input->len -= n;
+
+  return line;
+}
+
 static int
-_send_continously (riemann_client_type_t client_type,
-                   riemann_client_t *client,
-                   riemann_event_t *source_event)
+_send_input_fill (send_input_t *input)
 {
-  char buffer[1024];
-  int e = 0;
+  ssize_t n;
 
-  while (fgets (buffer, sizeof (buffer) - 1, stdin) != NULL)
+  if (input->start > 0)
     {
-      riemann_message_t *response, *message;
-      riemann_event_t *event;
-      char *endptr;
-      double d;
-      long long int l;
+      memmove (input->data, input->data + input->start, input->len);
+      input->start = 0;
+    }
 
-      buffer[strlen (buffer) - 1] = '\0';
-      if (strlen (buffer) == 0)
-        continue;
+  n = read (STDIN_FILENO, input->data + input->len,
+            sizeof (input->data) - 1 - input->len);
+  if (n < 0)
+    return (errno == EINTR) ? 0 : -errno;
+  if (n == 0)
+    input->eof = 1;
 
-      event = riemann_event_clone (source_event);
+  input->len += n;
+  return 0;
+}
 
-      errno = 0;
-      l = strtoll (buffer, &endptr, 10);
-      if (((l == 0) && (endptr == buffer)) || (errno == ERANGE) ||
+static int
+_send_line (riemann_batcher_t *batcher, riemann_event_template_t *tmpl,
+            const riemann_event_template_values_t *defaults, char *buffer)
+{
+  riemann_event_template_values_t values = *defaults;
+  char *endptr;
+  double d;
+  long long int l;
+
+  errno = 0;
+  l = strtoll (buffer, &endptr, 10);
+  if (((l == 0) && (endptr == buffer)) || (errno == ERANGE) ||
+      (endptr[0] != '\0' && endptr[0] != ' '))
+    {
+      d = strtod (buffer, &endptr);
+      if (((d == 0) && (endptr == buffer)) || (errno == ERANGE) ||
           (endptr[0] != '\0' && endptr[0] != ' '))
         {
-          d = strtod (buffer, &endptr);
-          if (((d == 0) && (endptr == buffer)) || (errno == ERANGE) ||
-              (endptr[0] != '\0' && endptr[0] != ' '))
-            riemann_event_set_one (event,
-                                   STATE, buffer);
-          else
-            {
-              riemann_event_set_one (event, METRIC_D, (double) d);
-              if (endptr[0] != '\0')
-                riemann_event_set_one (event, STATE, endptr + 1);
-            }
+          values.fields |= RIEMANN_EVENT_FIELD_MASK (STATE);
+          values.state = buffer;
         }
       else
         {
-          riemann_event_set_one (event, METRIC_S64, (int64_t) l);
+          values.fields |= RIEMANN_EVENT_FIELD_MASK (METRIC_D);
+          values.metric_d = d;
           if (endptr[0] != '\0')
-            riemann_event_set_one (event, STATE, endptr + 1);
+            {
+              values.fields |= RIEMANN_EVENT_FIELD_MASK (STATE);
+              values.state = endptr + 1;
+            }
+        }
+    }
+  else
+    {
+      values.fields |= RIEMANN_EVENT_FIELD_MASK (METRIC_S64);
+      values.metric_sint64 = (int64_t) l;
+      if (endptr[0] != '\0')
+        {
+          values.fields |= RIEMANN_EVENT_FIELD_MASK (STATE);
+          values.state = endptr + 1;
         }
+    }
 
-      message = riemann_message_create_with_events (event, NULL);
-      e = riemann_client_send_message_oneshot (client, message);
+  return riemann_batcher_add_event_template (batcher, tmpl, &values);
+}
 
-      if (e != 0)
-        break;
+/* Reports the receipt of every batch the way a single message's would
+   be, and remembers whether there was anything to report. */
+static void
+_send_receipt (riemann_client_t *client, riemann_message_t *response,
+               int error, void *userdata)
+{
+  int *reported = (int *) userdata;
 
-      if (client_type == RIEMANN_CLIENT_UDP)
-        continue;
+  (void) client;
 
-      response = riemann_client_recv_message (client);
-      if (!response)
+  if (!response)
+    {
+      fprintf (stderr, "Error when asking for a message receipt: %s\n",
+               strerror (-error));
+      *reported = 1;
+      return;
+    }
+
+  if (response->ok != 1)
+    {
+      fprintf (stderr, "Message receipt failed: %s\n", response->error);
+      *reported = 1;
+    }
+
+  riemann_message_free (response);
+}
+
+static int
+_send_continously (riemann_client_t *client,
+                   riemann_event_t *source_event,
+                   size_t batch_events, unsigned int batch_delay)
+{
+  send_input_t input;
+  char *line;
+  int e = 0, timer_fd, reported = 0;
+  riemann_event_template_t *tmpl;
+  riemann_event_template_values_t defaults;
+  riemann_batcher_t *batcher;
+
+  /* Only the state and the metric change from line to line, everything
+     else is encoded once, up front. */
+  tmpl = riemann_event_template_new (source_event,
+                                     RIEMANN_EVENT_FIELD_MASK (STATE) |
+                                     RIEMANN_EVENT_FIELD_MASK (METRIC_S64) |
+                                     RIEMANN_EVENT_FIELD_MASK (METRIC_D));
+  if (!tmpl)
+    {
+      e = -errno;
+      fprintf (stderr, "Error preparing events: %s\n", strerror (-e));
+      riemann_event_free (source_event);
+      return e;
+    }
+
+  memset (&defaults, 0, sizeof (defaults));
+  if (source_event->state)
+    {
+      defaults.fields |= RIEMANN_EVENT_FIELD_MASK (STATE);
+      defaults.state = source_event->state;
+    }
+  if (source_event->has_metric_sint64)
+    {
+      defaults.fields |= RIEMANN_EVENT_FIELD_MASK (METRIC_S64);
+      defaults.metric_sint64 = source_event->metric_sint64;
+    }
+  if (source_event->has_metric_d)
+    {
+      defaults.fields |= RIEMANN_EVENT_FIELD_MASK (METRIC_D);
+      defaults.metric_d = source_event->metric_d;
+    }
+
+  batcher = riemann_batcher_new (client, batch_events, 0, batch_delay);
+  if (!batcher)
+    {
+      e = -errno;
+      fprintf (stderr, "Error setting up batching: %s\n", strerror (-e));
+      riemann_event_template_free (tmpl);
+      riemann_event_free (source_event);
+      return e;
+    }
+  riemann_batcher_set_callback (batcher, _send_receipt, &reported);
+  timer_fd = riemann_batcher_get_fd (batcher);
+
+  memset (&input, 0, sizeof (input));
+
+  for (;;)
+    {
+      /* Every line already read goes into the batch before waiting
+         for more. */
+      while (e == 0 && (line = _send_input_line (&input)) != NULL)
         {
-          fprintf (stderr, "Error when asking for a message receipt: %s\n",
-                   strerror (errno));
-          e = -EPROTO;
-          break;
+          if (line[0] != '\0')
+            e = _send_line (batcher, tmpl, &defaults, line);
         }
+      if (e != 0 || input.eof)
+        break;
 
-      if (response->ok != 1)
+      /* While events wait in a batch, input is only waited for until
+         they waited long enough. */
+      if (riemann_batcher_size (batcher) > 0 && batch_delay)
         {
-          fprintf (stderr, "Message receipt failed: %s\n", response->error);
-          riemann_message_free (response);
-          e = -EPROTO;
-          break;
+          struct pollfd fds[2];
+
+          fds[0].fd = STDIN_FILENO;
+          fds[0].events = POLLIN;
+          fds[0].revents = 0;
+          fds[1].fd = timer_fd;
+          fds[1].events = POLLIN;
+          fds[1].revents = 0;
+
+          poll (fds, 2, (timer_fd >= 0) ? -1 :
+                riemann_batcher_get_timeout (batcher));
+          if ((e = riemann_batcher_process (batcher)) != 0)
+            break;
+          if (fds[0].revents == 0)
+            continue;
         }
 
-      riemann_message_free (response);
+      if ((e = _send_input_fill (&input)) != 0)
+        break;
     }
 
+  if (e == 0)
+    e = riemann_batcher_flush (batcher);
+
+  if (e != 0 && !reported)
+    fprintf (stderr, "Error sending message: %s\n", strerror (-e));
+
+  riemann_batcher_free (batcher);
+  riemann_event_template_free (tmpl);
   riemann_event_free (source_event);
   return e;
 }
 
+/* Parses the number given to an option, which must be between `min'
+   and `max'. */
+static int
+_send_parse_count (const char *arg, long min, long max, long *value)
+{
+  char *endptr;
+
+  errno = 0;
+  *value = strtol (arg, &endptr, 10);
+  if (errno != 0 || endptr == arg || endptr[0] != '\0' ||
+      *value < min || *value > max)
+    return -EINVAL;
+
+  return 0;
+}
+
 static int
 client_send (int argc, char *argv[])
 {
@@ -139,6 +318,8 @@ client_send (int argc, char *argv[])
     char *priorities;
   } tls = {NULL, NULL, NULL, NULL};
   int stdin = 0;
+  size_t batch_events = 1;
+  unsigned int batch_delay = 0;
 
   event = riemann_event_new ();
 
@@ -165,12 +346,14 @@ client_send (int argc, char *argv[])
         {"ttl", required_argument, NULL, 'L'},
         {"option", required_argument, NULL, 'o'},
         {"stdin", no_argument, NULL, '0'},
+        {"batch-events", required_argument, NULL, 'b'},
+        {"batch-delay", required_argument, NULL, 'w'},
         {"help", no_argument, NULL, '?'},
         {"version", no_argument, NULL, 'V'},
         {NULL, 0, NULL, 0}
       };
 
-      c = getopt_long (argc, argv, "s:S:h:D:a:t:i:d:f:?VUTGL:o:0",
+      c = getopt_long (argc, argv, "s:S:h:D:a:t:i:d:f:?VUTGL:o:0b:w:",
                        long_options, &option_index);
 
       if (c == -1)
@@ -266,6 +449,33 @@ client_send (int argc, char *argv[])
           stdin = 1;
           break;
 
+        case 'b':
+          {
+            long n;
+
+            if (_send_parse_count (optarg, 1, LONG_MAX, &n) != 0)
+              {
+                fprintf (stderr, "Invalid number of batch events: %s\n",
+                         optarg);
+                return EXIT_FAILURE;
+              }
+            batch_events = (size_t) n;
+            break;
+          }
+
+        case 'w':
+          {
+            long n;
+
+            if (_send_parse_count (optarg, 0, INT_MAX, &n) != 0)
+              {
+                fprintf (stderr, "Invalid batch delay: %s\n", optarg);
+                return EXIT_FAILURE;
+              }
+            batch_delay = (unsigned int) n;
+            break;
+          }
+
         case '?':
           help_display (argv[0], help_send);
           return EXIT_SUCCESS;
@@ -314,11 +524,10 @@ client_send (int argc, char *argv[])
 
   if (stdin)
     {
-      e = _send_continously (client_type, client, event);
+      e = _send_continously (client, event, batch_events, batch_delay);
 
       if (e != 0)
         {
-          fprintf (stderr, "Error sending message: %s\n", (char *)strerror (-e));
           exit_status = EXIT_FAILURE;
           goto end;
         }
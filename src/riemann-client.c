@@ -19,11 +19,13 @@
 
 #include <errno.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <getopt.h>
+#include <poll.h>
 #include <time.h>
 
 #include "riemann/platform.h"
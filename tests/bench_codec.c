@@ -0,0 +1,368 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "riemann/_simd.h"
+#include "riemann/_wire.h"
+#include "riemann/writer.h"
+
+/* Encoding benchmark: compares the protobuf-c generated encoder with
+   the specialised one and the batch writer, on a message of typical
+   events; then the numeric field kernels against protobuf-c packing
+   the same fields; and finally, the decoders, on a query response of
+   several megabytes.
+
+   Usage: bench_codec [EVENTS [ITERATIONS]] */
+
+static char *
+_bench_strdup (const char *str)
+{
+  return strcpy ((char *) malloc (strlen (str) + 1), str);
+}
+
+static riemann_message_t *
+_bench_message_new (size_t n_events)
+{
+  riemann_message_t *message;
+  size_t i;
+
+  message = (riemann_message_t *) malloc (sizeof (riemann_message_t));
+  msg__init (message);
+
+  message->n_events = n_events;
+  message->events = (riemann_event_t **)
+    malloc (sizeof (riemann_event_t *) * n_events);
+
+  for (i = 0; i < n_events; i++)
+    {
+      riemann_event_t *event;
+      char buffer[64];
+      size_t j;
+
+      event = (riemann_event_t *) malloc (sizeof (riemann_event_t));
+      event__init (event);
+
+      snprintf (buffer, sizeof (buffer), "service-%zu", i % 100);
+      event->service = _bench_strdup (buffer);
+      event->host = _bench_strdup ("web-frontend-01.example.com");
+      event->state = _bench_strdup ("ok");
+      event->description = _bench_strdup ("Requests per second served");
+      event->has_time = 1;
+      event->time = 1497000000 + i;
+      event->has_ttl = 1;
+      event->ttl = 60;
+      event->has_metric_d = 1;
+      event->metric_d = i * 1.5;
+
+      event->n_tags = 3;
+      event->tags = (char **) malloc (sizeof (char *) * event->n_tags);
+      event->tags[0] = _bench_strdup ("production");
+      event->tags[1] = _bench_strdup ("frontend");
+      event->tags[2] = _bench_strdup ("http");
+
+      event->n_attributes = 2;
+      event->attributes = (riemann_attribute_t **)
+        malloc (sizeof (riemann_attribute_t *) * event->n_attributes);
+      for (j = 0; j < event->n_attributes; j++)
+        {
+          event->attributes[j] = (riemann_attribute_t *)
+            malloc (sizeof (riemann_attribute_t));
+          attribute__init (event->attributes[j]);
+        }
+      event->attributes[0]->key = _bench_strdup ("datacenter");
+      event->attributes[0]->value = _bench_strdup ("eu-west-1");
+      event->attributes[1]->key = _bench_strdup ("version");
+      event->attributes[1]->value = _bench_strdup ("1.10.1");
+
+      message->events[i] = event;
+    }
+
+  return message;
+}
+
+static void
+_bench_write_batch (riemann_batch_writer_t *writer,
+                    const riemann_message_t *message)
+{
+  size_t i, j;
+
+  riemann_batch_writer_reset (writer);
+
+  for (i = 0; i < message->n_events; i++)
+    {
+      const riemann_event_t *event = message->events[i];
+
+      riemann_batch_writer_begin_event (writer);
+      riemann_batch_writer_set_time (writer, event->time);
+      riemann_batch_writer_set_state (writer, event->state);
+      riemann_batch_writer_set_service (writer, event->service);
+      riemann_batch_writer_set_host (writer, event->host);
+      riemann_batch_writer_set_description (writer, event->description);
+      for (j = 0; j < event->n_tags; j++)
+        riemann_batch_writer_add_tag (writer, event->tags[j]);
+      riemann_batch_writer_set_ttl (writer, event->ttl);
+      for (j = 0; j < event->n_attributes; j++)
+        riemann_batch_writer_add_attribute (writer,
+                                            event->attributes[j]->key,
+                                            event->attributes[j]->value);
+      riemann_batch_writer_set_metric_d (writer, event->metric_d);
+      riemann_batch_writer_end_event (writer);
+    }
+}
+
+/* Encodes the time and metric_sint64 columns of `n' events, without
+   any constant fields, the way the batch writer does. */
+static size_t
+_bench_kernels (const riemann_simd_kernels_t *kernels, const int64_t *time,
+                const int64_t *metric, size_t n, uint8_t *out)
+{
+  uint64_t zz[256];
+  uint8_t time_sizes[256], zz_sizes[256];
+  size_t offset, len = 0;
+
+  for (offset = 0; offset < n; offset += 256)
+    {
+      riemann_simd_event_block_t block;
+
+      memset (&block, 0, sizeof (block));
+      block.n = (n - offset < 256) ? n - offset : 256;
+
+      kernels->varint_sizes ((const uint64_t *) time + offset, time_sizes,
+                             block.n);
+      kernels->zigzag (metric + offset, zz, block.n);
+      kernels->varint_sizes (zz, zz_sizes, block.n);
+
+      block.time = (const uint64_t *) time + offset;
+      block.time_sizes = time_sizes;
+      block.metric_sint64 = zz;
+      block.metric_sint64_sizes = zz_sizes;
+
+      len += kernels->write_events (out + len, &block);
+    }
+
+  return len;
+}
+
+static double
+_bench_now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+_bench_report (const char *name, double elapsed, size_t n_events,
+               size_t iterations, size_t len)
+{
+  printf ("%-24s %10.1f ns/event %10.1f MB/s\n", name,
+          elapsed * 1e9 / (n_events * iterations),
+          len * iterations / elapsed / (1024 * 1024));
+}
+
+static void
+_bench_numeric (size_t n_events, size_t iterations)
+{
+  const riemann_simd_kernels_t *kernels = _riemann_simd_kernels ();
+  int64_t *time, *metric;
+  uint8_t *expected, *buffer;
+  size_t i, j, len = 0;
+  double start;
+  char name[64];
+
+  time = (int64_t *) malloc (sizeof (int64_t) * n_events);
+  metric = (int64_t *) malloc (sizeof (int64_t) * n_events);
+  for (i = 0; i < n_events; i++)
+    {
+      time[i] = 1497000000000000LL + i * 1000;
+      metric[i] = (int64_t) (i * i * 37) * ((i % 3) ? 1 : -1);
+    }
+
+  /* Every event is at most 1 + 2 + 2 * (1 + 10) bytes */
+  expected = (uint8_t *) malloc (n_events * 32 + RIEMANN_SIMD_SLACK);
+  buffer = (uint8_t *) malloc (n_events * 32 + RIEMANN_SIMD_SLACK);
+
+  printf ("\n%zu events of time and metric_sint64, %zu iterations\n",
+          n_events, iterations);
+
+  start = _bench_now ();
+  for (i = 0; i < iterations; i++)
+    for (j = 0, len = 0; j < n_events; j++)
+      {
+        riemann_event_t event;
+        size_t event_len;
+
+        event__init (&event);
+        event.has_time = 1;
+        event.time = time[j];
+        event.has_metric_sint64 = 1;
+        event.metric_sint64 = metric[j];
+
+        event_len = event__get_packed_size (&event);
+        buffer[len++] = RIEMANN_WIRE_TAG (6, RIEMANN_WIRE_LENGTH_DELIMITED);
+        len += _riemann_wire_write_varint (buffer + len, event_len);
+        len += event__pack (&event, buffer + len);
+      }
+  _bench_report ("protobuf-c", _bench_now () - start, n_events, iterations, len);
+
+  start = _bench_now ();
+  for (i = 0; i < iterations; i++)
+    len = _bench_kernels (&_riemann_simd_kernels_scalar, time, metric,
+                          n_events, expected);
+  _bench_report ("scalar kernels", _bench_now () - start, n_events,
+                 iterations, len);
+
+  start = _bench_now ();
+  for (i = 0; i < iterations; i++)
+    len = _bench_kernels (kernels, time, metric, n_events, buffer);
+  snprintf (name, sizeof (name), "%s kernels", kernels->name);
+  _bench_report (name, _bench_now () - start, n_events, iterations, len);
+
+  if (memcmp (expected, buffer, len) != 0)
+    {
+      fprintf (stderr, "Kernels disagree!\n");
+      exit (EXIT_FAILURE);
+    }
+
+  free (expected);
+  free (buffer);
+  free (time);
+  free (metric);
+}
+
+static void
+_bench_report_decode (const char *name, double elapsed, size_t n_events,
+                      size_t iterations, size_t len)
+{
+  printf ("%-24s %10.2f M events/s %8.1f MB/s\n", name,
+          n_events * iterations / elapsed / 1e6,
+          len * iterations / elapsed / (1024 * 1024));
+}
+
+static void
+_bench_decode (size_t n_events, size_t iterations)
+{
+  riemann_message_t *message, *decoded;
+  uint8_t *buffer, *repacked;
+  size_t i, len;
+  double start;
+
+  message = _bench_message_new (n_events);
+  len = msg__get_packed_size (message);
+  buffer = (uint8_t *) malloc (len);
+  msg__pack (message, buffer);
+  msg__free_unpacked (message, NULL);
+
+  printf ("\n%zu events in a %.1f MB response, %zu iterations\n",
+          n_events, len / (1024.0 * 1024.0), iterations);
+
+  start = _bench_now ();
+  for (i = 0; i < iterations; i++)
+    msg__free_unpacked (msg__unpack (NULL, len, buffer), NULL);
+  _bench_report_decode ("protobuf-c", _bench_now () - start, n_events,
+                        iterations, len);
+
+  start = _bench_now ();
+  for (i = 0; i < iterations; i++)
+    {
+      decoded = _riemann_wire_message_unpack (NULL, buffer, len);
+      if (!decoded)
+        abort ();
+      msg__free_unpacked (decoded, NULL);
+    }
+  _bench_report_decode ("specialised", _bench_now () - start, n_events,
+                        iterations, len);
+
+  decoded = _riemann_wire_message_unpack (NULL, buffer, len);
+  repacked = (uint8_t *) malloc (len);
+  if (msg__pack (decoded, repacked) != len ||
+      memcmp (buffer, repacked, len) != 0)
+    {
+      fprintf (stderr, "Decoders disagree!\n");
+      exit (EXIT_FAILURE);
+    }
+  msg__free_unpacked (decoded, NULL);
+
+  free (repacked);
+  free (buffer);
+}
+
+int
+main (int argc, char *argv[])
+{
+  riemann_message_t *message;
+  riemann_batch_writer_t *writer;
+  size_t n_events = 1000, iterations = 1000, i, len;
+  uint8_t *expected, *buffer;
+  double start;
+
+  if (argc > 1)
+    n_events = strtoul (argv[1], NULL, 10);
+  if (argc > 2)
+    iterations = strtoul (argv[2], NULL, 10);
+
+  message = _bench_message_new (n_events);
+
+  len = msg__get_packed_size (message);
+  expected = (uint8_t *) malloc (len);
+  buffer = (uint8_t *) malloc (len + sizeof (uint32_t));
+  msg__pack (message, expected);
+
+  printf ("%zu events, %zu bytes, %zu iterations\n", n_events, len, iterations);
+
+  start = _bench_now ();
+  for (i = 0; i < iterations; i++)
+    {
+      if (msg__get_packed_size (message) > len)
+        abort ();
+      msg__pack (message, buffer);
+    }
+  _bench_report ("protobuf-c", _bench_now () - start, n_events, iterations, len);
+
+  start = _bench_now ();
+  for (i = 0; i < iterations; i++)
+    {
+      riemann_wire_buffer_t out = { buffer, len + sizeof (uint32_t), 0, 1 };
+
+      _riemann_wire_message_frame (&out, message);
+      if (!out.borrowed)
+        abort ();
+    }
+  _bench_report ("specialised", _bench_now () - start, n_events, iterations, len);
+
+  if (memcmp (expected, buffer + sizeof (uint32_t), len) != 0)
+    {
+      fprintf (stderr, "Encoders disagree!\n");
+      return EXIT_FAILURE;
+    }
+
+  writer = riemann_batch_writer_new ();
+  start = _bench_now ();
+  for (i = 0; i < iterations; i++)
+    _bench_write_batch (writer, message);
+  _bench_report ("batch writer", _bench_now () - start, n_events, iterations, len);
+
+  if (memcmp (expected, riemann_batch_writer_get_buffer (writer, NULL) +
+              sizeof (uint32_t), len) != 0)
+    {
+      fprintf (stderr, "Encoders disagree!\n");
+      return EXIT_FAILURE;
+    }
+  riemann_batch_writer_free (writer);
+
+  free (expected);
+  free (buffer);
+  msg__free_unpacked (message, NULL);
+
+  _bench_numeric (n_events, iterations);
+
+  /* Responses to broad queries are large: decode the same number of
+     events as all the iterations above, in fewer, larger batches. */
+  _bench_decode (32768, (n_events * iterations) / 32768 + 1);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,276 @@
+#include <riemann/arena.h>
+
+START_TEST (test_riemann_arena_new_and_free)
+{
+  riemann_arena_t *arena;
+
+  ck_assert ((arena = riemann_arena_new (0)) != NULL);
+  riemann_arena_free (arena);
+
+  errno = 0;
+  riemann_arena_free (NULL);
+  ck_assert_errno (-errno, EINVAL);
+
+  errno = 0;
+  riemann_arena_reset (NULL);
+  ck_assert_errno (-errno, EINVAL);
+}
+END_TEST
+
+START_TEST (test_riemann_arena_alloc)
+{
+  riemann_arena_t *arena;
+  uint8_t *a, *b, *big;
+  char *str;
+
+  errno = 0;
+  ck_assert (riemann_arena_alloc (NULL, 16) == NULL);
+  ck_assert_errno (-errno, EINVAL);
+
+  arena = riemann_arena_new (64);
+
+  errno = 0;
+  ck_assert (riemann_arena_strdup (arena, NULL) == NULL);
+  ck_assert_errno (-errno, EINVAL);
+
+  a = riemann_arena_alloc (arena, 3);
+  b = riemann_arena_alloc (arena, 3);
+  ck_assert (a != NULL);
+  ck_assert (b != NULL);
+  ck_assert (a != b);
+  ck_assert_int_eq (((uintptr_t) b) % (2 * sizeof (void *)), 0);
+
+  big = riemann_arena_alloc (arena, 1024);
+  ck_assert (big != NULL);
+  memset (big, 0xff, 1024);
+
+  str = riemann_arena_strdup (arena, "foobar");
+  ck_assert_str_eq (str, "foobar");
+
+  riemann_arena_reset (arena);
+  ck_assert (riemann_arena_alloc (arena, 3) == a);
+
+  riemann_arena_free (arena);
+}
+END_TEST
+
+START_TEST (test_riemann_arena_events)
+{
+  riemann_arena_t *arena;
+  riemann_event_t *event;
+
+  errno = 0;
+  ck_assert (riemann_event_new_in (NULL) == NULL);
+  ck_assert_errno (-errno, EINVAL);
+
+  errno = 0;
+  ck_assert (riemann_event_create_in (NULL, RIEMANN_EVENT_FIELD_NONE) == NULL);
+  ck_assert_errno (-errno, EINVAL);
+
+  arena = riemann_arena_new (0);
+
+  errno = 0;
+  ck_assert (riemann_event_create_in (arena, 255) == NULL);
+  ck_assert_errno (-errno, EPROTO);
+
+  event = riemann_event_create_in
+    (arena,
+     RIEMANN_EVENT_FIELD_HOST, "localhost",
+     RIEMANN_EVENT_FIELD_SERVICE, "test",
+     RIEMANN_EVENT_FIELD_TAGS, "tag-1", "tag-2", NULL,
+     RIEMANN_EVENT_FIELD_STRING_ATTRIBUTES, "key", "value", NULL,
+     RIEMANN_EVENT_FIELD_METRIC_S64, (int64_t) 42,
+     RIEMANN_EVENT_FIELD_NONE);
+  ck_assert (event != NULL);
+  ck_assert_str_eq (event->host, "localhost");
+  ck_assert_str_eq (event->service, "test");
+  ck_assert_int_eq (event->n_tags, 2);
+  ck_assert_str_eq (event->tags[1], "tag-2");
+  ck_assert_int_eq (event->n_attributes, 1);
+  ck_assert_str_eq (event->attributes[0]->key, "key");
+  ck_assert_int_eq (event->metric_sint64, 42);
+
+  ck_assert_errno (riemann_event_set_in (NULL, event,
+                                         RIEMANN_EVENT_FIELD_NONE), EINVAL);
+  ck_assert_errno (riemann_event_set_in (arena, event,
+                                         RIEMANN_EVENT_FIELD_HOST, "remote",
+                                         RIEMANN_EVENT_FIELD_NONE), 0);
+  ck_assert_str_eq (event->host, "remote");
+
+  ck_assert_errno (riemann_event_tag_add_in (NULL, event, "tag-3"), EINVAL);
+  ck_assert_errno (riemann_event_tag_add_in (arena, event, NULL), EINVAL);
+  ck_assert_errno (riemann_event_tag_add_in (arena, event, "tag-3"), 0);
+  ck_assert_int_eq (event->n_tags, 3);
+  ck_assert_str_eq (event->tags[0], "tag-1");
+  ck_assert_str_eq (event->tags[2], "tag-3");
+
+  ck_assert_errno (riemann_event_attribute_add_in (arena, event, NULL), EINVAL);
+  ck_assert_errno
+    (riemann_event_attribute_add_in
+     (arena, event, riemann_attribute_create_in (arena, "other", "attrib")), 0);
+  ck_assert_int_eq (event->n_attributes, 2);
+  ck_assert_str_eq (event->attributes[1]->value, "attrib");
+
+  errno = 0;
+  ck_assert (riemann_attribute_create_in (NULL, "key", "value") == NULL);
+  ck_assert_errno (-errno, EINVAL);
+
+  riemann_arena_free (arena);
+}
+END_TEST
+
+START_TEST (test_riemann_arena_events_grow)
+{
+  riemann_arena_t *arena;
+  riemann_event_t *event;
+  uint8_t *start, *end;
+  size_t i;
+
+  /* One chunk, large enough for the old copies of the tag array too,
+     if it grew one element at a time. */
+  arena = riemann_arena_new (8 * 1024 * 1024);
+
+  event = riemann_event_new_in (arena);
+  start = (uint8_t *) riemann_arena_alloc (arena, 1);
+
+  for (i = 0; i < 1000; i++)
+    ck_assert_errno (riemann_event_tag_add_in (arena, event, "tag"), 0);
+
+  end = (uint8_t *) riemann_arena_alloc (arena, 1);
+
+  ck_assert_int_eq (event->n_tags, 1000);
+  for (i = 0; i < 1000; i++)
+    ck_assert_str_eq (event->tags[i], "tag");
+
+  /* 1000 tags of 16 bytes, and arrays of up to 1024 pointers, twice
+     over. */
+  ck_assert ((size_t)(end - start) < 1000 * 16 + 2 * 2 * 1024 * sizeof (char *));
+
+  riemann_arena_free (arena);
+}
+END_TEST
+
+START_TEST (test_riemann_arena_messages)
+{
+  riemann_arena_t *arena;
+  riemann_message_t *message, *heap_message;
+  riemann_event_t *events[2];
+  uint8_t *arena_buffer, *heap_buffer;
+  size_t arena_len, heap_len;
+
+  errno = 0;
+  ck_assert (riemann_message_new_in (NULL) == NULL);
+  ck_assert_errno (-errno, EINVAL);
+
+  arena = riemann_arena_new (128);
+  message = riemann_message_new_in (arena);
+
+  events[0] = riemann_event_create_in (arena,
+                                       RIEMANN_EVENT_FIELD_HOST, "localhost",
+                                       RIEMANN_EVENT_FIELD_NONE);
+  events[1] = riemann_event_create_in (arena,
+                                       RIEMANN_EVENT_FIELD_SERVICE, "test",
+                                       RIEMANN_EVENT_FIELD_TAGS, "tag", NULL,
+                                       RIEMANN_EVENT_FIELD_NONE);
+
+  ck_assert_errno (riemann_message_append_events_n_in (NULL, message, 2, events),
+                   EINVAL);
+  ck_assert_errno (riemann_message_append_events_n_in (arena, NULL, 2, events),
+                   EINVAL);
+  ck_assert_errno (riemann_message_append_events_n_in (arena, message, 0, events),
+                   ERANGE);
+  ck_assert_errno (riemann_message_append_events_n_in (arena, message, 2, NULL),
+                   EINVAL);
+
+  ck_assert_errno (riemann_message_append_events_n_in (arena, message, 1, events),
+                   0);
+  ck_assert_errno (riemann_message_append_events_n_in (arena, message, 1,
+                                                       &events[1]), 0);
+  ck_assert_int_eq (message->n_events, 2);
+  ck_assert (message->events[1] == events[1]);
+
+  heap_message = riemann_message_create_with_events
+    (riemann_event_create (RIEMANN_EVENT_FIELD_HOST, "localhost",
+                           RIEMANN_EVENT_FIELD_NONE),
+     riemann_event_create (RIEMANN_EVENT_FIELD_SERVICE, "test",
+                           RIEMANN_EVENT_FIELD_TAGS, "tag", NULL,
+                           RIEMANN_EVENT_FIELD_NONE),
+     NULL);
+
+  arena_buffer = riemann_message_to_buffer (message, &arena_len);
+  heap_buffer = riemann_message_to_buffer (heap_message, &heap_len);
+  ck_assert_int_eq (arena_len, heap_len);
+  ck_assert (memcmp (arena_buffer, heap_buffer, heap_len) == 0);
+
+  free (arena_buffer);
+  free (heap_buffer);
+  riemann_message_free (heap_message);
+
+  riemann_arena_reset (arena);
+  message = riemann_message_new_in (arena);
+  ck_assert_int_eq (message->n_events, 0);
+
+  riemann_arena_free (arena);
+}
+END_TEST
+
+START_TEST (test_riemann_arena_from_buffer)
+{
+  riemann_arena_t *arena;
+  riemann_message_t *message, *response;
+  uint8_t *buffer;
+  size_t len;
+
+  message = riemann_message_create_with_events
+    (riemann_event_create (RIEMANN_EVENT_FIELD_SERVICE, "test",
+                           RIEMANN_EVENT_FIELD_STATE, "ok",
+                           RIEMANN_EVENT_FIELD_TAGS, "tag-1", "tag-2", NULL,
+                           RIEMANN_EVENT_FIELD_NONE),
+     NULL);
+  buffer = riemann_message_to_buffer (message, &len);
+
+  arena = riemann_arena_new (0);
+
+  errno = 0;
+  ck_assert (riemann_message_from_buffer_in (NULL, buffer + sizeof (uint32_t),
+                                             len - sizeof (uint32_t)) == NULL);
+  ck_assert_errno (-errno, EINVAL);
+  ck_assert (riemann_message_from_buffer_in (arena, NULL, 1) == NULL);
+  ck_assert_errno (-errno, EINVAL);
+  ck_assert (riemann_message_from_buffer_in (arena, buffer, 0) == NULL);
+  ck_assert_errno (-errno, EINVAL);
+
+  response = riemann_message_from_buffer_in (arena, buffer + sizeof (uint32_t),
+                                             len - sizeof (uint32_t));
+  ck_assert (response != NULL);
+  ck_assert_int_eq (response->n_events, 1);
+  ck_assert_str_eq (response->events[0]->service, "test");
+  ck_assert_str_eq (response->events[0]->state, "ok");
+  ck_assert_int_eq (response->events[0]->n_tags, 2);
+  ck_assert_str_eq (response->events[0]->tags[1], "tag-2");
+
+  memset (buffer, 128, len);
+  ck_assert (riemann_message_from_buffer_in (arena, buffer, len) == NULL);
+  ck_assert_errno (-errno, EPROTO);
+
+  riemann_arena_free (arena);
+  riemann_message_free (message);
+  free (buffer);
+}
+END_TEST
+
+static TCase *
+test_riemann_arena (void)
+{
+  TCase *tests;
+
+  tests = tcase_create ("Arena");
+  tcase_add_test (tests, test_riemann_arena_new_and_free);
+  tcase_add_test (tests, test_riemann_arena_alloc);
+  tcase_add_test (tests, test_riemann_arena_events);
+  tcase_add_test (tests, test_riemann_arena_events_grow);
+  tcase_add_test (tests, test_riemann_arena_messages);
+  tcase_add_test (tests, test_riemann_arena_from_buffer);
+
+  return tests;
+}
@@ -0,0 +1,425 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <riemann/async.h>
+
+START_TEST (test_riemann_async_client_new)
+{
+  riemann_client_t *client;
+  riemann_event_t *event;
+
+  ck_assert (riemann_async_client_new (NULL) == NULL);
+  ck_assert_errno (-errno, EINVAL);
+
+  client = riemann_client_new ();
+  ck_assert (riemann_async_client_new (client) == NULL);
+  ck_assert_errno (-errno, ENOTCONN);
+  riemann_client_free (client);
+
+  event = riemann_event_new ();
+  ck_assert_errno (riemann_async_client_send_event (NULL, event), EINVAL);
+  riemann_event_free (event);
+
+  errno = 0;
+  riemann_async_client_free (NULL);
+  ck_assert_errno (-errno, EINVAL);
+}
+END_TEST
+
+#define ASYNC_PRODUCERS 4
+#define ASYNC_EVENTS 250
+
+typedef struct
+{
+  riemann_async_client_t *async;
+  int id;
+} _async_producer_t;
+
+static void *
+_async_produce (void *data)
+{
+  _async_producer_t *producer = (_async_producer_t *) data;
+  char host[32];
+  int i;
+
+  for (i = 0; i < ASYNC_EVENTS; i++)
+    {
+      snprintf (host, sizeof (host), "producer-%d-%d", producer->id, i);
+      riemann_async_client_send_event
+        (producer->async,
+         riemann_event_create (RIEMANN_EVENT_FIELD_HOST, host,
+                               RIEMANN_EVENT_FIELD_SERVICE,
+                               "test_riemann_async_client",
+                               RIEMANN_EVENT_FIELD_METRIC_S64, (int64_t) i,
+                               RIEMANN_EVENT_FIELD_NONE));
+    }
+
+  return NULL;
+}
+
+static void
+_async_produce_all (riemann_client_type_t type)
+{
+  riemann_async_client_t *async;
+  _async_producer_t producers[ASYNC_PRODUCERS];
+  pthread_t threads[ASYNC_PRODUCERS];
+  int i;
+
+  async = riemann_async_client_new
+    (riemann_client_create (type, "127.0.0.1", 5555));
+  ck_assert (async != NULL);
+
+  for (i = 0; i < ASYNC_PRODUCERS; i++)
+    {
+      producers[i].async = async;
+      producers[i].id = i;
+      ck_assert_int_eq (pthread_create (&threads[i], NULL, _async_produce,
+                                        &producers[i]), 0);
+    }
+  for (i = 0; i < ASYNC_PRODUCERS; i++)
+    pthread_join (threads[i], NULL);
+
+  /* Freeing the client sends out everything queued. */
+  riemann_async_client_free (async);
+}
+
+START_TEST (test_riemann_async_client_send_event)
+{
+  riemann_client_t *client;
+  riemann_message_t *response;
+
+  _async_produce_all (RIEMANN_CLIENT_TCP);
+
+  client = riemann_client_create (RIEMANN_CLIENT_TCP, "127.0.0.1", 5555);
+  response = riemann_communicate_query
+    (client, "service = \"test_riemann_async_client\"");
+  ck_assert (response != NULL);
+  ck_assert_int_eq (response->ok, 1);
+  ck_assert_int_eq (response->n_events, ASYNC_PRODUCERS * ASYNC_EVENTS);
+  riemann_message_free (response);
+  riemann_client_free (client);
+
+  /* Over UDP, there is nothing to wait for. */
+  _async_produce_all (RIEMANN_CLIENT_UDP);
+}
+END_TEST
+
+#define ASYNC_FLOOD 2000
+
+static riemann_event_t *
+_async_flood_event (int i)
+{
+  return riemann_event_create (RIEMANN_EVENT_FIELD_HOST, "flood",
+                               RIEMANN_EVENT_FIELD_SERVICE,
+                               "test_riemann_async_client_limits",
+                               RIEMANN_EVENT_FIELD_METRIC_S64, (int64_t) i,
+                               RIEMANN_EVENT_FIELD_NONE);
+}
+
+/* Sends more events than the queue holds, as fast as possible, and
+   waits for whatever got queued to be sent. */
+static void
+_async_flood (riemann_async_policy_t policy, riemann_async_client_stats_t *stats)
+{
+  riemann_async_client_t *async;
+  int i, e, accepted = 0, tries;
+
+  async = riemann_async_client_new
+    (riemann_client_create (RIEMANN_CLIENT_TCP, "127.0.0.1", 5555));
+  ck_assert (async != NULL);
+  ck_assert_errno (riemann_async_client_set_limits (async, 8, 0, policy,
+                                                    5000), 0);
+
+  for (i = 0; i < ASYNC_FLOOD; i++)
+    {
+      e = riemann_async_client_send_event (async, _async_flood_event (i));
+      ck_assert (e == 0 || e == -ENOBUFS);
+      if (e == 0)
+        accepted++;
+
+      /* Whatever the I/O thread is up to, the queue never grows past
+         twice its limits. */
+      ck_assert_errno (riemann_async_client_get_stats (async, stats), 0);
+      ck_assert (stats->queued_events <= 16);
+    }
+
+  for (tries = 0; tries < 5000; tries++)
+    {
+      ck_assert_errno (riemann_async_client_get_stats (async, stats), 0);
+      if (stats->queued_events == 0 &&
+          stats->delivered + stats->failed + stats->dropped == ASYNC_FLOOD)
+        break;
+      poll (NULL, 0, 1);
+    }
+
+  ck_assert_int_eq (stats->enqueued, accepted);
+  ck_assert_int_eq (stats->queued_events, 0);
+  ck_assert_int_eq (stats->queued_bytes, 0);
+  ck_assert_int_eq (stats->failed, 0);
+  ck_assert_int_eq (stats->delivered + stats->dropped, ASYNC_FLOOD);
+
+  riemann_async_client_free (async);
+}
+
+START_TEST (test_riemann_async_client_limits)
+{
+  riemann_async_client_t *async;
+  riemann_async_client_stats_t stats;
+
+  async = riemann_async_client_new
+    (riemann_client_create (RIEMANN_CLIENT_TCP, "127.0.0.1", 5555));
+  ck_assert (async != NULL);
+
+  ck_assert_errno (riemann_async_client_set_limits
+                   (NULL, 1, 0, RIEMANN_ASYNC_POLICY_BLOCK, 0), EINVAL);
+  ck_assert_errno (riemann_async_client_set_limits
+                   (async, 1, 0, (riemann_async_policy_t) 42, 0), EINVAL);
+  ck_assert_errno (riemann_async_client_get_stats (NULL, &stats), EINVAL);
+  ck_assert_errno (riemann_async_client_get_stats (async, NULL), EINVAL);
+
+  /* An event that would not fit even in an empty queue is turned
+     away, whatever the policy. */
+  ck_assert_errno (riemann_async_client_set_limits
+                   (async, 0, 16, RIEMANN_ASYNC_POLICY_BLOCK, 0), 0);
+  ck_assert_errno (riemann_async_client_send_event
+                   (async,
+                    riemann_event_create (RIEMANN_EVENT_FIELD_DESCRIPTION,
+                                          "far too long to fit in the queue",
+                                          RIEMANN_EVENT_FIELD_NONE)),
+                   EMSGSIZE);
+  ck_assert_errno (riemann_async_client_get_stats (async, &stats), 0);
+  ck_assert_int_eq (stats.enqueued, 0);
+  ck_assert_int_eq (stats.dropped, 1);
+  riemann_async_client_free (async);
+
+  /* Blocking loses nothing. */
+  _async_flood (RIEMANN_ASYNC_POLICY_BLOCK, &stats);
+  ck_assert_int_eq (stats.delivered, ASYNC_FLOOD);
+  ck_assert_int_eq (stats.dropped, 0);
+
+  /* Dropping the oldest accepts up to twice the limits, but may not
+     send it all. */
+  _async_flood (RIEMANN_ASYNC_POLICY_DROP_OLDEST, &stats);
+  ck_assert (stats.enqueued >= 16);
+
+  /* The others turn events away instead. */
+  _async_flood (RIEMANN_ASYNC_POLICY_DROP_NEWEST, &stats);
+  ck_assert_int_eq (stats.enqueued + stats.dropped, ASYNC_FLOOD);
+  _async_flood (RIEMANN_ASYNC_POLICY_SHED, &stats);
+  ck_assert_int_eq (stats.enqueued + stats.dropped, ASYNC_FLOOD);
+}
+END_TEST
+
+START_TEST (test_riemann_async_client_reconnect)
+{
+  riemann_client_t *client;
+  riemann_async_client_t *async;
+  riemann_async_client_stats_t stats;
+  riemann_message_t *response;
+  char host[32];
+  int fd, i, tries;
+
+  client = riemann_client_create (RIEMANN_CLIENT_TCP, "127.0.0.1", 5555);
+  fd = riemann_client_get_fd (client);
+  async = riemann_async_client_new (client);
+  ck_assert (async != NULL);
+
+  ck_assert_errno (riemann_async_client_set_reconnect (NULL, 1, 2), EINVAL);
+  ck_assert_errno (riemann_async_client_set_reconnect (async, 10, 1), EINVAL);
+  ck_assert_errno (riemann_async_client_set_reconnect (async, 10, 100), 0);
+
+  /* The connection is cut from under the I/O thread, half way: the
+     events in flight, and those sent after, all make it. */
+  for (i = 0; i < 200; i++)
+    {
+      if (i == 100)
+        shutdown (fd, SHUT_RDWR);
+
+      snprintf (host, sizeof (host), "reconnect-%d", i);
+      ck_assert_errno (riemann_async_client_send_event
+                       (async,
+                        riemann_event_create
+                        (RIEMANN_EVENT_FIELD_HOST, host,
+                         RIEMANN_EVENT_FIELD_SERVICE,
+                         "test_riemann_async_client_reconnect",
+                         RIEMANN_EVENT_FIELD_NONE)), 0);
+    }
+
+  for (tries = 0; tries < 5000; tries++)
+    {
+      ck_assert_errno (riemann_async_client_get_stats (async, &stats), 0);
+      if (stats.delivered + stats.failed == 200)
+        break;
+      poll (NULL, 0, 1);
+    }
+
+  ck_assert_int_eq (stats.delivered, 200);
+  ck_assert_int_eq (stats.failed, 0);
+  ck_assert (stats.reconnects >= 1);
+  riemann_async_client_free (async);
+
+  client = riemann_client_create (RIEMANN_CLIENT_TCP, "127.0.0.1", 5555);
+  response = riemann_communicate_query
+    (client, "service = \"test_riemann_async_client_reconnect\"");
+  ck_assert (response != NULL);
+  ck_assert_int_eq (response->n_events, 200);
+  riemann_message_free (response);
+  riemann_client_free (client);
+}
+END_TEST
+
+/* The sends seen, by the number of the first event of their message,
+   with the fifth and the seventh failing, to cut the connection
+   twice, and whether replies are held back. */
+static pthread_mutex_t _async_order_lock = PTHREAD_MUTEX_INITIALIZER;
+static int _async_order[32];
+static int _async_order_n;
+static int _async_order_held;
+
+static int
+_async_order_sent (void)
+{
+  int n;
+
+  pthread_mutex_lock (&_async_order_lock);
+  n = _async_order_n;
+  pthread_mutex_unlock (&_async_order_lock);
+
+  return n;
+}
+
+static void
+_async_order_wait (int n)
+{
+  int tries;
+
+  for (tries = 0; tries < 5000 && _async_order_sent () < n; tries++)
+    poll (NULL, 0, 1);
+  ck_assert (_async_order_sent () >= n);
+}
+
+static ssize_t
+_async_order_send (int sockfd, const void *buf, size_t len, int flags)
+{
+  riemann_message_t *message = NULL;
+  int i = -1, n;
+
+  if (len > 4)
+    message = riemann_message_from_buffer ((uint8_t *) buf + 4, len - 4);
+  if (message)
+    {
+      if (message->n_events > 0)
+        sscanf (message->events[0]->host, "order-%d", &i);
+      riemann_message_free (message);
+    }
+
+  pthread_mutex_lock (&_async_order_lock);
+  n = ++_async_order_n;
+  if (n <= 32)
+    _async_order[n - 1] = i;
+  pthread_mutex_unlock (&_async_order_lock);
+
+  if (n == 5 || n == 7)
+    {
+      errno = ECONNRESET;
+      return -1;
+    }
+
+  return real_send (sockfd, buf, len, flags);
+}
+
+static ssize_t
+_async_order_recv (int sockfd, void *buf, size_t len, int flags)
+{
+  int held;
+
+  pthread_mutex_lock (&_async_order_lock);
+  held = _async_order_held;
+  pthread_mutex_unlock (&_async_order_lock);
+
+  if (held)
+    {
+      errno = EAGAIN;
+      return -1;
+    }
+
+  return real_recv (sockfd, buf, len, flags);
+}
+
+START_TEST (test_riemann_async_client_retry_order)
+{
+  riemann_async_client_t *async;
+  riemann_async_client_stats_t stats;
+  char host[32];
+  int i, tries;
+
+  /* With the replies held back, four messages are in flight when the
+     fifth fails. Of those sent again, the first is in flight when the
+     second fails, and the rest are still waiting. */
+  _async_order_held = 1;
+  mock (recv, _async_order_recv);
+  mock (send, _async_order_send);
+
+  async = riemann_async_client_new
+    (riemann_client_create (RIEMANN_CLIENT_TCP, "127.0.0.1", 5555));
+  ck_assert (async != NULL);
+  ck_assert_errno (riemann_async_client_set_reconnect (async, 1, 2), 0);
+
+  for (i = 0; i < 5; i++)
+    {
+      snprintf (host, sizeof (host), "order-%d", i);
+      ck_assert_errno (riemann_async_client_send_event
+                       (async,
+                        riemann_event_create
+                        (RIEMANN_EVENT_FIELD_HOST, host,
+                         RIEMANN_EVENT_FIELD_SERVICE,
+                         "test_riemann_async_client_retry_order",
+                         RIEMANN_EVENT_FIELD_NONE)), 0);
+      _async_order_wait (i + 1);
+    }
+  _async_order_wait (12);
+  pthread_mutex_lock (&_async_order_lock);
+  _async_order_held = 0;
+  pthread_mutex_unlock (&_async_order_lock);
+
+  for (tries = 0; tries < 5000; tries++)
+    {
+      ck_assert_errno (riemann_async_client_get_stats (async, &stats), 0);
+      if (stats.delivered + stats.failed == 5)
+        break;
+      poll (NULL, 0, 1);
+    }
+
+  ck_assert_int_eq (stats.delivered, 5);
+  ck_assert_int_eq (stats.failed, 0);
+  ck_assert_int_eq (stats.reconnects, 2);
+
+  /* After the second loss, everything goes out in the order it was
+     first sent. */
+  ck_assert_int_eq (_async_order_sent (), 12);
+  for (i = 0; i < 5; i++)
+    ck_assert_int_eq (_async_order[7 + i], i);
+
+  riemann_async_client_free (async);
+  restore (recv);
+  restore (send);
+}
+END_TEST
+
+static TCase *
+test_riemann_async (void)
+{
+  TCase *tests;
+
+  tests = tcase_create ("Async");
+  tcase_add_test (tests, test_riemann_async_client_new);
+
+  if (network_tests_enabled ())
+    {
+      tcase_add_test (tests, test_riemann_async_client_send_event);
+      tcase_add_test (tests, test_riemann_async_client_limits);
+      tcase_add_test (tests, test_riemann_async_client_reconnect);
+      tcase_add_test (tests, test_riemann_async_client_retry_order);
+    }
+
+  return tests;
+}
@@ -76,11 +76,13 @@ START_TEST (test_riemann_attribute_clone)
 
   ck_assert (clone != NULL);
   ck_assert (attrib != clone);
-  ck_assert (attrib->key != clone->key);
-  ck_assert (attrib->value != clone->value);
+  ck_assert (attrib->key == clone->key);
+  ck_assert (attrib->value == clone->value);
 
+  ck_assert_errno (riemann_attribute_set_value (clone, "other"), 0);
+  ck_assert_str_eq (attrib->value, "value");
+  ck_assert_str_eq (clone->value, "other");
   ck_assert_str_eq (attrib->key, clone->key);
-  ck_assert_str_eq (attrib->value, clone->value);
 
   riemann_attribute_free (attrib);
   riemann_attribute_free (clone);
@@ -0,0 +1,198 @@
+#include <poll.h>
+#include <riemann/batcher.h>
+
+static riemann_event_t *
+_batcher_event (int i)
+{
+  char host[32];
+
+  snprintf (host, sizeof (host), "batcher-%d", i);
+  return riemann_event_create (RIEMANN_EVENT_FIELD_HOST, host,
+                               RIEMANN_EVENT_FIELD_SERVICE,
+                               "test_riemann_batcher",
+                               RIEMANN_EVENT_FIELD_METRIC_S64, (int64_t) i,
+                               RIEMANN_EVENT_FIELD_NONE);
+}
+
+static void
+_batcher_count_replies (riemann_client_t *client, riemann_message_t *response,
+                        int error, void *userdata)
+{
+  int *replies = (int *) userdata;
+
+  (void) client;
+
+  if (response && response->ok)
+    replies[0]++;
+  else
+    replies[1]++;
+  if (error == 0)
+    riemann_message_free (response);
+}
+
+START_TEST (test_riemann_batcher_new)
+{
+  riemann_client_t *client;
+  riemann_batcher_t *batcher;
+  riemann_event_t *event;
+
+  ck_assert (riemann_batcher_new (NULL, 10, 0, 0) == NULL);
+  ck_assert_errno (-errno, EINVAL);
+
+  errno = 0;
+  riemann_batcher_free (NULL);
+  ck_assert_errno (-errno, EINVAL);
+
+  errno = 0;
+  riemann_batcher_set_callback (NULL, NULL, NULL);
+  ck_assert_errno (-errno, EINVAL);
+
+  event = _batcher_event (0);
+  ck_assert_errno (riemann_batcher_add_event (NULL, event), EINVAL);
+  ck_assert_errno (riemann_batcher_flush (NULL), EINVAL);
+  ck_assert_errno (riemann_batcher_process (NULL), EINVAL);
+  ck_assert_errno (riemann_batcher_get_fd (NULL), EINVAL);
+  ck_assert_errno (riemann_batcher_get_timeout (NULL), EINVAL);
+  ck_assert_int_eq (riemann_batcher_size (NULL), 0);
+
+  /* Events are only sent when a limit is reached, so they can be
+     collected without a connection. */
+  client = riemann_client_new ();
+  batcher = riemann_batcher_new (client, 0, 0, 0);
+  ck_assert_errno (riemann_batcher_add_event (batcher, NULL), EINVAL);
+  ck_assert_errno (riemann_batcher_get_fd (batcher), ENOTSUP);
+  ck_assert_int_eq (riemann_batcher_get_timeout (batcher), -1);
+
+  ck_assert_errno (riemann_batcher_add_event (batcher, event), 0);
+  ck_assert_errno (riemann_batcher_add_event (batcher, event), 0);
+  ck_assert_int_eq (riemann_batcher_size (batcher), 2);
+  ck_assert_int_eq (riemann_batcher_get_timeout (batcher), -1);
+  ck_assert_errno (riemann_batcher_process (batcher), 0);
+  ck_assert_int_eq (riemann_batcher_size (batcher), 2);
+
+  /* Whatever happens, a flush empties the batch. */
+  ck_assert_errno (riemann_batcher_flush (batcher), ENOTCONN);
+  ck_assert_int_eq (riemann_batcher_size (batcher), 0);
+  ck_assert_errno (riemann_batcher_flush (batcher), 0);
+  riemann_batcher_free (batcher);
+
+  batcher = riemann_batcher_new (client, 0, 0, 10000);
+#if HAVE_SYS_TIMERFD_H
+  ck_assert (riemann_batcher_get_fd (batcher) >= 0);
+#endif
+  ck_assert_int_eq (riemann_batcher_get_timeout (batcher), -1);
+  ck_assert_errno (riemann_batcher_add_event (batcher, event), 0);
+  ck_assert (riemann_batcher_get_timeout (batcher) > 0);
+  ck_assert (riemann_batcher_get_timeout (batcher) <= 10000);
+  riemann_batcher_free (batcher);
+
+  riemann_client_free (client);
+  riemann_event_free (event);
+}
+END_TEST
+
+START_TEST (test_riemann_batcher_limits)
+{
+  riemann_client_t *client;
+  riemann_batcher_t *batcher;
+  riemann_batch_writer_t *writer;
+  riemann_event_t *event;
+  riemann_message_t *response;
+  size_t max_bytes;
+  int i, replies[2] = {0, 0};
+
+  client = riemann_client_create (RIEMANN_CLIENT_TCP, "127.0.0.1", 5555);
+
+  /* A batch is sent as soon as it has enough events. */
+  batcher = riemann_batcher_new (client, 3, 0, 0);
+  riemann_batcher_set_callback (batcher, _batcher_count_replies, replies);
+  for (i = 0; i < 7; i++)
+    {
+      event = _batcher_event (i);
+      ck_assert_errno (riemann_batcher_add_event (batcher, event), 0);
+      ck_assert_int_eq (riemann_batcher_size (batcher), (i + 1) % 3);
+      riemann_event_free (event);
+    }
+  ck_assert_errno (riemann_batcher_flush (batcher), 0);
+  ck_assert_int_eq (riemann_batcher_size (batcher), 0);
+
+  /* Every batch had its reply handed to the callback. */
+  ck_assert_int_eq (replies[0], 3);
+  ck_assert_int_eq (replies[1], 0);
+  riemann_batcher_free (batcher);
+
+  response = riemann_communicate_query
+    (client, "service = \"test_riemann_batcher\"");
+  ck_assert (response != NULL);
+  ck_assert_int_eq (response->n_events, 7);
+  riemann_message_free (response);
+
+  /* Or as soon as it grows large enough: here, an event and a half,
+     so every event that would not fit goes into the next batch. */
+  writer = riemann_batch_writer_new ();
+  event = _batcher_event (0);
+  riemann_batch_writer_add_event (writer, event);
+  riemann_batch_writer_get_buffer (writer, &max_bytes);
+  max_bytes = (max_bytes - sizeof (uint32_t)) * 3 / 2;
+  riemann_event_free (event);
+  riemann_batch_writer_free (writer);
+
+  batcher = riemann_batcher_new (client, 0, max_bytes, 0);
+  for (i = 0; i < 5; i++)
+    {
+      event = _batcher_event (i);
+      ck_assert_errno (riemann_batcher_add_event (batcher, event), 0);
+      ck_assert_int_eq (riemann_batcher_size (batcher), 1);
+      riemann_event_free (event);
+    }
+  riemann_batcher_free (batcher);
+
+  /* Or once the oldest event waited long enough. */
+  batcher = riemann_batcher_new (client, 0, 0, 50);
+  event = _batcher_event (0);
+  ck_assert_errno (riemann_batcher_add_event (batcher, event), 0);
+  riemann_event_free (event);
+  ck_assert_int_eq (riemann_batcher_size (batcher), 1);
+
+#if HAVE_SYS_TIMERFD_H
+  {
+    struct pollfd pfd;
+
+    pfd.fd = riemann_batcher_get_fd (batcher);
+    pfd.events = POLLIN;
+    ck_assert_int_eq (poll (&pfd, 1, 5000), 1);
+  }
+#else
+  poll (NULL, 0, riemann_batcher_get_timeout (batcher));
+#endif
+  ck_assert_errno (riemann_batcher_process (batcher), 0);
+  ck_assert_int_eq (riemann_batcher_size (batcher), 0);
+
+  /* Without a connection, flushing fails, and drops the batch. */
+  riemann_client_disconnect (client);
+  event = _batcher_event (0);
+  ck_assert_errno (riemann_batcher_add_event (batcher, event), 0);
+  riemann_event_free (event);
+  ck_assert_errno (riemann_batcher_flush (batcher), ENOTCONN);
+  ck_assert_int_eq (riemann_batcher_size (batcher), 0);
+  riemann_batcher_free (batcher);
+
+  riemann_client_free (client);
+}
+END_TEST
+
+static TCase *
+test_riemann_batcher (void)
+{
+  TCase *tests;
+
+  tests = tcase_create ("Batcher");
+  tcase_add_test (tests, test_riemann_batcher_new);
+
+  if (network_tests_enabled ())
+    {
+      tcase_add_test (tests, test_riemann_batcher_limits);
+    }
+
+  return tests;
+}
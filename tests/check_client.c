@@ -1,3 +1,5 @@
+#include <fcntl.h>
+#include <poll.h>
 #include <riemann/client.h>
 #include "riemann/platform.h"
 #include "riemann/_private.h"
@@ -244,6 +246,64 @@ START_TEST (test_riemann_client_disconnect)
 }
 END_TEST
 
+START_TEST (test_riemann_client_reconnect)
+{
+  riemann_client_t *client;
+
+  ck_assert_errno (riemann_client_reconnect (NULL), EINVAL);
+
+  /* There is nothing to reconnect to, before the first connection. */
+  client = riemann_client_new ();
+  ck_assert_errno (riemann_client_reconnect (client), ENOTCONN);
+  riemann_client_free (client);
+
+  if (network_tests_enabled ())
+    {
+      struct timeval timeout = {1, 0}, actual;
+      socklen_t len = sizeof (actual);
+      riemann_message_t *message, *response;
+
+      message = riemann_message_create_with_events
+        (riemann_event_create (RIEMANN_EVENT_FIELD_SERVICE,
+                               "test_riemann_client_reconnect",
+                               RIEMANN_EVENT_FIELD_STATE, "ok",
+                               RIEMANN_EVENT_FIELD_NONE),
+         NULL);
+
+      client = riemann_client_create (RIEMANN_CLIENT_TCP, "127.0.0.1", 5555);
+      ck_assert_errno (riemann_client_set_timeout (client, &timeout), 0);
+      ck_assert_errno (riemann_client_disconnect (client), 0);
+
+      /* The same server, with the same timeout, on a new socket. */
+      ck_assert_errno (riemann_client_reconnect (client), 0);
+      ck_assert (getsockopt (riemann_client_get_fd (client), SOL_SOCKET,
+                             SO_RCVTIMEO, &actual, &len) == 0);
+      ck_assert_int_eq (actual.tv_sec, 1);
+
+      /* Connecting does not block, but the connection made does. */
+      ck_assert_int_eq (fcntl (riemann_client_get_fd (client), F_GETFL) &
+                        O_NONBLOCK, 0);
+
+      ck_assert_errno (riemann_client_send_message (client, message), 0);
+      response = riemann_client_recv_message (client);
+      ck_assert (response != NULL);
+      ck_assert_int_eq (response->ok, 1);
+      riemann_message_free (response);
+
+      /* A connection that is still open is replaced. */
+      ck_assert_errno (riemann_client_reconnect (client), 0);
+      ck_assert_errno (riemann_client_send_message (client, message), 0);
+      response = riemann_client_recv_message (client);
+      ck_assert (response != NULL);
+      ck_assert_int_eq (response->ok, 1);
+      riemann_message_free (response);
+
+      riemann_message_free (message);
+      riemann_client_free (client);
+    }
+}
+END_TEST
+
 START_TEST (test_riemann_client_create)
 {
   riemann_client_t *client;
@@ -291,23 +351,29 @@ START_TEST (test_riemann_client_create)
 }
 END_TEST
 
-make_mock (riemann_message_to_buffer, uint8_t *,
-           riemann_message_t *message, size_t *len)
+make_mock (riemann_message_pack_into, int,
+           riemann_message_t *message, uint8_t *buffer, size_t size,
+           size_t *len)
+{
+  STUB (riemann_message_pack_into, message, buffer, size, len);
+}
+
+static int
+_mock_message_pack_into ()
 {
-  STUB (riemann_message_to_buffer, message, len);
+  return -EPROTO;
 }
 
-static uint8_t *
-_mock_message_to_buffer ()
+static ssize_t
+_mock_send_partial (int sockfd, const void *buf, size_t len, int flags)
 {
-  errno = EPROTO;
-  return NULL;
+  return real_send (sockfd, buf, (len > 3) ? 3 : len, flags);
 }
 
 START_TEST (test_riemann_client_send_message)
 {
   riemann_client_t *client, *client_fresh;
-  riemann_message_t *message;
+  riemann_message_t *message, *response;
 
   client = riemann_client_create (RIEMANN_CLIENT_TCP, "127.0.0.1", 5555);
   message = riemann_message_create_with_events
@@ -323,12 +389,26 @@ START_TEST (test_riemann_client_send_message)
   ck_assert_errno (riemann_client_send_message (client_fresh, message), ENOTCONN);
   riemann_client_free (client_fresh);
 
-  mock (riemann_message_to_buffer, _mock_message_to_buffer);
+  mock (riemann_message_pack_into, _mock_message_pack_into);
   ck_assert_errno (riemann_client_send_message (client, message),
                    EPROTO);
-  restore (riemann_message_to_buffer);
+  restore (riemann_message_pack_into);
+
+  ck_assert_errno (riemann_client_send_message (client, message), 0);
+  response = riemann_client_recv_message (client);
+  ck_assert (response != NULL);
+  ck_assert_int_eq (response->ok, 1);
+  riemann_message_free (response);
 
+  /* A frame the socket takes only part of at a time still goes out
+     in full. */
+  mock (send, _mock_send_partial);
   ck_assert_errno (riemann_client_send_message (client, message), 0);
+  restore (send);
+  response = riemann_client_recv_message (client);
+  ck_assert (response != NULL);
+  ck_assert_int_eq (response->ok, 1);
+  riemann_message_free (response);
 
   mock (send, mock_enosys_ssize_t_always_fail);
   ck_assert_errno (riemann_client_send_message (client, message), ENOSYS);
@@ -338,10 +418,10 @@ START_TEST (test_riemann_client_send_message)
 
   client = riemann_client_create (RIEMANN_CLIENT_UDP, "127.0.0.1", 5555);
 
-  mock (riemann_message_to_buffer, _mock_message_to_buffer);
+  mock (riemann_message_pack_into, _mock_message_pack_into);
   ck_assert_errno (riemann_client_send_message (client, message),
                    EPROTO);
-  restore (riemann_message_to_buffer);
+  restore (riemann_message_pack_into);
 
   ck_assert_errno (riemann_client_send_message (client, message), 0);
 
@@ -447,6 +527,78 @@ START_TEST (test_riemann_client_recv_message)
 }
 END_TEST
 
+START_TEST (test_riemann_client_recv_message_in)
+{
+  riemann_client_t *client;
+  riemann_message_t *message, *response;
+  riemann_arena_t *arena;
+
+  arena = riemann_arena_new (0);
+
+  errno = 0;
+  ck_assert (riemann_client_recv_message_in (NULL, arena) == NULL);
+  ck_assert_errno (-errno, ENOTCONN);
+
+  client = riemann_client_create (RIEMANN_CLIENT_TCP, "127.0.0.1", 5555);
+  ck_assert (riemann_client_recv_message_in (client, NULL) == NULL);
+  ck_assert_errno (-errno, EINVAL);
+
+  message = riemann_message_create_with_query
+    (riemann_query_new ("true"));
+  riemann_client_send_message (client, message);
+  riemann_client_send_message (client, message);
+
+  ck_assert ((response = riemann_client_recv_message_in (client, arena)) != NULL);
+  ck_assert_int_eq (response->ok, 1);
+
+  riemann_arena_reset (arena);
+  ck_assert ((response = riemann_client_recv_message_in (client, arena)) != NULL);
+  ck_assert_int_eq (response->ok, 1);
+
+  riemann_message_free (message);
+  riemann_client_free (client);
+  riemann_arena_free (arena);
+}
+END_TEST
+
+START_TEST (test_riemann_client_recv_message_projected)
+{
+  riemann_client_t *client;
+  riemann_message_t *message, *response;
+
+  errno = 0;
+  ck_assert (riemann_client_recv_message_projected
+             (NULL, RIEMANN_EVENT_FIELD_MASK_ALL) == NULL);
+  ck_assert_errno (-errno, ENOTCONN);
+
+  client = riemann_client_create (RIEMANN_CLIENT_TCP, "127.0.0.1", 5555);
+  message = riemann_message_create_with_events
+    (riemann_event_create (RIEMANN_EVENT_FIELD_SERVICE, "test-projected",
+                           RIEMANN_EVENT_FIELD_HOST, "localhost",
+                           RIEMANN_EVENT_FIELD_NONE),
+     NULL);
+  riemann_client_send_message_oneshot (client, message);
+  response = riemann_client_recv_message_projected
+    (client, RIEMANN_EVENT_FIELD_MASK_ALL);
+  ck_assert (response != NULL);
+  ck_assert_int_eq (response->ok, 1);
+  riemann_message_free (response);
+
+  message = riemann_message_create_with_query
+    (riemann_query_new ("service = \"test-projected\""));
+  riemann_client_send_message_oneshot (client, message);
+  response = riemann_client_recv_message_projected
+    (client, RIEMANN_EVENT_FIELD_MASK (SERVICE));
+  ck_assert (response != NULL);
+  ck_assert (response->n_events >= 1);
+  ck_assert_str_eq (response->events[0]->service, "test-projected");
+  ck_assert (response->events[0]->host == NULL);
+  riemann_message_free (response);
+
+  riemann_client_free (client);
+}
+END_TEST
+
 START_TEST (test_riemann_client_send_message_oneshot)
 {
   riemann_client_t *client, *client_fresh;
@@ -547,10 +699,10 @@ START_TEST (test_riemann_client_send_message_tls)
   ck_assert_errno (riemann_client_send_message (NULL, message), ENOTCONN);
   ck_assert_errno (riemann_client_send_message (client, NULL), EINVAL);
 
-  mock (riemann_message_to_buffer, _mock_message_to_buffer);
+  mock (riemann_message_pack_into, _mock_message_pack_into);
   ck_assert_errno (riemann_client_send_message (client, message),
                    EPROTO);
-  restore (riemann_message_to_buffer);
+  restore (riemann_message_pack_into);
 
   ck_assert_errno (riemann_client_send_message (client, message), 0);
 
@@ -635,6 +787,263 @@ START_TEST (test_riemann_client_recv_message_tls)
 END_TEST
 #endif
 
+START_TEST (test_riemann_client_set_nonblocking)
+{
+  riemann_client_t *client;
+
+  ck_assert_errno (riemann_client_set_nonblocking (NULL, 1), EINVAL);
+  ck_assert_errno (riemann_client_flush (NULL), ENOTCONN);
+
+  client = riemann_client_new ();
+  ck_assert_errno (riemann_client_set_nonblocking (client, 1), 0);
+  ck_assert_errno (riemann_client_flush (client), 0);
+  ck_assert_errno (riemann_client_set_nonblocking (client, 0), 0);
+  riemann_client_free (client);
+}
+END_TEST
+
+static ssize_t
+_mock_send_a_little (int sockfd, const void *buf, size_t len, int flags)
+{
+  static int counter;
+
+  /* Sends five bytes the first time, then the socket is "full". */
+  if (counter++ == 0)
+    return real_send (sockfd, buf, (len < 5) ? len : 5, flags);
+
+  errno = EAGAIN;
+  return -1;
+}
+
+START_TEST (test_riemann_client_send_message_nonblocking)
+{
+  riemann_client_t *client;
+  riemann_message_t *message, *response;
+
+  client = riemann_client_create (RIEMANN_CLIENT_TCP, "127.0.0.1", 5555);
+  message = riemann_message_create_with_events
+    (riemann_event_create (RIEMANN_EVENT_FIELD_SERVICE, "test-nonblocking",
+                           RIEMANN_EVENT_FIELD_STATE, "ok",
+                           RIEMANN_EVENT_FIELD_NONE),
+     NULL);
+
+  ck_assert_errno (riemann_client_set_nonblocking (client, 1), 0);
+  ck_assert_errno (riemann_client_send_message (client, message), 0);
+  response = riemann_client_recv_message (client);
+  ck_assert (response != NULL);
+  ck_assert_int_eq (response->ok, 1);
+  riemann_message_free (response);
+
+  /* A send that does not complete is queued, and nothing else is
+     accepted until it is flushed. */
+  mock (send, _mock_send_a_little);
+  ck_assert_errno (riemann_client_send_message (client, message), EINPROGRESS);
+  ck_assert_errno (riemann_client_send_message (client, message), EAGAIN);
+  ck_assert_errno (riemann_client_flush (client), EAGAIN);
+  ck_assert_errno (riemann_client_set_nonblocking (client, 0), EBUSY);
+  restore (send);
+
+  ck_assert_errno (riemann_client_flush (client), 0);
+  ck_assert_errno (riemann_client_flush (client), 0);
+  response = riemann_client_recv_message (client);
+  ck_assert (response != NULL);
+  ck_assert_int_eq (response->ok, 1);
+  riemann_message_free (response);
+
+  mock (send, mock_enosys_ssize_t_always_fail);
+  ck_assert_errno (riemann_client_send_message (client, message), ENOSYS);
+  restore (send);
+
+  ck_assert_errno (riemann_client_set_nonblocking (client, 0), 0);
+  ck_assert_errno (riemann_client_send_message (client, message), 0);
+  response = riemann_client_recv_message (client);
+  ck_assert (response != NULL);
+  riemann_message_free (response);
+
+  riemann_client_free (client);
+  riemann_message_free (message);
+}
+END_TEST
+
+START_TEST (test_riemann_client_send_async_errors)
+{
+  riemann_client_t *client;
+  riemann_message_t *message;
+
+  message = riemann_message_new ();
+
+  ck_assert_errno (riemann_client_send_async (NULL, message, NULL, NULL),
+                   ENOTCONN);
+  ck_assert_errno (riemann_client_process_io (NULL, POLLIN), ENOTCONN);
+  ck_assert_errno (riemann_client_get_io_events (NULL), EINVAL);
+  ck_assert_errno (riemann_client_set_max_in_flight (NULL, 1), EINVAL);
+
+  client = riemann_client_new ();
+  ck_assert_errno (riemann_client_send_async (client, NULL, NULL, NULL),
+                   EINVAL);
+  ck_assert_errno (riemann_client_send_async (client, message, NULL, NULL),
+                   ENOTCONN);
+  ck_assert_errno (riemann_client_process_io (client, POLLIN), ENOTCONN);
+  ck_assert_int_eq (riemann_client_get_io_events (client), 0);
+  riemann_client_free (client);
+
+  riemann_message_free (message);
+}
+END_TEST
+
+typedef struct
+{
+  int done;
+  int ok;
+  int error;
+} _async_results_t;
+
+static void
+_async_count_replies (riemann_client_t __attribute__((unused)) *client,
+                      riemann_message_t *response, int error,
+                      void *userdata)
+{
+  _async_results_t *results = (_async_results_t *) userdata;
+
+  results->done++;
+  if (error)
+    results->error = error;
+  if (response && response->ok)
+    results->ok++;
+  riemann_message_free (response);
+}
+
+static void
+_async_wait (riemann_client_t *client, _async_results_t *results, int n)
+{
+  struct pollfd pfd;
+
+  pfd.fd = riemann_client_get_fd (client);
+  while (results->done < n)
+    {
+      pfd.events = (short) riemann_client_get_io_events (client);
+      ck_assert (poll (&pfd, 1, 5000) == 1);
+      ck_assert_errno (riemann_client_process_io (client, pfd.revents), 0);
+    }
+}
+
+START_TEST (test_riemann_client_send_async)
+{
+  riemann_client_t *client;
+  riemann_message_t *message;
+  _async_results_t results = {0, 0, 0};
+  int i;
+
+  message = riemann_message_create_with_events
+    (riemann_event_create (RIEMANN_EVENT_FIELD_SERVICE, "test-async",
+                           RIEMANN_EVENT_FIELD_STATE, "ok",
+                           RIEMANN_EVENT_FIELD_NONE),
+     NULL);
+
+  client = riemann_client_create (RIEMANN_CLIENT_UDP, "127.0.0.1", 5555);
+  ck_assert_errno (riemann_client_send_async (client, message, NULL, NULL),
+                   ENOTSUP);
+  riemann_client_free (client);
+
+  client = riemann_client_create (RIEMANN_CLIENT_TCP, "127.0.0.1", 5555);
+  for (i = 0; i < 3; i++)
+    ck_assert_errno (riemann_client_send_async (client, message,
+                                                _async_count_replies,
+                                                &results), 0);
+  ck_assert (riemann_client_get_io_events (client) & POLLIN);
+  ck_assert (riemann_client_recv_message (client) == NULL);
+  ck_assert_errno (-errno, EBUSY);
+
+  _async_wait (client, &results, 3);
+  ck_assert_int_eq (results.ok, 3);
+  ck_assert_int_eq (results.error, 0);
+  ck_assert_int_eq (riemann_client_get_io_events (client), 0);
+
+  /* A full window turns further requests away, until a reply
+     arrives. */
+  ck_assert_errno (riemann_client_set_max_in_flight (client, 1), 0);
+  ck_assert_errno (riemann_client_send_async (client, message,
+                                              _async_count_replies,
+                                              &results), 0);
+  ck_assert_errno (riemann_client_send_async (client, message,
+                                              _async_count_replies,
+                                              &results), EAGAIN);
+  _async_wait (client, &results, 4);
+  ck_assert_int_eq (results.ok, 4);
+  ck_assert_errno (riemann_client_set_max_in_flight (client, 0), 0);
+
+  /* Whatever is still in flight when the connection goes away is
+     told so. */
+  ck_assert_errno (riemann_client_send_async (client, message,
+                                              _async_count_replies,
+                                              &results), 0);
+  ck_assert_errno (riemann_client_disconnect (client), 0);
+  ck_assert_int_eq (results.done, 5);
+  ck_assert_errno (results.error, ECONNABORTED);
+  ck_assert_errno (riemann_client_send_async (client, message, NULL, NULL),
+                   ENOTCONN);
+  ck_assert_errno (riemann_client_process_io (client, POLLIN), ENOTCONN);
+
+  /* A failed connection is given up on, and is not used for anything
+     after. */
+  ck_assert_errno (riemann_client_reconnect (client), 0);
+  ck_assert_errno (riemann_client_send_async (client, message,
+                                              _async_count_replies,
+                                              &results), 0);
+  shutdown (riemann_client_get_fd (client), SHUT_RDWR);
+  ck_assert (riemann_client_process_io (client, POLLIN) < 0);
+  ck_assert_int_eq (results.done, 6);
+  ck_assert (results.error < 0);
+  ck_assert_errno (riemann_client_process_io (client, POLLIN), ENOTCONN);
+
+  riemann_client_free (client);
+  riemann_message_free (message);
+}
+END_TEST
+
+#if HAVE_GNUTLS
+START_TEST (test_riemann_client_send_async_tls)
+{
+  riemann_client_t *client;
+  riemann_message_t *message;
+  _async_results_t results = {0, 0, 0};
+  int i;
+
+  client = riemann_client_create
+    (RIEMANN_CLIENT_TLS,
+     "127.0.0.1", 5554,
+     RIEMANN_CLIENT_OPTION_TLS_CA_FILE, "tests/data/cacert.pem",
+     RIEMANN_CLIENT_OPTION_TLS_CERT_FILE, "tests/data/client.crt",
+     RIEMANN_CLIENT_OPTION_TLS_KEY_FILE, "tests/data/client.key",
+     RIEMANN_CLIENT_OPTION_NONE);
+  message = riemann_message_create_with_events
+    (riemann_event_create (RIEMANN_EVENT_FIELD_SERVICE, "test-async-tls",
+                           RIEMANN_EVENT_FIELD_STATE, "ok",
+                           RIEMANN_EVENT_FIELD_NONE),
+     NULL);
+
+  for (i = 0; i < 3; i++)
+    ck_assert_errno (riemann_client_send_async (client, message,
+                                                _async_count_replies,
+                                                &results), 0);
+  _async_wait (client, &results, 3);
+  ck_assert_int_eq (results.ok, 3);
+  ck_assert_int_eq (results.error, 0);
+
+  /* Reconnecting does the handshake again, with the same options. */
+  ck_assert_errno (riemann_client_reconnect (client), 0);
+  ck_assert_errno (riemann_client_send_async (client, message,
+                                              _async_count_replies,
+                                              &results), 0);
+  _async_wait (client, &results, 4);
+  ck_assert_int_eq (results.ok, 4);
+
+  riemann_client_free (client);
+  riemann_message_free (message);
+}
+END_TEST
+#endif
+
 static TCase *
 test_riemann_client (void)
 {
@@ -645,8 +1054,11 @@ test_riemann_client (void)
   tcase_add_test (test_client, test_riemann_client_free);
   tcase_add_test (test_client, test_riemann_client_connect);
   tcase_add_test (test_client, test_riemann_client_disconnect);
+  tcase_add_test (test_client, test_riemann_client_reconnect);
   tcase_add_test (test_client, test_riemann_client_get_fd);
   tcase_add_test (test_client, test_riemann_client_set_timeout);
+  tcase_add_test (test_client, test_riemann_client_set_nonblocking);
+  tcase_add_test (test_client, test_riemann_client_send_async_errors);
 
   if (network_tests_enabled ())
     {
@@ -654,10 +1066,15 @@ test_riemann_client (void)
       tcase_add_test (test_client, test_riemann_client_send_message);
       tcase_add_test (test_client, test_riemann_client_send_message_oneshot);
       tcase_add_test (test_client, test_riemann_client_recv_message);
+      tcase_add_test (test_client, test_riemann_client_recv_message_in);
+      tcase_add_test (test_client, test_riemann_client_recv_message_projected);
+      tcase_add_test (test_client, test_riemann_client_send_message_nonblocking);
+      tcase_add_test (test_client, test_riemann_client_send_async);
 
 #if HAVE_GNUTLS
       tcase_add_test (test_client, test_riemann_client_send_message_tls);
       tcase_add_test (test_client, test_riemann_client_recv_message_tls);
+      tcase_add_test (test_client, test_riemann_client_send_async_tls);
 #endif
     }
 
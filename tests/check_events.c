@@ -271,34 +271,166 @@ START_TEST (test_riemann_event_clone)
   ck_assert (clone != NULL);
   ck_assert (clone != event);
 
-  ck_assert (clone->host != event->host);
-  ck_assert_str_eq (clone->host, event->host);
-  ck_assert (clone->service != event->service);
-  ck_assert_str_eq (clone->service, event->service);
+  /* Until either of them changes, the clone shares its strings and
+     tags with the original. Attributes are objects of its own, with
+     shared keys and values. */
+  ck_assert (clone->host == event->host);
+  ck_assert (clone->service == event->service);
+  ck_assert (clone->state == event->state);
+  ck_assert (clone->description == event->description);
+  ck_assert (clone->tags == event->tags);
+  ck_assert (clone->attributes != event->attributes);
+  ck_assert (clone->attributes[0] != event->attributes[0]);
+  ck_assert (clone->attributes[0]->key == event->attributes[0]->key);
+  ck_assert (clone->attributes[0]->value == event->attributes[0]->value);
+  ck_assert_int_eq (clone->n_tags, event->n_tags);
+  ck_assert_int_eq (clone->n_attributes, event->n_attributes);
+
+  ck_assert (clone->has_time && clone->has_time_micros && clone->has_ttl);
   ck_assert_int_eq (clone->time, event->time);
   ck_assert_int_eq (clone->time_micros, event->time_micros);
-  ck_assert (clone->state != event->state);
-  ck_assert_str_eq (clone->state, event->state);
-  ck_assert (clone->description != event->description);
-  ck_assert_str_eq (clone->description, event->description);
+  ck_assert (clone->has_metric_sint64);
   ck_assert_int_eq (clone->metric_sint64, event->metric_sint64);
 
-  ck_assert (clone->tags != NULL);
-  ck_assert_int_eq (clone->n_tags, event->n_tags);
-  ck_assert (clone->tags[0] != event->tags[0]);
-  ck_assert_str_eq (clone->tags[0], event->tags[0]);
+  /* Changes made to either one are not visible in the other. */
+  ck_assert_errno (riemann_event_set_host (clone, "remotehost"), 0);
+  ck_assert_errno (riemann_event_tag_add (clone, "tag-3"), 0);
+  ck_assert_errno (riemann_event_string_attribute_add (clone, "key-3",
+                                                       "value-3"), 0);
+  ck_assert_errno (riemann_attribute_set_value (clone->attributes[0],
+                                                "changed"), 0);
+  ck_assert_errno (riemann_event_set (event,
+                                      RIEMANN_EVENT_FIELD_DESCRIPTION, "else",
+                                      RIEMANN_EVENT_FIELD_TAGS, "tag-4", NULL,
+                                      RIEMANN_EVENT_FIELD_NONE), 0);
 
-  ck_assert (clone->attributes != NULL);
-  ck_assert_int_eq (clone->n_attributes, event->n_attributes);
-  ck_assert (clone->attributes[0] != event->attributes[0]);
-  ck_assert_str_eq (clone->attributes[0]->key,
-                    event->attributes[0]->key);
+  ck_assert_str_eq (event->host, "localhost");
+  ck_assert_str_eq (clone->host, "remotehost");
+  ck_assert_str_eq (event->description, "else");
+  ck_assert_str_eq (clone->description, "something");
+
+  ck_assert_int_eq (event->n_tags, 1);
+  ck_assert_str_eq (event->tags[0], "tag-4");
+  ck_assert_int_eq (clone->n_tags, 3);
+  ck_assert_str_eq (clone->tags[0], "tag-1");
+  ck_assert_str_eq (clone->tags[2], "tag-3");
+
+  ck_assert_int_eq (event->n_attributes, 2);
+  ck_assert_int_eq (clone->n_attributes, 3);
+  ck_assert_str_eq (clone->attributes[0]->key, event->attributes[0]->key);
+  ck_assert_str_eq (event->attributes[0]->value, "value-1");
+  ck_assert_str_eq (clone->attributes[0]->value, "changed");
 
   riemann_event_free (event);
+  ck_assert_str_eq (clone->service, "test");
+  ck_assert_str_eq (clone->attributes[1]->value, "value-2");
   riemann_event_free (clone);
 }
 END_TEST
 
+START_TEST (test_riemann_event_typed_setters)
+{
+  riemann_event_t *event;
+
+  ck_assert_errno (riemann_event_set_host (NULL, "localhost"), EINVAL);
+  ck_assert_errno (riemann_event_set_metric_d (NULL, 1.0), EINVAL);
+
+  event = riemann_event_new ();
+
+  ck_assert_int_eq (riemann_event_set_time (event, 1234), 0);
+  ck_assert_int_eq (riemann_event_set_time_micros (event, 1234000), 0);
+  ck_assert_int_eq (riemann_event_set_state (event, "ok"), 0);
+  ck_assert_int_eq (riemann_event_set_service (event, "test"), 0);
+  ck_assert_int_eq (riemann_event_set_host (event, "localhost"), 0);
+  ck_assert_int_eq (riemann_event_set_description (event, "desc"), 0);
+  ck_assert_int_eq (riemann_event_set_ttl (event, 30.5f), 0);
+  ck_assert_int_eq (riemann_event_set_metric_sint64 (event, -42), 0);
+  ck_assert_int_eq (riemann_event_set_metric_d (event, 3.5), 0);
+  ck_assert_int_eq (riemann_event_set_metric_f (event, 1.5f), 0);
+
+  ck_assert (event->has_time && event->time == 1234);
+  ck_assert (event->has_time_micros && event->time_micros == 1234000);
+  ck_assert_str_eq (event->state, "ok");
+  ck_assert_str_eq (event->service, "test");
+  ck_assert_str_eq (event->host, "localhost");
+  ck_assert_str_eq (event->description, "desc");
+  ck_assert (event->has_ttl && event->ttl == 30.5f);
+  ck_assert (event->has_metric_sint64 && event->metric_sint64 == -42);
+  ck_assert (event->has_metric_d && event->metric_d == 3.5);
+  ck_assert (event->has_metric_f && event->metric_f == 1.5f);
+
+  ck_assert_int_eq (riemann_event_set_host (event, "other"), 0);
+  ck_assert_str_eq (event->host, "other");
+  ck_assert_int_eq (riemann_event_set_host (event, NULL), 0);
+  ck_assert (event->host == NULL);
+  ck_assert_int_eq (riemann_event_set_description (event, NULL), 0);
+  ck_assert (event->description == NULL);
+
+  riemann_event_free (event);
+}
+END_TEST
+
+START_TEST (test_riemann_events_create_n)
+{
+  const char *hosts[] = { "host-1", "host-2", NULL };
+  const char *services[] = { "cpu", "cpu", "memory" };
+  const int64_t times[] = { 1, 2, 3 };
+  const double metrics[] = { 0.5, 1.5, 2.5 };
+  riemann_event_fields_t fields;
+  riemann_event_t **events;
+  riemann_message_t *message;
+  riemann_arena_t *arena;
+  size_t i;
+
+  memset (&fields, 0, sizeof (fields));
+
+  errno = 0;
+  ck_assert (riemann_events_create_n (NULL, 3, NULL) == NULL);
+  ck_assert_errno (-errno, EINVAL);
+  errno = 0;
+  ck_assert (riemann_events_create_n (NULL, 0, &fields) == NULL);
+  ck_assert_errno (-errno, ERANGE);
+
+  fields.host = hosts;
+  fields.service = services;
+  fields.time = times;
+  fields.metric_d = metrics;
+
+  /* On the heap, the events can be handed over to a message. */
+  events = riemann_events_create_n (NULL, 3, &fields);
+  ck_assert (events != NULL);
+  for (i = 0; i < 3; i++)
+    {
+      ck_assert_str_eq (events[i]->service, services[i]);
+      ck_assert (events[i]->has_time && events[i]->time == times[i]);
+      ck_assert (events[i]->has_metric_d && events[i]->metric_d == metrics[i]);
+      ck_assert (!events[i]->has_metric_sint64);
+      ck_assert (events[i]->state == NULL);
+    }
+  ck_assert_str_eq (events[0]->host, "host-1");
+  ck_assert_str_eq (events[1]->host, "host-2");
+  ck_assert (events[2]->host == NULL);
+
+  message = riemann_message_new ();
+  ck_assert_int_eq (riemann_message_append_events_n (message, 3, events), 0);
+  riemann_message_free (message);
+
+  /* From an arena, the events are allocated together. */
+  arena = riemann_arena_new (0);
+  events = riemann_events_create_n (arena, 3, &fields);
+  ck_assert (events != NULL);
+  ck_assert (events[1] == events[0] + 1);
+  ck_assert_str_eq (events[1]->host, "host-2");
+  ck_assert_str_eq (events[2]->service, "memory");
+
+  message = riemann_message_new_in (arena);
+  ck_assert_int_eq (riemann_message_append_events_n_in (arena, message,
+                                                        3, events), 0);
+  ck_assert_int_eq (message->n_events, 3);
+  riemann_arena_free (arena);
+}
+END_TEST
+
 static TCase *
 test_riemann_events (void)
 {
@@ -314,6 +446,8 @@ test_riemann_events (void)
   tcase_add_test (test_events, test_riemann_event_string_attribute_add);
   tcase_add_test (test_events, test_riemann_event_create);
   tcase_add_test (test_events, test_riemann_event_clone);
+  tcase_add_test (test_events, test_riemann_event_typed_setters);
+  tcase_add_test (test_events, test_riemann_events_create_n);
 
   return test_events;
 }
@@ -0,0 +1,168 @@
+#include <riemann/intern.h>
+
+START_TEST (test_riemann_intern_events)
+{
+  riemann_event_t *a, *b, *clone;
+  riemann_attribute_t *attrib;
+
+  ck_assert_int_eq (riemann_intern_count (), 0);
+  ck_assert_int_eq (riemann_intern_enable (), 0);
+
+  a = riemann_event_create (RIEMANN_EVENT_FIELD_HOST, "localhost",
+                            RIEMANN_EVENT_FIELD_SERVICE, "test",
+                            RIEMANN_EVENT_FIELD_STATE, "ok",
+                            RIEMANN_EVENT_FIELD_DESCRIPTION, "not interned",
+                            RIEMANN_EVENT_FIELD_TAGS, "tag-1", "tag-2", NULL,
+                            RIEMANN_EVENT_FIELD_STRING_ATTRIBUTES,
+                            "key", "value", NULL,
+                            RIEMANN_EVENT_FIELD_NONE);
+  b = riemann_event_create (RIEMANN_EVENT_FIELD_HOST, "localhost",
+                            RIEMANN_EVENT_FIELD_SERVICE, "other",
+                            RIEMANN_EVENT_FIELD_DESCRIPTION, "not interned",
+                            RIEMANN_EVENT_FIELD_TAGS, "tag-2", NULL,
+                            RIEMANN_EVENT_FIELD_NONE);
+
+  ck_assert (a->host == b->host);
+  ck_assert (a->service != b->service);
+  ck_assert (a->tags[1] == b->tags[0]);
+  ck_assert (a->description != b->description);
+  /* localhost, test, ok, tag-1, tag-2, key, other */
+  ck_assert_int_eq (riemann_intern_count (), 7);
+
+  attrib = riemann_attribute_create ("key", NULL);
+  ck_assert (attrib->key == a->attributes[0]->key);
+  riemann_event_attribute_add (b, attrib);
+
+  /* Clones share strings, interned or not. */
+  clone = riemann_event_clone (a);
+  ck_assert (clone->host == a->host);
+  ck_assert (clone->tags[0] == a->tags[0]);
+  ck_assert (clone->attributes[0]->key == a->attributes[0]->key);
+  ck_assert (clone->description == a->description);
+  ck_assert_int_eq (riemann_intern_count (), 7);
+
+  /* Strings stay around as long as anything refers to them. */
+  riemann_event_set (b, RIEMANN_EVENT_FIELD_SERVICE, "test",
+                     RIEMANN_EVENT_FIELD_NONE);
+  ck_assert (b->service == a->service);
+  ck_assert_int_eq (riemann_intern_count (), 6);
+
+  riemann_event_free (a);
+  ck_assert_int_eq (riemann_intern_count (), 6);
+  ck_assert_str_eq (clone->host, "localhost");
+  ck_assert_str_eq (clone->tags[0], "tag-1");
+
+  riemann_event_free (clone);
+  ck_assert_int_eq (riemann_intern_count (), 4);
+
+  /* Disabling stops interning, but shared strings stay valid. */
+  ck_assert_int_eq (riemann_intern_disable (), 0);
+  riemann_event_tag_add (b, "tag-2");
+  ck_assert (b->tags[1] != b->tags[0]);
+  ck_assert_int_eq (riemann_intern_count (), 4);
+
+  clone = riemann_event_clone (b);
+  ck_assert (clone->host == b->host);
+  ck_assert (clone->tags[1] == b->tags[1]);
+  riemann_event_tag_add (clone, "tag-3");
+  ck_assert (clone->tags != b->tags);
+  ck_assert (clone->tags[1] == b->tags[1]);
+  ck_assert_int_eq (b->n_tags, 2);
+
+  riemann_event_free (clone);
+  riemann_event_free (b);
+  ck_assert_int_eq (riemann_intern_count (), 0);
+}
+END_TEST
+
+START_TEST (test_riemann_intern_messages)
+{
+  riemann_message_t *message;
+  riemann_event_t *event;
+  riemann_attribute_t *attrib;
+  size_t i;
+
+  riemann_intern_enable ();
+
+  message = riemann_message_new ();
+  for (i = 0; i < 100; i++)
+    {
+      event = riemann_event_create (RIEMANN_EVENT_FIELD_HOST, "localhost",
+                                    RIEMANN_EVENT_FIELD_SERVICE, "test",
+                                    RIEMANN_EVENT_FIELD_METRIC_S64, (int64_t) i,
+                                    RIEMANN_EVENT_FIELD_NONE);
+      riemann_message_append_events (message, event, NULL);
+    }
+  ck_assert_int_eq (riemann_intern_count (), 2);
+  ck_assert (message->events[0]->host == message->events[99]->host);
+
+  riemann_message_free (message);
+  ck_assert_int_eq (riemann_intern_count (), 0);
+
+  /* Attributes on their own */
+  attrib = riemann_attribute_create ("key", "value");
+  riemann_attribute_set_key (attrib, "other");
+  ck_assert_int_eq (riemann_intern_count (), 1);
+  riemann_attribute_free (attrib);
+  ck_assert_int_eq (riemann_intern_count (), 0);
+
+  riemann_intern_disable ();
+
+  event = riemann_event_create (RIEMANN_EVENT_FIELD_HOST, "localhost",
+                                RIEMANN_EVENT_FIELD_NONE);
+  ck_assert_int_eq (riemann_intern_count (), 0);
+  riemann_event_free (event);
+}
+END_TEST
+
+START_TEST (test_riemann_intern_shared_many)
+{
+  riemann_event_t *events[512], *clones[512];
+  char host[32];
+  size_t i;
+
+  /* Enough shared strings and arrays to fill up the table of shared
+     allocations a few times over, released in a different order than
+     they were shared in. */
+  for (i = 0; i < 512; i++)
+    {
+      snprintf (host, sizeof (host), "host-%zu", i);
+      events[i] = riemann_event_create (RIEMANN_EVENT_FIELD_HOST, host,
+                                        RIEMANN_EVENT_FIELD_TAGS, host, NULL,
+                                        RIEMANN_EVENT_FIELD_NONE);
+      clones[i] = riemann_event_clone (events[i]);
+    }
+
+  for (i = 0; i < 512; i += 2)
+    riemann_event_free (events[i]);
+  for (i = 0; i < 512; i++)
+    {
+      snprintf (host, sizeof (host), "host-%zu", i);
+      ck_assert_str_eq (clones[i]->host, host);
+      ck_assert_str_eq (clones[i]->tags[0], host);
+    }
+  for (i = 511; i < 512; i -= 2)
+    riemann_event_free (clones[i]);
+  for (i = 1; i < 512; i += 2)
+    {
+      snprintf (host, sizeof (host), "host-%zu", i);
+      ck_assert_str_eq (events[i]->host, host);
+      riemann_event_free (events[i]);
+    }
+  for (i = 0; i < 512; i += 2)
+    riemann_event_free (clones[i]);
+}
+END_TEST
+
+static TCase *
+test_riemann_intern (void)
+{
+  TCase *tests;
+
+  tests = tcase_create ("Interning");
+  tcase_add_test (tests, test_riemann_intern_events);
+  tcase_add_test (tests, test_riemann_intern_messages);
+  tcase_add_test (tests, test_riemann_intern_shared_many);
+
+  return tests;
+}
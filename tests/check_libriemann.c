@@ -1,5 +1,6 @@
 #define _GNU_SOURCE
 
+#include <arpa/inet.h>
 #include <check.h>
 #include <errno.h>
 #include <netdb.h>
@@ -63,6 +64,15 @@ network_tests_enabled (void)
 #include "check_messages.c"
 #include "check_client.c"
 #include "check_simple.c"
+#include "check_arena.c"
+#include "check_view.c"
+#include "check_template.c"
+#include "check_writer.c"
+#include "check_intern.c"
+#include "check_pool.c"
+#include "check_async.c"
+#include "check_batcher.c"
+#include "check_spool.c"
 
 int
 main (void)
@@ -81,6 +91,15 @@ main (void)
   suite_add_tcase (suite, test_riemann_messages ());
   suite_add_tcase (suite, test_riemann_client ());
   suite_add_tcase (suite, test_riemann_simple ());
+  suite_add_tcase (suite, test_riemann_arena ());
+  suite_add_tcase (suite, test_riemann_view ());
+  suite_add_tcase (suite, test_riemann_template ());
+  suite_add_tcase (suite, test_riemann_writer ());
+  suite_add_tcase (suite, test_riemann_intern ());
+  suite_add_tcase (suite, test_riemann_pool ());
+  suite_add_tcase (suite, test_riemann_async ());
+  suite_add_tcase (suite, test_riemann_batcher ());
+  suite_add_tcase (suite, test_riemann_spool ());
 
   runner = srunner_create (suite);
 
@@ -114,6 +114,44 @@ START_TEST (test_riemann_message_to_buffer)
 }
 END_TEST
 
+START_TEST (test_riemann_message_pack_into)
+{
+  riemann_message_t *message;
+  uint8_t *buffer, small[4], large[64];
+  size_t len;
+
+  message = riemann_message_create_with_events
+    (riemann_event_create (RIEMANN_EVENT_FIELD_SERVICE, "test",
+                           RIEMANN_EVENT_FIELD_NONE),
+     NULL);
+
+  ck_assert_errno (riemann_message_pack_into (NULL, large, sizeof (large),
+                                              &len), EINVAL);
+
+  len = 0;
+  ck_assert_errno (riemann_message_pack_into (message, NULL, 0, &len),
+                   ENOBUFS);
+  ck_assert_int_eq (len, 12);
+
+  len = 0;
+  ck_assert_errno (riemann_message_pack_into (message, small, sizeof (small),
+                                              &len), ENOBUFS);
+  ck_assert_int_eq (len, 12);
+
+  ck_assert_errno (riemann_message_pack_into (message, large, sizeof (large),
+                                              NULL), 0);
+  ck_assert_errno (riemann_message_pack_into (message, large, sizeof (large),
+                                              &len), 0);
+  ck_assert_int_eq (len, 12);
+
+  buffer = riemann_message_to_buffer (message, &len);
+  ck_assert (memcmp (buffer, large, len) == 0);
+  free (buffer);
+
+  riemann_message_free (message);
+}
+END_TEST
+
 START_TEST (test_riemann_message_from_buffer)
 {
   riemann_message_t *message, *response;
@@ -149,6 +187,86 @@ START_TEST (test_riemann_message_from_buffer)
 }
 END_TEST
 
+START_TEST (test_riemann_message_from_buffer_projected)
+{
+  riemann_message_t *message, *response;
+  riemann_event_t *event;
+  uint8_t *buffer;
+  size_t len;
+
+  message = riemann_message_create_with_events
+    (riemann_event_create (RIEMANN_EVENT_FIELD_HOST, "localhost",
+                           RIEMANN_EVENT_FIELD_SERVICE, "test",
+                           RIEMANN_EVENT_FIELD_STATE, "ok",
+                           RIEMANN_EVENT_FIELD_DESCRIPTION, "something long",
+                           RIEMANN_EVENT_FIELD_TIME, (int64_t) 1234,
+                           RIEMANN_EVENT_FIELD_METRIC_D, 3.5,
+                           RIEMANN_EVENT_FIELD_TAGS, "tag-1", "tag-2", NULL,
+                           RIEMANN_EVENT_FIELD_STRING_ATTRIBUTES,
+                           "key", "value", NULL,
+                           RIEMANN_EVENT_FIELD_NONE),
+     riemann_event_create (RIEMANN_EVENT_FIELD_SERVICE, "other",
+                           RIEMANN_EVENT_FIELD_NONE),
+     NULL);
+  message->has_ok = 1;
+  message->ok = 1;
+  buffer = riemann_message_to_buffer (message, &len);
+
+  errno = 0;
+  ck_assert (riemann_message_from_buffer_projected
+             (NULL, 1, RIEMANN_EVENT_FIELD_MASK_ALL) == NULL);
+  ck_assert_errno (-errno, EINVAL);
+  ck_assert (riemann_message_from_buffer_projected
+             (buffer, 0, RIEMANN_EVENT_FIELD_MASK_ALL) == NULL);
+  ck_assert_errno (-errno, EINVAL);
+
+  response = riemann_message_from_buffer_projected
+    (buffer + sizeof (uint32_t), len - sizeof (uint32_t),
+     RIEMANN_EVENT_FIELD_MASK (SERVICE) | RIEMANN_EVENT_FIELD_MASK (METRIC_D) |
+     RIEMANN_EVENT_FIELD_MASK (TIME));
+  ck_assert (response != NULL);
+  ck_assert_int_eq (response->has_ok, 1);
+  ck_assert_int_eq (response->ok, 1);
+  ck_assert_int_eq (response->n_events, 2);
+
+  event = response->events[0];
+  ck_assert_str_eq (event->service, "test");
+  ck_assert_int_eq (event->has_metric_d, 1);
+  ck_assert (event->metric_d == 3.5);
+  ck_assert_int_eq (event->has_time, 1);
+  ck_assert_int_eq (event->time, 1234);
+  ck_assert (event->host == NULL);
+  ck_assert (event->state == NULL);
+  ck_assert (event->description == NULL);
+  ck_assert_int_eq (event->n_tags, 0);
+  ck_assert_int_eq (event->n_attributes, 0);
+  ck_assert_str_eq (response->events[1]->service, "other");
+  riemann_message_free (response);
+
+  response = riemann_message_from_buffer_projected
+    (buffer + sizeof (uint32_t), len - sizeof (uint32_t),
+     RIEMANN_EVENT_FIELD_MASK (TAGS) | RIEMANN_EVENT_FIELD_MASK (ATTRIBUTES));
+  ck_assert (response != NULL);
+  event = response->events[0];
+  ck_assert (event->service == NULL);
+  ck_assert_int_eq (event->has_metric_d, 0);
+  ck_assert_int_eq (event->n_tags, 2);
+  ck_assert_str_eq (event->tags[1], "tag-2");
+  ck_assert_int_eq (event->n_attributes, 1);
+  ck_assert_str_eq (event->attributes[0]->key, "key");
+  ck_assert_str_eq (event->attributes[0]->value, "value");
+  riemann_message_free (response);
+
+  memset (buffer, 128, len);
+  ck_assert (riemann_message_from_buffer_projected
+             (buffer, len, RIEMANN_EVENT_FIELD_MASK_ALL) == NULL);
+  ck_assert_errno (-errno, EPROTO);
+
+  riemann_message_free (message);
+  free (buffer);
+}
+END_TEST
+
 START_TEST (test_riemann_message_set_events)
 {
   riemann_message_t *message;
@@ -343,7 +461,7 @@ START_TEST (test_riemann_message_clone)
   ck_assert_int_eq (clone->n_events, message->n_events);
 
   ck_assert (clone->events[0] != message->events[0]);
-  ck_assert_str_eq (clone->events[0]->host, message->events[0]->host);
+  ck_assert (clone->events[0]->host == message->events[0]->host);
 
   riemann_message_free (message);
   riemann_message_free (clone);
@@ -367,6 +485,60 @@ START_TEST (test_riemann_message_get_packed_size)
 }
 END_TEST
 
+START_TEST (test_riemann_message_builder)
+{
+  riemann_message_builder_t *builder;
+  riemann_message_t *message;
+  riemann_event_t *events[2];
+  size_t i;
+
+  ck_assert_errno (riemann_message_builder_append (NULL, NULL), EINVAL);
+  ck_assert_errno (riemann_message_builder_reserve (NULL, 1), EINVAL);
+  errno = 0;
+  ck_assert (riemann_message_builder_finish (NULL) == NULL);
+  ck_assert_errno (-errno, EINVAL);
+
+  builder = riemann_message_builder_new (0);
+  ck_assert_int_eq (riemann_message_builder_capacity (builder), 0);
+  ck_assert_errno (riemann_message_builder_append (builder, NULL), EINVAL);
+  ck_assert_errno (riemann_message_builder_append_n (builder, 0, events),
+                   ERANGE);
+
+  ck_assert_errno (riemann_message_builder_reserve (builder, 100), 0);
+  ck_assert_int_eq (riemann_message_builder_capacity (builder), 100);
+  ck_assert_errno (riemann_message_builder_reserve (builder, 10), 0);
+  ck_assert_int_eq (riemann_message_builder_capacity (builder), 100);
+
+  for (i = 0; i < 1000; i++)
+    ck_assert_errno (riemann_message_builder_append
+                     (builder,
+                      riemann_event_create (RIEMANN_EVENT_FIELD_METRIC_S64,
+                                            (int64_t) i,
+                                            RIEMANN_EVENT_FIELD_NONE)), 0);
+  ck_assert_int_eq (riemann_message_builder_size (builder), 1000);
+  /* Growth doubles the capacity. */
+  ck_assert_int_eq (riemann_message_builder_capacity (builder), 1600);
+
+  events[0] = riemann_event_new ();
+  events[1] = riemann_event_new ();
+  ck_assert_errno (riemann_message_builder_append_n (builder, 2, events), 0);
+  ck_assert_int_eq (riemann_message_builder_size (builder), 1002);
+
+  message = riemann_message_builder_finish (builder);
+  ck_assert_int_eq (message->n_events, 1002);
+  ck_assert_int_eq (message->events[999]->metric_sint64, 999);
+  ck_assert (message->events[1001] == events[1]);
+
+  /* The builder starts over with an empty message. */
+  ck_assert_int_eq (riemann_message_builder_size (builder), 0);
+  ck_assert_int_eq (riemann_message_builder_capacity (builder), 0);
+  riemann_message_builder_append (builder, riemann_event_new ());
+
+  riemann_message_free (message);
+  riemann_message_builder_free (builder);
+}
+END_TEST
+
 static TCase *
 test_riemann_messages (void)
 {
@@ -377,7 +549,9 @@ test_riemann_messages (void)
   tcase_add_test (test_messages, test_riemann_message_free);
   tcase_add_test (test_messages, test_riemann_message_set_events_n);
   tcase_add_test (test_messages, test_riemann_message_to_buffer);
+  tcase_add_test (test_messages, test_riemann_message_pack_into);
   tcase_add_test (test_messages, test_riemann_message_from_buffer);
+  tcase_add_test (test_messages, test_riemann_message_from_buffer_projected);
   tcase_add_test (test_messages, test_riemann_message_set_events);
   tcase_add_test (test_messages, test_riemann_message_create_with_events);
   tcase_add_test (test_messages, test_riemann_message_set_query);
@@ -386,6 +560,7 @@ test_riemann_messages (void)
   tcase_add_test (test_messages, test_riemann_message_append_events);
   tcase_add_test (test_messages, test_riemann_message_clone);
   tcase_add_test (test_messages, test_riemann_message_get_packed_size);
+  tcase_add_test (test_messages, test_riemann_message_builder);
 
   return test_messages;
 }
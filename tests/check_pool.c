@@ -0,0 +1,135 @@
+#include <riemann/pool.h>
+
+START_TEST (test_riemann_event_reset)
+{
+  riemann_event_t *event;
+  char **tags;
+  riemann_attribute_t **attributes;
+
+  ck_assert_errno (riemann_event_reset (NULL), EINVAL);
+
+  event = riemann_event_create (RIEMANN_EVENT_FIELD_HOST, "localhost",
+                                RIEMANN_EVENT_FIELD_SERVICE, "test",
+                                RIEMANN_EVENT_FIELD_STATE, "ok",
+                                RIEMANN_EVENT_FIELD_DESCRIPTION, "desc",
+                                RIEMANN_EVENT_FIELD_TIME, (int64_t) 1234,
+                                RIEMANN_EVENT_FIELD_METRIC_D, 1.5,
+                                RIEMANN_EVENT_FIELD_TTL, 30.0,
+                                RIEMANN_EVENT_FIELD_TAGS, "tag-1", "tag-2", NULL,
+                                RIEMANN_EVENT_FIELD_STRING_ATTRIBUTES,
+                                "key", "value", NULL,
+                                RIEMANN_EVENT_FIELD_NONE);
+  tags = event->tags;
+  attributes = event->attributes;
+
+  ck_assert_int_eq (riemann_event_reset (event), 0);
+
+  ck_assert (event->host == NULL);
+  ck_assert (event->service == NULL);
+  ck_assert (event->state == NULL);
+  ck_assert (event->description == NULL);
+  ck_assert (!event->has_time);
+  ck_assert (!event->has_metric_d);
+  ck_assert (!event->has_ttl);
+  ck_assert_int_eq (event->n_tags, 0);
+  ck_assert_int_eq (event->n_attributes, 0);
+  ck_assert (event->tags == tags);
+  ck_assert (event->attributes == attributes);
+
+  /* A reset event can be reused, and as long as they fit, new tags
+     and attributes go into the arrays kept. */
+  riemann_event_tag_add (event, "tag-3");
+  riemann_event_tag_add (event, "tag-4");
+  riemann_event_tag_add (event, "tag-5");
+  riemann_event_tag_add (event, "tag-6");
+  riemann_event_string_attribute_add (event, "key", "other");
+  ck_assert_int_eq (event->n_tags, 4);
+  ck_assert_str_eq (event->tags[0], "tag-3");
+  ck_assert_str_eq (event->tags[3], "tag-6");
+  ck_assert_str_eq (event->attributes[0]->value, "other");
+#if HAVE_MALLOC_USABLE_SIZE
+  ck_assert (event->tags == tags);
+  ck_assert (event->attributes == attributes);
+#endif
+
+  riemann_event_free (event);
+}
+END_TEST
+
+START_TEST (test_riemann_event_pool)
+{
+  riemann_event_pool_t *pool;
+  riemann_event_t *a, *b;
+
+  errno = 0;
+  ck_assert (riemann_event_pool_get (NULL) == NULL);
+  ck_assert_errno (-errno, EINVAL);
+  errno = 0;
+  riemann_event_pool_free (NULL);
+  ck_assert_errno (-errno, EINVAL);
+
+  pool = riemann_event_pool_new (1);
+  ck_assert_errno (riemann_event_pool_put (pool, NULL), EINVAL);
+
+  a = riemann_event_pool_get (pool);
+  b = riemann_event_pool_get (pool);
+  ck_assert_errno (riemann_event_pool_put (NULL, a), EINVAL);
+  ck_assert (a != NULL);
+  ck_assert (b != NULL);
+  ck_assert (a != b);
+
+  riemann_event_set_host (a, "localhost");
+  ck_assert_int_eq (riemann_event_pool_put (pool, a), 0);
+  ck_assert (a->host == NULL);
+
+  /* Beyond the limit, events are freed. */
+  ck_assert_int_eq (riemann_event_pool_put (pool, b), 0);
+
+  ck_assert (riemann_event_pool_get (pool) == a);
+  riemann_event_pool_put (pool, a);
+
+  riemann_event_pool_free (pool);
+}
+END_TEST
+
+START_TEST (test_riemann_event_pool_put_message)
+{
+  riemann_event_pool_t *pool;
+  riemann_message_t *message;
+  riemann_event_t *events[2];
+
+  pool = riemann_event_pool_new (0);
+
+  ck_assert_errno (riemann_event_pool_put_message (pool, NULL), EINVAL);
+
+  events[0] = riemann_event_pool_get (pool);
+  events[1] = riemann_event_pool_get (pool);
+  riemann_event_set_service (events[0], "test-1");
+  riemann_event_set_service (events[1], "test-2");
+
+  message = riemann_message_create_with_events (events[0], events[1], NULL);
+  ck_assert_int_eq (riemann_event_pool_put_message (pool, message), 0);
+
+  /* The events are back in the pool, reset. */
+  ck_assert (riemann_event_pool_get (pool) == events[1]);
+  ck_assert (riemann_event_pool_get (pool) == events[0]);
+  ck_assert (events[0]->service == NULL);
+
+  riemann_event_pool_put (pool, events[0]);
+  riemann_event_pool_put (pool, events[1]);
+  riemann_event_pool_free (pool);
+}
+END_TEST
+
+static TCase *
+test_riemann_pool (void)
+{
+  TCase *tests;
+
+  tests = tcase_create ("Pool");
+  tcase_add_test (tests, test_riemann_event_reset);
+  tcase_add_test (tests, test_riemann_event_pool);
+  tcase_add_test (tests, test_riemann_event_pool_put_message);
+
+  return tests;
+}
@@ -214,6 +214,67 @@ START_TEST (test_riemann_simple_communicate_event)
 }
 END_TEST
 
+START_TEST (test_riemann_simple_communicate_pipelined)
+{
+  riemann_client_t *client;
+  riemann_message_t *messages[8], *response;
+  int results[8];
+  size_t i;
+
+  for (i = 0; i < 8; i++)
+    messages[i] = riemann_message_create_with_events
+      (riemann_event_create (RIEMANN_EVENT_FIELD_HOST, "localhost",
+                             RIEMANN_EVENT_FIELD_SERVICE,
+                             "test_riemann_simple_communicate_pipelined",
+                             RIEMANN_EVENT_FIELD_METRIC_S64, (int64_t) i,
+                             RIEMANN_EVENT_FIELD_NONE),
+       NULL);
+
+  client = riemann_client_new ();
+  ck_assert_errno (riemann_communicate_pipelined (NULL, messages, 8, results),
+                   ENOTCONN);
+  ck_assert_errno (riemann_communicate_pipelined (client, messages, 8,
+                                                  results), ENOTCONN);
+  riemann_client_free (client);
+
+  client = riemann_client_create (RIEMANN_CLIENT_TCP, "127.0.0.1", 5555);
+  ck_assert_errno (riemann_communicate_pipelined (client, NULL, 8, results),
+                   EINVAL);
+  ck_assert_errno (riemann_communicate_pipelined (client, NULL, 0, NULL), 0);
+
+  ck_assert_errno (riemann_client_set_max_in_flight (client, 3), 0);
+  memset (results, 0xff, sizeof (results));
+  ck_assert_errno (riemann_communicate_pipelined (client, messages, 8,
+                                                  results), 0);
+  for (i = 0; i < 8; i++)
+    ck_assert_int_eq (results[i], 0);
+
+  /* The client is left in blocking mode, ready for lockstep use. */
+  response = riemann_communicate
+    (client,
+     riemann_message_create_with_query
+     (riemann_query_new ("service = \"test_riemann_simple_communicate_pipelined\"")));
+  ck_assert (response != NULL);
+  ck_assert_int_eq (response->ok, 1);
+  riemann_message_free (response);
+
+  riemann_client_disconnect (client);
+  ck_assert_errno (riemann_communicate_pipelined (client, messages, 8,
+                                                  results), ENOTCONN);
+
+  riemann_client_connect (client, RIEMANN_CLIENT_UDP, "127.0.0.1", 5555);
+  memset (results, 0xff, sizeof (results));
+  ck_assert_errno (riemann_communicate_pipelined (client, messages, 8,
+                                                  results), 0);
+  for (i = 0; i < 8; i++)
+    ck_assert_int_eq (results[i], 0);
+  riemann_client_free (client);
+
+  for (i = 0; i < 8; i++)
+    riemann_message_free (messages[i]);
+}
+END_TEST
+
 static TCase *
 test_riemann_simple (void)
 {
@@ -228,6 +289,7 @@ test_riemann_simple (void)
       tcase_add_test (test_simple, test_riemann_simple_communicate);
       tcase_add_test (test_simple, test_riemann_simple_communicate_query);
       tcase_add_test (test_simple, test_riemann_simple_communicate_event);
+      tcase_add_test (test_simple, test_riemann_simple_communicate_pipelined);
     }
 
   return test_simple;
@@ -0,0 +1,301 @@
+#include <fcntl.h>
+#include <riemann/spool.h>
+
+static riemann_message_t *
+_spool_message (const char *service, int i)
+{
+  char host[32];
+
+  snprintf (host, sizeof (host), "spool-%03d", i);
+  return riemann_message_create_with_events
+    (riemann_event_create (RIEMANN_EVENT_FIELD_HOST, host,
+                           RIEMANN_EVENT_FIELD_SERVICE, service,
+                           RIEMANN_EVENT_FIELD_METRIC_S64, (int64_t) 1,
+                           RIEMANN_EVENT_FIELD_NONE),
+     NULL);
+}
+
+/* Appends messages until the spool is full, and returns how many
+   fit. */
+static int
+_spool_fill (riemann_spool_t *spool, int first)
+{
+  riemann_message_t *message;
+  int i, r;
+
+  for (i = first; ; i++)
+    {
+      message = _spool_message ("test_riemann_spool", i);
+      r = riemann_spool_append (spool, message);
+      riemann_message_free (message);
+
+      if (r != 0)
+        {
+          ck_assert_errno (r, ENOSPC);
+          return i - first;
+        }
+    }
+}
+
+static void
+_spool_path (char *path)
+{
+  int fd;
+
+  strcpy (path, "/tmp/riemann-spool-XXXXXX");
+  ck_assert ((fd = mkstemp (path)) != -1);
+  close (fd);
+}
+
+START_TEST (test_riemann_spool_open)
+{
+  riemann_spool_t *spool;
+  riemann_client_t *client;
+  riemann_message_t *message;
+  char path[64], *description;
+  size_t len;
+  int n;
+
+  ck_assert (riemann_spool_open (NULL, 4096) == NULL);
+  ck_assert_errno (-errno, EINVAL);
+
+  errno = 0;
+  riemann_spool_free (NULL);
+  ck_assert_errno (-errno, EINVAL);
+
+  client = riemann_client_new ();
+  message = _spool_message ("test_riemann_spool", 0);
+  ck_assert_errno (riemann_spool_append (NULL, message), EINVAL);
+  ck_assert_errno (riemann_spool_set_replay_rate (NULL, 1), EINVAL);
+  ck_assert_errno (riemann_spool_replay (NULL, client), EINVAL);
+  ck_assert_errno (riemann_spool_send_message (NULL, client, message),
+                   EINVAL);
+  ck_assert_int_eq (riemann_spool_count (NULL), 0);
+
+  _spool_path (path);
+
+  /* There must be room for a header, and a frame. */
+  ck_assert (riemann_spool_open (path, 16) == NULL);
+  ck_assert_errno (-errno, EINVAL);
+
+  spool = riemann_spool_open (path, 4096);
+  ck_assert (spool != NULL);
+  ck_assert_int_eq (riemann_spool_count (spool), 0);
+  ck_assert_errno (riemann_spool_append (spool, NULL), EINVAL);
+  ck_assert_errno (riemann_spool_replay (spool, NULL), EINVAL);
+
+  /* Only one spool may use a file at a time. */
+  ck_assert (riemann_spool_open (path, 4096) == NULL);
+  ck_assert_errno (-errno, EWOULDBLOCK);
+
+  /* The file never grows past its size. */
+  riemann_message_pack_into (message, NULL, 0, &len);
+  n = _spool_fill (spool, 0);
+  ck_assert_int_eq (n, (4096 - 64) / len);
+  ck_assert_int_eq (riemann_spool_count (spool), n);
+
+  description = (char *) malloc (8192);
+  memset (description, 'x', 8191);
+  description[8191] = '\0';
+  riemann_message_free (message);
+  message = riemann_message_create_with_events
+    (riemann_event_create (RIEMANN_EVENT_FIELD_DESCRIPTION, description,
+                           RIEMANN_EVENT_FIELD_NONE),
+     NULL);
+  free (description);
+  ck_assert_errno (riemann_spool_append (spool, message), EMSGSIZE);
+
+  /* Without a connection, nothing leaves the spool. */
+  ck_assert_errno (riemann_spool_replay (spool, client), ENOTCONN);
+  ck_assert_int_eq (riemann_spool_count (spool), n);
+  riemann_spool_free (spool);
+
+  /* The frames outlive the spool object, and the size of an existing
+     file is kept. */
+  spool = riemann_spool_open (path, 64 * 1024);
+  ck_assert (spool != NULL);
+  ck_assert_int_eq (riemann_spool_count (spool), n);
+  ck_assert_int_eq (_spool_fill (spool, n), 0);
+  riemann_spool_free (spool);
+
+  unlink (path);
+  riemann_message_free (message);
+  riemann_client_free (client);
+}
+END_TEST
+
+/* Overwrites the length of the oldest frame in the spool file. */
+static void
+_spool_tear (const char *path, uint32_t len)
+{
+  int fd;
+
+  len = htonl (len);
+  ck_assert ((fd = open (path, O_RDWR)) != -1);
+  ck_assert_int_eq (pwrite (fd, &len, sizeof (len), 64), sizeof (len));
+  close (fd);
+}
+
+START_TEST (test_riemann_spool_torn)
+{
+  riemann_spool_t *spool;
+  riemann_client_t *client;
+  riemann_message_t *message;
+  char path[64];
+  size_t len;
+  int i;
+
+  client = riemann_client_new ();
+  message = _spool_message ("test_riemann_spool", 0);
+  riemann_message_pack_into (message, NULL, 0, &len);
+  _spool_path (path);
+
+  /* A frame running past the newest one, or past the end of the file,
+     empties the spool, instead of sending whatever follows. */
+  for (i = 0; i < 2; i++)
+    {
+      spool = riemann_spool_open (path, 4096);
+      ck_assert_errno (riemann_spool_append (spool, message), 0);
+      ck_assert_errno (riemann_spool_append (spool, message), 0);
+      riemann_spool_free (spool);
+
+      _spool_tear (path, (i == 0) ? 2 * len - sizeof (uint32_t) + 1
+                   : 0x7fffffff);
+
+      spool = riemann_spool_open (path, 4096);
+      ck_assert_int_eq (riemann_spool_count (spool), 2);
+      ck_assert_errno (riemann_spool_replay (spool, client), EBADMSG);
+      ck_assert_int_eq (riemann_spool_count (spool), 0);
+
+      /* The spool is usable again afterwards. */
+      ck_assert_errno (riemann_spool_append (spool, message), 0);
+      ck_assert_errno (riemann_spool_replay (spool, client), ENOTCONN);
+      ck_assert_int_eq (riemann_spool_count (spool), 1);
+      riemann_spool_free (spool);
+      unlink (path);
+    }
+
+  riemann_message_free (message);
+  riemann_client_free (client);
+}
+END_TEST
+
+static ssize_t
+_spool_recv_nothing (int sockfd __attribute__((unused)),
+                     void *buf __attribute__((unused)),
+                     size_t len __attribute__((unused)),
+                     int flags __attribute__((unused)))
+{
+  return 0;
+}
+
+START_TEST (test_riemann_spool_replay)
+{
+  riemann_spool_t *spool;
+  riemann_client_t *client;
+  riemann_message_t *message, *response;
+  char path[64];
+  int n, total;
+
+  _spool_path (path);
+  spool = riemann_spool_open (path, 4096);
+  client = riemann_client_create (RIEMANN_CLIENT_TCP, "127.0.0.1", 5555);
+
+  /* Replay goes no faster than the rate allows. */
+  n = _spool_fill (spool, 0);
+  ck_assert_errno (riemann_spool_set_replay_rate (spool, 5), 0);
+  ck_assert_errno (riemann_spool_replay (spool, client), EAGAIN);
+  ck_assert_int_eq (riemann_spool_count (spool), n - 5);
+
+  /* The room freed at the start of the ring is used once the end is
+     full. */
+  ck_assert_int_eq (_spool_fill (spool, n), 5);
+  total = n + 5;
+  ck_assert_int_eq (riemann_spool_count (spool), n);
+  riemann_spool_free (spool);
+
+  spool = riemann_spool_open (path, 4096);
+  ck_assert_int_eq (riemann_spool_count (spool), n);
+  ck_assert_errno (riemann_spool_replay (spool, client), 0);
+  ck_assert_int_eq (riemann_spool_count (spool), 0);
+
+  response = riemann_communicate_query
+    (client, "service = \"test_riemann_spool\"");
+  ck_assert (response != NULL);
+  ck_assert_int_eq (response->n_events, total);
+  riemann_message_free (response);
+
+  /* Sending spools whatever can not be sent, and catches up once it
+     can. */
+  message = _spool_message ("test_riemann_spool_send", 0);
+  ck_assert_errno (riemann_spool_send_message (spool, client, message), 0);
+  ck_assert_int_eq (riemann_spool_count (spool), 0);
+  riemann_message_free (message);
+
+  riemann_client_disconnect (client);
+  message = _spool_message ("test_riemann_spool_send", 1);
+  ck_assert_errno (riemann_spool_send_message (spool, client, message),
+                   ENOTCONN);
+  ck_assert_int_eq (riemann_spool_count (spool), 1);
+  riemann_message_free (message);
+
+  ck_assert_errno (riemann_client_connect (client, RIEMANN_CLIENT_TCP,
+                                           "127.0.0.1", 5555), 0);
+  message = _spool_message ("test_riemann_spool_send", 2);
+  ck_assert_errno (riemann_spool_send_message (spool, client, message), 0);
+  ck_assert_int_eq (riemann_spool_count (spool), 0);
+  riemann_message_free (message);
+
+  /* A reply cut short is -EPROTO too, but it is not a refusal: the
+     message is kept for later. */
+  message = _spool_message ("test_riemann_spool_send", 3);
+  mock (recv, _spool_recv_nothing);
+  ck_assert_errno (riemann_spool_send_message (spool, client, message),
+                   EPROTO);
+  restore (recv);
+  ck_assert_int_eq (riemann_spool_count (spool), 1);
+  riemann_message_free (message);
+
+  ck_assert_errno (riemann_client_connect (client, RIEMANN_CLIENT_TCP,
+                                           "127.0.0.1", 5555), 0);
+  ck_assert_errno (riemann_spool_replay (spool, client), 0);
+  ck_assert_int_eq (riemann_spool_count (spool), 0);
+
+  /* A non-blocking client is turned away, and nothing is spooled. */
+  ck_assert_errno (riemann_client_set_nonblocking (client, 1), 0);
+  message = _spool_message ("test_riemann_spool_send", 4);
+  ck_assert_errno (riemann_spool_send_message (spool, client, message),
+                   EINVAL);
+  ck_assert_int_eq (riemann_spool_count (spool), 0);
+  ck_assert_errno (riemann_spool_replay (spool, client), EINVAL);
+  riemann_message_free (message);
+  ck_assert_errno (riemann_client_set_nonblocking (client, 0), 0);
+
+  response = riemann_communicate_query
+    (client, "service = \"test_riemann_spool_send\"");
+  ck_assert (response != NULL);
+  ck_assert_int_eq (response->n_events, 4);
+  riemann_message_free (response);
+
+  riemann_spool_free (spool);
+  unlink (path);
+  riemann_client_free (client);
+}
+END_TEST
+
+static TCase *
+test_riemann_spool (void)
+{
+  TCase *tests;
+
+  tests = tcase_create ("Spool");
+  tcase_add_test (tests, test_riemann_spool_open);
+  tcase_add_test (tests, test_riemann_spool_torn);
+
+  if (network_tests_enabled ())
+    {
+      tcase_add_test (tests, test_riemann_spool_replay);
+    }
+
+  return tests;
+}
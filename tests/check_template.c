@@ -0,0 +1,252 @@
+#include <riemann/template.h>
+
+static riemann_message_t *
+_template_test_decode (uint8_t *buffer, size_t len)
+{
+  uint32_t header;
+
+  memcpy (&header, buffer, sizeof (header));
+  ck_assert_int_eq (ntohl (header), len - sizeof (header));
+
+  return riemann_message_from_buffer (buffer + sizeof (header),
+                                      len - sizeof (header));
+}
+
+START_TEST (test_riemann_event_template_new)
+{
+  riemann_event_t *event;
+  riemann_event_template_t *tmpl;
+
+  errno = 0;
+  ck_assert (riemann_event_template_new (NULL, 0) == NULL);
+  ck_assert_errno (-errno, EINVAL);
+
+  errno = 0;
+  riemann_event_template_free (NULL);
+  ck_assert_errno (-errno, EINVAL);
+
+  event = riemann_event_create (RIEMANN_EVENT_FIELD_SERVICE, "test",
+                                RIEMANN_EVENT_FIELD_NONE);
+
+  errno = 0;
+  ck_assert (riemann_event_template_new
+             (event, RIEMANN_EVENT_FIELD_MASK (SERVICE)) == NULL);
+  ck_assert_errno (-errno, EINVAL);
+
+  ck_assert ((tmpl = riemann_event_template_new
+              (event, RIEMANN_EVENT_FIELD_MASK (METRIC_D))) != NULL);
+  riemann_event_template_free (tmpl);
+
+  riemann_event_free (event);
+}
+END_TEST
+
+START_TEST (test_riemann_event_template_pack_into)
+{
+  riemann_event_t *event;
+  riemann_event_template_t *tmpl;
+  riemann_event_template_values_t values;
+  riemann_message_t *message;
+  uint8_t buffer[1024], small[8];
+  size_t len, len2;
+
+  event = riemann_event_create (RIEMANN_EVENT_FIELD_HOST, "localhost",
+                                RIEMANN_EVENT_FIELD_SERVICE, "test",
+                                RIEMANN_EVENT_FIELD_STATE, "ok",
+                                RIEMANN_EVENT_FIELD_TAGS, "tag-1", "tag-2", NULL,
+                                RIEMANN_EVENT_FIELD_STRING_ATTRIBUTES,
+                                "key", "value", NULL,
+                                RIEMANN_EVENT_FIELD_TIME, (int64_t) 1,
+                                RIEMANN_EVENT_FIELD_METRIC_D, 1.0,
+                                RIEMANN_EVENT_FIELD_NONE);
+  tmpl = riemann_event_template_new (event,
+                                     RIEMANN_EVENT_FIELD_MASK (TIME) |
+                                     RIEMANN_EVENT_FIELD_MASK (METRIC_D) |
+                                     RIEMANN_EVENT_FIELD_MASK (METRIC_S64));
+  riemann_event_free (event);
+
+  memset (&values, 0, sizeof (values));
+  values.fields = RIEMANN_EVENT_FIELD_MASK (TIME) |
+    RIEMANN_EVENT_FIELD_MASK (METRIC_D);
+  values.time = 1234;
+  values.metric_d = 4.5;
+
+  ck_assert_errno (riemann_event_template_pack_into (NULL, &values, buffer,
+                                                     sizeof (buffer), &len),
+                   EINVAL);
+
+  ck_assert_errno (riemann_event_template_pack_into (tmpl, &values, small,
+                                                     sizeof (small), &len),
+                   ENOBUFS);
+  ck_assert (len > sizeof (small));
+  ck_assert_errno (riemann_event_template_pack_into (tmpl, &values, buffer,
+                                                     sizeof (buffer), &len),
+                   0);
+
+  message = _template_test_decode (buffer, len);
+  ck_assert (message != NULL);
+  ck_assert_int_eq (message->n_events, 1);
+  ck_assert_str_eq (message->events[0]->host, "localhost");
+  ck_assert_str_eq (message->events[0]->service, "test");
+  ck_assert_str_eq (message->events[0]->state, "ok");
+  ck_assert_int_eq (message->events[0]->n_tags, 2);
+  ck_assert_str_eq (message->events[0]->tags[1], "tag-2");
+  ck_assert_int_eq (message->events[0]->n_attributes, 1);
+  ck_assert_str_eq (message->events[0]->attributes[0]->value, "value");
+  ck_assert_int_eq (message->events[0]->has_time, 1);
+  ck_assert_int_eq (message->events[0]->time, 1234);
+  ck_assert_int_eq (message->events[0]->has_metric_d, 1);
+  ck_assert (message->events[0]->metric_d == 4.5);
+  ck_assert_int_eq (message->events[0]->has_metric_sint64, 0);
+  riemann_message_free (message);
+
+  /* Variable fields not set for this send are left out */
+  values.fields = RIEMANN_EVENT_FIELD_MASK (METRIC_S64);
+  values.metric_sint64 = -42;
+  ck_assert_errno (riemann_event_template_pack_into (tmpl, &values, buffer,
+                                                     sizeof (buffer), &len),
+                   0);
+  message = _template_test_decode (buffer, len);
+  ck_assert_int_eq (message->events[0]->has_time, 0);
+  ck_assert_int_eq (message->events[0]->has_metric_d, 0);
+  ck_assert_int_eq (message->events[0]->has_metric_sint64, 1);
+  ck_assert_int_eq (message->events[0]->metric_sint64, -42);
+  riemann_message_free (message);
+
+  ck_assert_errno (riemann_event_template_pack_into (tmpl, NULL, buffer,
+                                                     sizeof (buffer), &len),
+                   0);
+  message = _template_test_decode (buffer, len);
+  ck_assert_str_eq (message->events[0]->service, "test");
+  ck_assert_int_eq (message->events[0]->has_metric_d, 0);
+  riemann_message_free (message);
+
+  /* Constant fields can not be overridden */
+  values.fields = RIEMANN_EVENT_FIELD_MASK (STATE);
+  values.state = "critical";
+  ck_assert_errno (riemann_event_template_pack_into (tmpl, &values, buffer,
+                                                     sizeof (buffer), &len),
+                   EINVAL);
+
+  riemann_event_template_free (tmpl);
+
+  /* A NULL state leaves the field out, like in an event */
+  event = riemann_event_create (RIEMANN_EVENT_FIELD_SERVICE, "test",
+                                RIEMANN_EVENT_FIELD_NONE);
+  tmpl = riemann_event_template_new (event, RIEMANN_EVENT_FIELD_MASK (STATE));
+  riemann_event_free (event);
+
+  ck_assert_errno (riemann_event_template_pack_into (tmpl, NULL, small,
+                                                     0, &len),
+                   ENOBUFS);
+  values.fields = RIEMANN_EVENT_FIELD_MASK (STATE);
+  values.state = NULL;
+  ck_assert_errno (riemann_event_template_pack_into (tmpl, &values, buffer,
+                                                     sizeof (buffer), &len2),
+                   0);
+  ck_assert_int_eq (len2, len);
+  message = _template_test_decode (buffer, len2);
+  ck_assert_str_eq (message->events[0]->service, "test");
+  ck_assert (message->events[0]->state == NULL);
+  riemann_message_free (message);
+
+  values.state = "critical";
+  ck_assert_errno (riemann_event_template_pack_into (tmpl, &values, buffer,
+                                                     sizeof (buffer), &len2),
+                   0);
+  ck_assert (len2 > len);
+  message = _template_test_decode (buffer, len2);
+  ck_assert_str_eq (message->events[0]->state, "critical");
+  riemann_message_free (message);
+
+  riemann_event_template_free (tmpl);
+}
+END_TEST
+
+START_TEST (test_riemann_client_send_event_template)
+{
+  riemann_client_t *client;
+  riemann_event_t *event;
+  riemann_event_template_t *tmpl;
+  riemann_event_template_values_t values;
+  riemann_message_t *message, *response;
+
+  event = riemann_event_create (RIEMANN_EVENT_FIELD_HOST, "localhost",
+                                RIEMANN_EVENT_FIELD_SERVICE, "test-template",
+                                RIEMANN_EVENT_FIELD_NONE);
+  tmpl = riemann_event_template_new (event, RIEMANN_EVENT_FIELD_MASK (METRIC_D));
+  riemann_event_free (event);
+
+  memset (&values, 0, sizeof (values));
+  values.fields = RIEMANN_EVENT_FIELD_MASK (METRIC_D);
+  values.metric_d = 42.5;
+
+  ck_assert_errno (riemann_client_send_event_template (NULL, tmpl, &values),
+                   ENOTCONN);
+
+  client = riemann_client_new ();
+  ck_assert_errno (riemann_client_send_event_template (client, tmpl, &values),
+                   ENOTCONN);
+  riemann_client_free (client);
+
+  client = riemann_client_create (RIEMANN_CLIENT_TCP, "127.0.0.1", 5555);
+  ck_assert_errno (riemann_client_send_event_template (client, NULL, &values),
+                   EINVAL);
+
+  ck_assert_errno (riemann_client_send_event_template (client, tmpl, &values),
+                   0);
+  response = riemann_client_recv_message (client);
+  ck_assert (response != NULL);
+  ck_assert_int_eq (response->ok, 1);
+  riemann_message_free (response);
+
+  message = riemann_message_create_with_query
+    (riemann_query_new ("service = \"test-template\""));
+  riemann_client_send_message_oneshot (client, message);
+  response = riemann_client_recv_message (client);
+  ck_assert (response != NULL);
+  ck_assert (response->n_events >= 1);
+  ck_assert_str_eq (response->events[0]->host, "localhost");
+  ck_assert (response->events[0]->metric_d == 42.5);
+  riemann_message_free (response);
+
+  riemann_client_free (client);
+
+  client = riemann_client_create (RIEMANN_CLIENT_UDP, "127.0.0.1", 5555);
+  ck_assert_errno (riemann_client_send_event_template (client, tmpl, &values),
+                   0);
+  riemann_client_free (client);
+
+  client = riemann_client_create (RIEMANN_CLIENT_TLS, "127.0.0.1", 5554,
+                                  RIEMANN_CLIENT_OPTION_TLS_CA_FILE,
+                                  "tests/data/cacert.pem",
+                                  RIEMANN_CLIENT_OPTION_TLS_CERT_FILE,
+                                  "tests/data/client.crt",
+                                  RIEMANN_CLIENT_OPTION_TLS_KEY_FILE,
+                                  "tests/data/client.key",
+                                  RIEMANN_CLIENT_OPTION_NONE);
+  ck_assert (client != NULL);
+  ck_assert_errno (riemann_client_send_event_template (client, tmpl, &values),
+                   0);
+  riemann_client_free (client);
+
+  riemann_event_template_free (tmpl);
+}
+END_TEST
+
+static TCase *
+test_riemann_template (void)
+{
+  TCase *tests;
+
+  tests = tcase_create ("Template");
+  tcase_add_test (tests, test_riemann_event_template_new);
+  tcase_add_test (tests, test_riemann_event_template_pack_into);
+
+  if (network_tests_enabled ())
+    {
+      tcase_add_test (tests, test_riemann_client_send_event_template);
+    }
+
+  return tests;
+}
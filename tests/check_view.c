@@ -0,0 +1,211 @@
+#include <riemann/view.h>
+
+static uint8_t *
+_view_test_buffer (riemann_message_t *message, size_t *len)
+{
+  uint8_t *wire, *buffer;
+
+  wire = riemann_message_to_buffer (message, len);
+  *len -= sizeof (uint32_t);
+  buffer = (uint8_t *) malloc (*len);
+  memcpy (buffer, wire + sizeof (uint32_t), *len);
+  free (wire);
+
+  return buffer;
+}
+
+#define ck_assert_slice_eq(slice, str)                                  \
+  do                                                                    \
+    {                                                                   \
+      ck_assert ((slice).data != NULL);                                 \
+      ck_assert_int_eq ((slice).len, strlen (str));                     \
+      ck_assert (memcmp ((slice).data, str, (slice).len) == 0);         \
+    }                                                                   \
+  while (0)
+
+START_TEST (test_riemann_message_view_new)
+{
+  riemann_message_t *message;
+  riemann_message_view_t *view;
+  riemann_event_view_t *event;
+  uint8_t *buffer;
+  size_t len;
+
+  errno = 0;
+  ck_assert (riemann_message_view_new (NULL, 1) == NULL);
+  ck_assert_errno (-errno, EINVAL);
+
+  errno = 0;
+  riemann_message_view_free (NULL);
+  ck_assert_errno (-errno, EINVAL);
+
+  message = riemann_message_create_with_events
+    (riemann_event_create (RIEMANN_EVENT_FIELD_HOST, "localhost",
+                           RIEMANN_EVENT_FIELD_SERVICE, "test",
+                           RIEMANN_EVENT_FIELD_STATE, "ok",
+                           RIEMANN_EVENT_FIELD_DESCRIPTION, "something",
+                           RIEMANN_EVENT_FIELD_TIME, (int64_t) 1234,
+                           RIEMANN_EVENT_FIELD_TIME_MICROS, (int64_t) 1234000000,
+                           RIEMANN_EVENT_FIELD_TTL, (float) 30,
+                           RIEMANN_EVENT_FIELD_METRIC_S64, (int64_t) -42,
+                           RIEMANN_EVENT_FIELD_METRIC_D, 3.5,
+                           RIEMANN_EVENT_FIELD_METRIC_F, (float) 1.5,
+                           RIEMANN_EVENT_FIELD_NONE),
+     riemann_event_create (RIEMANN_EVENT_FIELD_SERVICE, "other",
+                           RIEMANN_EVENT_FIELD_NONE),
+     NULL);
+  message->has_ok = 1;
+  message->ok = 1;
+
+  buffer = _view_test_buffer (message, &len);
+  ck_assert ((view = riemann_message_view_new (buffer, len)) != NULL);
+
+  ck_assert_int_eq (view->has_ok, 1);
+  ck_assert_int_eq (view->ok, 1);
+  ck_assert (view->error.data == NULL);
+  ck_assert_int_eq (view->n_events, 2);
+
+  event = &view->events[0];
+  ck_assert_slice_eq (event->host, "localhost");
+  ck_assert_slice_eq (event->service, "test");
+  ck_assert_slice_eq (event->state, "ok");
+  ck_assert_slice_eq (event->description, "something");
+  ck_assert ((const uint8_t *)event->host.data >= buffer &&
+             (const uint8_t *)event->host.data < buffer + len);
+  ck_assert_int_eq (event->has_time, 1);
+  ck_assert_int_eq (event->time, 1234);
+  ck_assert_int_eq (event->has_time_micros, 1);
+  ck_assert_int_eq (event->time_micros, 1234000000);
+  ck_assert_int_eq (event->has_ttl, 1);
+  ck_assert (event->ttl == 30);
+  ck_assert_int_eq (event->has_metric_sint64, 1);
+  ck_assert_int_eq (event->metric_sint64, -42);
+  ck_assert_int_eq (event->has_metric_d, 1);
+  ck_assert (event->metric_d == 3.5);
+  ck_assert_int_eq (event->has_metric_f, 1);
+  ck_assert (event->metric_f == 1.5);
+
+  event = &view->events[1];
+  ck_assert_slice_eq (event->service, "other");
+  ck_assert (event->host.data == NULL);
+  ck_assert_int_eq (event->has_time, 0);
+  ck_assert_int_eq (event->has_metric_sint64, 0);
+
+  riemann_message_view_free (view);
+  riemann_message_free (message);
+
+  buffer = (uint8_t *) malloc (16);
+  memset (buffer, 128, 16);
+  errno = 0;
+  ck_assert (riemann_message_view_new (buffer, 16) == NULL);
+  ck_assert_errno (-errno, EPROTO);
+  free (buffer);
+}
+END_TEST
+
+START_TEST (test_riemann_event_view_iter)
+{
+  riemann_message_t *message;
+  riemann_message_view_t *view;
+  riemann_view_iter_t iter;
+  riemann_slice_t tag, key, value;
+  uint8_t *buffer;
+  size_t len;
+
+  message = riemann_message_create_with_events
+    (riemann_event_create (RIEMANN_EVENT_FIELD_SERVICE, "test",
+                           RIEMANN_EVENT_FIELD_TAGS, "tag-1", "tag-2", NULL,
+                           RIEMANN_EVENT_FIELD_STRING_ATTRIBUTES,
+                           "key-1", "value-1",
+                           "key-2", "value-2",
+                           NULL,
+                           RIEMANN_EVENT_FIELD_NONE),
+     NULL);
+  riemann_event_attribute_add (message->events[0],
+                               riemann_attribute_create ("key-3", NULL));
+
+  buffer = _view_test_buffer (message, &len);
+  view = riemann_message_view_new (buffer, len);
+  ck_assert (view != NULL);
+  ck_assert_int_eq (view->events[0].n_tags, 2);
+  ck_assert_int_eq (view->events[0].n_attributes, 3);
+
+  iter = riemann_event_view_iter (&view->events[0]);
+  ck_assert_errno (riemann_event_view_next_tag (NULL, &tag), EINVAL);
+  ck_assert_errno (riemann_event_view_next_tag (&iter, NULL), EINVAL);
+
+  ck_assert_int_eq (riemann_event_view_next_tag (&iter, &tag), 1);
+  ck_assert_slice_eq (tag, "tag-1");
+  ck_assert_int_eq (riemann_event_view_next_tag (&iter, &tag), 1);
+  ck_assert_slice_eq (tag, "tag-2");
+  ck_assert_int_eq (riemann_event_view_next_tag (&iter, &tag), 0);
+
+  iter = riemann_event_view_iter (&view->events[0]);
+  ck_assert_errno (riemann_event_view_next_attribute (&iter, NULL, &value),
+                   EINVAL);
+  ck_assert_int_eq (riemann_event_view_next_attribute (&iter, &key, &value), 1);
+  ck_assert_slice_eq (key, "key-1");
+  ck_assert_slice_eq (value, "value-1");
+  ck_assert_int_eq (riemann_event_view_next_attribute (&iter, &key, &value), 1);
+  ck_assert_slice_eq (key, "key-2");
+  ck_assert_slice_eq (value, "value-2");
+  ck_assert_int_eq (riemann_event_view_next_attribute (&iter, &key, &value), 1);
+  ck_assert_slice_eq (key, "key-3");
+  ck_assert (value.data == NULL);
+  ck_assert_int_eq (riemann_event_view_next_attribute (&iter, &key, &value), 0);
+
+  riemann_message_view_free (view);
+  riemann_message_free (message);
+}
+END_TEST
+
+START_TEST (test_riemann_client_recv_message_view)
+{
+  riemann_client_t *client;
+  riemann_message_t *message;
+  riemann_message_view_t *view;
+
+  errno = 0;
+  ck_assert (riemann_client_recv_message_view (NULL) == NULL);
+  ck_assert_errno (-errno, ENOTCONN);
+
+  client = riemann_client_create (RIEMANN_CLIENT_TCP, "127.0.0.1", 5555);
+  message = riemann_message_create_with_events
+    (riemann_event_create (RIEMANN_EVENT_FIELD_SERVICE, "test-view",
+                           RIEMANN_EVENT_FIELD_STATE, "ok",
+                           RIEMANN_EVENT_FIELD_NONE),
+     NULL);
+  riemann_client_send_message_oneshot (client, message);
+  ck_assert ((view = riemann_client_recv_message_view (client)) != NULL);
+  ck_assert_int_eq (view->ok, 1);
+  riemann_message_view_free (view);
+
+  message = riemann_message_create_with_query
+    (riemann_query_new ("service = \"test-view\""));
+  riemann_client_send_message_oneshot (client, message);
+  ck_assert ((view = riemann_client_recv_message_view (client)) != NULL);
+  ck_assert_int_eq (view->ok, 1);
+  ck_assert (view->n_events >= 1);
+  ck_assert_slice_eq (view->events[0].service, "test-view");
+  riemann_message_view_free (view);
+
+  riemann_client_free (client);
+}
+END_TEST
+
+static TCase *
+test_riemann_view (void)
+{
+  TCase *tests;
+
+  tests = tcase_create ("View");
+  tcase_add_test (tests, test_riemann_message_view_new);
+  tcase_add_test (tests, test_riemann_event_view_iter);
+
+  if (network_tests_enabled ())
+    {
+      tcase_add_test (tests, test_riemann_client_recv_message_view);
+    }
+
+  return tests;
+}
@@ -0,0 +1,614 @@
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <check.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "riemann/_simd.h"
+#include "riemann/_wire.h"
+#include "tests.h"
+
+/* The specialised encoder and decoder are compiled into this test
+   directly, along with the protobuf-c generated code, so the two can
+   be compared byte-by-byte. */
+
+static riemann_event_t *
+_wire_event_new (void)
+{
+  riemann_event_t *event;
+
+  event = (riemann_event_t *) malloc (sizeof (riemann_event_t));
+  event__init (event);
+  return event;
+}
+
+static void
+_wire_event_tag_add (riemann_event_t *event, const char *tag)
+{
+  event->tags = (char **) realloc (event->tags,
+                                   sizeof (char *) * (event->n_tags + 1));
+  event->tags[event->n_tags++] = strdup (tag);
+}
+
+static void
+_wire_event_attribute_add (riemann_event_t *event,
+                           const char *key, const char *value)
+{
+  riemann_attribute_t *attrib;
+
+  attrib = (riemann_attribute_t *) malloc (sizeof (riemann_attribute_t));
+  attribute__init (attrib);
+  attrib->key = (key) ? strdup (key) : NULL;
+  attrib->value = (value) ? strdup (value) : NULL;
+
+  event->attributes = (riemann_attribute_t **)
+    realloc (event->attributes,
+             sizeof (riemann_attribute_t *) * (event->n_attributes + 1));
+  event->attributes[event->n_attributes++] = attrib;
+}
+
+static riemann_message_t *
+_wire_message_new (void)
+{
+  riemann_message_t *message;
+
+  message = (riemann_message_t *) malloc (sizeof (riemann_message_t));
+  msg__init (message);
+  return message;
+}
+
+static void
+_wire_message_event_add (riemann_message_t *message, riemann_event_t *event)
+{
+  message->events = (riemann_event_t **)
+    realloc (message->events,
+             sizeof (riemann_event_t *) * (message->n_events + 1));
+  message->events[message->n_events++] = event;
+}
+
+static void
+_wire_assert_frame (riemann_wire_buffer_t *buffer,
+                    const uint8_t *expected, size_t expected_len)
+{
+  uint32_t header;
+
+  ck_assert_int_eq (buffer->len, expected_len + sizeof (header));
+
+  memcpy (&header, buffer->data, sizeof (header));
+  ck_assert_int_eq (ntohl (header), expected_len);
+  ck_assert (memcmp (expected, buffer->data + sizeof (header),
+                     expected_len) == 0);
+}
+
+/* The specialised decoder must either decline, or produce a message
+   that packs back to the very same bytes. */
+static void
+_wire_assert_decoded (const riemann_message_t *message,
+                      const uint8_t *packed, size_t len)
+{
+  riemann_message_t *decoded;
+  uint8_t *repacked;
+  size_t i;
+  int unknown = 0;
+
+  for (i = 0; i < message->n_events; i++)
+    if (message->events[i]->base.n_unknown_fields)
+      unknown = 1;
+
+  decoded = _riemann_wire_message_unpack (NULL, packed, len);
+  if (message->n_states || message->query)
+    {
+      ck_assert (decoded == NULL);
+      return;
+    }
+  if (!decoded)
+    {
+      ck_assert (unknown);
+      return;
+    }
+  ck_assert_int_eq (decoded->n_events, message->n_events);
+
+  repacked = (uint8_t *) malloc (len + 1);
+  ck_assert_int_eq (msg__get_packed_size (decoded), len);
+  ck_assert_int_eq (msg__pack (decoded, repacked), len);
+  ck_assert (memcmp (packed, repacked, len) == 0);
+  free (repacked);
+
+  msg__free_unpacked (decoded, NULL);
+}
+
+static void
+_wire_assert_identical (riemann_message_t *message)
+{
+  uint8_t *expected, small[8], *large;
+  size_t expected_len;
+  riemann_wire_buffer_t buffer;
+
+  expected_len = msg__get_packed_size (message);
+  ck_assert_int_eq (_riemann_wire_message_get_packed_size (message),
+                    expected_len);
+
+  expected = (uint8_t *) malloc (expected_len + 1);
+  ck_assert_int_eq (msg__pack (message, expected), expected_len);
+
+  /* Growing from nothing */
+  memset (&buffer, 0, sizeof (buffer));
+  ck_assert_int_eq (_riemann_wire_message_frame (&buffer, message),
+                    expected_len + sizeof (uint32_t));
+  _wire_assert_frame (&buffer, expected, expected_len);
+  free (buffer.data);
+
+  /* Spilling out of a borrowed buffer that is too small */
+  buffer.data = small;
+  buffer.size = sizeof (small);
+  buffer.len = 0;
+  buffer.borrowed = 1;
+  _riemann_wire_message_frame (&buffer, message);
+  _wire_assert_frame (&buffer, expected, expected_len);
+  if (!buffer.borrowed)
+    free (buffer.data);
+  else
+    ck_assert (buffer.data == small);
+
+  /* A borrowed buffer that is large enough is used as-is */
+  large = (uint8_t *) malloc (expected_len + sizeof (uint32_t));
+  buffer.data = large;
+  buffer.size = expected_len + sizeof (uint32_t);
+  buffer.len = 0;
+  buffer.borrowed = 1;
+  _riemann_wire_message_frame (&buffer, message);
+  _wire_assert_frame (&buffer, expected, expected_len);
+  ck_assert (buffer.borrowed);
+  ck_assert (buffer.data == large);
+  free (large);
+
+  _wire_assert_decoded (message, expected, expected_len);
+
+  free (expected);
+}
+
+START_TEST (test_riemann_wire_empty)
+{
+  riemann_message_t *message;
+
+  message = _wire_message_new ();
+  _wire_assert_identical (message);
+
+  message->has_ok = 1;
+  message->ok = 1;
+  _wire_assert_identical (message);
+
+  message->ok = 0;
+  message->error = strdup ("");
+  _wire_assert_identical (message);
+
+  msg__free_unpacked (message, NULL);
+}
+END_TEST
+
+START_TEST (test_riemann_wire_event_fields)
+{
+  riemann_message_t *message;
+  riemann_event_t *event;
+  char *long_string;
+
+  message = _wire_message_new ();
+
+  event = _wire_event_new ();
+  event->has_time = 1;
+  event->time = 1497000000;
+  event->state = strdup ("ok");
+  event->service = strdup ("test");
+  event->host = strdup ("localhost");
+  event->description = strdup ("");
+  _wire_event_tag_add (event, "tag-1");
+  _wire_event_tag_add (event, "");
+  event->has_ttl = 1;
+  event->ttl = 30.5;
+  _wire_event_attribute_add (event, "key", "value");
+  _wire_event_attribute_add (event, "key-only", NULL);
+  _wire_event_attribute_add (event, NULL, "value-only");
+  event->has_time_micros = 1;
+  event->time_micros = 1497000000123456;
+  event->has_metric_sint64 = 1;
+  event->metric_sint64 = -1;
+  event->has_metric_d = 1;
+  event->metric_d = -0.25;
+  event->has_metric_f = 1;
+  event->metric_f = 1e10;
+  _wire_message_event_add (message, event);
+  _wire_assert_identical (message);
+
+  /* Extreme values, and strings needing multi-byte length prefixes. */
+  long_string = (char *) malloc (20000);
+  memset (long_string, 'x', 19999);
+  long_string[19999] = '\0';
+
+  event = _wire_event_new ();
+  event->has_time = 1;
+  event->time = -1;
+  event->has_metric_sint64 = 1;
+  event->metric_sint64 = INT64_MIN;
+  event->description = strdup (long_string + 19800);
+  event->service = long_string;
+  _wire_message_event_add (message, event);
+
+  event = _wire_event_new ();
+  event->has_metric_sint64 = 1;
+  event->metric_sint64 = INT64_MAX;
+  event->has_ttl = 1;
+  event->has_metric_f = 1;
+  _wire_message_event_add (message, event);
+
+  _wire_message_event_add (message, _wire_event_new ());
+  _wire_assert_identical (message);
+
+  msg__free_unpacked (message, NULL);
+}
+END_TEST
+
+START_TEST (test_riemann_wire_query_and_states)
+{
+  riemann_message_t *message;
+  State *state;
+
+  message = _wire_message_new ();
+  message->query = (riemann_query_t *) malloc (sizeof (riemann_query_t));
+  query__init (message->query);
+  _wire_assert_identical (message);
+
+  message->query->string = strdup ("service = \"test\"");
+  _wire_assert_identical (message);
+
+  state = (State *) malloc (sizeof (State));
+  state__init (state);
+  state->has_time = 1;
+  state->time = 1234;
+  state->state = strdup ("warning");
+  state->service = strdup ("test");
+  state->host = strdup ("localhost");
+  state->description = strdup ("a state");
+  state->has_once = 1;
+  state->once = 1;
+  state->tags = (char **) malloc (sizeof (char *) * 2);
+  state->tags[0] = strdup ("tag-1");
+  state->tags[1] = strdup ("tag-2");
+  state->n_tags = 2;
+  state->has_ttl = 1;
+  state->ttl = 60;
+
+  message->states = (State **) malloc (sizeof (State *));
+  message->states[0] = state;
+  message->n_states = 1;
+
+  message->has_ok = 1;
+  message->ok = 1;
+  _wire_message_event_add (message, _wire_event_new ());
+  _wire_assert_identical (message);
+
+  msg__free_unpacked (message, NULL);
+}
+END_TEST
+
+START_TEST (test_riemann_wire_many_events)
+{
+  riemann_message_t *message;
+  size_t i;
+
+  message = _wire_message_new ();
+
+  for (i = 0; i < 1000; i++)
+    {
+      riemann_event_t *event = _wire_event_new ();
+      char buffer[64];
+
+      snprintf (buffer, sizeof (buffer), "service-%zu", i);
+      event->service = strdup (buffer);
+      event->host = strdup ("localhost");
+      if (i % 2)
+        {
+          event->has_metric_d = 1;
+          event->metric_d = i / 3.0;
+        }
+      else
+        {
+          event->has_metric_sint64 = 1;
+          event->metric_sint64 = (int64_t)(i * i) - 5000;
+        }
+      if (i % 3)
+        _wire_event_tag_add (event, "tag");
+      if (i % 5)
+        _wire_event_attribute_add (event, "key", buffer);
+      event->has_time = 1;
+      event->time = (int64_t)i << 30;
+
+      _wire_message_event_add (message, event);
+    }
+
+  _wire_assert_identical (message);
+
+  msg__free_unpacked (message, NULL);
+}
+END_TEST
+
+START_TEST (test_riemann_wire_length_prefixes)
+{
+  riemann_message_t *message;
+  riemann_event_t *event;
+  char *long_value;
+
+  message = _wire_message_new ();
+
+  /* Shorter than the reserved width */
+  _wire_message_event_add (message, _wire_event_new ());
+
+  /* An attribute longer than 127 bytes, an event that fits in the
+     reserved width. */
+  long_value = (char *) malloc (1000);
+  memset (long_value, 'a', 999);
+  long_value[999] = '\0';
+  event = _wire_event_new ();
+  _wire_event_attribute_add (event, "key", long_value);
+  _wire_message_event_add (message, event);
+  free (long_value);
+
+  /* An event longer than 16383 bytes */
+  long_value = (char *) malloc (100000);
+  memset (long_value, 'b', 99999);
+  long_value[99999] = '\0';
+  event = _wire_event_new ();
+  event->description = long_value;
+  _wire_event_attribute_add (event, "key", "value");
+  _wire_message_event_add (message, event);
+
+  _wire_message_event_add (message, _wire_event_new ());
+
+  _wire_assert_identical (message);
+
+  msg__free_unpacked (message, NULL);
+}
+END_TEST
+
+START_TEST (test_riemann_wire_unknown_fields)
+{
+  riemann_message_t *message;
+  riemann_event_t *event;
+  ProtobufCMessageUnknownField *unknown;
+
+  message = _wire_message_new ();
+  event = _wire_event_new ();
+  event->service = strdup ("test");
+
+  unknown = (ProtobufCMessageUnknownField *)
+    malloc (sizeof (ProtobufCMessageUnknownField));
+  unknown->tag = 11;
+  unknown->wire_type = PROTOBUF_C_WIRE_TYPE_VARINT;
+  unknown->len = 1;
+  unknown->data = (uint8_t *) malloc (1);
+  unknown->data[0] = 42;
+  event->base.n_unknown_fields = 1;
+  event->base.unknown_fields = unknown;
+
+  _wire_message_event_add (message, event);
+  _wire_assert_identical (message);
+
+  msg__free_unpacked (message, NULL);
+}
+END_TEST
+
+START_TEST (test_riemann_wire_decode_varints)
+{
+  riemann_message_t *message;
+  riemann_event_t *event;
+  unsigned int i;
+
+  /* Every varint length, both with plenty of buffer left after it,
+     and right at the end. */
+  for (i = 0; i < 64; i++)
+    {
+      message = _wire_message_new ();
+
+      event = _wire_event_new ();
+      event->has_time = 1;
+      event->time = (int64_t)(UINT64_C (1) << i);
+      event->has_metric_sint64 = 1;
+      event->metric_sint64 = -event->time;
+      _wire_message_event_add (message, event);
+
+      event = _wire_event_new ();
+      event->description = strdup ("padding, so the varints above are "
+                                   "not near the end of the buffer");
+      _wire_message_event_add (message, event);
+
+      event = _wire_event_new ();
+      event->has_time_micros = 1;
+      event->time_micros = (int64_t)((UINT64_C (1) << i) - 1);
+      _wire_message_event_add (message, event);
+
+      _wire_assert_identical (message);
+      msg__free_unpacked (message, NULL);
+    }
+}
+END_TEST
+
+START_TEST (test_riemann_wire_decode_fallback)
+{
+  /* A truncated event */
+  static const uint8_t truncated[] = { 0x32, 0x05, 0x1a, 0x04, 't', 'e' };
+  /* A truncated varint at the very end */
+  static const uint8_t unterminated[] = { 0x32, 0x02, 0x08, 0x80 };
+  /* A field with a multi-byte tag */
+  static const uint8_t long_tag[] = { 0x32, 0x03, 0x80, 0x01, 0x00 };
+  /* The service, as a varint */
+  static const uint8_t wrong_type[] = { 0x32, 0x02, 0x18, 0x01 };
+  /* An attribute without a key */
+  static const uint8_t keyless[] = { 0x32, 0x05, 0x4a, 0x03, 0x12, 0x01,
+                                     'v' };
+  /* The same field twice: the last one wins */
+  static const uint8_t twice[] = { 0x32, 0x08, 0x1a, 0x01, 'a',
+                                   0x1a, 0x01, 'b', 0x08, 0x07 };
+  riemann_message_t *message;
+
+  ck_assert (_riemann_wire_message_unpack (NULL, truncated,
+                                           sizeof (truncated)) == NULL);
+  ck_assert (_riemann_wire_message_unpack (NULL, unterminated,
+                                           sizeof (unterminated)) == NULL);
+  ck_assert (_riemann_wire_message_unpack (NULL, long_tag,
+                                           sizeof (long_tag)) == NULL);
+  ck_assert (_riemann_wire_message_unpack (NULL, wrong_type,
+                                           sizeof (wrong_type)) == NULL);
+  ck_assert (_riemann_wire_message_unpack (NULL, keyless,
+                                           sizeof (keyless)) == NULL);
+
+  message = _riemann_wire_message_unpack (NULL, twice, sizeof (twice));
+  ck_assert (message != NULL);
+  ck_assert_int_eq (message->n_events, 1);
+  ck_assert_str_eq (message->events[0]->service, "b");
+  ck_assert_int_eq (message->events[0]->time, 7);
+  msg__free_unpacked (message, NULL);
+}
+END_TEST
+
+static const int64_t _wire_simd_values[] =
+  {
+    0, 1, -1, 63, -64, 64, 127, 128, 255, 300, -300, 16383, 16384,
+    2097151, 2097152, 268435455, 268435456, 34359738367LL,
+    34359738368LL, 4398046511103LL, 4398046511104LL,
+    562949953421311LL, 562949953421312LL, 72057594037927935LL,
+    72057594037927936LL, 9223372036854775807LL,
+    -9223372036854775807LL - 1, 1497000000, 1497000000000000LL, -42
+  };
+
+#define _WIRE_SIMD_N (sizeof (_wire_simd_values) / sizeof (_wire_simd_values[0]))
+
+START_TEST (test_riemann_wire_simd_kernels)
+{
+  const riemann_simd_kernels_t *scalar = &_riemann_simd_kernels_scalar;
+  const riemann_simd_kernels_t *best = _riemann_simd_kernels ();
+  uint64_t zz_scalar[_WIRE_SIMD_N], zz_best[_WIRE_SIMD_N];
+  uint8_t sizes_scalar[_WIRE_SIMD_N], sizes_best[_WIRE_SIMD_N];
+  size_t i;
+
+  ck_assert (best != NULL);
+
+  scalar->zigzag (_wire_simd_values, zz_scalar, _WIRE_SIMD_N);
+  best->zigzag (_wire_simd_values, zz_best, _WIRE_SIMD_N);
+  for (i = 0; i < _WIRE_SIMD_N; i++)
+    {
+      ck_assert (zz_scalar[i] == _riemann_wire_zigzag_encode (_wire_simd_values[i]));
+      ck_assert (zz_best[i] == zz_scalar[i]);
+    }
+
+  scalar->varint_sizes ((const uint64_t *) _wire_simd_values, sizes_scalar,
+                        _WIRE_SIMD_N);
+  best->varint_sizes ((const uint64_t *) _wire_simd_values, sizes_best,
+                      _WIRE_SIMD_N);
+  for (i = 0; i < _WIRE_SIMD_N; i++)
+    {
+      ck_assert_int_eq (sizes_scalar[i],
+                        _riemann_wire_varint_size ((uint64_t) _wire_simd_values[i]));
+      ck_assert_int_eq (sizes_best[i], sizes_scalar[i]);
+    }
+}
+END_TEST
+
+START_TEST (test_riemann_wire_simd_write_events)
+{
+  const riemann_simd_kernels_t *scalar = &_riemann_simd_kernels_scalar;
+  const riemann_simd_kernels_t *best = _riemann_simd_kernels ();
+  riemann_simd_event_block_t block;
+  uint64_t zz[_WIRE_SIMD_N];
+  uint8_t time_sizes[_WIRE_SIMD_N], zz_sizes[_WIRE_SIMD_N];
+  double metric_d[_WIRE_SIMD_N];
+  const uint8_t prefix[] = { 0x1a, 0x04, 't', 'e', 's', 't' };
+  uint8_t *expected, *got;
+  size_t i, size;
+  riemann_message_t *message;
+
+  for (i = 0; i < _WIRE_SIMD_N; i++)
+    metric_d[i] = i / 4.0;
+
+  scalar->zigzag (_wire_simd_values, zz, _WIRE_SIMD_N);
+  scalar->varint_sizes (zz, zz_sizes, _WIRE_SIMD_N);
+  scalar->varint_sizes ((const uint64_t *) _wire_simd_values, time_sizes,
+                        _WIRE_SIMD_N);
+
+  memset (&block, 0, sizeof (block));
+  block.n = _WIRE_SIMD_N;
+  block.prefix = prefix;
+  block.prefix_len = sizeof (prefix);
+  block.time = (const uint64_t *) _wire_simd_values;
+  block.time_sizes = time_sizes;
+  block.metric_sint64 = zz;
+  block.metric_sint64_sizes = zz_sizes;
+  block.metric_d = metric_d;
+
+  size = _riemann_simd_event_block_size (&block);
+  expected = (uint8_t *) malloc (size + RIEMANN_SIMD_SLACK);
+  got = (uint8_t *) malloc (size + RIEMANN_SIMD_SLACK);
+
+  ck_assert_int_eq (scalar->write_events (expected, &block), size);
+  ck_assert_int_eq (best->write_events (got, &block), size);
+  ck_assert (memcmp (expected, got, size) == 0);
+
+  /* A batch of events is a valid message body on its own */
+  message = msg__unpack (NULL, size, expected);
+  ck_assert (message != NULL);
+  ck_assert_int_eq (message->n_events, _WIRE_SIMD_N);
+  for (i = 0; i < _WIRE_SIMD_N; i++)
+    {
+      ck_assert_str_eq (message->events[i]->service, "test");
+      ck_assert (message->events[i]->time == _wire_simd_values[i]);
+      ck_assert (message->events[i]->metric_sint64 == _wire_simd_values[i]);
+      ck_assert (message->events[i]->metric_d == metric_d[i]);
+    }
+  msg__free_unpacked (message, NULL);
+
+  free (expected);
+  free (got);
+}
+END_TEST
+
+static TCase *
+test_riemann_wire (void)
+{
+  TCase *test_wire;
+
+  test_wire = tcase_create ("Wire format");
+
+  tcase_add_test (test_wire, test_riemann_wire_empty);
+  tcase_add_test (test_wire, test_riemann_wire_event_fields);
+  tcase_add_test (test_wire, test_riemann_wire_query_and_states);
+  tcase_add_test (test_wire, test_riemann_wire_many_events);
+  tcase_add_test (test_wire, test_riemann_wire_length_prefixes);
+  tcase_add_test (test_wire, test_riemann_wire_unknown_fields);
+  tcase_add_test (test_wire, test_riemann_wire_decode_varints);
+  tcase_add_test (test_wire, test_riemann_wire_decode_fallback);
+  tcase_add_test (test_wire, test_riemann_wire_simd_kernels);
+  tcase_add_test (test_wire, test_riemann_wire_simd_write_events);
+
+  return test_wire;
+}
+
+int
+main (void)
+{
+  Suite *suite;
+  SRunner *runner;
+
+  int nfailed;
+
+  suite = suite_create ("Riemann C client library wire format tests");
+
+  suite_add_tcase (suite, test_riemann_wire ());
+
+  runner = srunner_create (suite);
+
+  srunner_run_all (runner, CK_ENV);
+  nfailed = srunner_ntests_failed (runner);
+  srunner_free (runner);
+
+  return (nfailed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
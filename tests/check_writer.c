@@ -0,0 +1,259 @@
+#include <riemann/writer.h>
+
+START_TEST (test_riemann_batch_writer_errors)
+{
+  riemann_batch_writer_t *writer;
+
+  errno = 0;
+  riemann_batch_writer_free (NULL);
+  ck_assert_errno (-errno, EINVAL);
+
+  ck_assert_errno (riemann_batch_writer_begin_event (NULL), EINVAL);
+  ck_assert_errno (riemann_batch_writer_set_service (NULL, "test"), EINVAL);
+
+  writer = riemann_batch_writer_new ();
+
+  ck_assert_errno (riemann_batch_writer_end_event (writer), EINVAL);
+  ck_assert_errno (riemann_batch_writer_set_service (writer, "test"), EINVAL);
+  ck_assert_errno (riemann_batch_writer_set_metric_d (writer, 1.0), EINVAL);
+
+  ck_assert_errno (riemann_batch_writer_begin_event (writer), 0);
+  ck_assert_errno (riemann_batch_writer_begin_event (writer), EINVAL);
+  ck_assert_errno (riemann_batch_writer_set_service (writer, NULL), EINVAL);
+  ck_assert_errno (riemann_batch_writer_add_attribute (writer, NULL, "value"),
+                   EINVAL);
+  ck_assert_errno (riemann_batch_writer_add_event (writer, NULL), EINVAL);
+
+  errno = 0;
+  ck_assert (riemann_batch_writer_get_buffer (writer, NULL) == NULL);
+  ck_assert_errno (-errno, EINVAL);
+
+  ck_assert_errno (riemann_batch_writer_end_event (writer), 0);
+  ck_assert (riemann_batch_writer_get_buffer (writer, NULL) != NULL);
+
+  riemann_batch_writer_free (writer);
+}
+END_TEST
+
+START_TEST (test_riemann_batch_writer_events)
+{
+  riemann_batch_writer_t *writer;
+  riemann_message_t *message;
+  riemann_event_t *event;
+  riemann_event_template_t *tmpl;
+  riemann_event_template_values_t values;
+  uint8_t *expected;
+  const uint8_t *buffer;
+  size_t expected_len, len;
+  int i;
+
+  message = riemann_message_new ();
+  writer = riemann_batch_writer_new ();
+
+  for (i = 0; i < 200; i++)
+    {
+      char service[32];
+
+      snprintf (service, sizeof (service), "service-%d", i);
+
+      event = riemann_event_create (RIEMANN_EVENT_FIELD_TIME, (int64_t) i,
+                                    RIEMANN_EVENT_FIELD_STATE, "ok",
+                                    RIEMANN_EVENT_FIELD_SERVICE, service,
+                                    RIEMANN_EVENT_FIELD_HOST, "localhost",
+                                    RIEMANN_EVENT_FIELD_DESCRIPTION, "desc",
+                                    RIEMANN_EVENT_FIELD_TAGS, "tag", NULL,
+                                    RIEMANN_EVENT_FIELD_TTL, (float) 30,
+                                    RIEMANN_EVENT_FIELD_STRING_ATTRIBUTES,
+                                    "key", service, NULL,
+                                    RIEMANN_EVENT_FIELD_TIME_MICROS,
+                                    (int64_t) i * 1000000,
+                                    RIEMANN_EVENT_FIELD_METRIC_S64, (int64_t) -i,
+                                    RIEMANN_EVENT_FIELD_METRIC_D, i / 2.0,
+                                    RIEMANN_EVENT_FIELD_METRIC_F, (float) i,
+                                    RIEMANN_EVENT_FIELD_NONE);
+      riemann_message_append_events (message, event, NULL);
+
+      /* Setters called in field number order produce the very same
+         bytes as packing a message does. */
+      if (i % 2)
+        {
+          ck_assert_errno (riemann_batch_writer_add_event (writer, event), 0);
+          continue;
+        }
+
+      ck_assert_errno (riemann_batch_writer_begin_event (writer), 0);
+      riemann_batch_writer_set_time (writer, i);
+      riemann_batch_writer_set_state (writer, "ok");
+      riemann_batch_writer_set_service (writer, service);
+      riemann_batch_writer_set_host (writer, "localhost");
+      riemann_batch_writer_set_description (writer, "desc");
+      riemann_batch_writer_add_tag (writer, "tag");
+      riemann_batch_writer_set_ttl (writer, 30);
+      riemann_batch_writer_add_attribute (writer, "key", service);
+      riemann_batch_writer_set_time_micros (writer, (int64_t) i * 1000000);
+      riemann_batch_writer_set_metric_sint64 (writer, -i);
+      riemann_batch_writer_set_metric_d (writer, i / 2.0);
+      riemann_batch_writer_set_metric_f (writer, i);
+      ck_assert_errno (riemann_batch_writer_end_event (writer), 0);
+    }
+
+  expected = riemann_message_to_buffer (message, &expected_len);
+  buffer = riemann_batch_writer_get_buffer (writer, &len);
+  ck_assert_int_eq (len, expected_len);
+  ck_assert (memcmp (buffer, expected, len) == 0);
+  free (expected);
+  riemann_message_free (message);
+
+  /* Resetting starts a new, empty batch */
+  riemann_batch_writer_reset (writer);
+  buffer = riemann_batch_writer_get_buffer (writer, &len);
+  ck_assert_int_eq (len, sizeof (uint32_t));
+
+  event = riemann_event_create (RIEMANN_EVENT_FIELD_SERVICE, "test-template",
+                                RIEMANN_EVENT_FIELD_NONE);
+  tmpl = riemann_event_template_new (event, RIEMANN_EVENT_FIELD_MASK (METRIC_D));
+  riemann_event_free (event);
+
+  memset (&values, 0, sizeof (values));
+  values.fields = RIEMANN_EVENT_FIELD_MASK (METRIC_D);
+  values.metric_d = 2.5;
+  ck_assert_errno (riemann_batch_writer_add_event_template (writer, tmpl,
+                                                            &values), 0);
+  values.fields = RIEMANN_EVENT_FIELD_MASK (STATE);
+  ck_assert_errno (riemann_batch_writer_add_event_template (writer, tmpl,
+                                                            &values), EINVAL);
+  riemann_event_template_free (tmpl);
+
+  buffer = riemann_batch_writer_get_buffer (writer, &len);
+  message = riemann_message_from_buffer ((uint8_t *) buffer + sizeof (uint32_t),
+                                         len - sizeof (uint32_t));
+  ck_assert (message != NULL);
+  ck_assert_int_eq (message->n_events, 1);
+  ck_assert_str_eq (message->events[0]->service, "test-template");
+  ck_assert (message->events[0]->metric_d == 2.5);
+  riemann_message_free (message);
+
+  riemann_batch_writer_free (writer);
+}
+END_TEST
+
+START_TEST (test_riemann_batch_writer_add_columns)
+{
+  riemann_batch_writer_t *writer, *expected_writer;
+  riemann_event_columns_t columns;
+  riemann_event_t *event;
+  int64_t time[1000], metric_sint64[1000];
+  double metric_d[1000];
+  const uint8_t *buffer, *expected;
+  size_t len, expected_len, i;
+
+  writer = riemann_batch_writer_new ();
+  expected_writer = riemann_batch_writer_new ();
+
+  memset (&columns, 0, sizeof (columns));
+  ck_assert_errno (riemann_batch_writer_add_columns (NULL, &columns), EINVAL);
+  ck_assert_errno (riemann_batch_writer_add_columns (writer, NULL), EINVAL);
+
+  event = riemann_event_create (RIEMANN_EVENT_FIELD_SERVICE, "test-columns",
+                                RIEMANN_EVENT_FIELD_HOST, "localhost",
+                                RIEMANN_EVENT_FIELD_NONE);
+  columns.tmpl = riemann_event_template_new
+    (event, RIEMANN_EVENT_FIELD_MASK (TIME) |
+     RIEMANN_EVENT_FIELD_MASK (METRIC_S64) |
+     RIEMANN_EVENT_FIELD_MASK (METRIC_D));
+  riemann_event_free (event);
+
+  for (i = 0; i < 1000; i++)
+    {
+      time[i] = 1497000000 + i * 997;
+      metric_sint64[i] = ((int64_t) i * i * i * i * i) * ((i % 2) ? -1 : 1);
+      metric_d[i] = i / 3.0;
+
+      riemann_batch_writer_begin_event (expected_writer);
+      riemann_batch_writer_set_service (expected_writer, "test-columns");
+      riemann_batch_writer_set_host (expected_writer, "localhost");
+      riemann_batch_writer_set_time (expected_writer, time[i]);
+      riemann_batch_writer_set_metric_sint64 (expected_writer,
+                                              metric_sint64[i]);
+      riemann_batch_writer_set_metric_d (expected_writer, metric_d[i]);
+      riemann_batch_writer_end_event (expected_writer);
+    }
+
+  columns.n_events = 1000;
+  columns.time = time;
+  columns.metric_sint64 = metric_sint64;
+  columns.metric_d = metric_d;
+  ck_assert_errno (riemann_batch_writer_add_columns (writer, &columns), 0);
+
+  buffer = riemann_batch_writer_get_buffer (writer, &len);
+  expected = riemann_batch_writer_get_buffer (expected_writer, &expected_len);
+  ck_assert_int_eq (len, expected_len);
+  ck_assert (memcmp (buffer, expected, len) == 0);
+
+  /* Columns the template does not have as variable are refused */
+  columns.metric_f = (const float *) metric_d;
+  ck_assert_errno (riemann_batch_writer_add_columns (writer, &columns), EINVAL);
+
+  riemann_event_template_free ((riemann_event_template_t *) columns.tmpl);
+  riemann_batch_writer_free (expected_writer);
+  riemann_batch_writer_free (writer);
+}
+END_TEST
+
+START_TEST (test_riemann_client_send_batch)
+{
+  riemann_client_t *client;
+  riemann_batch_writer_t *writer;
+  riemann_message_t *message, *response;
+
+  writer = riemann_batch_writer_new ();
+  riemann_batch_writer_begin_event (writer);
+  riemann_batch_writer_set_service (writer, "test-batch");
+  riemann_batch_writer_set_host (writer, "localhost");
+  riemann_batch_writer_set_metric_d (writer, 1.5);
+
+  ck_assert_errno (riemann_client_send_batch (NULL, writer), ENOTCONN);
+
+  client = riemann_client_create (RIEMANN_CLIENT_TCP, "127.0.0.1", 5555);
+  ck_assert_errno (riemann_client_send_batch (client, NULL), EINVAL);
+  ck_assert_errno (riemann_client_send_batch (client, writer), EINVAL);
+
+  riemann_batch_writer_end_event (writer);
+  ck_assert_errno (riemann_client_send_batch (client, writer), 0);
+  response = riemann_client_recv_message (client);
+  ck_assert (response != NULL);
+  ck_assert_int_eq (response->ok, 1);
+  riemann_message_free (response);
+
+  message = riemann_message_create_with_query
+    (riemann_query_new ("service = \"test-batch\""));
+  riemann_client_send_message_oneshot (client, message);
+  response = riemann_client_recv_message (client);
+  ck_assert (response != NULL);
+  ck_assert (response->n_events >= 1);
+  ck_assert_str_eq (response->events[0]->host, "localhost");
+  ck_assert (response->events[0]->metric_d == 1.5);
+  riemann_message_free (response);
+
+  riemann_client_free (client);
+  riemann_batch_writer_free (writer);
+}
+END_TEST
+
+static TCase *
+test_riemann_writer (void)
+{
+  TCase *tests;
+
+  tests = tcase_create ("Batch writer");
+  tcase_add_test (tests, test_riemann_batch_writer_errors);
+  tcase_add_test (tests, test_riemann_batch_writer_events);
+  tcase_add_test (tests, test_riemann_batch_writer_add_columns);
+
+  if (network_tests_enabled ())
+    {
+      tcase_add_test (tests, test_riemann_client_send_batch);
+    }
+
+  return tests;
+}